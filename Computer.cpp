@@ -15,6 +15,7 @@
 // limitations under the License.
 
 #include "Computer.hpp"
+#include "Snapshot.hpp"
 
 namespace nebula {
 
@@ -46,28 +47,113 @@ void ProcessorInterrupt::waitForTrigger() {
 
 void InterruptQueue::push( Word message ) {
     if ( _isEnabled ) {
-        if ( _q.size() >= computer::MAX_QUEUED_INTERRUPTS ) {
-            throw error::CaughtFire {};
+        std::lock_guard<std::mutex> _lock { _mutex };
+
+        if ( _size >= computer::MAX_QUEUED_INTERRUPTS ) {
+            _isOnFire.store( true );
+            return;
         }
 
-        std::lock_guard<std::mutex> _lock { _mutex };
-        _q.emplace( message );
+        _q[(_front + _size) % computer::MAX_QUEUED_INTERRUPTS] = message;
+        ++_size;
         _hasInterrupt.store( true );
+        _condition.notify_all();
     }
 }
 
 Word InterruptQueue::pop() {
     std::lock_guard<std::mutex> _lock { _mutex };
-    auto res = _q.front();
-    _q.pop();
+    auto res = _q[_front];
+    _front = (_front + 1) % computer::MAX_QUEUED_INTERRUPTS;
+    --_size;
 
-    if ( _q.empty() ) {
+    if ( _size == 0 ) {
         _hasInterrupt.store( false );
     }
 
     return res;
 }
 
+SnapshotPart InterruptQueue::capture() {
+    std::lock_guard<std::mutex> _lock { _mutex };
+
+    std::vector<Word> messages {};
+
+    for ( std::size_t i = 0; i < _size; ++i ) {
+        messages.push_back( _q[(_front + i) % computer::MAX_QUEUED_INTERRUPTS] );
+    }
+
+    auto isEnabled = _isEnabled;
+    auto isOnFire = _isOnFire.load();
+
+    return [=] ( SnapshotWriter& writer ) {
+        writer.write( isEnabled );
+        writer.write( isOnFire );
+        writer.write( static_cast<std::uint16_t>( messages.size() ) );
+
+        for ( auto message : messages ) {
+            writer.write( message );
+        }
+    };
+}
+
+void InterruptQueue::save( SnapshotWriter& writer ) {
+    capture()( writer );
+}
+
+void InterruptQueue::restore( SnapshotReader& reader ) {
+    std::lock_guard<std::mutex> _lock { _mutex };
+
+    _isEnabled = reader.read<bool>();
+    _isOnFire.store( reader.read<bool>() );
+
+    auto size = reader.read<std::uint16_t>();
+
+    if ( size > computer::MAX_QUEUED_INTERRUPTS ) {
+        throw error::BadSnapshot { "too many queued interrupts" };
+    }
+
+    _front = 0;
+    _size = size;
+
+    for ( std::size_t i = 0; i < _size; ++i ) {
+        _q[i] = reader.read<Word>();
+    }
+
+    _hasInterrupt.store( _size != 0 );
+}
+
+SnapshotPart Computer::capture() {
+    auto now = _timing.now();
+    auto ia = this->ia;
+    auto onlyQueuing = this->onlyQueuing;
+    auto queue = _intQ.capture();
+
+    _capturedMemory = _memory->capture( _capturedMemory );
+    auto memory = _capturedMemory;
+
+    return [=] ( SnapshotWriter& writer ) {
+        writer.write( static_cast<std::int64_t>( now.count() ) );
+        writer.write( ia );
+        writer.write( onlyQueuing );
+        queue( writer );
+        memory->save( writer );
+    };
+}
+
+void Computer::save( SnapshotWriter& writer ) {
+    capture()( writer );
+}
+
+void Computer::restore( SnapshotReader& reader ) {
+    _timing.resumeAt( Timing::Duration { reader.read<std::int64_t>() } );
+    ia = reader.read<Word>();
+    onlyQueuing = reader.read<bool>();
+    _intQ.restore( reader );
+    _memory->restore( reader );
+    _capturedMemory = nullptr;
+}
+
 std::shared_ptr<ProcessorInterrupt>
 Computer::nextInterrupt( const Device* const  dev ) {
     if ( _devIndex >= computer::MAX_DEVICES ) {
@@ -80,21 +166,20 @@ Computer::nextInterrupt( const Device* const  dev ) {
     return _procInts[_devIndex++];
 }
 
-std::shared_ptr<ProcessorInterrupt>
-Computer::interruptByIndex( std::size_t index ) {
+ProcessorInterrupt* Computer::interruptByIndex( std::size_t index ) noexcept {
     if ( index >= _devIndex ) {
-        throw error::NoSuchDeviceIndex { index };
+        return nullptr;
     }
 
-    return _procInts[index];
+    return _procInts[index].get();
 }
 
-DeviceInfo Computer::infoByIndex( std::size_t index ) {
+optional<DeviceInfo> Computer::infoByIndex( std::size_t index ) noexcept {
     if ( index >= _devIndex ) {
-        throw error::NoSuchDeviceIndex { index };
+        return {};
     }
 
-    return *_devInfo[index];
+    return _devInfo[index];
 }
 
 }
@@ -16,12 +16,18 @@
 
 #pragma once
 
+#include "InputLog.hpp"
 #include "ProcessorState.hpp"
 #include "Simulation.hpp"
+#include "Snapshot.hpp"
+#include "Timing.hpp"
 
+#include <algorithm>
+#include <array>
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
-#include <queue>
+#include <functional>
 #include <stdexcept>
 #include <vector>
 
@@ -63,10 +69,14 @@ public:
 };
 
 class ProcessorInterrupt final {
+public:
+    using Responder = std::function<void ( ProcessorState& proc )>;
+private:
     std::atomic<bool> _isActive;
     std::condition_variable _condition {};
     std::mutex _mutex {};
     std::unique_ptr<ProcessorState> _proc = nullptr;
+    Responder _responder { nullptr };
 public:
     explicit ProcessorInterrupt() :
         _isActive { false } {}
@@ -87,6 +97,12 @@ public:
     void respond();
     void waitForTrigger();
 
+    // A device that runs on the same thread as the processor responds to it
+    // directly, instead of being triggered. This must happen before the
+    // simulation starts.
+    inline void setResponder( Responder responder ) { _responder = std::move( responder ); }
+    inline const Responder& responder() const noexcept { return _responder; }
+
     template <typename StateType>
     void waitForTriggerOrDeath( Simulation<StateType>& s ) {
         std::unique_lock<std::mutex> lock { _mutex };
@@ -107,19 +123,56 @@ public:
 };
 
 class InterruptQueue final {
-    std::queue<Word> _q {};
+    // A ring buffer, so that queuing an interrupt never allocates.
+    std::array<Word, computer::MAX_QUEUED_INTERRUPTS> _q {};
+    std::size_t _front { 0 };
+    std::size_t _size { 0 };
+
     std::mutex _mutex {};
+    std::condition_variable _condition {};
 
     bool _isEnabled { true };
 
     // Used so that checking the queue doesn't require locking it.
     std::atomic<bool> _hasInterrupt { false };
+
+    std::atomic<bool> _isOnFire { false };
 public:
+    // An interrupt pushed onto a full queue is dropped, and the processor
+    // catches fire (see `isOnFire`).
     void push( Word message );
+
     Word pop();
     inline bool hasInterrupt() const noexcept { return _hasInterrupt.load(); }
 
+    // Whether the queue has ever overflowed.
+    inline bool isOnFire() const noexcept { return _isOnFire.load(); }
+
     inline void setEnabled( bool value ) noexcept { _isEnabled = value; }
+
+    SnapshotPart capture();
+    void save( SnapshotWriter& writer );
+    void restore( SnapshotReader& reader );
+
+    // Block until there is an interrupt (only if `isInterruptible`), until
+    // `deadline`, or until the simulation has died.
+    template <typename StateType>
+    void waitForInterruptOrDeath( Simulation<StateType>& s,
+                                  bool isInterruptible,
+                                  std::chrono::steady_clock::time_point deadline ) {
+        std::unique_lock<std::mutex> lock { _mutex };
+
+        while ( s.isActive() ) {
+            auto limit = std::min( deadline,
+                                   std::chrono::steady_clock::now() + std::chrono::milliseconds { 5 } );
+
+            if ( _condition.wait_until( lock, limit,
+                                        [&] { return isInterruptible && hasInterrupt(); } ) ||
+                 limit == deadline ) {
+                break;
+            }
+        }
+    }
 };
 
 namespace error {
@@ -138,18 +191,6 @@ public:
         } {}
 };
 
-class NoSuchDeviceIndex : public std::out_of_range {
-    std::size_t _index;
-public:
-    explicit NoSuchDeviceIndex( std::size_t index ) :
-        std::out_of_range {
-            (format( "No such device index: 0x%04x" ) % index).str()
-        },
-        _index { index } {}
-
-    std::size_t index() const noexcept { return _index; }
-};
-
 }
 
 class Computer final {
@@ -163,11 +204,23 @@ class Computer final {
     InterruptQueue _intQ {};
 
     std::shared_ptr<Memory> _memory { nullptr };
+    Timing _timing;
+
+    LiveSnapshots _snapshots {};
+
+    InputLog _inputs {};
+
+    // Memory as it was last captured, to share pages with the next capture.
+    std::shared_ptr<const MemoryImage> _capturedMemory { nullptr };
 public:
-    explicit Computer( std::shared_ptr<Memory> memory ) :
+    // `speed` is a multiple of real time, or `timing::UNTHROTTLED`.
+    explicit Computer( std::shared_ptr<Memory> memory,
+                       std::uint64_t clockHz = pacing::DEFAULT_CLOCK_HZ,
+                       double speed = 1.0 ) :
         _procInts { InterruptTable( computer::MAX_DEVICES, nullptr ) },
         _devInfo { DeviceTable( computer::MAX_DEVICES, boost::none ) },
-        _memory { memory } {
+        _memory { memory },
+        _timing { clockHz, speed } {
     }
 
     bool onlyQueuing { false };
@@ -176,12 +229,26 @@ public:
     inline std::shared_ptr<Memory> memory() noexcept { return _memory; }
 
     std::shared_ptr<ProcessorInterrupt> nextInterrupt( const Device* const  dev );
-    std::shared_ptr<ProcessorInterrupt> interruptByIndex( std::size_t index );
-    DeviceInfo infoByIndex( std::size_t index );
+    // Nothing, if there's no device at `index`. A program can ask for any
+    // index, so this isn't an error.
+    ProcessorInterrupt* interruptByIndex( std::size_t index ) noexcept;
+    optional<DeviceInfo> infoByIndex( std::size_t index ) noexcept;
 
     inline std::size_t numDevices() const noexcept { return _devIndex; }
 
     inline InterruptQueue& queue() noexcept { return _intQ; }
+
+    inline Timing& timing() noexcept { return _timing; }
+
+    inline LiveSnapshots& snapshots() noexcept { return _snapshots; }
+
+    inline InputLog& inputs() noexcept { return _inputs; }
+
+    // Everything but the processor and devices, which save themselves. A
+    // computer is only restored before the simulation starts.
+    SnapshotPart capture();
+    void save( SnapshotWriter& writer );
+    void restore( SnapshotReader& reader );
 };
 
 }
@@ -0,0 +1,167 @@
+// History.cpp
+//
+// Copyright 2013 Jesse Haber-Kucharsky
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "History.hpp"
+
+#include "Snapshot.hpp"
+
+namespace nebula {
+
+History::History( Computer& computer,
+                  ProcessorState& proc,
+                  Execute execute,
+                  std::uint64_t interval,
+                  std::size_t budget ) :
+    _computer( computer ),
+    _proc( proc ),
+    _execute { execute ? std::move( execute ) : [] ( ProcessorState& proc ) { proc.executeNext(); } },
+    _interval { interval },
+    _budget { budget } {
+    _proc.clearClock();
+    checkpoint();
+}
+
+void History::checkpoint() {
+    SnapshotWriter writer {};
+    _proc.save( writer );
+    writer.write( _computer.ia );
+    writer.write( _computer.onlyQueuing );
+    _computer.queue().save( writer );
+
+    auto base = _checkpoints.empty() ? nullptr : _checkpoints.back().memory;
+    auto memory = _computer.memory()->capture( base );
+    auto numPages = base ? memory->numStoredPagesNotIn( *base ) : memory->numStoredPages();
+
+    Checkpoint checkpoint {
+        _cycles,
+        _instructions,
+        writer.bytes(),
+        memory,
+        sizeof( Checkpoint ) + writer.bytes().size() + numPages * sizeof( Memory::Page )
+    };
+
+    _size += checkpoint.size;
+    _checkpoints.push_back( std::move( checkpoint ) );
+
+    // The oldest checkpoint holds all of its pages, including the ones that
+    // are shared with the next checkpoint.
+    while ( _size > _budget && _checkpoints.size() > 1 ) {
+        _size -= _checkpoints.front().size;
+        _checkpoints.pop_front();
+
+        auto& oldest = _checkpoints.front();
+        _size -= oldest.size;
+        oldest.size = sizeof( Checkpoint ) + oldest.state.size() + oldest.memory->numStoredPages() * sizeof( Memory::Page );
+        _size += oldest.size;
+    }
+}
+
+void History::restore( const Checkpoint& checkpoint ) {
+    SnapshotReader reader { checkpoint.state };
+    _proc.restore( reader );
+    _computer.ia = reader.read<Word>();
+    _computer.onlyQueuing = reader.read<bool>();
+    _computer.queue().restore( reader );
+
+    _computer.memory()->reset( checkpoint.memory );
+
+    _cycles = checkpoint.cycles;
+    _instructions = checkpoint.instructions;
+}
+
+void History::step() {
+    _execute( _proc );
+    _cycles += _proc.clock();
+    _proc.clearClock();
+    ++_instructions;
+
+    if ( _cycles >= _checkpoints.back().cycles + _interval ) {
+        checkpoint();
+    }
+}
+
+// Executing forward again takes checkpoints of its own, so the ones after the
+// destination are dropped.
+bool History::rewindToCheckpoint( std::uint64_t instruction ) {
+    if ( instruction < _checkpoints.front().instructions ) {
+        return false;
+    }
+
+    while ( _checkpoints.back().instructions > instruction ) {
+        _size -= _checkpoints.back().size;
+        _checkpoints.pop_back();
+    }
+
+    restore( _checkpoints.back() );
+    return true;
+}
+
+bool History::rewindToInstruction( std::uint64_t instruction ) {
+    if ( instruction > _instructions || instruction < _checkpoints.front().instructions ) {
+        return false;
+    }
+
+    if ( instruction == _instructions ) {
+        return true;
+    }
+
+    rewindToCheckpoint( instruction );
+
+    while ( _instructions < instruction ) {
+        step();
+    }
+
+    return true;
+}
+
+// Instructions take different numbers of cycles, so finding the instruction
+// means executing forward from the checkpoint once to count them.
+bool History::rewindTo( std::uint64_t cycle ) {
+    if ( cycle >= _cycles ) {
+        return true;
+    }
+
+    if ( cycle < _checkpoints.front().cycles ) {
+        return false;
+    }
+
+    std::uint64_t instruction = 0;
+
+    for ( const auto& checkpoint : _checkpoints ) {
+        if ( checkpoint.cycles <= cycle ) {
+            instruction = checkpoint.instructions;
+        }
+    }
+
+    rewindToCheckpoint( instruction );
+
+    while ( true ) {
+        instruction = _instructions;
+        step();
+
+        if ( _cycles > cycle ) {
+            break;
+        }
+    }
+
+    return rewindToInstruction( instruction );
+}
+
+bool History::stepBack() {
+    return _instructions != 0 && rewindToInstruction( _instructions - 1 );
+}
+
+}
@@ -0,0 +1,128 @@
+// History.hpp
+//
+// Copyright 2013 Jesse Haber-Kucharsky
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "Computer.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace nebula {
+
+namespace history {
+
+const std::uint64_t DEFAULT_INTERVAL_CYCLES = 10000;
+
+const std::size_t DEFAULT_BUDGET_BYTES = 16 * 1024 * 1024;
+
+}
+
+// Execution that can go backwards.
+//
+// Every `interval` cycles, the history takes a checkpoint of the processor,
+// the interrupt state of the computer and memory. Memory is captured
+// incrementally (see `Memory::capture`), so a checkpoint shares every page
+// that hasn't changed with the one before it, and only costs the pages that
+// have. The oldest checkpoints are dropped to keep within a budget.
+//
+// Going back restores the nearest checkpoint before the destination, and
+// executes forward again from there. That only reaches the same state if
+// executing is deterministic, so devices must either not be involved, or have
+// their inputs replayed.
+class History final {
+public:
+    // Execute a single instruction.
+    using Execute = std::function<void ( ProcessorState& proc )>;
+private:
+    struct Checkpoint {
+        std::uint64_t cycles;
+        std::uint64_t instructions;
+
+        // The processor and the computer, without memory.
+        std::vector<unsigned char> state;
+
+        std::shared_ptr<const MemoryImage> memory;
+
+        // Approximately, the space that is freed when the checkpoint is
+        // dropped.
+        std::size_t size;
+    };
+
+    Computer& _computer;
+    ProcessorState& _proc;
+    Execute _execute;
+
+    std::uint64_t _interval;
+    std::size_t _budget;
+
+    std::uint64_t _cycles { 0 };
+    std::uint64_t _instructions { 0 };
+
+    // From oldest to newest.
+    std::deque<Checkpoint> _checkpoints {};
+    std::size_t _size { 0 };
+
+    void checkpoint();
+    void restore( const Checkpoint& checkpoint );
+
+    // Go back to the last checkpoint at or before `instruction`.
+    bool rewindToCheckpoint( std::uint64_t instruction );
+public:
+    // The first checkpoint is taken immediately. By default, instructions
+    // are executed with `ProcessorState::executeNext`.
+    explicit History( Computer& computer,
+                      ProcessorState& proc,
+                      Execute execute = nullptr,
+                      std::uint64_t interval = history::DEFAULT_INTERVAL_CYCLES,
+                      std::size_t budget = history::DEFAULT_BUDGET_BYTES );
+
+    History( const History& ) = delete;
+    History& operator=( const History& ) = delete;
+
+    // Execute the next instruction. The processor's clock is cleared, and its
+    // cycles are counted by the history instead.
+    void step();
+
+    // Since the history began.
+    inline std::uint64_t cycles() const noexcept { return _cycles; }
+    inline std::uint64_t instructions() const noexcept { return _instructions; }
+
+    // The earliest cycle that can still be reached.
+    inline std::uint64_t earliestCycle() const noexcept { return _checkpoints.front().cycles; }
+
+    // Go back to just before `instruction` was executed (counting from zero).
+    // Returns false, without changing anything, if the history doesn't reach
+    // that far back.
+    bool rewindToInstruction( std::uint64_t instruction );
+
+    // Go back to the last instruction that began at or before `cycle`.
+    bool rewindTo( std::uint64_t cycle );
+
+    // Undo the last instruction.
+    bool stepBack();
+
+    inline std::size_t numCheckpoints() const noexcept { return _checkpoints.size(); }
+
+    // Approximately, the space taken by the checkpoints.
+    inline std::size_t size() const noexcept { return _size; }
+};
+
+}
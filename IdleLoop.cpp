@@ -0,0 +1,128 @@
+// IdleLoop.cpp
+//
+// Copyright 2013 Jesse Haber-Kucharsky
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "IdleLoop.hpp"
+#include "InstructionCache.hpp"
+
+namespace nebula {
+
+namespace {
+
+inline isa::OperandClass operandClass( std::uint8_t code ) {
+    return isa::OPERANDS[code].operandClass;
+}
+
+// Whether reading the operand can change the stack pointer.
+inline bool isStack( std::uint8_t code ) {
+    return operandClass( code ) == isa::OperandClass::Stack;
+}
+
+inline bool isMemory( std::uint8_t code ) {
+    switch ( operandClass( code ) ) {
+    case isa::OperandClass::RegisterIndirect:
+    case isa::OperandClass::RegisterIndirectOffset:
+    case isa::OperandClass::Peek:
+    case isa::OperandClass::Pick:
+    case isa::OperandClass::Indirect:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// A jump that writes nothing but PC (and EX).
+inline bool isJump( const DecodedInstruction& ins ) {
+    auto opcode = ins.binaryOpcode();
+
+    return operandClass( ins.b ) == isa::OperandClass::Pc &&
+        (opcode == Opcode::Set || opcode == Opcode::Add || opcode == Opcode::Sub);
+}
+
+}
+
+optional<IdleLoop> findIdleLoop( ProcessorState& proc ) {
+    if ( proc.doSkip ) {
+        return {};
+    }
+
+    // The instructions are checked first to make sure that executing them
+    // can't write to memory.
+
+    auto address = proc.read( Special::Pc );
+    Word next = address;
+    int numInstructions = 0;
+    bool isPolling = false;
+
+    while ( true ) {
+        if ( numInstructions == idle::MAX_LOOP_INSTRUCTIONS ) {
+            return {};
+        }
+
+        const auto& ins = decodeCached( proc.memory()->read( next ) );
+        ++numInstructions;
+
+        if ( ins.kind != InstructionKind::Binary || isStack( ins.a ) || isStack( ins.b ) ) {
+            return {};
+        }
+
+        isPolling = isPolling || isMemory( ins.a ) || isMemory( ins.b );
+        next += 1 + ins.size;
+
+        if ( ! ins.isConditional ) {
+            if ( isJump( ins ) ) {
+                break;
+            }
+
+            return {};
+        }
+    }
+
+    // Registers and the stack are never modified, so only these need to be
+    // restored afterwards.
+    auto ex = proc.read( Special::Ex );
+    auto clock = proc.clock();
+    auto isFusing = proc.isFusing;
+
+    proc.isFusing = false;
+    proc.clearClock();
+
+    for ( int i = 0; i < numInstructions; ++i ) {
+        proc.executeNext();
+    }
+
+    // Every test has to pass, and the jump may change EX the first time
+    // through.
+    bool isIdle = ! proc.doSkip &&
+        proc.read( Special::Pc ) == address &&
+        proc.read( Special::Ex ) == ex;
+
+    int cycles = proc.clock();
+
+    proc.doSkip = false;
+    proc.write( Special::Pc, address );
+    proc.write( Special::Ex, ex );
+    proc.clearClock();
+    proc.tickClock( clock );
+    proc.isFusing = isFusing;
+
+    if ( ! isIdle ) {
+        return {};
+    }
+
+    return IdleLoop { address, cycles, isPolling };
+}
+
+}
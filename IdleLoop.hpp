@@ -0,0 +1,61 @@
+// IdleLoop.hpp
+//
+// Copyright 2013 Jesse Haber-Kucharsky
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "ProcessorState.hpp"
+
+namespace nebula {
+
+namespace idle {
+
+// Idle loops are at most this many instructions, including the jump.
+const int MAX_LOOP_INSTRUCTIONS = 4;
+
+static_assert( 3 * MAX_LOOP_INSTRUCTIONS <= processor::MAX_LOOP_WORDS,
+               "Batches of instructions must stop at the end of every idle loop." );
+
+}
+
+// A loop that leaves the processor exactly as it found it, like
+//
+//     SUB PC, 1
+//
+// or
+//
+//     :wait IFE [flag], 0
+//           SET PC, wait
+//
+// The body is made up of conditional instructions, all of which pass, and
+// ends with a jump back to the beginning. Only an interrupt (or, for loops
+// that read memory, a device writing to memory) can end it.
+struct IdleLoop {
+    Word address;
+
+    // The cycles taken by a single iteration.
+    int cycles;
+
+    // Whether the loop reads memory, and so may be ended by a device.
+    bool isPolling;
+};
+
+// Check if `proc` is at the beginning of an idle loop, in a state that
+// iterating doesn't change.
+//
+// The body is executed once to check, and then `proc` is restored.
+optional<IdleLoop> findIdleLoop( ProcessorState& proc );
+
+}
@@ -0,0 +1,358 @@
+// InputLog.cpp
+//
+// Copyright 2013 Jesse Haber-Kucharsky
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "InputLog.hpp"
+
+#include <fstream>
+#include <iterator>
+
+namespace nebula {
+
+namespace {
+
+const std::array<Register, 8> REGISTERS = {
+    Register::A,
+    Register::B,
+    Register::C,
+    Register::X,
+    Register::Y,
+    Register::Z,
+    Register::I,
+    Register::J
+};
+
+const std::array<Special, 3> SPECIALS = { Special::Pc, Special::Sp, Special::Ex };
+
+}
+
+InputLog::Registers InputLog::registersOf( const ProcessorState& proc ) noexcept {
+    Registers values;
+
+    for ( std::size_t i = 0; i < REGISTERS.size(); ++i ) {
+        values[i] = proc.read( REGISTERS[i] );
+    }
+
+    for ( std::size_t i = 0; i < SPECIALS.size(); ++i ) {
+        values[REGISTERS.size() + i] = proc.read( SPECIALS[i] );
+    }
+
+    return values;
+}
+
+void InputLog::startRecording( ExecutionMode executionMode, bool isFusing ) {
+    _mode = Mode::Recording;
+    _executionMode = executionMode;
+    _isFusing = isFusing;
+    _bytes.clear();
+    _cycle = 0;
+
+    for ( std::size_t i = 0; i < 4; ++i ) {
+        _bytes.push_back( static_cast<unsigned char>( input::MAGIC >> (8 * i) ) );
+    }
+
+    writeNumber( input::VERSION );
+    writeNumber( static_cast<std::uint64_t>( executionMode ) );
+    _bytes.push_back( isFusing ? 1 : 0 );
+}
+
+void InputLog::startReplaying( std::vector<unsigned char> bytes ) {
+    _bytes = std::move( bytes );
+    _position = 0;
+    _cycle = 0;
+
+    require( 4 );
+    std::uint32_t magic = 0;
+
+    for ( std::size_t i = 0; i < 4; ++i ) {
+        magic |= static_cast<std::uint32_t>( _bytes[_position++] ) << (8 * i);
+    }
+
+    if ( magic != input::MAGIC ) {
+        throw error::BadInputLog { "not an input log" };
+    }
+
+    auto version = readNumber();
+
+    if ( version != input::VERSION ) {
+        throw error::BadInputLog { (format( "unsupported version %d" ) % version).str() };
+    }
+
+    auto executionMode = readNumber();
+
+    if ( executionMode > static_cast<std::uint64_t>( ExecutionMode::Compiled ) ) {
+        throw error::BadInputLog { (format( "unknown execution mode %d" ) % executionMode).str() };
+    }
+
+    require( 1 );
+    _executionMode = static_cast<ExecutionMode>( executionMode );
+    _isFusing = _bytes[_position++] != 0;
+
+    _mode = Mode::Replaying;
+    readEvent();
+}
+
+void InputLog::startReplayingFile( const std::string& path ) {
+    std::ifstream file { path, std::ios::in | std::ios::binary };
+
+    if ( ! file.is_open() ) {
+        throw error::InputLogFile { path };
+    }
+
+    startReplaying( std::vector<unsigned char>( std::istreambuf_iterator<char> { file },
+                                                std::istreambuf_iterator<char> {} ) );
+}
+
+void InputLog::checkExecution( ExecutionMode executionMode, bool isFusing ) const {
+    if ( ! isReplaying() ) {
+        return;
+    }
+
+    if ( executionMode != _executionMode ) {
+        throw error::BadInputLog { "recorded with a different execution mode" };
+    }
+
+    if ( isFusing != _isFusing ) {
+        throw error::BadInputLog { isFusing ? "recorded without fusion" : "recorded with fusion" };
+    }
+}
+
+void InputLog::saveToFile( const std::string& path ) const {
+    std::ofstream file { path, std::ios::out | std::ios::binary };
+
+    if ( ! file.is_open() ) {
+        throw error::InputLogFile { path };
+    }
+
+    file.write( reinterpret_cast<const char*>( _bytes.data() ), _bytes.size() );
+    file.close();
+
+    if ( ! file ) {
+        throw error::InputLogFile { path };
+    }
+}
+
+void InputLog::writeEvent( std::uint64_t cycle, InputKind kind ) {
+    writeNumber( cycle - _cycle );
+    _bytes.push_back( static_cast<unsigned char>( kind ) );
+    _cycle = cycle;
+}
+
+// Seven bits at a time, with the high bit set on every byte but the last.
+void InputLog::writeNumber( std::uint64_t value ) {
+    while ( value >= 0x80 ) {
+        _bytes.push_back( static_cast<unsigned char>( value | 0x80 ) );
+        value >>= 7;
+    }
+
+    _bytes.push_back( static_cast<unsigned char>( value ) );
+}
+
+void InputLog::writeWord( Word value ) {
+    _bytes.push_back( static_cast<unsigned char>( value ) );
+    _bytes.push_back( static_cast<unsigned char>( value >> 8 ) );
+}
+
+void InputLog::require( std::size_t count ) const {
+    if ( _bytes.size() - _position < count ) {
+        throw error::BadInputLog { "truncated" };
+    }
+}
+
+std::uint64_t InputLog::readNumber() {
+    std::uint64_t value = 0;
+
+    for ( int shift = 0; shift < 64; shift += 7 ) {
+        require( 1 );
+        auto byte = _bytes[_position++];
+        value |= static_cast<std::uint64_t>( byte & 0x7f ) << shift;
+
+        if ( ! (byte & 0x80) ) {
+            return value;
+        }
+    }
+
+    throw error::BadInputLog { "number is too long" };
+}
+
+Word InputLog::readWord() {
+    require( 2 );
+    auto value = static_cast<Word>( _bytes[_position] | (_bytes[_position + 1] << 8) );
+    _position += 2;
+    return value;
+}
+
+void InputLog::readEvent() {
+    _hasNext = _position != _bytes.size();
+
+    if ( ! _hasNext ) {
+        return;
+    }
+
+    _cycle += readNumber();
+
+    require( 1 );
+    auto kind = _bytes[_position++];
+
+    if ( kind > static_cast<unsigned char>( InputKind::End ) ) {
+        throw error::BadInputLog { (format( "unknown event %d" ) % static_cast<int>( kind )).str() };
+    }
+
+    _nextKind = static_cast<InputKind>( kind );
+}
+
+void InputLog::deviceWrote( Word offset, const Word* words, std::size_t count ) {
+    if ( ! isRecording() ) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock { _mutex };
+    _pendingWrites.emplace_back( offset, std::vector<Word>( words, words + count ) );
+}
+
+void InputLog::recordInterrupt( std::uint64_t cycle, Word message ) {
+    writeEvent( cycle, InputKind::Interrupt );
+    writeWord( message );
+}
+
+// Only the registers that changed are recorded, after a mask of which ones
+// they are.
+void InputLog::recordHwi( std::uint64_t cycle, const Registers& before, const ProcessorState& after, int ticks ) {
+    auto values = registersOf( after );
+    Word changed = 0;
+
+    for ( std::size_t i = 0; i < values.size(); ++i ) {
+        if ( values[i] != before[i] ) {
+            changed |= 1 << i;
+        }
+    }
+
+    writeEvent( cycle, InputKind::Hwi );
+    writeNumber( static_cast<std::uint64_t>( ticks ) );
+    writeWord( changed );
+
+    for ( std::size_t i = 0; i < values.size(); ++i ) {
+        if ( changed & (1 << i) ) {
+            writeWord( values[i] );
+        }
+    }
+}
+
+void InputLog::recordIdle( std::uint64_t cycle, std::uint64_t cycles ) {
+    writeEvent( cycle, InputKind::Idle );
+    writeNumber( cycles );
+}
+
+void InputLog::recordFire( std::uint64_t cycle ) {
+    writeEvent( cycle, InputKind::Fire );
+}
+
+void InputLog::recordEnd( std::uint64_t cycle ) {
+    writeEvent( cycle, InputKind::End );
+}
+
+void InputLog::recordWrites( std::uint64_t cycle ) {
+    std::vector<std::pair<Word, std::vector<Word>>> writes {};
+
+    {
+        std::lock_guard<std::mutex> lock { _mutex };
+
+        if ( _pendingWrites.empty() ) {
+            return;
+        }
+
+        writes.swap( _pendingWrites );
+    }
+
+    for ( const auto& write : writes ) {
+        writeEvent( cycle, InputKind::Write );
+        writeWord( write.first );
+        writeNumber( write.second.size() );
+
+        for ( auto word : write.second ) {
+            writeWord( word );
+        }
+    }
+}
+
+Word InputLog::replayInterrupt() {
+    auto message = readWord();
+    readEvent();
+    return message;
+}
+
+bool InputLog::replayHwi( std::uint64_t cycle, ProcessorState& proc ) {
+    if ( ! isDue( InputKind::Hwi, cycle ) || _cycle != cycle ) {
+        return false;
+    }
+
+    auto ticks = readNumber();
+    auto changed = readWord();
+
+    for ( std::size_t i = 0; i < REGISTERS.size(); ++i ) {
+        if ( changed & (1 << i) ) {
+            proc.write( REGISTERS[i], readWord() );
+        }
+    }
+
+    for ( std::size_t i = 0; i < SPECIALS.size(); ++i ) {
+        if ( changed & (1 << (REGISTERS.size() + i)) ) {
+            proc.write( SPECIALS[i], readWord() );
+        }
+    }
+
+    proc.tickClock( static_cast<int>( ticks ) );
+    readEvent();
+    return true;
+}
+
+std::uint64_t InputLog::replayIdle( std::uint64_t cycle ) {
+    if ( ! isDue( InputKind::Idle, cycle ) ) {
+        return 0;
+    }
+
+    auto cycles = readNumber();
+    readEvent();
+    return cycles;
+}
+
+void InputLog::replayWrites( std::uint64_t cycle, Memory& memory ) {
+    std::vector<Word> words {};
+
+    while ( isDue( InputKind::Write, cycle ) ) {
+        auto offset = readWord();
+        auto count = readNumber();
+
+        if ( count > static_cast<std::uint64_t>( Memory::SIZE ) ) {
+            throw error::BadInputLog { "write is too long" };
+        }
+
+        require( 2 * count );
+        words.resize( count );
+
+        for ( auto& word : words ) {
+            word = readWord();
+        }
+
+        memory.writeBlock( offset, words.data(), words.size() );
+        readEvent();
+    }
+}
+
+void InputLog::replayFire() {
+    readEvent();
+}
+
+}
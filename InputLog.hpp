@@ -0,0 +1,221 @@
+// InputLog.hpp
+//
+// Copyright 2013 Jesse Haber-Kucharsky
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "Memory.hpp"
+#include "ProcessorState.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace nebula {
+
+namespace input {
+
+// "NEBI", in little endian order.
+const std::uint32_t MAGIC = 0x4942454e;
+
+// Incremented whenever the format of events changes.
+const std::uint32_t VERSION = 2;
+
+}
+
+namespace error {
+
+class BadInputLog : public std::runtime_error {
+public:
+    explicit BadInputLog( const std::string& reason ) :
+        std::runtime_error {
+            (format( "Invalid input log: %s" ) % reason).str()
+        } {}
+};
+
+class InputLogFile : public std::runtime_error {
+    std::string _path;
+public:
+    explicit InputLogFile( const std::string& path ) :
+        std::runtime_error {
+            (format( "Unable to access input log '%s'" ) % path).str()
+        },
+        _path { path } {}
+
+    const std::string& path() const noexcept { return _path; }
+};
+
+}
+
+enum class InputKind : std::uint8_t {
+    // The processor handled a hardware interrupt.
+    Interrupt = 0,
+
+    // A device responded to `HWI`.
+    Hwi = 1,
+
+    // A device wrote to memory.
+    Write = 2,
+
+    // The processor skipped cycles while it was idle.
+    Idle = 3,
+
+    // The interrupt queue overflowed.
+    Fire = 4,
+
+    // The processor stopped.
+    End = 5
+};
+
+// Everything from outside the processor that it can observe, against the
+// cycle at which it observes it.
+//
+// Devices run on threads of their own, at times that depend on the host, so
+// no two runs of the same machine are alike. Instead of the inputs to every
+// device, the log records what crosses into the processor: which interrupts
+// it handles, what each `HWI` does to its registers, what devices write to
+// memory, and how long it spends idle. The processor only observes any of
+// these at particular points between instructions, which are the same from
+// one run to the next as long as the inputs are, so replaying them at the
+// same cycles executes exactly the same instructions without any devices,
+// and without ever waiting.
+//
+// A device that writes to memory reports what it wrote (see `deviceWrote`),
+// and the processor records it the next time that it observes the device.
+// Guests that wait for a device to finish before they read what it wrote
+// can't tell the difference.
+//
+// The cycles at which the processor observes inputs depend on how it executes
+// instructions, so the log starts with the execution mode and whether
+// instructions were fused, and can only be replayed the same way.
+//
+// Events are stored as the number of cycles since the previous event, its
+// kind, and whatever else it needs, in little endian order. Most events take
+// a few bytes.
+class InputLog final {
+public:
+    // A, B, C, X, Y, Z, I, J, PC, SP and EX.
+    using Registers = std::array<Word, 11>;
+
+    enum class Mode {
+        Off,
+        Recording,
+        Replaying
+    };
+private:
+    Mode _mode { Mode::Off };
+
+    ExecutionMode _executionMode { ExecutionMode::Interpreted };
+    bool _isFusing { false };
+
+    std::vector<unsigned char> _bytes {};
+    std::size_t _position { 0 };
+
+    // The cycle of the last event that was recorded, or of the next one to
+    // replay.
+    std::uint64_t _cycle { 0 };
+
+    InputKind _nextKind { InputKind::End };
+    bool _hasNext { false };
+
+    std::mutex _mutex {};
+    std::vector<std::pair<Word, std::vector<Word>>> _pendingWrites {};
+
+    void writeEvent( std::uint64_t cycle, InputKind kind );
+    void writeNumber( std::uint64_t value );
+    void writeWord( Word value );
+
+    // Throw if fewer than `count` bytes remain.
+    void require( std::size_t count ) const;
+    std::uint64_t readNumber();
+    Word readWord();
+    void readEvent();
+
+    // Whether the next event is `kind` and happens by `cycle`.
+    inline bool isDue( InputKind kind, std::uint64_t cycle ) const noexcept {
+        return _hasNext && _nextKind == kind && _cycle <= cycle;
+    }
+public:
+    explicit InputLog() = default;
+
+    InputLog( const InputLog& ) = delete;
+    InputLog& operator=( const InputLog& ) = delete;
+
+    static Registers registersOf( const ProcessorState& proc ) noexcept;
+
+    // Either of these must happen before the simulation starts.
+    void startRecording( ExecutionMode executionMode, bool isFusing );
+    void startReplaying( std::vector<unsigned char> bytes );
+    void startReplayingFile( const std::string& path );
+
+    // Throw unless the log was recorded the same way, when replaying.
+    void checkExecution( ExecutionMode executionMode, bool isFusing ) const;
+
+    inline Mode mode() const noexcept { return _mode; }
+    inline bool isRecording() const noexcept { return _mode == Mode::Recording; }
+    inline bool isReplaying() const noexcept { return _mode == Mode::Replaying; }
+
+    // Everything that has been recorded.
+    inline const std::vector<unsigned char>& bytes() const noexcept { return _bytes; }
+
+    void saveToFile( const std::string& path ) const;
+
+    // Called by devices, from any thread, after they write to memory. Does
+    // nothing unless recording.
+    void deviceWrote( Word offset, const Word* words, std::size_t count );
+
+    // Recording, by the processor.
+
+    void recordInterrupt( std::uint64_t cycle, Word message );
+
+    // `before` is what the registers were before the device responded, and
+    // `ticks` is how many cycles the device took.
+    void recordHwi( std::uint64_t cycle, const Registers& before, const ProcessorState& after, int ticks );
+
+    void recordIdle( std::uint64_t cycle, std::uint64_t cycles );
+    void recordFire( std::uint64_t cycle );
+    void recordEnd( std::uint64_t cycle );
+
+    // Record what devices have written since the last time.
+    void recordWrites( std::uint64_t cycle );
+
+    // Replaying, by the processor. Each event is replayed at most once.
+
+    inline bool isInterruptDue( std::uint64_t cycle ) const noexcept { return isDue( InputKind::Interrupt, cycle ); }
+    inline bool isFireDue( std::uint64_t cycle ) const noexcept { return isDue( InputKind::Fire, cycle ); }
+    inline bool isEndDue( std::uint64_t cycle ) const noexcept { return isDue( InputKind::End, cycle ); }
+
+    // Only when an interrupt is due.
+    Word replayInterrupt();
+
+    // False, without changing anything, unless the next event is an `HWI`
+    // recorded at exactly `cycle`.
+    bool replayHwi( std::uint64_t cycle, ProcessorState& proc );
+
+    // The cycles that were skipped, or zero if the processor wasn't idle at
+    // `cycle`.
+    std::uint64_t replayIdle( std::uint64_t cycle );
+
+    void replayWrites( std::uint64_t cycle, Memory& memory );
+
+    void replayFire();
+};
+
+}
@@ -0,0 +1,136 @@
+// InstructionCache.cpp
+//
+// Copyright 2013 Jesse Haber-Kucharsky
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "InstructionCache.hpp"
+
+namespace nebula {
+
+using isa::OperandClass;
+
+static Fusion fusionBegunBy( const DecodedInstruction& ins ) {
+    auto a = isa::OPERANDS[ins.a].operandClass;
+    auto b = isa::OPERANDS[ins.b].operandClass;
+
+    if ( ins.isConditional ) {
+        return Fusion::ConditionalJump;
+    }
+
+    // Nothing follows an instruction that writes PC.
+    if ( b == OperandClass::Pc ) {
+        return Fusion::None;
+    }
+
+    switch ( ins.binaryOpcode() ) {
+    case Opcode::Set:
+        return b == OperandClass::Stack ? Fusion::PushRun
+             : a == OperandClass::Stack ? Fusion::PopRun
+             : Fusion::None;
+    case Opcode::Add:
+    case Opcode::Sub:
+        return Fusion::ExcessTest;
+    case Opcode::Sti:
+    case Opcode::Std:
+        return b == OperandClass::RegisterIndirect &&
+            (a == OperandClass::Register ||
+             a == OperandClass::RegisterIndirect ||
+             a == OperandClass::Direct ||
+             a == OperandClass::Literal) ? Fusion::BlockTransfer : Fusion::None;
+    default:
+        return Fusion::None;
+    }
+}
+
+static std::uint8_t fusionsContinuedBy( const DecodedInstruction& ins ) {
+    auto a = isa::OPERANDS[ins.a].operandClass;
+    auto b = isa::OPERANDS[ins.b].operandClass;
+    std::uint8_t fusions = 0;
+
+    auto add = [&fusions] ( Fusion fusion ) { fusions |= 1u << static_cast<unsigned>( fusion ); };
+
+    if ( ins.binaryOpcode() == Opcode::Set ) {
+        if ( b == OperandClass::Pc && (a == OperandClass::Direct || a == OperandClass::Literal) ) {
+            add( Fusion::ConditionalJump );
+        }
+
+        if ( b == OperandClass::Stack ) {
+            add( Fusion::PushRun );
+        }
+
+        if ( a == OperandClass::Stack ) {
+            add( Fusion::PopRun );
+        }
+    }
+
+    if ( ins.isConditional && (a == OperandClass::Ex || b == OperandClass::Ex) ) {
+        add( Fusion::ExcessTest );
+    }
+
+    return fusions;
+}
+
+static DecodedInstruction decodeWord( Word word ) {
+    DecodedInstruction ins { InstructionKind::Malformed, 0, 0, 0, 0, 0, false, nullptr, Fusion::None, 0 };
+
+    auto a = isa::aField( word );
+    auto b = isa::bField( word );
+
+    if ( isa::isBinary( word ) ) {
+        const auto& spec = isa::OPCODES[isa::opcodeField( word )];
+
+        ins.kind = InstructionKind::Binary;
+        ins.opcode = isa::opcodeField( word );
+        ins.a = a;
+        ins.b = b;
+        ins.isConditional = spec.isConditional;
+        ins.cycles = spec.cycles;
+    } else if ( isa::isUnary( word ) ) {
+        ins.kind = InstructionKind::Unary;
+        ins.opcode = b;
+        ins.a = a;
+        ins.cycles = isa::SPECIAL_OPCODES[b].cycles;
+    }
+
+    if ( ins.kind != InstructionKind::Malformed ) {
+        ins.size = isa::size( word ) - 1;
+        ins.cycles += 1 + ins.size;
+        ins.handler = handlerFor( word );
+    }
+
+    if ( ins.kind == InstructionKind::Binary ) {
+        ins.fusion = fusionBegunBy( ins );
+        ins.continuedFusions = fusionsContinuedBy( ins );
+    }
+
+    return ins;
+}
+
+static std::array<DecodedInstruction, 0x10000> decodeAll() {
+    std::array<DecodedInstruction, 0x10000> table;
+
+    for ( DoubleWord word = 0; word < table.size(); ++word ) {
+        table[word] = decodeWord( static_cast<Word>( word ) );
+    }
+
+    return table;
+}
+
+namespace decoder {
+
+const std::array<DecodedInstruction, 0x10000> CACHE = decodeAll();
+
+}
+
+}
@@ -0,0 +1,115 @@
+// InstructionCache.hpp
+//
+// Copyright 2013 Jesse Haber-Kucharsky
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "InstructionHandlers.hpp"
+#include "ProcessorState.hpp"
+
+#include <array>
+#include <cstdint>
+
+namespace nebula {
+
+enum class InstructionKind : std::uint8_t {
+    Malformed,
+    Binary,
+    Unary
+};
+
+// An instruction word, decoded ahead of time.
+//
+// Decoding depends only on the instruction word itself (and not on the
+// location it was read from), so every one of the 0x10000 possible words is
+// decoded exactly once and the result is shared by every processor. Operand
+// values are never part of a decoded instruction, so nothing here needs to be
+// invalidated when memory is written.
+struct DecodedInstruction {
+    InstructionKind kind;
+
+    // Either an `Opcode` or a `SpecialOpcode`, depending on the kind.
+    std::uint8_t opcode;
+
+    // The raw operand encodings. Unary instructions only have `a`.
+    std::uint8_t a;
+    std::uint8_t b;
+
+    // The number of next words consumed by the operands.
+    std::uint8_t size;
+
+    // The cost of executing the instruction, including fetching the
+    // instruction word and all of its next words.
+    std::uint8_t cycles;
+
+    bool isConditional;
+
+    // Specialized for the opcode and the operand classes, so no further
+    // decoding happens at execution time.
+    InstructionHandler handler;
+
+    // The fusion this instruction can begin, and the fusions it can continue
+    // (as a set of bits indexed by `Fusion`).
+    Fusion fusion;
+    std::uint8_t continuedFusions;
+
+    inline Opcode binaryOpcode() const noexcept { return static_cast<Opcode>( opcode ); }
+    inline SpecialOpcode specialOpcode() const noexcept { return static_cast<SpecialOpcode>( opcode ); }
+};
+
+inline bool continuesFusion( const DecodedInstruction& ins, Fusion fusion ) noexcept {
+    return (ins.continuedFusions & (1u << static_cast<unsigned>( fusion ))) != 0;
+}
+
+namespace decoder {
+
+extern const std::array<DecodedInstruction, 0x10000> CACHE;
+
+}
+
+inline const DecodedInstruction& decodeCached( Word word ) noexcept {
+    return decoder::CACHE[word];
+}
+
+inline const DecodedInstruction& ProcessorState::decodeNext() {
+    if ( isFusing ) {
+        _chain = &chainAt( _pc );
+        return *_chain->leader;
+    }
+
+    return decodeCached( _memory->read( _pc ) );
+}
+
+template <typename IsInterrupted>
+inline void ProcessorState::fuse( const DecodedInstruction& leader,
+                                  int clockLimit,
+                                  IsInterrupted isInterrupted ) {
+    if ( _chain->count == 0 && leader.fusion != Fusion::BlockTransfer ) {
+        return;
+    }
+
+    BatchLimit limit { clockLimit, &callInterrupted<IsInterrupted>, &isInterrupted };
+    _limit = &limit;
+
+    if ( _chain->count != 0 ) {
+        fuse( *_chain );
+    } else {
+        transfer( leader );
+    }
+
+    _limit = nullptr;
+}
+
+}
@@ -0,0 +1,530 @@
+// InstructionHandlers.cpp
+//
+// Copyright 2013 Jesse Haber-Kucharsky
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "InstructionHandlers.hpp"
+#include "InstructionCache.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+
+namespace nebula {
+
+namespace {
+
+using isa::OperandClass;
+
+//
+// Operand access.
+//
+// `resolve` fetches the operand's next word (if it has one) and determines
+// its location, which is then passed to `load` and `store`. Operand a is
+// always resolved and loaded before operand b is resolved.
+//
+
+template <OperandClass C, AddressContext Context>
+struct Access;
+
+template <AddressContext Context>
+struct Access<OperandClass::Register, Context> {
+    using Location = Register;
+
+    static inline Location resolve( ProcessorState&, Word code ) { return static_cast<Register>( code & 0x7 ); }
+    static inline Word load( ProcessorState& proc, Location reg ) { return proc.read( reg ); }
+    static inline void store( ProcessorState& proc, Location reg, Word value ) { proc.write( reg, value ); }
+};
+
+// All operands that refer to a memory location.
+struct MemoryAccess {
+    using Location = Word;
+
+    static inline Word load( ProcessorState& proc, Location loc ) { return proc.readMemory( loc ); }
+    static inline void store( ProcessorState& proc, Location loc, Word value ) { proc.writeMemory( loc, value ); }
+};
+
+template <AddressContext Context>
+struct Access<OperandClass::RegisterIndirect, Context> : MemoryAccess {
+    static inline Location resolve( ProcessorState& proc, Word code ) {
+        return proc.read( static_cast<Register>( code & 0x7 ) );
+    }
+};
+
+template <AddressContext Context>
+struct Access<OperandClass::RegisterIndirectOffset, Context> : MemoryAccess {
+    static inline Location resolve( ProcessorState& proc, Word code ) {
+        auto next = fetchNextWord( proc );
+        return proc.read( static_cast<Register>( code & 0x7 ) ) + next;
+    }
+};
+
+template <>
+struct Access<OperandClass::Stack, AddressContext::A> {
+    using Location = bool;
+
+    static inline Location resolve( ProcessorState&, Word ) { return true; }
+    static inline Word load( ProcessorState& proc, Location ) { return pop( proc ); }
+
+    static inline void store( ProcessorState&, Location, Word ) {
+        assert( ! "Attempt to store to a 'pop' address!" );
+    }
+};
+
+template <>
+struct Access<OperandClass::Stack, AddressContext::B> {
+    using Location = bool;
+
+    static inline Location resolve( ProcessorState&, Word ) { return true; }
+
+    static inline Word load( ProcessorState&, Location ) {
+        assert( ! "Attempt to load from a 'push' address!" );
+        return 0;
+    }
+
+    static inline void store( ProcessorState& proc, Location, Word value ) { push( proc, value ); }
+};
+
+template <AddressContext Context>
+struct Access<OperandClass::Peek, Context> : MemoryAccess {
+    static inline Location resolve( ProcessorState& proc, Word ) { return proc.read( Special::Sp ); }
+};
+
+template <AddressContext Context>
+struct Access<OperandClass::Pick, Context> : MemoryAccess {
+    static inline Location resolve( ProcessorState& proc, Word ) {
+        auto next = fetchNextWord( proc );
+        return proc.read( Special::Sp ) + next;
+    }
+};
+
+template <Special S>
+struct SpecialAccess {
+    using Location = bool;
+
+    static inline Location resolve( ProcessorState&, Word ) { return true; }
+    static inline Word load( ProcessorState& proc, Location ) { return proc.read( S ); }
+    static inline void store( ProcessorState& proc, Location, Word value ) { proc.write( S, value ); }
+};
+
+template <AddressContext Context>
+struct Access<OperandClass::Sp, Context> : SpecialAccess<Special::Sp> {};
+
+template <AddressContext Context>
+struct Access<OperandClass::Pc, Context> : SpecialAccess<Special::Pc> {};
+
+template <AddressContext Context>
+struct Access<OperandClass::Ex, Context> : SpecialAccess<Special::Ex> {};
+
+template <AddressContext Context>
+struct Access<OperandClass::Indirect, Context> : MemoryAccess {
+    static inline Location resolve( ProcessorState& proc, Word ) { return fetchNextWord( proc ); }
+};
+
+// Literal values, whether they're encoded in the instruction or in the next
+// word. Storing to a literal has no effect.
+struct LiteralAccess {
+    using Location = Word;
+
+    static inline Word load( ProcessorState&, Location value ) { return value; }
+    static inline void store( ProcessorState&, Location, Word ) {}
+};
+
+template <AddressContext Context>
+struct Access<OperandClass::Direct, Context> : LiteralAccess {
+    static inline Location resolve( ProcessorState& proc, Word ) { return fetchNextWord( proc ); }
+};
+
+template <AddressContext Context>
+struct Access<OperandClass::Literal, Context> : LiteralAccess {
+    static inline Location resolve( ProcessorState&, Word code ) { return isa::OPERANDS[code].value; }
+};
+
+//
+// Instruction semantics.
+//
+
+// Store b <- a, and then do something else.
+template <typename After>
+struct Transfer {
+    template <typename A, typename B>
+    static inline void execute( ProcessorState& proc, const DecodedInstruction& ins ) {
+        auto la = A::resolve( proc, ins.a );
+        auto y = A::load( proc, la );
+        auto lb = B::resolve( proc, ins.b );
+        B::store( proc, lb, y );
+
+        After::apply( proc );
+    }
+};
+
+// Store b <- f(b, a).
+template <typename F>
+struct Modify {
+    template <typename A, typename B>
+    static inline void execute( ProcessorState& proc, const DecodedInstruction& ins ) {
+        auto la = A::resolve( proc, ins.a );
+        auto y = A::load( proc, la );
+        auto lb = B::resolve( proc, ins.b );
+        auto x = B::load( proc, lb );
+
+        B::store( proc, lb, F::apply( proc, x, y ) );
+    }
+};
+
+// Store b <- f(b, a) truncated, and then set EX from the full result.
+template <typename F>
+struct ModifyThenEx {
+    template <typename A, typename B>
+    static inline void execute( ProcessorState& proc, const DecodedInstruction& ins ) {
+        auto la = A::resolve( proc, ins.a );
+        auto yd = DoubleWord { A::load( proc, la ) };
+        auto lb = B::resolve( proc, ins.b );
+        auto xd = DoubleWord { B::load( proc, lb ) };
+        auto zd = F::apply( proc, xd, yd );
+
+        B::store( proc, lb, static_cast<Word>( zd ) );
+        proc.write( Special::Ex, F::excess( zd ) );
+    }
+};
+
+// Set EX, and then store b <- f(b, a).
+template <typename F>
+struct ExThenModify {
+    template <typename A, typename B>
+    static inline void execute( ProcessorState& proc, const DecodedInstruction& ins ) {
+        auto la = A::resolve( proc, ins.a );
+        auto y = A::load( proc, la );
+        auto lb = B::resolve( proc, ins.b );
+        auto x = B::load( proc, lb );
+
+        proc.write( Special::Ex, F::excess( x, y ) );
+        B::store( proc, lb, F::apply( x, y ) );
+    }
+};
+
+// Skip the next instruction unless f(b, a).
+template <typename F>
+struct SkipUnless {
+    template <typename A, typename B>
+    static inline void execute( ProcessorState& proc, const DecodedInstruction& ins ) {
+        auto la = A::resolve( proc, ins.a );
+        auto y = A::load( proc, la );
+        auto lb = B::resolve( proc, ins.b );
+        auto x = B::load( proc, lb );
+
+        bool skip = ! F::apply( x, y );
+
+        if ( skip ) {
+            proc.tickClock( 1 );
+        }
+
+        proc.doSkip = skip;
+    }
+};
+
+namespace op {
+
+struct Nothing { static inline void apply( ProcessorState& ) {} };
+
+struct Increment {
+    static inline void apply( ProcessorState& proc ) {
+        proc.write( Register::I, proc.read( Register::I ) + 1 );
+        proc.write( Register::J, proc.read( Register::J ) + 1 );
+    }
+};
+
+struct Decrement {
+    static inline void apply( ProcessorState& proc ) {
+        proc.write( Register::I, proc.read( Register::I ) - 1 );
+        proc.write( Register::J, proc.read( Register::J ) - 1 );
+    }
+};
+
+struct Add {
+    static inline DoubleWord apply( ProcessorState&, DoubleWord x, DoubleWord y ) { return x + y; }
+    static inline Word excess( DoubleWord z ) { return z > 0xffff ? 1 : 0; }
+};
+
+struct Sub {
+    static inline DoubleWord apply( ProcessorState&, DoubleWord x, DoubleWord y ) { return x - y; }
+    static inline Word excess( DoubleWord z ) { return z > 0xffff ? 0xffff : 0; }
+};
+
+struct Mul {
+    static inline DoubleWord apply( ProcessorState&, DoubleWord x, DoubleWord y ) { return x * y; }
+    static inline Word excess( DoubleWord z ) { return (z >> 16) & 0xffff; }
+};
+
+struct Adx {
+    static inline DoubleWord apply( ProcessorState& proc, DoubleWord x, DoubleWord y ) {
+        return x + y + proc.read( Special::Ex );
+    }
+
+    static inline Word excess( DoubleWord z ) { return z > 0xffff ? 1 : 0; }
+};
+
+struct Sbx {
+    static inline DoubleWord apply( ProcessorState& proc, DoubleWord x, DoubleWord y ) {
+        return x - y + proc.read( Special::Ex );
+    }
+
+    static inline Word excess( DoubleWord z ) { return z > 0xffff ? 1 : 0; }
+};
+
+struct Mli {
+    static inline Word apply( ProcessorState&, Word x, Word y ) {
+        return static_cast<Word>( static_cast<SignedWord>( x ) * static_cast<SignedWord>( y ) );
+    }
+};
+
+struct Dvi {
+    static inline Word apply( ProcessorState&, Word x, Word y ) {
+        auto xi = static_cast<SignedWord>( x );
+        auto yi = static_cast<SignedWord>( y );
+
+        return static_cast<Word>( yi != 0 ? xi / yi : 0 );
+    }
+};
+
+struct Mod {
+    static inline Word apply( ProcessorState&, Word x, Word y ) { return y != 0 ? x % y : 0; }
+};
+
+struct Mdi {
+    static inline Word apply( ProcessorState&, Word x, Word y ) {
+        auto xi = static_cast<SignedWord>( x );
+        auto yi = static_cast<SignedWord>( y );
+
+        return static_cast<Word>( yi != 0 ? xi % yi : 0 );
+    }
+};
+
+struct And { static inline Word apply( ProcessorState&, Word x, Word y ) { return x & y; } };
+struct Bor { static inline Word apply( ProcessorState&, Word x, Word y ) { return x | y; } };
+struct Xor { static inline Word apply( ProcessorState&, Word x, Word y ) { return x ^ y; } };
+
+struct Div {
+    static inline Word apply( Word x, Word y ) { return y != 0 ? x / y : 0; }
+
+    static inline Word excess( Word x, Word y ) {
+        return y != 0 ? ((DoubleWord { x } << 16) / y) & 0xffff : 0;
+    }
+};
+
+// Shifting by the width of the operand or more clears it.
+
+struct Shr {
+    static inline Word apply( Word x, Word y ) { return y < 32 ? DoubleWord { x } >> y : 0; }
+    static inline Word excess( Word x, Word y ) { return y < 32 ? ((DoubleWord { x } << 16) >> y) & 0xffff : 0; }
+};
+
+struct Asr {
+    static inline Word apply( Word x, Word y ) {
+        return static_cast<Word>( SignedDoubleWord { x } >> std::min( y, Word { 31 } ) );
+    }
+
+    static inline Word excess( Word x, Word y ) {
+        return (static_cast<SignedDoubleWord>( DoubleWord { x } << 16 ) >> std::min( y, Word { 31 } )) & 0xffff;
+    }
+};
+
+struct Shl {
+    static inline Word apply( Word x, Word y ) { return y < 32 ? static_cast<Word>( DoubleWord { x } << y ) : 0; }
+    static inline Word excess( Word x, Word y ) { return y < 32 ? ((DoubleWord { x } << y) >> 16) & 0xffff : 0; }
+};
+
+struct Ifb { static inline bool apply( Word x, Word y ) { return (x & y) != 0; } };
+struct Ifc { static inline bool apply( Word x, Word y ) { return (x & y) == 0; } };
+struct Ife { static inline bool apply( Word x, Word y ) { return x == y; } };
+struct Ifn { static inline bool apply( Word x, Word y ) { return x != y; } };
+struct Ifg { static inline bool apply( Word x, Word y ) { return x > y; } };
+struct Ifl { static inline bool apply( Word x, Word y ) { return x < y; } };
+
+struct Ifa {
+    static inline bool apply( Word x, Word y ) { return static_cast<SignedWord>( x ) > static_cast<SignedWord>( y ); }
+};
+
+struct Ifu {
+    static inline bool apply( Word x, Word y ) { return static_cast<SignedWord>( x ) < static_cast<SignedWord>( y ); }
+};
+
+}
+
+template <Opcode O>
+struct Semantics;
+
+template <> struct Semantics<Opcode::Set> : Transfer<op::Nothing> {};
+template <> struct Semantics<Opcode::Add> : ModifyThenEx<op::Add> {};
+template <> struct Semantics<Opcode::Sub> : ModifyThenEx<op::Sub> {};
+template <> struct Semantics<Opcode::Mul> : ModifyThenEx<op::Mul> {};
+template <> struct Semantics<Opcode::Mli> : Modify<op::Mli> {};
+template <> struct Semantics<Opcode::Div> : ExThenModify<op::Div> {};
+template <> struct Semantics<Opcode::Dvi> : Modify<op::Dvi> {};
+template <> struct Semantics<Opcode::Mod> : Modify<op::Mod> {};
+template <> struct Semantics<Opcode::Mdi> : Modify<op::Mdi> {};
+template <> struct Semantics<Opcode::And> : Modify<op::And> {};
+template <> struct Semantics<Opcode::Bor> : Modify<op::Bor> {};
+template <> struct Semantics<Opcode::Xor> : Modify<op::Xor> {};
+template <> struct Semantics<Opcode::Shr> : ExThenModify<op::Shr> {};
+template <> struct Semantics<Opcode::Asr> : ExThenModify<op::Asr> {};
+template <> struct Semantics<Opcode::Shl> : ExThenModify<op::Shl> {};
+template <> struct Semantics<Opcode::Ifb> : SkipUnless<op::Ifb> {};
+template <> struct Semantics<Opcode::Ifc> : SkipUnless<op::Ifc> {};
+template <> struct Semantics<Opcode::Ife> : SkipUnless<op::Ife> {};
+template <> struct Semantics<Opcode::Ifn> : SkipUnless<op::Ifn> {};
+template <> struct Semantics<Opcode::Ifg> : SkipUnless<op::Ifg> {};
+template <> struct Semantics<Opcode::Ifa> : SkipUnless<op::Ifa> {};
+template <> struct Semantics<Opcode::Ifl> : SkipUnless<op::Ifl> {};
+template <> struct Semantics<Opcode::Ifu> : SkipUnless<op::Ifu> {};
+template <> struct Semantics<Opcode::Adx> : ModifyThenEx<op::Adx> {};
+template <> struct Semantics<Opcode::Sbx> : ModifyThenEx<op::Sbx> {};
+template <> struct Semantics<Opcode::Sti> : Transfer<op::Increment> {};
+template <> struct Semantics<Opcode::Std> : Transfer<op::Decrement> {};
+
+template <Opcode O, OperandClass A, OperandClass B>
+void binaryHandler( ProcessorState& proc, const DecodedInstruction& ins ) {
+    Semantics<O>::template execute<Access<A, AddressContext::A>, Access<B, AddressContext::B>>( proc, ins );
+}
+
+template <OperandClass A>
+void jsrHandler( ProcessorState& proc, const DecodedInstruction& ins ) {
+    using Address = Access<A, AddressContext::A>;
+
+    auto loc = Address::resolve( proc, ins.a );
+    auto target = Address::load( proc, loc );
+    push( proc, proc.read( Special::Pc ) );
+    proc.write( Special::Pc, target );
+}
+
+// Special instructions other than JSR are handled by the parent simulation.
+void deferredHandler( ProcessorState&, const DecodedInstruction& ) {}
+
+//
+// The handler matrix.
+//
+
+template <std::size_t... I>
+struct Indices {};
+
+template <std::size_t N, std::size_t... I>
+struct MakeIndices : MakeIndices<N - 1, N - 1, I...> {};
+
+template <std::size_t... I>
+struct MakeIndices<0, I...> {
+    using Type = Indices<I...>;
+};
+
+constexpr std::size_t NUM_CLASSES = isa::NUM_OPERAND_CLASSES;
+
+// Operand b can never be a literal encoded in the instruction.
+template <std::size_t O, std::size_t A, std::size_t B,
+          bool = isa::OPCODES[O].isValid() && B != static_cast<std::size_t>( OperandClass::Literal )>
+struct BinaryEntry {
+    static constexpr InstructionHandler get() { return nullptr; }
+};
+
+template <std::size_t O, std::size_t A, std::size_t B>
+struct BinaryEntry<O, A, B, true> {
+    static constexpr InstructionHandler get() {
+        return &binaryHandler<static_cast<Opcode>( O ), static_cast<OperandClass>( A ), static_cast<OperandClass>( B )>;
+    }
+};
+
+template <std::size_t O, std::size_t A, bool = isa::SPECIAL_OPCODES[O].isValid()>
+struct UnaryEntry {
+    static constexpr InstructionHandler get() { return nullptr; }
+};
+
+template <std::size_t O, std::size_t A>
+struct UnaryEntry<O, A, true> {
+    static constexpr InstructionHandler get() {
+        return O == static_cast<std::size_t>( SpecialOpcode::Jsr )
+            ? &jsrHandler<static_cast<OperandClass>( A )>
+            : &deferredHandler;
+    }
+};
+
+// Handlers for one opcode, indexed by the class of operand a and then by the
+// class of operand b.
+struct BinaryRow {
+    InstructionHandler handlers[NUM_CLASSES * NUM_CLASSES];
+};
+
+// Handlers for one special opcode, indexed by the class of operand a.
+struct UnaryRow {
+    InstructionHandler handlers[NUM_CLASSES];
+};
+
+struct HandlerMatrix {
+    BinaryRow binary[0x20];
+    UnaryRow unary[0x20];
+};
+
+template <std::size_t O, std::size_t... I>
+constexpr BinaryRow makeBinaryRow( Indices<I...> ) {
+    return BinaryRow { { BinaryEntry<O, I / NUM_CLASSES, I % NUM_CLASSES>::get()... } };
+}
+
+template <std::size_t O, std::size_t... I>
+constexpr UnaryRow makeUnaryRow( Indices<I...> ) {
+    return UnaryRow { { UnaryEntry<O, I>::get()... } };
+}
+
+template <std::size_t... O>
+constexpr HandlerMatrix makeMatrix( Indices<O...> ) {
+    return HandlerMatrix {
+        { makeBinaryRow<O>( typename MakeIndices<NUM_CLASSES * NUM_CLASSES>::Type {} )... },
+        { makeUnaryRow<O>( typename MakeIndices<NUM_CLASSES>::Type {} )... }
+    };
+}
+
+// This is constant-initialized, so it's safe to use while other static data
+// (like the decode cache) is being initialized.
+constexpr HandlerMatrix HANDLERS = makeMatrix( MakeIndices<0x20>::Type {} );
+
+inline std::size_t classIndex( Word code ) {
+    return static_cast<std::size_t>( isa::OPERANDS[code].operandClass );
+}
+
+}
+
+InstructionHandler handlerFor( Word word ) noexcept {
+    auto a = classIndex( isa::aField( word ) );
+
+    if ( isa::isBinary( word ) ) {
+        auto b = classIndex( isa::bField( word ) );
+        return HANDLERS.binary[isa::opcodeField( word )].handlers[(a * NUM_CLASSES) + b];
+    } else if ( isa::isUnary( word ) ) {
+        return HANDLERS.unary[isa::bField( word )].handlers[a];
+    } else {
+        return nullptr;
+    }
+}
+
+bool passesTest( Opcode opcode, Word x, Word y ) noexcept {
+    switch ( opcode ) {
+    case Opcode::Ifb: return op::Ifb::apply( x, y );
+    case Opcode::Ifc: return op::Ifc::apply( x, y );
+    case Opcode::Ife: return op::Ife::apply( x, y );
+    case Opcode::Ifn: return op::Ifn::apply( x, y );
+    case Opcode::Ifg: return op::Ifg::apply( x, y );
+    case Opcode::Ifa: return op::Ifa::apply( x, y );
+    case Opcode::Ifl: return op::Ifl::apply( x, y );
+    case Opcode::Ifu: return op::Ifu::apply( x, y );
+    default: return true;
+    }
+}
+
+}
@@ -0,0 +1,39 @@
+// InstructionHandlers.hpp
+//
+// Copyright 2013 Jesse Haber-Kucharsky
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "ProcessorState.hpp"
+
+namespace nebula {
+
+// Forward declaration.
+struct DecodedInstruction;
+
+// Executes the semantics of a decoded instruction. Cycles are not ticked,
+// except for the extra cycle of a failed conditional.
+using InstructionHandler = void (*)( ProcessorState& proc, const DecodedInstruction& ins );
+
+// Every handler is specialized at compile-time for the opcode and for the
+// class (see `isa::OperandClass`) of each of its operands, so operand access
+// is inlined into the handler. Malformed instructions have no handler.
+InstructionHandler handlerFor( Word word ) noexcept;
+
+// Whether the test of a conditional instruction passes for the values of
+// operand b (`x`) and operand a (`y`).
+bool passesTest( Opcode opcode, Word x, Word y ) noexcept;
+
+}
@@ -0,0 +1,91 @@
+// Isa.cpp
+//
+// Copyright 2013 Jesse Haber-Kucharsky
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "Isa.hpp"
+#include "Memory.hpp"
+
+namespace nebula {
+
+namespace isa {
+
+static const char* const REGISTER_NAMES[8] = { "A", "B", "C", "X", "Y", "Z", "I", "J" };
+
+static std::string formatOperand( Word code, bool isB, Word next ) {
+    const auto& spec = OPERANDS[code];
+
+    switch ( spec.operandClass ) {
+    case OperandClass::Register:
+        return REGISTER_NAMES[spec.value];
+    case OperandClass::RegisterIndirect:
+        return (format( "[%s]" ) % REGISTER_NAMES[spec.value]).str();
+    case OperandClass::RegisterIndirectOffset:
+        return (format( "[%s + 0x%04x]" ) % REGISTER_NAMES[spec.value] % next).str();
+    case OperandClass::Stack:
+        return isB ? "PUSH" : "POP";
+    case OperandClass::Peek:
+        return "PEEK";
+    case OperandClass::Pick:
+        return (format( "PICK 0x%04x" ) % next).str();
+    case OperandClass::Sp:
+        return "SP";
+    case OperandClass::Pc:
+        return "PC";
+    case OperandClass::Ex:
+        return "EX";
+    case OperandClass::Indirect:
+        return (format( "[0x%04x]" ) % next).str();
+    case OperandClass::Direct:
+        return (format( "0x%04x" ) % next).str();
+    case OperandClass::Literal:
+        return (format( "0x%04x" ) % spec.value).str();
+    }
+
+    return {};
+}
+
+std::pair<std::string, int> disassemble( Memory& memory, Word pc ) {
+    auto word = memory.read( pc );
+    auto a = aField( word );
+    auto b = bField( word );
+
+    // The next word of operand a precedes that of operand b.
+    Word nextA = OPERANDS[a].size != 0 ? memory.read( pc + 1 ) : 0;
+
+    if ( isBinary( word ) ) {
+        Word nextB = OPERANDS[b].size != 0 ? memory.read( pc + 1 + OPERANDS[a].size ) : 0;
+
+        return {
+            (format( "%s %s, %s" )
+                 % OPCODES[opcodeField( word )].mnemonic
+                 % formatOperand( b, true, nextB )
+                 % formatOperand( a, false, nextA )).str(),
+            size( word )
+        };
+    } else if ( isUnary( word ) ) {
+        return {
+            (format( "%s %s" )
+                 % SPECIAL_OPCODES[b].mnemonic
+                 % formatOperand( a, false, nextA )).str(),
+            size( word )
+        };
+    } else {
+        return { (format( "DAT 0x%04x" ) % word).str(), 1 };
+    }
+}
+
+}
+
+}
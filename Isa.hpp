@@ -0,0 +1,251 @@
+// Isa.hpp
+//
+// Copyright 2013 Jesse Haber-Kucharsky
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "Fundamental.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+
+namespace nebula {
+
+// Forward declaration.
+class Memory;
+
+// The encoding of the DCPU-16 instruction set (version 1.7 of the
+// specification).
+//
+// Everything else that needs to know about encodings (the decoder, cycle
+// accounting, operand lengths and the disassembler) is derived from the
+// tables here.
+namespace isa {
+
+struct OpcodeSpec {
+    // `nullptr` for encodings that aren't assigned to an instruction.
+    const char* mnemonic;
+    std::uint8_t cycles;
+    bool isConditional;
+
+    constexpr bool isValid() const { return mnemonic != nullptr; }
+};
+
+constexpr OpcodeSpec UNASSIGNED { nullptr, 0, false };
+
+// Indexed by the five-bit opcode of a binary instruction. Zero marks a unary
+// instruction.
+constexpr OpcodeSpec OPCODES[0x20] = {
+    UNASSIGNED,
+    { "SET", 1, false },
+    { "ADD", 2, false },
+    { "SUB", 2, false },
+    { "MUL", 2, false },
+    { "MLI", 2, false },
+    { "DIV", 3, false },
+    { "DVI", 3, false },
+    { "MOD", 3, false },
+    { "MDI", 3, false },
+    { "AND", 1, false },
+    { "BOR", 1, false },
+    { "XOR", 1, false },
+    { "SHR", 1, false },
+    { "ASR", 1, false },
+    { "SHL", 1, false },
+    { "IFB", 2, true },
+    { "IFC", 2, true },
+    { "IFE", 2, true },
+    { "IFN", 2, true },
+    { "IFG", 2, true },
+    { "IFA", 2, true },
+    { "IFL", 2, true },
+    { "IFU", 2, true },
+    UNASSIGNED,
+    UNASSIGNED,
+    { "ADX", 3, false },
+    { "SBX", 3, false },
+    UNASSIGNED,
+    UNASSIGNED,
+    { "STI", 2, false },
+    { "STD", 2, false }
+};
+
+// Indexed by the five-bit opcode of a unary instruction.
+constexpr OpcodeSpec SPECIAL_OPCODES[0x20] = {
+    UNASSIGNED,
+    { "JSR", 3, false },
+    UNASSIGNED,
+    UNASSIGNED,
+    UNASSIGNED,
+    UNASSIGNED,
+    UNASSIGNED,
+    UNASSIGNED,
+    { "INT", 4, false },
+    { "IAG", 1, false },
+    { "IAS", 1, false },
+    { "RFI", 3, false },
+    { "IAQ", 2, false },
+    UNASSIGNED,
+    UNASSIGNED,
+    UNASSIGNED,
+    { "HWN", 2, false },
+    { "HWQ", 4, false },
+    { "HWI", 4, false },
+    UNASSIGNED,
+    UNASSIGNED,
+    UNASSIGNED,
+    UNASSIGNED,
+    UNASSIGNED,
+    UNASSIGNED,
+    UNASSIGNED,
+    UNASSIGNED,
+    UNASSIGNED,
+    UNASSIGNED,
+    UNASSIGNED,
+    UNASSIGNED,
+    UNASSIGNED
+};
+
+enum class OperandClass : std::uint8_t {
+    Register,
+    RegisterIndirect,
+    RegisterIndirectOffset,
+    // `PUSH` as operand b, and `POP` as operand a.
+    Stack,
+    Peek,
+    Pick,
+    Sp,
+    Pc,
+    Ex,
+    Indirect,
+    Direct,
+    Literal
+};
+
+constexpr std::size_t NUM_OPERAND_CLASSES = 12;
+
+struct OperandSpec {
+    OperandClass operandClass;
+
+    // The number of next words consumed by the operand.
+    std::uint8_t size;
+
+    // The register index for register classes, and the value for literals.
+    Word value;
+};
+
+// Indexed by the six-bit encoding of operand a. Operand b can only encode
+// the first 0x20 of these.
+constexpr OperandSpec OPERANDS[0x40] = {
+    { OperandClass::Register, 0, 0 },
+    { OperandClass::Register, 0, 1 },
+    { OperandClass::Register, 0, 2 },
+    { OperandClass::Register, 0, 3 },
+    { OperandClass::Register, 0, 4 },
+    { OperandClass::Register, 0, 5 },
+    { OperandClass::Register, 0, 6 },
+    { OperandClass::Register, 0, 7 },
+    { OperandClass::RegisterIndirect, 0, 0 },
+    { OperandClass::RegisterIndirect, 0, 1 },
+    { OperandClass::RegisterIndirect, 0, 2 },
+    { OperandClass::RegisterIndirect, 0, 3 },
+    { OperandClass::RegisterIndirect, 0, 4 },
+    { OperandClass::RegisterIndirect, 0, 5 },
+    { OperandClass::RegisterIndirect, 0, 6 },
+    { OperandClass::RegisterIndirect, 0, 7 },
+    { OperandClass::RegisterIndirectOffset, 1, 0 },
+    { OperandClass::RegisterIndirectOffset, 1, 1 },
+    { OperandClass::RegisterIndirectOffset, 1, 2 },
+    { OperandClass::RegisterIndirectOffset, 1, 3 },
+    { OperandClass::RegisterIndirectOffset, 1, 4 },
+    { OperandClass::RegisterIndirectOffset, 1, 5 },
+    { OperandClass::RegisterIndirectOffset, 1, 6 },
+    { OperandClass::RegisterIndirectOffset, 1, 7 },
+    { OperandClass::Stack, 0, 0 },
+    { OperandClass::Peek, 0, 0 },
+    { OperandClass::Pick, 1, 0 },
+    { OperandClass::Sp, 0, 0 },
+    { OperandClass::Pc, 0, 0 },
+    { OperandClass::Ex, 0, 0 },
+    { OperandClass::Indirect, 1, 0 },
+    { OperandClass::Direct, 1, 0 },
+    { OperandClass::Literal, 0, 0xffff },
+    { OperandClass::Literal, 0, 0x00 },
+    { OperandClass::Literal, 0, 0x01 },
+    { OperandClass::Literal, 0, 0x02 },
+    { OperandClass::Literal, 0, 0x03 },
+    { OperandClass::Literal, 0, 0x04 },
+    { OperandClass::Literal, 0, 0x05 },
+    { OperandClass::Literal, 0, 0x06 },
+    { OperandClass::Literal, 0, 0x07 },
+    { OperandClass::Literal, 0, 0x08 },
+    { OperandClass::Literal, 0, 0x09 },
+    { OperandClass::Literal, 0, 0x0a },
+    { OperandClass::Literal, 0, 0x0b },
+    { OperandClass::Literal, 0, 0x0c },
+    { OperandClass::Literal, 0, 0x0d },
+    { OperandClass::Literal, 0, 0x0e },
+    { OperandClass::Literal, 0, 0x0f },
+    { OperandClass::Literal, 0, 0x10 },
+    { OperandClass::Literal, 0, 0x11 },
+    { OperandClass::Literal, 0, 0x12 },
+    { OperandClass::Literal, 0, 0x13 },
+    { OperandClass::Literal, 0, 0x14 },
+    { OperandClass::Literal, 0, 0x15 },
+    { OperandClass::Literal, 0, 0x16 },
+    { OperandClass::Literal, 0, 0x17 },
+    { OperandClass::Literal, 0, 0x18 },
+    { OperandClass::Literal, 0, 0x19 },
+    { OperandClass::Literal, 0, 0x1a },
+    { OperandClass::Literal, 0, 0x1b },
+    { OperandClass::Literal, 0, 0x1c },
+    { OperandClass::Literal, 0, 0x1d },
+    { OperandClass::Literal, 0, 0x1e }
+};
+
+constexpr Word opcodeField( Word word ) { return word & 0x1f; }
+constexpr Word bField( Word word ) { return (word & 0x3e0) >> 5; }
+constexpr Word aField( Word word ) { return (word & 0xfc00) >> 10; }
+
+constexpr bool isBinary( Word word ) { return OPCODES[opcodeField( word )].isValid(); }
+
+constexpr bool isUnary( Word word ) {
+    return opcodeField( word ) == 0 && SPECIAL_OPCODES[bField( word )].isValid();
+}
+
+// The number of words occupied by an instruction, including the instruction
+// word itself. Malformed instructions occupy a single word.
+constexpr int size( Word word ) {
+    return isBinary( word ) ? 1 + OPERANDS[aField( word )].size + OPERANDS[bField( word )].size
+         : isUnary( word ) ? 1 + OPERANDS[aField( word )].size
+         : 1;
+}
+
+static_assert( OPCODES[0x12].isConditional && ! OPCODES[0x01].isConditional,
+               "IFE is conditional, and SET is not" );
+static_assert( size( 0x7c01 ) == 2, "SET A, <next> occupies two words" );
+static_assert( size( 0x7bc1 ) == 3, "SET [next], <next> occupies three words" );
+static_assert( OPERANDS[0x20].value == 0xffff && OPERANDS[0x3f].value == 0x1e,
+               "Literals range from -1 to 30" );
+
+// Disassembles the instruction at `pc`, returning its text and the number of
+// words it occupies.
+std::pair<std::string, int> disassemble( Memory& memory, Word pc );
+
+}
+
+}
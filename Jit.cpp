@@ -0,0 +1,1111 @@
+// Jit.cpp
+//
+// Copyright 2013 Jesse Haber-Kucharsky
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "Jit.hpp"
+#include "InstructionCache.hpp"
+#include "X86Assembler.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <iterator>
+#include <type_traits>
+
+#if defined( __x86_64__ ) && (defined( __unix__ ) || defined( __APPLE__ ))
+#define NEBULA_JIT_SUPPORTED
+#include <sys/mman.h>
+#endif
+
+DEFINE_LOGGER( JIT, "Jit" )
+
+namespace nebula {
+
+namespace jit {
+
+namespace {
+
+using x86::AluOp;
+using x86::Assembler;
+using x86::Condition;
+using x86::Label;
+using x86::Mem;
+using x86::Reg;
+using x86::ShiftOp;
+
+static_assert( std::is_standard_layout<Context>::value,
+               "Compiled code requires the layout of the context to be standard." );
+
+static_assert( sizeof( Context ) <= 128,
+               "Compiled code addresses the context with 8-bit displacements." );
+
+static_assert( sizeof( std::atomic<std::uint8_t> ) == 1,
+               "Compiled code reads the stale flag as a byte." );
+
+// Room for the largest possible block.
+const std::size_t MAX_BLOCK_CODE_SIZE = 64 * 1024;
+
+//
+// Register assignment.
+//
+// The context is always in RBX. The value of operand a and the address of
+// operand b are kept in callee-saved registers so that they survive calls to
+// read and write memory.
+//
+
+const Reg CONTEXT = Reg::Rbx;
+const Reg VALUE_A = Reg::R12;
+const Reg ADDRESS_B = Reg::R13;
+const Reg SCRATCH = Reg::R14;
+const Reg EXCESS = Reg::R15;
+
+inline Mem field( std::size_t offset ) { return Mem { CONTEXT, static_cast<std::int8_t>( offset ) }; }
+
+inline Mem registerField( Word code ) {
+    return field( offsetof( Context, registers ) + (sizeof( Word ) * (code & 0x7)) );
+}
+
+inline Mem registerField( Register reg ) { return registerField( static_cast<Word>( reg ) ); }
+
+const Mem PC = field( offsetof( Context, pc ) );
+const Mem SP = field( offsetof( Context, sp ) );
+const Mem EX = field( offsetof( Context, ex ) );
+const Mem IS_STALE = field( offsetof( Context, isStale ) );
+const Mem DO_SKIP = field( offsetof( Context, doSkip ) );
+const Mem CYCLES = field( offsetof( Context, cycles ) );
+const Mem BUDGET = field( offsetof( Context, budget ) );
+const Mem ENTRIES = field( offsetof( Context, entries ) );
+const Mem LINK = field( offsetof( Context, link ) );
+
+// Called from compiled code. Compiled code has no unwinding information, so
+// these must not throw.
+
+Word readMemory( Context* context, Word offset ) noexcept {
+    context->cycles += context->memory->readWaitStates( offset );
+    return context->memory->read( offset );
+}
+
+void writeMemory( Context* context, Word offset, Word value ) noexcept {
+    context->cycles += context->memory->writeWaitStates( offset );
+    context->memory->write( offset, value );
+}
+
+// An instruction in a block, with the values of its next words.
+struct Step {
+    Word address;
+    const DecodedInstruction* ins;
+    Word nextA;
+    Word nextB;
+
+    // The address of the instruction that follows.
+    Word following;
+
+    // Where execution continues when a conditional instruction fails, and the
+    // cycles that skipping takes (including the cost of failing). If skipping
+    // stops at a malformed instruction, then the processor must raise the
+    // error itself.
+    Word skipTarget;
+    int skipCycles;
+    bool isSkipInterrupted;
+
+    inline isa::OperandClass classA() const { return isa::OPERANDS[ins->a].operandClass; }
+    inline isa::OperandClass classB() const { return isa::OPERANDS[ins->b].operandClass; }
+
+    // The value of PC observed by each operand.
+    inline Word pcA() const { return address + 1 + isa::OPERANDS[ins->a].size; }
+    inline Word pcB() const { return following; }
+
+    inline bool writesPc() const {
+        return ins->kind == InstructionKind::Unary ||
+            (! ins->isConditional && classB() == isa::OperandClass::Pc);
+    }
+
+    // Whether operand a evaluates to the same value every time.
+    inline bool isConstantA() const {
+        auto c = classA();
+        return c == isa::OperandClass::Direct || c == isa::OperandClass::Literal || c == isa::OperandClass::Pc;
+    }
+
+    inline Word constantA() const {
+        switch ( classA() ) {
+        case isa::OperandClass::Direct: return nextA;
+        case isa::OperandClass::Pc: return pcA();
+        default: return isa::OPERANDS[ins->a].value;
+        }
+    }
+};
+
+inline bool isMemory( isa::OperandClass c ) {
+    switch ( c ) {
+    case isa::OperandClass::RegisterIndirect:
+    case isa::OperandClass::RegisterIndirectOffset:
+    case isa::OperandClass::Stack:
+    case isa::OperandClass::Peek:
+    case isa::OperandClass::Pick:
+    case isa::OperandClass::Indirect:
+        return true;
+    default:
+        return false;
+    }
+}
+
+class BlockCompiler final {
+    Assembler& _as;
+    const std::uint8_t* _exit;
+    const std::uint8_t* _dispatch;
+
+    const std::vector<Step>& _steps;
+    std::vector<Label> _labels {};
+
+    // Code emitted after the body of the block, for paths that are rarely
+    // taken.
+    struct Tail {
+        Label label;
+        const Step* step;
+        bool isSkip;
+    };
+
+    std::vector<Tail> _tails {};
+
+    void callRead( Reg destination );
+    void callWrite();
+
+    void loadA( const Step& step );
+    void resolveB( const Step& step );
+    void loadB( const Step& step );
+    void storeB( const Step& step );
+
+    void compileBinary( const Step& step );
+    void compileJsr( const Step& step );
+
+    void checkStale( const Step& step );
+    void exitTo( Word address );
+    void jumpTo( Word address );
+
+    void compileTail( const Tail& tail );
+public:
+    explicit BlockCompiler( Assembler& as,
+                            const std::uint8_t* exit,
+                            const std::uint8_t* dispatch,
+                            const std::vector<Step>& steps ) :
+        _as( as ),
+        _exit { exit },
+        _dispatch { dispatch },
+        _steps( steps ) {}
+
+    void compile();
+};
+
+void BlockCompiler::callRead( Reg destination ) {
+    // The address is in ESI.
+    _as.mov64( Reg::Rdi, CONTEXT );
+    _as.mov64( Reg::Rax, reinterpret_cast<const void*>( &readMemory ) );
+    _as.call( Reg::Rax );
+    _as.movzx16( destination, Reg::Rax );
+}
+
+void BlockCompiler::callWrite() {
+    // The address is in ESI and the value is in EDX.
+    _as.mov64( Reg::Rdi, CONTEXT );
+    _as.mov64( Reg::Rax, reinterpret_cast<const void*>( &writeMemory ) );
+    _as.call( Reg::Rax );
+}
+
+// The value of operand a ends up in VALUE_A.
+void BlockCompiler::loadA( const Step& step ) {
+    auto code = step.ins->a;
+
+    switch ( step.classA() ) {
+    case isa::OperandClass::Register:
+        _as.movzx16( VALUE_A, registerField( code ) );
+        break;
+    case isa::OperandClass::RegisterIndirect:
+        _as.movzx16( Reg::Rsi, registerField( code ) );
+        callRead( VALUE_A );
+        break;
+    case isa::OperandClass::RegisterIndirectOffset:
+        _as.movzx16( Reg::Rsi, registerField( code ) );
+        _as.alu( AluOp::Add, Reg::Rsi, step.nextA );
+        _as.movzx16( Reg::Rsi, Reg::Rsi );
+        callRead( VALUE_A );
+        break;
+    case isa::OperandClass::Stack:
+        // Pop.
+        _as.movzx16( Reg::Rsi, SP );
+        _as.add16( SP, 1 );
+        callRead( VALUE_A );
+        break;
+    case isa::OperandClass::Peek:
+        _as.movzx16( Reg::Rsi, SP );
+        callRead( VALUE_A );
+        break;
+    case isa::OperandClass::Pick:
+        _as.movzx16( Reg::Rsi, SP );
+        _as.alu( AluOp::Add, Reg::Rsi, step.nextA );
+        _as.movzx16( Reg::Rsi, Reg::Rsi );
+        callRead( VALUE_A );
+        break;
+    case isa::OperandClass::Sp:
+        _as.movzx16( VALUE_A, SP );
+        break;
+    case isa::OperandClass::Ex:
+        _as.movzx16( VALUE_A, EX );
+        break;
+    case isa::OperandClass::Indirect:
+        _as.mov( Reg::Rsi, step.nextA );
+        callRead( VALUE_A );
+        break;
+    case isa::OperandClass::Pc:
+    case isa::OperandClass::Direct:
+    case isa::OperandClass::Literal:
+        _as.mov( VALUE_A, step.constantA() );
+        break;
+    }
+}
+
+// The address of operand b, if it's in memory, ends up in ADDRESS_B.
+void BlockCompiler::resolveB( const Step& step ) {
+    auto code = step.ins->b;
+
+    switch ( step.classB() ) {
+    case isa::OperandClass::RegisterIndirect:
+        _as.movzx16( ADDRESS_B, registerField( code ) );
+        break;
+    case isa::OperandClass::RegisterIndirectOffset:
+        _as.movzx16( ADDRESS_B, registerField( code ) );
+        _as.alu( AluOp::Add, ADDRESS_B, step.nextB );
+        _as.movzx16( ADDRESS_B, ADDRESS_B );
+        break;
+    case isa::OperandClass::Peek:
+        _as.movzx16( ADDRESS_B, SP );
+        break;
+    case isa::OperandClass::Pick:
+        _as.movzx16( ADDRESS_B, SP );
+        _as.alu( AluOp::Add, ADDRESS_B, step.nextB );
+        _as.movzx16( ADDRESS_B, ADDRESS_B );
+        break;
+    case isa::OperandClass::Indirect:
+        _as.mov( ADDRESS_B, step.nextB );
+        break;
+    default:
+        // Pushing happens when the operand is stored.
+        break;
+    }
+}
+
+// The value of operand b ends up in EAX.
+void BlockCompiler::loadB( const Step& step ) {
+    switch ( step.classB() ) {
+    case isa::OperandClass::Register:
+        _as.movzx16( Reg::Rax, registerField( step.ins->b ) );
+        break;
+    case isa::OperandClass::Stack:
+        // A 'push' address can't be loaded.
+        _as.mov( Reg::Rax, 0u );
+        break;
+    case isa::OperandClass::Sp:
+        _as.movzx16( Reg::Rax, SP );
+        break;
+    case isa::OperandClass::Ex:
+        _as.movzx16( Reg::Rax, EX );
+        break;
+    case isa::OperandClass::Pc:
+        _as.mov( Reg::Rax, step.pcB() );
+        break;
+    case isa::OperandClass::Direct:
+        _as.mov( Reg::Rax, step.nextB );
+        break;
+    case isa::OperandClass::Literal:
+        _as.mov( Reg::Rax, isa::OPERANDS[step.ins->b].value );
+        break;
+    default:
+        _as.mov( Reg::Rsi, ADDRESS_B );
+        callRead( Reg::Rax );
+        break;
+    }
+}
+
+// Store EAX to operand b.
+void BlockCompiler::storeB( const Step& step ) {
+    switch ( step.classB() ) {
+    case isa::OperandClass::Register:
+        _as.store16( registerField( step.ins->b ), Reg::Rax );
+        break;
+    case isa::OperandClass::Stack:
+        // Push.
+        _as.add16( SP, -1 );
+        _as.movzx16( Reg::Rsi, SP );
+        _as.movzx16( Reg::Rdx, Reg::Rax );
+        callWrite();
+        break;
+    case isa::OperandClass::Sp:
+        _as.store16( SP, Reg::Rax );
+        break;
+    case isa::OperandClass::Ex:
+        _as.store16( EX, Reg::Rax );
+        break;
+    case isa::OperandClass::Pc:
+        _as.store16( PC, Reg::Rax );
+        break;
+    case isa::OperandClass::Direct:
+    case isa::OperandClass::Literal:
+        // Storing to a literal has no effect.
+        break;
+    default:
+        _as.mov( Reg::Rsi, ADDRESS_B );
+        _as.movzx16( Reg::Rdx, Reg::Rax );
+        callWrite();
+        break;
+    }
+}
+
+void BlockCompiler::compileBinary( const Step& step ) {
+    auto opcode = step.ins->binaryOpcode();
+    bool isExFirst = false;
+    bool hasEx = false;
+
+    loadA( step );
+    resolveB( step );
+
+    switch ( opcode ) {
+    case Opcode::Set:
+    case Opcode::Sti:
+    case Opcode::Std:
+        break;
+    default:
+        loadB( step );
+        break;
+    }
+
+    // x is in EAX and y is in VALUE_A. The result goes in EAX and EX (if it's
+    // set) goes in EXCESS.
+
+    auto zero = _as.newLabel();
+    auto done = _as.newLabel();
+    bool usesZero = false;
+
+    switch ( opcode ) {
+    case Opcode::Set:
+    case Opcode::Sti:
+    case Opcode::Std:
+        _as.mov( Reg::Rax, VALUE_A );
+        break;
+    case Opcode::Add:
+    case Opcode::Sub:
+    case Opcode::Mul:
+        // The excess is the upper half of the double-word result.
+        if ( opcode == Opcode::Add ) {
+            _as.alu( AluOp::Add, Reg::Rax, VALUE_A );
+        } else if ( opcode == Opcode::Sub ) {
+            _as.alu( AluOp::Sub, Reg::Rax, VALUE_A );
+        } else {
+            _as.imul( Reg::Rax, VALUE_A );
+        }
+
+        _as.mov( EXCESS, Reg::Rax );
+        _as.shift( ShiftOp::Shr, EXCESS, 16 );
+        hasEx = true;
+        break;
+    case Opcode::Adx:
+    case Opcode::Sbx:
+        _as.alu( opcode == Opcode::Adx ? AluOp::Add : AluOp::Sub, Reg::Rax, VALUE_A );
+        _as.movzx16( Reg::Rcx, EX );
+        _as.alu( AluOp::Add, Reg::Rax, Reg::Rcx );
+        _as.alu( AluOp::Xor, EXCESS, EXCESS );
+        _as.alu( AluOp::Cmp, Reg::Rax, 0xffff );
+        _as.setcc( Condition::Above, EXCESS );
+        hasEx = true;
+        break;
+    case Opcode::Mli:
+        // The truncated product is the same whether it's signed or not.
+        _as.imul( Reg::Rax, VALUE_A );
+        break;
+    case Opcode::Div:
+        _as.test( VALUE_A, VALUE_A );
+        _as.jcc( Condition::Equal, zero );
+        _as.mov( Reg::Rcx, Reg::Rax );
+        _as.alu( AluOp::Xor, Reg::Rdx, Reg::Rdx );
+        _as.div( VALUE_A );
+        _as.mov( SCRATCH, Reg::Rax );
+        _as.mov( Reg::Rax, Reg::Rcx );
+        _as.shift( ShiftOp::Shl, Reg::Rax, 16 );
+        _as.alu( AluOp::Xor, Reg::Rdx, Reg::Rdx );
+        _as.div( VALUE_A );
+        _as.movzx16( EXCESS, Reg::Rax );
+        _as.mov( Reg::Rax, SCRATCH );
+        usesZero = true;
+        hasEx = isExFirst = true;
+        break;
+    case Opcode::Dvi:
+    case Opcode::Mdi:
+        _as.test( VALUE_A, VALUE_A );
+        _as.jcc( Condition::Equal, zero );
+        _as.movsx16( Reg::Rax, Reg::Rax );
+        _as.movsx16( Reg::Rcx, VALUE_A );
+        _as.cdq();
+        _as.idiv( Reg::Rcx );
+
+        if ( opcode == Opcode::Mdi ) {
+            _as.mov( Reg::Rax, Reg::Rdx );
+        }
+
+        usesZero = true;
+        break;
+    case Opcode::Mod:
+        _as.test( VALUE_A, VALUE_A );
+        _as.jcc( Condition::Equal, zero );
+        _as.alu( AluOp::Xor, Reg::Rdx, Reg::Rdx );
+        _as.div( VALUE_A );
+        _as.mov( Reg::Rax, Reg::Rdx );
+        usesZero = true;
+        break;
+    case Opcode::And:
+        _as.alu( AluOp::And, Reg::Rax, VALUE_A );
+        break;
+    case Opcode::Bor:
+        _as.alu( AluOp::Or, Reg::Rax, VALUE_A );
+        break;
+    case Opcode::Xor:
+        _as.alu( AluOp::Xor, Reg::Rax, VALUE_A );
+        break;
+    case Opcode::Shr:
+        // Shifting by the width of the operand or more clears it.
+        _as.alu( AluOp::Cmp, VALUE_A, 32 );
+        _as.jcc( Condition::AboveOrEqual, zero );
+        _as.mov( Reg::Rcx, VALUE_A );
+        _as.mov( Reg::Rdx, Reg::Rax );
+        _as.shiftCl( ShiftOp::Shr, Reg::Rax );
+        _as.shift( ShiftOp::Shl, Reg::Rdx, 16 );
+        _as.shiftCl( ShiftOp::Shr, Reg::Rdx );
+        _as.movzx16( EXCESS, Reg::Rdx );
+        usesZero = true;
+        hasEx = isExFirst = true;
+        break;
+    case Opcode::Shl:
+        _as.alu( AluOp::Cmp, VALUE_A, 32 );
+        _as.jcc( Condition::AboveOrEqual, zero );
+        _as.mov( Reg::Rcx, VALUE_A );
+        _as.shiftCl( ShiftOp::Shl, Reg::Rax );
+        _as.mov( EXCESS, Reg::Rax );
+        _as.shift( ShiftOp::Shr, EXCESS, 16 );
+        usesZero = true;
+        hasEx = isExFirst = true;
+        break;
+    case Opcode::Asr:
+        // b is zero-extended, and the shift is limited to 31.
+        _as.mov( Reg::Rcx, VALUE_A );
+        _as.mov( Reg::Rdx, 31u );
+        _as.alu( AluOp::Cmp, Reg::Rcx, 31 );
+        _as.cmovcc( Condition::Above, Reg::Rcx, Reg::Rdx );
+        _as.mov( Reg::Rdx, Reg::Rax );
+        _as.shiftCl( ShiftOp::Sar, Reg::Rax );
+        _as.shift( ShiftOp::Shl, Reg::Rdx, 16 );
+        _as.shiftCl( ShiftOp::Sar, Reg::Rdx );
+        _as.movzx16( EXCESS, Reg::Rdx );
+        hasEx = isExFirst = true;
+        break;
+    case Opcode::Ifb:
+    case Opcode::Ifc:
+    case Opcode::Ife:
+    case Opcode::Ifn:
+    case Opcode::Ifg:
+    case Opcode::Ifa:
+    case Opcode::Ifl:
+    case Opcode::Ifu: {
+        Condition failure;
+
+        switch ( opcode ) {
+        case Opcode::Ifb: failure = Condition::Equal; break;
+        case Opcode::Ifc: failure = Condition::NotEqual; break;
+        case Opcode::Ife: failure = Condition::NotEqual; break;
+        case Opcode::Ifn: failure = Condition::Equal; break;
+        case Opcode::Ifg: failure = Condition::BelowOrEqual; break;
+        case Opcode::Ifl: failure = Condition::AboveOrEqual; break;
+        case Opcode::Ifa: failure = Condition::LessOrEqual; break;
+        default: failure = Condition::GreaterOrEqual; break;
+        }
+
+        if ( opcode == Opcode::Ifb || opcode == Opcode::Ifc ) {
+            _as.test( Reg::Rax, VALUE_A );
+        } else if ( opcode == Opcode::Ifa || opcode == Opcode::Ifu ) {
+            _as.movsx16( Reg::Rax, Reg::Rax );
+            _as.movsx16( Reg::Rcx, VALUE_A );
+            _as.alu( AluOp::Cmp, Reg::Rax, Reg::Rcx );
+        } else {
+            _as.alu( AluOp::Cmp, Reg::Rax, VALUE_A );
+        }
+
+        auto skip = _as.newLabel();
+        _as.jcc( failure, skip );
+        _tails.push_back( Tail { skip, &step, true } );
+
+        // Nothing is stored.
+        return;
+    }
+    }
+
+    if ( usesZero ) {
+        _as.jmp( done );
+        _as.bind( zero );
+        _as.mov( Reg::Rax, 0u );
+
+        if ( hasEx ) {
+            _as.mov( EXCESS, 0u );
+        }
+
+        _as.bind( done );
+    }
+
+    if ( hasEx && isExFirst ) {
+        _as.store16( EX, EXCESS );
+    }
+
+    storeB( step );
+
+    if ( hasEx && ! isExFirst ) {
+        _as.store16( EX, EXCESS );
+    }
+
+    if ( opcode == Opcode::Sti || opcode == Opcode::Std ) {
+        std::int8_t delta = opcode == Opcode::Sti ? 1 : -1;
+        _as.add16( registerField( Register::I ), delta );
+        _as.add16( registerField( Register::J ), delta );
+    }
+
+    if ( step.writesPc() ) {
+        if ( opcode == Opcode::Set && step.isConstantA() ) {
+            exitTo( step.constantA() );
+        } else {
+            _as.jmp( _dispatch );
+        }
+    } else if ( isMemory( step.classB() ) ) {
+        checkStale( step );
+    }
+}
+
+void BlockCompiler::compileJsr( const Step& step ) {
+    loadA( step );
+
+    // Push the return address.
+    _as.add16( SP, -1 );
+    _as.movzx16( Reg::Rsi, SP );
+    _as.mov( Reg::Rdx, step.following );
+    callWrite();
+
+    _as.store16( PC, VALUE_A );
+
+    if ( step.isConstantA() ) {
+        _as.cmp8( IS_STALE, 0 );
+        _as.jcc( Condition::NotEqual, _exit );
+        exitTo( step.constantA() );
+    } else {
+        _as.jmp( _dispatch );
+    }
+}
+
+// Stop before the next instruction if a write has invalidated compiled code,
+// which might be this block.
+void BlockCompiler::checkStale( const Step& step ) {
+    auto stale = _as.newLabel();
+
+    _as.cmp8( IS_STALE, 0 );
+    _as.jcc( Condition::NotEqual, stale );
+    _tails.push_back( Tail { stale, &step, false } );
+}
+
+// Leave the block for the block at `address`. The jump is linked to that
+// block once it's been compiled.
+void BlockCompiler::exitTo( Word address ) {
+    auto unlinked = _as.newLabel();
+
+    _as.store16( PC, address );
+    auto link = _as.jmpPatchable( unlinked );
+
+    _as.bind( unlinked );
+    _as.mov64( Reg::Rax, static_cast<const void*>( link ) );
+    _as.store64( LINK, Reg::Rax );
+    _as.jmp( _exit );
+}
+
+// Continue at `address`, either within the block or by leaving it.
+void BlockCompiler::jumpTo( Word address ) {
+    for ( std::size_t i = 0; i < _steps.size(); ++i ) {
+        if ( _steps[i].address == address ) {
+            _as.jmp( _labels[i] );
+            return;
+        }
+    }
+
+    exitTo( address );
+}
+
+void BlockCompiler::compileTail( const Tail& tail ) {
+    const auto& step = *tail.step;
+
+    _as.bind( tail.label );
+
+    if ( ! tail.isSkip ) {
+        _as.store16( PC, step.following );
+        _as.jmp( _exit );
+        return;
+    }
+
+    _as.add64( CYCLES, step.skipCycles );
+
+    if ( step.isSkipInterrupted ) {
+        _as.store16( PC, step.skipTarget );
+        _as.store8( DO_SKIP, 1 );
+        _as.jmp( _exit );
+    } else {
+        jumpTo( step.skipTarget );
+    }
+}
+
+void BlockCompiler::compile() {
+    // Every block can be entered directly from another, so this is the
+    // opportunity to stop for the budget or for stale code.
+    _as.cmp8( IS_STALE, 0 );
+    _as.jcc( Condition::NotEqual, _exit );
+    _as.load64( Reg::Rax, CYCLES );
+    _as.cmp64( Reg::Rax, BUDGET );
+    _as.jcc( Condition::GreaterOrEqual, _exit );
+
+    for ( std::size_t i = 0; i < _steps.size(); ++i ) {
+        _labels.push_back( _as.newLabel() );
+    }
+
+    for ( std::size_t i = 0; i < _steps.size(); ++i ) {
+        const auto& step = _steps[i];
+
+        _as.bind( _labels[i] );
+        _as.add64( CYCLES, step.ins->cycles );
+
+        if ( step.ins->kind == InstructionKind::Binary ) {
+            compileBinary( step );
+        } else {
+            compileJsr( step );
+        }
+    }
+
+    const auto& last = _steps.back();
+
+    if ( ! last.writesPc() ) {
+        exitTo( last.following );
+    }
+
+    // Compiling tails can't add more tails.
+    for ( const auto& tail : _tails ) {
+        compileTail( tail );
+    }
+}
+
+}
+
+}
+
+bool Jit::isSupported() noexcept {
+#if defined( NEBULA_JIT_SUPPORTED )
+    return true;
+#else
+    return false;
+#endif
+}
+
+Jit::Jit( std::shared_ptr<Memory> memory ) :
+    _memory { memory },
+    _entries( 0x10000, nullptr ),
+    _blockIndex( 0x10000, 0 ),
+    _pageBlocks( jit::NUM_PAGES ),
+    _isUncompilable( 0x10000, false ),
+    _isCompiled { new std::atomic<bool>[0x10000] },
+    _isPageDirty { new std::atomic<bool>[jit::NUM_PAGES] },
+    _pageInvalidations( jit::NUM_PAGES, 0 ) {
+    if ( ! isSupported() ) {
+        throw error::JitUnavailable { "unsupported host" };
+    }
+
+#if defined( NEBULA_JIT_SUPPORTED )
+    void* code = mmap( nullptr,
+                       jit::CODE_SIZE,
+                       PROT_READ | PROT_WRITE | PROT_EXEC,
+                       MAP_PRIVATE | MAP_ANONYMOUS,
+                       -1,
+                       0 );
+
+    if ( code == MAP_FAILED ) {
+        throw error::JitUnavailable { "unable to allocate executable memory" };
+    }
+
+    _code = static_cast<std::uint8_t*>( code );
+    _codeEnd = _code + jit::CODE_SIZE;
+#endif
+
+    for ( std::size_t i = 0; i < 0x10000; ++i ) {
+        _isCompiled[i].store( false );
+    }
+
+    for ( std::size_t i = 0; i < jit::NUM_PAGES; ++i ) {
+        _isPageDirty[i].store( false );
+    }
+
+    _context.isStale.store( 0 );
+    _context.doSkip = 0;
+    _context.cycles = 0;
+    _context.budget = 0;
+    _context.memory = _memory.get();
+    _context.entries = _entries.data();
+    _context.link = nullptr;
+
+    assembleRuntime();
+    _memory->setObserver( this );
+}
+
+Jit::~Jit() {
+    _memory->setObserver( nullptr );
+
+#if defined( NEBULA_JIT_SUPPORTED )
+    munmap( _code, jit::CODE_SIZE );
+#endif
+}
+
+// The code shared by all blocks, at the start of the code buffer.
+void Jit::assembleRuntime() {
+    using x86::Condition;
+    using x86::Reg;
+
+    x86::Assembler as { _code };
+
+    static const Reg SAVED[] = { Reg::Rbp, Reg::Rbx, Reg::R12, Reg::R13, Reg::R14, Reg::R15 };
+
+    // enter( context, block ): Save the callee-saved registers and jump to
+    // the block. The extra push keeps the stack 16-byte aligned for calls.
+    for ( auto reg : SAVED ) {
+        as.push( reg );
+    }
+
+    as.push( Reg::Rax );
+    as.mov64( jit::CONTEXT, Reg::Rdi );
+    as.jmp( Reg::Rsi );
+
+    // Every exit from compiled code goes through here.
+    _exit = as.here();
+    as.pop( Reg::Rax );
+
+    for ( auto it = std::end( SAVED ); it != std::begin( SAVED ); ) {
+        as.pop( *--it );
+    }
+
+    as.ret();
+
+    // Continue at the block at PC, if it's compiled.
+    _dispatch = as.here();
+    as.cmp8( jit::IS_STALE, 0 );
+    as.jcc( Condition::NotEqual, _exit );
+    as.movzx16( Reg::Rax, jit::PC );
+    as.load64( Reg::Rcx, jit::ENTRIES );
+    as.load64( Reg::Rax, Reg::Rcx, Reg::Rax );
+    as.test64( Reg::Rax, Reg::Rax );
+    as.jcc( Condition::Equal, _exit );
+    as.jmp( Reg::Rax );
+
+    as.copyTo( _code );
+
+    _enter = reinterpret_cast<Enter>( _code );
+    _runtimeEnd = _code + as.size();
+    _free = _runtimeEnd;
+}
+
+// Discard all compiled code.
+void Jit::flush() {
+    std::fill( _entries.begin(), _entries.end(), nullptr );
+    std::fill( _isUncompilable.begin(), _isUncompilable.end(), false );
+
+    for ( std::size_t i = 0; i < 0x10000; ++i ) {
+        _isCompiled[i].store( false, std::memory_order_relaxed );
+    }
+
+    for ( std::size_t i = 0; i < jit::NUM_PAGES; ++i ) {
+        _isPageDirty[i].store( false );
+        _pageBlocks[i].clear();
+    }
+
+    _blocks.clear();
+    _context.isStale.store( 0 );
+    _free = _runtimeEnd;
+    ++_generation;
+}
+
+// Discard the blocks that read pages which have since been written.
+void Jit::invalidate() {
+    // This happens first so that no write is missed.
+    _context.isStale.store( 0 );
+
+    for ( std::size_t page = 0; page < jit::NUM_PAGES; ++page ) {
+        if ( _isPageDirty[page].exchange( false ) ) {
+            invalidatePage( page );
+        }
+    }
+}
+
+void Jit::invalidatePage( std::size_t page ) {
+    for ( auto index : _pageBlocks[page] ) {
+        discard( _blocks[index] );
+    }
+
+    _pageBlocks[page].clear();
+
+    // Every block that read the page is gone.
+    for ( std::size_t address = page * jit::PAGE_SIZE; address < (page + 1) * jit::PAGE_SIZE; ++address ) {
+        _isCompiled[address].store( false, std::memory_order_relaxed );
+        _isUncompilable[address] = false;
+    }
+
+    if ( ++_pageInvalidations[page] == jit::MAX_PAGE_INVALIDATIONS ) {
+        LOG( JIT, info ) << format( "No longer compiling page 0x%04x, which is modified too often." )
+            % (page * jit::PAGE_SIZE);
+    }
+}
+
+void Jit::discard( Block& block ) {
+    if ( ! block.isLive ) {
+        return;
+    }
+
+    block.isLive = false;
+    _entries[block.address] = nullptr;
+
+    // Restore the jumps linked to the block to their original exits.
+    for ( auto link : block.links ) {
+        x86::patchJump( link, link + 4 );
+    }
+
+    block.words.clear();
+    block.links.clear();
+}
+
+Word Jit::readCode( Word address, std::vector<Word>& words ) {
+    // This happens first so that no write is missed.
+    _isCompiled[address].store( true, std::memory_order_relaxed );
+    words.push_back( address );
+    return _memory->read( address );
+}
+
+void* Jit::blockAt( Word address ) {
+    if ( _entries[address] ) {
+        return _entries[address];
+    }
+
+    if ( _isUncompilable[address] ) {
+        return nullptr;
+    }
+
+    auto block = compile( address );
+
+    if ( ! block ) {
+        _isUncompilable[address] = true;
+    }
+
+    return block;
+}
+
+void* Jit::compile( Word address ) {
+    if ( static_cast<std::size_t>( _codeEnd - _free ) < jit::MAX_BLOCK_CODE_SIZE ) {
+        LOG( JIT, info ) << "The code buffer is full. Discarding compiled code.";
+        flush();
+    }
+
+    std::vector<jit::Step> steps {};
+    std::vector<Word> words {};
+    Word pc = address;
+
+    for ( int n = 0; n < jit::MAX_BLOCK_INSTRUCTIONS; ++n ) {
+        auto mark = words.size();
+        auto word = readCode( pc, words );
+        const auto& ins = decodeCached( word );
+
+        if ( ins.kind == InstructionKind::Malformed ||
+             (ins.kind == InstructionKind::Unary && ins.specialOpcode() != SpecialOpcode::Jsr) ) {
+            break;
+        }
+
+        jit::Step step { pc, &ins, 0, 0, 0, 0, 0, false };
+
+        Word cursor = pc + 1;
+
+        if ( isa::OPERANDS[ins.a].size != 0 ) {
+            step.nextA = readCode( cursor++, words );
+        }
+
+        if ( ins.kind == InstructionKind::Binary && isa::OPERANDS[ins.b].size != 0 ) {
+            step.nextB = readCode( cursor++, words );
+        }
+
+        step.following = cursor;
+
+        if ( ins.isConditional ) {
+            // Work out where skipping stops. Only the instruction words of the
+            // skipped instructions matter.
+            Word target = step.following;
+            int cycles = 1;
+            bool isFinished = false;
+
+            for ( int i = 0; i < jit::MAX_BLOCK_INSTRUCTIONS; ++i ) {
+                const auto& skipped = decodeCached( readCode( target, words ) );
+
+                if ( skipped.kind == InstructionKind::Malformed ) {
+                    step.isSkipInterrupted = true;
+                    isFinished = true;
+                    break;
+                }
+
+                cycles += skipped.isConditional ? 2 : 1;
+                target += 1 + skipped.size;
+
+                if ( ! skipped.isConditional ) {
+                    isFinished = true;
+                    break;
+                }
+            }
+
+            // The processor will skip this (unusually long) chain itself.
+            if ( ! isFinished ) {
+                break;
+            }
+
+            step.skipTarget = target;
+            step.skipCycles = cycles;
+        }
+
+        // Code that keeps being modified is left to the processor.
+        if ( std::any_of( words.begin() + mark, words.end(), [this]( Word w ) { return isHot( w ); } ) ) {
+            words.resize( mark );
+            break;
+        }
+
+        steps.push_back( step );
+        pc = step.following;
+
+        if ( step.writesPc() ) {
+            break;
+        }
+    }
+
+    if ( steps.empty() ) {
+        return nullptr;
+    }
+
+    x86::Assembler as { _free };
+    jit::BlockCompiler compiler { as, _exit, _dispatch, steps };
+    compiler.compile();
+
+    assert( as.size() <= jit::MAX_BLOCK_CODE_SIZE );
+    as.copyTo( _free );
+
+    void* entry = _free;
+    _entries[address] = entry;
+    _blockIndex[address] = _blocks.size();
+
+    std::vector<bool> isPageRead( jit::NUM_PAGES, false );
+
+    for ( auto w : words ) {
+        auto page = w / jit::PAGE_SIZE;
+
+        if ( ! isPageRead[page] ) {
+            isPageRead[page] = true;
+            _pageBlocks[page].push_back( _blocks.size() );
+        }
+    }
+
+    _blocks.push_back( Block { address, true, std::move( words ), {} } );
+
+    // Keep blocks aligned.
+    _free += (as.size() + 15) & ~std::size_t { 15 };
+
+    return entry;
+}
+
+bool Jit::execute( ProcessorState& proc, int cycleBudget ) {
+    if ( proc.doSkip ) {
+        return false;
+    }
+
+    for ( int i = 0; i < 8; ++i ) {
+        _context.registers[i] = proc.read( static_cast<Register>( i ) );
+    }
+
+    _context.pc = proc.read( Special::Pc );
+    _context.sp = proc.read( Special::Sp );
+    _context.ex = proc.read( Special::Ex );
+    _context.doSkip = 0;
+    _context.cycles = 0;
+    _context.budget = cycleBudget;
+
+    bool isExhausted = false;
+
+    while ( true ) {
+        if ( _context.isStale.load() ) {
+            invalidate();
+        }
+
+        if ( _context.cycles >= _context.budget ) {
+            isExhausted = true;
+            break;
+        }
+
+        auto block = blockAt( _context.pc );
+
+        if ( ! block ) {
+            break;
+        }
+
+        _context.link = nullptr;
+        _enter( &_context, block );
+
+        if ( _context.doSkip ) {
+            break;
+        }
+
+        if ( _context.link && ! _context.isStale.load() ) {
+            auto generation = _generation;
+            auto target = blockAt( _context.pc );
+
+            // Compiling the target may have discarded the block that jumped.
+            if ( target && generation == _generation ) {
+                x86::patchJump( _context.link, target );
+                _blocks[_blockIndex[_context.pc]].links.push_back( _context.link );
+            }
+        }
+    }
+
+    for ( int i = 0; i < 8; ++i ) {
+        proc.write( static_cast<Register>( i ), _context.registers[i] );
+    }
+
+    proc.write( Special::Pc, _context.pc );
+    proc.write( Special::Sp, _context.sp );
+    proc.write( Special::Ex, _context.ex );
+    proc.doSkip = _context.doSkip != 0;
+    proc.tickClock( static_cast<int>( _context.cycles ) );
+
+    return isExhausted;
+}
+
+void Jit::written( Word offset ) noexcept {
+    if ( _isCompiled[offset].load( std::memory_order_relaxed ) ) {
+        _isPageDirty[offset / jit::PAGE_SIZE].store( true );
+        _context.isStale.store( 1 );
+    }
+}
+
+}
@@ -0,0 +1,192 @@
+// Jit.hpp
+//
+// Copyright 2013 Jesse Haber-Kucharsky
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "Memory.hpp"
+#include "ProcessorState.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+namespace nebula {
+
+namespace error {
+
+class JitUnavailable : public std::runtime_error {
+public:
+    explicit JitUnavailable( const std::string& reason ) :
+        std::runtime_error {
+            (format( "The compiler is unavailable: %s" ) % reason).str()
+        } {}
+};
+
+}
+
+namespace jit {
+
+const std::size_t CODE_SIZE = 16 * 1024 * 1024;
+
+// Blocks end after this many instructions, even if control would continue
+// to flow straight through.
+const int MAX_BLOCK_INSTRUCTIONS = 32;
+
+// Compiled code is invalidated by pages of memory.
+const std::size_t PAGE_SIZE = 0x100;
+const std::size_t NUM_PAGES = 0x10000 / PAGE_SIZE;
+
+// Pages that are invalidated this many times are no longer compiled, so that
+// code that modifies itself continually is interpreted instead.
+const int MAX_PAGE_INVALIDATIONS = 64;
+
+// The state that compiled code operates on. Compiled code addresses the
+// fields by their offsets, so the layout must stay standard.
+struct Context {
+    Word registers[8];
+    Word pc;
+    Word sp;
+    Word ex;
+
+    // Set when memory that has been compiled is written.
+    std::atomic<std::uint8_t> isStale;
+
+    // Set when compiled code stops in the middle of skipping instructions.
+    std::uint8_t doSkip;
+
+    // Cycles elapsed since entering compiled code. Compiled code stops at the
+    // next block once this reaches the budget.
+    std::int64_t cycles;
+    std::int64_t budget;
+
+    Memory* memory;
+
+    // The entry point of the block starting at each address, or `nullptr`.
+    void* const* entries;
+
+    // When compiled code exits through a jump to a block that isn't compiled,
+    // this is the jump's rel32 field so that it can be linked to the block.
+    std::uint8_t* link;
+};
+
+}
+
+// Translates DCPU-16 code to native x86-64 code one basic block at a time.
+//
+// Blocks are discovered starting at the processor's PC and are compiled on
+// first execution. Jumps to fixed addresses are linked directly to the
+// target block, and other jumps are dispatched through a table indexed by
+// address without returning to the compiler.
+//
+// Operand values encoded in next words become constants in the compiled
+// code, so the compiler observes writes to memory. A write to a location that
+// was read to compile a block stops compiled code after the current
+// instruction, and then every block that read the same page is discarded.
+//
+// Special instructions other than JSR aren't compiled, because they require
+// the parent simulation (see `Processor`).
+class Jit final : public MemoryObserver {
+    std::shared_ptr<Memory> _memory;
+    jit::Context _context;
+
+    std::uint8_t* _code { nullptr };
+    std::uint8_t* _codeEnd { nullptr };
+    std::uint8_t* _runtimeEnd { nullptr };
+    std::uint8_t* _free { nullptr };
+
+    std::vector<void*> _entries;
+
+    struct Block {
+        Word address;
+        bool isLive;
+
+        // The memory locations that were read to compile the block.
+        std::vector<Word> words;
+
+        // The rel32 fields of jumps that have been linked to the block.
+        std::vector<std::uint8_t*> links;
+    };
+
+    std::vector<Block> _blocks {};
+
+    // The block starting at each address, as an index into `_blocks`. This
+    // is only meaningful where there is an entry.
+    std::vector<std::size_t> _blockIndex;
+
+    // The blocks that read each page of memory.
+    std::vector<std::vector<std::size_t>> _pageBlocks;
+
+    // Addresses where no block can start, because the instruction there can't
+    // be compiled.
+    std::vector<bool> _isUncompilable;
+
+    // Whether each memory location has been read to compile a block.
+    std::unique_ptr<std::atomic<bool>[]> _isCompiled;
+
+    // Whether a location in each page that has been read to compile a block
+    // has since been written.
+    std::unique_ptr<std::atomic<bool>[]> _isPageDirty;
+
+    std::vector<int> _pageInvalidations;
+
+    // Incremented every time all compiled code is discarded.
+    std::size_t _generation { 0 };
+
+    using Enter = void (*)( jit::Context* context, const void* block );
+
+    Enter _enter { nullptr };
+    const std::uint8_t* _exit { nullptr };
+    const std::uint8_t* _dispatch { nullptr };
+
+    void assembleRuntime();
+    void flush();
+    void invalidate();
+    void invalidatePage( std::size_t page );
+    void discard( Block& block );
+
+    inline bool isHot( Word address ) const {
+        return _pageInvalidations[address / jit::PAGE_SIZE] >= jit::MAX_PAGE_INVALIDATIONS;
+    }
+
+    Word readCode( Word address, std::vector<Word>& words );
+    void* blockAt( Word address );
+    void* compile( Word address );
+public:
+    // Whether the compiler supports the host platform.
+    static bool isSupported() noexcept;
+
+    explicit Jit( std::shared_ptr<Memory> memory );
+
+    Jit( const Jit& ) = delete;
+    Jit& operator=( const Jit& ) = delete;
+
+    virtual ~Jit();
+
+    // Execute compiled code until at least `cycleBudget` cycles have elapsed
+    // (ticked on the processor's clock), or until the next instruction can't
+    // be compiled.
+    //
+    // Returns `false` in the second case, when the processor must execute the
+    // next instruction itself.
+    bool execute( ProcessorState& proc, int cycleBudget );
+
+    virtual void written( Word offset ) noexcept override;
+};
+
+}
@@ -16,14 +16,21 @@
 
 #include "Computer.hpp"
 #include "Sdl.hpp"
+#include "Snapshot.hpp"
 #include "Simulation/Clock.hpp"
 #include "Simulation/FloppyDrive.hpp"
 #include "Simulation/Keyboard.hpp"
 #include "Simulation/Processor.hpp"
 #include "Simulation/Monitor.hpp"
+#include "Simulation/Scheduler.hpp"
 
 #include <cstddef>
+#include <cstdio>
+#include <functional>
 #include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include <boost/program_options.hpp>
 
@@ -31,6 +38,32 @@ using namespace nebula;
 
 DEFINE_LOGGER( MAIN, "Main" )
 
+namespace {
+
+struct WaitStateRange {
+    int begin;
+    int end;
+    WaitStates waitStates;
+};
+
+optional<WaitStateRange> parseWaitStates( const std::string& spec ) {
+    unsigned begin, end, read, write;
+    char trailing;
+
+    if ( std::sscanf( spec.c_str(), "%x-%x:%u:%u%c", &begin, &end, &read, &write, &trailing ) != 4 ||
+         begin > end || end > 0x10000 || read > 0xff || write > 0xff ) {
+        return {};
+    }
+
+    return WaitStateRange {
+        static_cast<int>( begin ),
+        static_cast<int>( end ),
+        WaitStates { static_cast<std::uint8_t>( read ), static_cast<std::uint8_t>( write ) }
+    };
+}
+
+}
+
 int main( int argc, char* argv[] ) {
     namespace po = boost::program_options;
 
@@ -41,6 +74,31 @@ int main( int argc, char* argv[] ) {
         ( "verbose,v", "Output verbose logging information to the console." )
         ( "floppy,f", "Insert a floppy disk into the drive before the simulation starts." )
         ( "dump,d", po::value<std::string>(), "Dump the state of memory at the conclusion of execution to the named file." )
+        ( "save-snapshot,s", po::value<std::string>(),
+          "Save the state of the whole machine at the conclusion of execution to the named file." )
+        ( "snapshot-interval", po::value<double>(),
+          "Also save the snapshot every this many seconds while the machine keeps running." )
+        ( "restore-snapshot,r", po::value<std::string>(),
+          "Resume the machine from a snapshot saved by --save-snapshot, instead of loading a memory file." )
+        ( "record-inputs", po::value<std::string>(),
+          "Record everything that the processor observes from devices to the named file, so that the run can be replayed." )
+        ( "replay-inputs", po::value<std::string>(),
+          "Replay a run recorded by --record-inputs, as quickly as possible. The machine must start the same way as the recording did." )
+        ( "execution,x", po::value<std::string>()->default_value( "interpreted" ),
+          "How the processor executes instructions: \"interpreted\", \"threaded\" or \"compiled\"." )
+        ( "fuse,u", "Execute common sequences of instructions as single operations when interpreting." )
+        ( "native-image,n", po::value<std::string>(),
+          "Execute code translated ahead of time by nebula-translate from the named shared object." )
+        ( "clock-hz", po::value<std::uint64_t>()->default_value( pacing::DEFAULT_CLOCK_HZ ),
+          "The clock rate of the processor, in Hz." )
+        ( "spin-limit", po::value<double>()->default_value( pacing::DEFAULT_SPIN_LIMIT ),
+          "The largest fraction of the time the processor may busy-wait to keep its clock rate precise, between 0 and 1." )
+        ( "speed", po::value<double>()->default_value( 1.0 ),
+          "Run the simulation at this multiple of real time. The timing of devices is scaled to match." )
+        ( "unthrottled", "Run the processor as quickly as possible. Devices follow the time simulated by the processor." )
+        ( "scheduled", "Run the processor and devices together on a single thread, in an order that only depends on simulated time. Instructions are interpreted." )
+        ( "wait-states", po::value<std::vector<std::string>>()->composing(),
+          "Extra cycles taken by the processor to read and write data in a range of memory, as \"BEGIN-END:READ:WRITE\" with the addresses in hexadecimal and END excluded. May be given more than once." )
         ;
 
     po::options_description hidden;
@@ -66,16 +124,87 @@ int main( int argc, char* argv[] ) {
         return EXIT_FAILURE;
     }
 
-    if ( vm.count( "help" ) || ! vm.count( "memory-file" ) ) {
+    if ( vm.count( "help" ) || ! (vm.count( "memory-file" ) || vm.count( "restore-snapshot" )) ) {
         std::cout << "This is Nebula, the DCPU-16 emulator." << std::endl;
         std::cout << "Copyright 2013 Jesse Haber-Kucharsky" << std::endl;
         std::cout << std::endl;
         std::cout << "Usage: nebula [OPTIONS] memory-file" << std::endl;
+        std::cout << "       nebula [OPTIONS] --restore-snapshot FILE" << std::endl;
         std::cout << std::endl;
         std::cout << visible << std::endl;
         return EXIT_SUCCESS;
     }
 
+    ExecutionMode executionMode;
+    auto execution = vm["execution"].as<std::string>();
+
+    if ( execution == "interpreted" ) {
+        executionMode = ExecutionMode::Interpreted;
+    } else if ( execution == "threaded" ) {
+        executionMode = ExecutionMode::Threaded;
+    } else if ( execution == "compiled" ) {
+        executionMode = ExecutionMode::Compiled;
+    } else {
+        std::cerr << "nebula: Unknown execution mode \"" << execution << "\"" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    auto clockHz = vm["clock-hz"].as<std::uint64_t>();
+    auto spinLimit = vm["spin-limit"].as<double>();
+
+    if ( clockHz == 0 ) {
+        std::cerr << "nebula: The clock rate must be positive." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if ( spinLimit < 0.0 || spinLimit > 1.0 ) {
+        std::cerr << "nebula: The spin limit must be between 0 and 1." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if ( vm.count( "record-inputs" ) && vm.count( "replay-inputs" ) ) {
+        std::cerr << "nebula: Inputs can't be recorded and replayed at the same time." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    auto speed = timing::UNTHROTTLED;
+
+    // Nothing that is replayed depends on real time.
+    if ( ! vm.count( "unthrottled" ) && ! vm.count( "replay-inputs" ) ) {
+        speed = vm["speed"].as<double>();
+
+        if ( speed <= 0.0 ) {
+            std::cerr << "nebula: The speed must be positive." << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    optional<std::chrono::duration<double>> snapshotInterval {};
+
+    if ( vm.count( "snapshot-interval" ) ) {
+        snapshotInterval = std::chrono::duration<double> { vm["snapshot-interval"].as<double>() };
+
+        if ( snapshotInterval->count() <= 0.0 || ! vm.count( "save-snapshot" ) ) {
+            std::cerr << "nebula: The snapshot interval must be positive, and requires --save-snapshot." << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    std::vector<WaitStateRange> waitStates {};
+
+    if ( vm.count( "wait-states" ) ) {
+        for ( const auto& spec : vm["wait-states"].as<std::vector<std::string>>() ) {
+            auto range = parseWaitStates( spec );
+
+            if ( ! range ) {
+                std::cerr << "nebula: Invalid wait states \"" << spec << "\"" << std::endl;
+                return EXIT_FAILURE;
+            }
+
+            waitStates.push_back( *range );
+        }
+    }
+
     logging::initialize( vm.count( "verbose" ) != 0,
                          logging::Severity::info );
 
@@ -84,10 +213,60 @@ int main( int argc, char* argv[] ) {
 
     auto byteOrder = vm.count( "little-endian" ) ? ByteOrder::LittleEndian : ByteOrder::BigEndian;
 
-    auto memory = Memory::fromFile( vm["memory-file"].as<std::string>(),
-                                    0x10000,
-                                    byteOrder );
-    Computer computer { memory };
+    optional<SnapshotReader> snapshot {};
+    std::shared_ptr<Memory> memory { nullptr };
+
+    try {
+        if ( vm.count( "restore-snapshot" ) ) {
+            snapshot = SnapshotReader::fromFile( vm["restore-snapshot"].as<std::string>() );
+            memory = std::make_shared<Memory>();
+        } else {
+            memory = Memory::fromFile( vm["memory-file"].as<std::string>(), byteOrder );
+        }
+    } catch ( std::runtime_error& err ) {
+        std::cerr << "nebula: " << err.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    for ( const auto& range : waitStates ) {
+        memory->setWaitStates( range.begin, range.end, range.waitStates );
+    }
+
+    Computer computer { memory, clockHz, speed };
+
+    // Memory is restored with the computer, so that a native image is
+    // checked against it.
+    try {
+        if ( snapshot ) {
+            computer.restore( *snapshot );
+        }
+    } catch ( error::BadSnapshot& err ) {
+        std::cerr << "nebula: " << err.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    try {
+        if ( vm.count( "record-inputs" ) ) {
+            computer.inputs().startRecording( executionMode, vm.count( "fuse" ) != 0 );
+        } else if ( vm.count( "replay-inputs" ) ) {
+            computer.inputs().startReplayingFile( vm["replay-inputs"].as<std::string>() );
+            computer.inputs().checkExecution( executionMode, vm.count( "fuse" ) != 0 );
+        }
+    } catch ( std::runtime_error& err ) {
+        std::cerr << "nebula: " << err.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::shared_ptr<NativeImage> nativeImage { nullptr };
+
+    if ( vm.count( "native-image" ) ) {
+        try {
+            nativeImage = std::make_shared<NativeImage>( memory, vm["native-image"].as<std::string>() );
+        } catch ( error::BadNativeImage& err ) {
+            std::cerr << "nebula: " << err.what() << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
 
     Clock clock { computer };
     Monitor monitor { computer };
@@ -98,28 +277,56 @@ int main( int argc, char* argv[] ) {
         floppy.insertDisk( false );
     }
 
-    Processor proc { computer };
-
-    auto procStateF = sim::launch( proc );
-    LOG( MAIN, info ) << "Launched the processor!";
-
-    auto clockStateF = sim::launch( clock );
-    LOG( MAIN, info ) << "Launched the clock!";
+    Processor proc { computer, executionMode, nativeImage };
+    proc.setFusing( vm.count( "fuse" ) != 0 );
+    proc.setSpinLimit( spinLimit );
+
+    // Captured while the machine runs, in the same order as they're saved
+    // below.
+    auto& snapshots = computer.snapshots();
+    snapshots.add( [&computer] { return computer.capture(); } );
+    snapshots.add( [&proc] { return proc.state().capture(); } );
+    snapshots.add( [&clock] { return clock.capture(); } );
+    snapshots.add( [&monitor] { return monitor.capture(); } );
+    snapshots.add( [&keyboard] { return keyboard.capture(); } );
+    snapshots.add( [&floppy] { return floppy.capture(); } );
+
+    Scheduler scheduler { computer.timing() };
+    bool isScheduled = vm.count( "scheduled" ) != 0;
+
+    // Devices start on the scheduler when they're restored.
+    if ( isScheduled ) {
+        clock.schedule( scheduler );
+        monitor.schedule( scheduler );
+        keyboard.schedule( scheduler );
+        floppy.schedule( scheduler );
+    }
 
-    auto monitorStateF = sim::launch( monitor );
-    LOG( MAIN, info ) << "Launched the monitor!";
+    // In the same order as they're saved.
+    try {
+        if ( snapshot ) {
+            proc.state().restore( *snapshot );
+            clock.restore( *snapshot );
+            monitor.restore( *snapshot );
+            keyboard.restore( *snapshot );
+            floppy.restore( *snapshot );
+
+            LOG( MAIN, info ) << "Restored the snapshot.";
+        }
+    } catch ( error::BadSnapshot& err ) {
+        std::cerr << "nebula: " << err.what() << std::endl;
+        return EXIT_FAILURE;
+    }
 
-    auto keyboardStateF = sim::launch( keyboard );
-    LOG( MAIN, info ) << "Launched the keyboard!";
+    auto lastSnapshot = std::chrono::steady_clock::now();
 
-    auto floppyStateF = sim::launch( floppy );
-    LOG( MAIN, info ) << "Launched the floppy drive!";
+    // Returns false once the window has been closed.
+    auto pollHost = [&] {
+        SDL_Event event;
 
-    SDL_Event event;
-    while ( true ) {
         if ( SDL_PollEvent( &event ) ) {
             if ( event.type == SDL_QUIT ) {
-                break;
+                return false;
             } else if ( event.type == SDL_KEYDOWN ) {
                 switch ( event.key.keysym.sym ) {
                 case SDLK_F10:
@@ -139,33 +346,94 @@ int main( int argc, char* argv[] ) {
             }
         }
 
-        if ( sim::isReady( procStateF ) ) {
-            break;
+        if ( snapshotInterval && std::chrono::steady_clock::now() - lastSnapshot >= *snapshotInterval ) {
+            snapshots.request( vm["save-snapshot"].as<std::string>() );
+            lastSnapshot = std::chrono::steady_clock::now();
+        }
+
+        return true;
+    };
+
+    std::unique_ptr<ProcessorState> state { nullptr };
+
+    if ( isScheduled ) {
+        std::function<void ()> pollHostEvent = [&] {
+            if ( pollHost() ) {
+                scheduler.after( std::chrono::milliseconds { 10 }, pollHostEvent );
+            } else {
+                proc.stop();
+            }
+        };
+
+        scheduler.after( std::chrono::milliseconds { 10 }, pollHostEvent );
+
+        LOG( MAIN, info ) << "Running on the scheduler!";
+        state = proc.runScheduled( scheduler );
+
+        if ( vm.count( "dump" ) ) {
+            Memory::dumpToFile( vm["dump"].as<std::string>(), memory, byteOrder );
         }
+    } else {
+        auto procStateF = sim::launch( proc );
+        LOG( MAIN, info ) << "Launched the processor!";
+
+        auto clockStateF = sim::launch( clock );
+        LOG( MAIN, info ) << "Launched the clock!";
 
-        std::this_thread::sleep_for( std::chrono::milliseconds { 10 } );
+        auto monitorStateF = sim::launch( monitor );
+        LOG( MAIN, info ) << "Launched the monitor!";
+
+        auto keyboardStateF = sim::launch( keyboard );
+        LOG( MAIN, info ) << "Launched the keyboard!";
+
+        auto floppyStateF = sim::launch( floppy );
+        LOG( MAIN, info ) << "Launched the floppy drive!";
+
+        while ( pollHost() && ! sim::isReady( procStateF ) ) {
+            std::this_thread::sleep_for( std::chrono::milliseconds { 10 } );
+        }
+
+        proc.stop();
+        floppy.stop();
+        clock.stop();
+        monitor.stop();
+        keyboard.stop();
+
+        if ( vm.count( "dump" ) ) {
+            Memory::dumpToFile( vm["dump"].as<std::string>(), memory, byteOrder );
+        }
+
+        // It is important to get this processor state first, in case it
+        // has thrown an exception. If it has, then getting the state of
+        // any of the peripherals can be stalled while waiting for a
+        // response from the non-running processor and the program itself
+        // will be unresponsive.
+        state = procStateF.get();
+        clockStateF.get();
+        monitorStateF.get();
+        keyboardStateF.get();
+        floppyStateF.get();
     }
 
-    proc.stop();
-    floppy.stop();
-    clock.stop();
-    monitor.stop();
-    keyboard.stop();
+    if ( vm.count( "save-snapshot" ) ) {
+        // Live snapshots are written first, so that this one is last.
+        snapshots.wait();
+
+        SnapshotWriter writer {};
 
-    if ( vm.count( "dump" ) ) {
-        Memory::dumpToFile( vm["dump"].as<std::string>(), memory, byteOrder );
+        computer.save( writer );
+        state->save( writer );
+        clock.save( writer );
+        monitor.save( writer );
+        keyboard.save( writer );
+        floppy.save( writer );
+
+        writer.saveToFile( vm["save-snapshot"].as<std::string>() );
     }
 
-    // It is important to get this processor state first, in case it
-    // has thrown an exception. If it has, then getting the state of
-    // any of the peripherals can be stalled while waiting for a
-    // response from the non-running processor and the program itself
-    // will be unresponsive.
-    auto state = procStateF.get();
-    clockStateF.get();
-    monitorStateF.get();
-    keyboardStateF.get();
-    floppyStateF.get();
+    if ( vm.count( "record-inputs" ) ) {
+        computer.inputs().saveToFile( vm["record-inputs"].as<std::string>() );
+    }
 
     dumpToLog( *state );
 }
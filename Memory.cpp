@@ -15,126 +15,619 @@
 // limitations under the License.
 
 #include "Memory.hpp"
+#include "Snapshot.hpp"
 
 DEFINE_LOGGER( MEMORY, "Memory" )
 
 #include <algorithm>
-#include <iterator>
+#include <array>
+#include <chrono>
+#include <cstring>
 #include <fstream>
-#include <thread>
+#include <iterator>
 
-#include <boost/spirit/include/qi.hpp>
-#include <boost/spirit/include/karma.hpp>
+#if defined( __unix__ ) || defined( __APPLE__ )
+#define NEBULA_MMAP_SUPPORTED
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined( __SSSE3__ )
+#include <tmmintrin.h>
+#elif defined( __SSE2__ )
+#include <emmintrin.h>
+#endif
 
 namespace nebula {
 
-Word Memory::read( Word offset ) {
-    if ( offset >= size() ) {
-        throw error::InvalidMemoryLocation {
-            MemoryOperation::Read,
-            offset
-        };    
+namespace {
+
+// Memory is converted to and from files this many words at a time.
+const std::size_t CHUNK_WORDS = 0x1000;
+
+#if defined( __BYTE_ORDER__ ) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+const ByteOrder HOST_ORDER = ByteOrder::BigEndian;
+#else
+const ByteOrder HOST_ORDER = ByteOrder::LittleEndian;
+#endif
+
+// Convert `count` words between `order` and the order of the host. The
+// conversion is its own inverse, so it works in both directions.
+void convert( const unsigned char* in, unsigned char* out, std::size_t count, ByteOrder order ) {
+    if ( order == HOST_ORDER ) {
+        std::memcpy( out, in, 2 * count );
+        return;
     }
-    
-    std::lock_guard<std::mutex> lock { _mutex };
 
-    std::this_thread::sleep_for( MEMORY_READ_DURATION );
-    return _vec[offset];
+    std::size_t i = 0;
+
+#if defined( __SSSE3__ )
+    const __m128i SWAP = _mm_set_epi8( 14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1 );
+
+    for ( ; i + 8 <= count; i += 8 ) {
+        auto words = _mm_loadu_si128( reinterpret_cast<const __m128i*>( in + 2 * i ) );
+        _mm_storeu_si128( reinterpret_cast<__m128i*>( out + 2 * i ), _mm_shuffle_epi8( words, SWAP ) );
+    }
+#endif
+
+    for ( ; i < count; ++i ) {
+        out[2 * i] = in[2 * i + 1];
+        out[2 * i + 1] = in[2 * i];
+    }
+}
+
+// Shared by every page that is all zeros.
+Memory::Page ZERO_PAGE {};
+
+// A page that is shared is never written, so its words can be read without
+// atomic operations.
+static_assert( sizeof( Memory::Page ) == Memory::PAGE_SIZE * sizeof( Word ),
+               "Pages must be laid out as plain words." );
+
+inline const Word* sharedWords( const Memory::Page* page ) noexcept {
+    return reinterpret_cast<const Word*>( page->data() );
 }
 
-void Memory::write( Word offset, Word value ) {
-    if ( offset >= size() ) {
-        throw error::InvalidMemoryLocation {
-            MemoryOperation::Write,
-            offset
-        };
+// Whether two pages have the same contents.
+bool isSamePage( const Word* a, const Word* b ) noexcept {
+#if defined( __SSE2__ )
+    auto differences = _mm_setzero_si128();
+
+    for ( int i = 0; i < Memory::PAGE_SIZE; i += 8 ) {
+        auto x = _mm_loadu_si128( reinterpret_cast<const __m128i*>( a + i ) );
+        auto y = _mm_loadu_si128( reinterpret_cast<const __m128i*>( b + i ) );
+        differences = _mm_or_si128( differences, _mm_xor_si128( x, y ) );
     }
 
-    std::lock_guard<std::mutex> lock { _mutex };
-    std::this_thread::sleep_for( MEMORY_WRITE_DURATION );
-    _vec[offset] = value;
+    return _mm_movemask_epi8( _mm_cmpeq_epi8( differences, _mm_setzero_si128() ) ) == 0xffff;
+#else
+    return std::equal( a, a + Memory::PAGE_SIZE, b );
+#endif
 }
 
-int Memory::size() {
-    std::lock_guard<std::mutex> lock { _mutex };
-    return _vec.size();
+double millisecondsSince( std::chrono::steady_clock::time_point start ) {
+    return std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - start ).count();
 }
 
-void Memory::dumpToFile( const std::string& filename,
-                         std::shared_ptr<Memory> mem,
-                         ByteOrder order ) {
-    namespace karma = boost::spirit::karma;
+// The contents of a file, which are mapped into memory where that's
+// supported.
+class FileContents final {
+    const unsigned char* _data { nullptr };
+    std::size_t _size { 0 };
+#if defined( NEBULA_MMAP_SUPPORTED )
+    void* _mapping { MAP_FAILED };
+#else
+    std::vector<char> _buffer {};
+#endif
+public:
+    explicit FileContents( const std::string& filename );
+    ~FileContents();
 
-    std::ofstream file {
+    FileContents( const FileContents& ) = delete;
+    FileContents& operator=( const FileContents& ) = delete;
+
+    inline const unsigned char* data() const noexcept { return _data; }
+    inline std::size_t size() const noexcept { return _size; }
+};
+
+#if defined( NEBULA_MMAP_SUPPORTED )
+
+FileContents::FileContents( const std::string& filename ) {
+    int fd = ::open( filename.c_str(), O_RDONLY );
+
+    if ( fd == -1 ) {
+        throw error::MissingMemoryFile { filename };
+    }
+
+    struct stat status;
+
+    if ( ::fstat( fd, &status ) == -1 ) {
+        ::close( fd );
+        throw error::MissingMemoryFile { filename };
+    }
+
+    _size = static_cast<std::size_t>( status.st_size );
+
+    if ( _size != 0 ) {
+        _mapping = ::mmap( nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    }
+
+    ::close( fd );
+
+    if ( _size != 0 && _mapping == MAP_FAILED ) {
+        throw error::MissingMemoryFile { filename };
+    }
+
+    _data = static_cast<const unsigned char*>( _mapping );
+}
+
+FileContents::~FileContents() {
+    if ( _mapping != MAP_FAILED ) {
+        ::munmap( _mapping, _size );
+    }
+}
+
+#else
+
+FileContents::FileContents( const std::string& filename ) {
+    std::ifstream file {
         filename,
-        std::ios::out | std::ios::binary
+        std::ios::in | std::ios::binary
     };
 
     if ( ! file.is_open() ) {
-        throw error::UnwritableMemoryFile { filename };
+        throw error::MissingMemoryFile { filename };
+    }
+
+    _buffer.assign( std::istreambuf_iterator<char> { file }, std::istreambuf_iterator<char> {} );
+    _data = reinterpret_cast<const unsigned char*>( _buffer.data() );
+    _size = _buffer.size();
+}
+
+FileContents::~FileContents() {}
+
+#endif
+
+}
+
+constexpr int Memory::SIZE;
+constexpr int Memory::PAGE_SIZE;
+constexpr int Memory::NUM_PAGES;
+
+Memory::Memory() {
+    for ( std::size_t page = 0; page < NUM_PAGES; ++page ) {
+        _sharedPages[page] = &ZERO_PAGE;
+        _pages[page].store( &ZERO_PAGE );
+    }
+}
+
+Memory::Memory( std::shared_ptr<const MemoryImage> image ) :
+    _sharedPages( image->_pages ),
+    _image { image } {
+    for ( std::size_t page = 0; page < NUM_PAGES; ++page ) {
+        _pages[page].store( _sharedPages[page] );
+    }
+}
+
+Memory::~Memory() {
+    releasePages();
+}
+
+void Memory::releasePages() noexcept {
+    for ( std::size_t page = 0; page < NUM_PAGES; ++page ) {
+        auto pointer = _pages[page].load();
+
+        if ( pointer != _sharedPages[page] ) {
+            delete pointer;
+        }
+    }
+}
+
+Memory::Page& Memory::copyPage( std::size_t page ) noexcept {
+    auto shared = _sharedPages[page];
+    auto copy = new Page;
+
+    // The shared page is never written, so the copy can't miss anything.
+    for ( int i = 0; i < PAGE_SIZE; ++i ) {
+        (*copy)[i].store( (*shared)[i].load( std::memory_order_relaxed ), std::memory_order_relaxed );
+    }
+
+    auto expected = shared;
+
+    if ( _pages[page].compare_exchange_strong( expected, copy, std::memory_order_acq_rel ) ) {
+        return *copy;
+    }
+
+    delete copy;
+    return *expected;
+}
+
+int Memory::numPrivatePages() const noexcept {
+    int count = 0;
+
+    for ( std::size_t page = 0; page < NUM_PAGES; ++page ) {
+        if ( _pages[page].load() != _sharedPages[page] ) {
+            ++count;
+        }
+    }
+
+    return count;
+}
+
+// A block shares one generation.
+void Memory::touchBlock( Word offset, std::size_t count ) noexcept {
+    if ( count == 0 ) {
+        return;
+    }
+
+    auto generation = _blockGeneration.fetch_add( 1, std::memory_order_acq_rel ) + 1;
+    auto numPages = std::min<std::size_t>( (offset % PAGE_SIZE + count + PAGE_SIZE - 1) / PAGE_SIZE, NUM_PAGES );
+
+    for ( std::size_t i = 0; i < numPages; ++i ) {
+        auto& pageGeneration = _pageBlockGenerations[(offset / PAGE_SIZE + i) % NUM_PAGES];
+        auto current = pageGeneration.load( std::memory_order_relaxed );
+
+        while ( current < generation && ! pageGeneration.compare_exchange_weak( current, generation ) ) {}
+    }
+}
+
+bool Memory::isChangedSince( int begin, int end, const Generation& generation ) const noexcept {
+    begin = std::max( begin, 0 );
+    end = std::min( end, SIZE );
+
+    for ( int page = begin / PAGE_SIZE; page * PAGE_SIZE < end; ++page ) {
+        if ( isPageChangedSince( page, generation ) ) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Blocks are accessed a page at a time.
+
+void Memory::readBlock( Word offset, Word* words, std::size_t count ) const noexcept {
+    for ( std::size_t i = 0; i < count; ) {
+        auto address = static_cast<Word>( offset + i );
+        auto& page = *_pages[address / PAGE_SIZE].load( std::memory_order_acquire );
+        auto n = std::min<std::size_t>( count - i, PAGE_SIZE - address % PAGE_SIZE );
+
+        for ( std::size_t j = 0; j < n; ++j ) {
+            words[i + j] = page[address % PAGE_SIZE + j].load( std::memory_order_relaxed );
+        }
+
+        i += n;
+    }
+}
+
+void Memory::writeBlock( Word offset, const Word* words, std::size_t count ) noexcept {
+    for ( std::size_t i = 0; i < count; ) {
+        auto address = static_cast<Word>( offset + i );
+        auto& page = writablePage( address / PAGE_SIZE );
+        auto n = std::min<std::size_t>( count - i, PAGE_SIZE - address % PAGE_SIZE );
+
+        for ( std::size_t j = 0; j < n; ++j ) {
+            page[address % PAGE_SIZE + j].store( words[i + j], std::memory_order_relaxed );
+        }
+
+        i += n;
+    }
+
+    touchBlock( offset, count );
+
+    auto observer = _observer.load( std::memory_order_acquire );
+
+    if ( observer ) {
+        for ( std::size_t i = 0; i < count; ++i ) {
+            observer->written( static_cast<Word>( offset + i ) );
+        }
     }
+}
+
+// Copying forwards is safe unless the destination starts inside the source,
+// and copying backwards is safe unless the destination ends inside it. A block
+// that is long enough to wrap around onto itself at both ends goes through a
+// buffer.
+void Memory::copyBlock( Word destination, Word source, std::size_t count ) {
+    std::size_t distance = static_cast<Word>( destination - source );
+
+    if ( distance == 0 || distance >= count ) {
+        for ( std::size_t i = 0; i < count; ++i ) {
+            store( static_cast<Word>( destination + i ), read( static_cast<Word>( source + i ) ) );
+        }
+    } else if ( distance + count <= static_cast<std::size_t>( SIZE ) ) {
+        for ( std::size_t i = count; i > 0; --i ) {
+            store( static_cast<Word>( destination + i - 1 ), read( static_cast<Word>( source + i - 1 ) ) );
+        }
+    } else {
+        std::vector<Word> buffer( count );
+        readBlock( source, buffer.data(), count );
+        writeBlock( destination, buffer.data(), count );
+        return;
+    }
+
+    touchBlock( destination, count );
+
+    auto observer = _observer.load( std::memory_order_acquire );
 
-    for ( const auto& w : mem->_vec ) {
-        if ( order == ByteOrder::BigEndian ) {
-            file << karma::format( karma::big_word, w );
+    if ( observer ) {
+        for ( std::size_t i = 0; i < count; ++i ) {
+            observer->written( static_cast<Word>( destination + i ) );
+        }
+    }
+}
+
+void Memory::reset( std::shared_ptr<const MemoryImage> image ) {
+    releasePages();
+
+    _sharedPages = image->_pages;
+    _image = image;
+
+    for ( std::size_t page = 0; page < NUM_PAGES; ++page ) {
+        _pages[page].store( _sharedPages[page] );
+    }
+
+    touchBlock( 0, SIZE );
+
+    auto observer = _observer.load( std::memory_order_acquire );
+
+    if ( observer ) {
+        for ( int i = 0; i < SIZE; ++i ) {
+            observer->written( static_cast<Word>( i ) );
+        }
+    }
+}
+
+std::shared_ptr<const MemoryImage>
+Memory::capture( const std::shared_ptr<const MemoryImage>& base ) const {
+    std::shared_ptr<MemoryImage> image { new MemoryImage {} };
+    image->_generation = generation();
+
+    for ( std::size_t page = 0; page < NUM_PAGES; ++page ) {
+        auto pointer = _pages[page].load( std::memory_order_acquire );
+
+        if ( pointer == _sharedPages[page] ) {
+            image->_pages[page] = pointer;
+            image->_storage[page] = _image ? _image->_storage[page] : nullptr;
+        } else if ( base && ! isPageChangedSince( page, base->_generation ) ) {
+            image->_pages[page] = base->_pages[page];
+            image->_storage[page] = base->_storage[page];
         } else {
-            file << karma::format( karma::little_word, w );
+            std::array<Word, PAGE_SIZE> words;
+
+            for ( int i = 0; i < PAGE_SIZE; ++i ) {
+                words[i] = (*pointer)[i].load( std::memory_order_relaxed );
+            }
+
+            // A page that was written can still end up the same as before.
+
+            if ( isSamePage( words.data(), sharedWords( &ZERO_PAGE ) ) ) {
+                image->_pages[page] = &ZERO_PAGE;
+                continue;
+            }
+
+            if ( base && isSamePage( words.data(), sharedWords( base->_pages[page] ) ) ) {
+                image->_pages[page] = base->_pages[page];
+                image->_storage[page] = base->_storage[page];
+                continue;
+            }
+
+            std::shared_ptr<Page> copy { new Page };
+
+            for ( int i = 0; i < PAGE_SIZE; ++i ) {
+                (*copy)[i].store( words[i], std::memory_order_relaxed );
+            }
+
+            image->_pages[page] = copy.get();
+            image->_storage[page] = std::move( copy );
         }
     }
 
-    LOG( MEMORY, info ) << format( "Wrote memory dump to '%s'" ) % filename;
+    return image;
+}
 
-    file.close();
+void Memory::save( SnapshotWriter& writer ) const {
+    capture()->save( writer );
 }
 
-std::shared_ptr<Memory>
-Memory::fromFile( const std::string& filename, int size, ByteOrder order ) {
-    namespace qi = boost::spirit::qi;
+void Memory::restore( SnapshotReader& reader ) {
+    std::vector<Word> words( SIZE, 0 );
+    auto numPages = reader.read<std::uint16_t>();
 
-    std::ifstream file {
+    if ( numPages > NUM_PAGES ) {
+        throw error::BadSnapshot { "too many pages of memory" };
+    }
+
+    for ( int i = 0; i < numPages; ++i ) {
+        auto page = reader.read<std::uint8_t>();
+        reader.readWords( &words[page * PAGE_SIZE], PAGE_SIZE );
+    }
+
+    reset( std::make_shared<const MemoryImage>( words.data(), words.size() ) );
+}
+
+void Memory::setWaitStates( int begin, int end, WaitStates waitStates ) {
+    begin = std::max( begin, 0 );
+    end = std::min( end, SIZE );
+
+    if ( begin >= end ) {
+        return;
+    }
+
+    if ( _waitStates.empty() ) {
+        _waitStates.resize( SIZE, WaitStates { 0, 0 } );
+    }
+
+    std::fill( _waitStates.begin() + begin, _waitStates.begin() + end, waitStates );
+}
+
+optional<WaitStates> Memory::blockWaitStates( Word offset, std::size_t count ) const noexcept {
+    if ( _waitStates.empty() || count == 0 ) {
+        return WaitStates { 0, 0 };
+    }
+
+    auto first = _waitStates[offset];
+
+    for ( std::size_t i = 1; i < count; ++i ) {
+        const auto& waitStates = _waitStates[static_cast<Word>( offset + i )];
+
+        if ( waitStates.read != first.read || waitStates.write != first.write ) {
+            return {};
+        }
+    }
+
+    return first;
+}
+
+void Memory::dumpToFile( const std::string& filename,
+                         std::shared_ptr<Memory> mem,
+                         ByteOrder order ) {
+    auto start = std::chrono::steady_clock::now();
+
+    std::ofstream file {
         filename,
-        std::ios::in | std::ios::binary
+        std::ios::out | std::ios::binary
     };
 
     if ( ! file.is_open() ) {
-        throw error::MissingMemoryFile { filename };
+        throw error::UnwritableMemoryFile { filename };
     }
 
-    auto begin = std::istreambuf_iterator<char> { file };
-    auto end = std::istreambuf_iterator<char> {};
+    // The whole image is converted first, so that it's written at once.
+    std::vector<unsigned char> bytes( 2 * SIZE );
+    std::array<Word, CHUNK_WORDS> chunk;
 
-    std::vector<char> contents( begin, end );
-    std::vector<Word> result;
+    for ( std::size_t offset = 0; offset < static_cast<std::size_t>( SIZE ); offset += CHUNK_WORDS ) {
+        mem->readBlock( static_cast<Word>( offset ), chunk.data(), CHUNK_WORDS );
+        convert( reinterpret_cast<const unsigned char*>( chunk.data() ), &bytes[2 * offset], CHUNK_WORDS, order );
+    }
 
-    bool isSuccessful { false };
+    file.write( reinterpret_cast<const char*>( bytes.data() ), bytes.size() );
+    file.close();
 
-    switch ( order ) {
-    case ByteOrder::BigEndian:
-        isSuccessful = qi::parse( contents.begin(), contents.end(),
-                                  +qi::big_word,
-                                  result );
-        break;
-    case ByteOrder::LittleEndian:
-        isSuccessful = qi::parse( contents.begin(), contents.end(),
-                                  +qi::little_word,
-                                  result );
-        break;
+    if ( ! file ) {
+        throw error::UnwritableMemoryFile { filename };
     }
 
-    if ( ! isSuccessful ) {
+    LOG( MEMORY, info ) << format( "Wrote memory dump to '%s' in %.3f ms" ) % filename % millisecondsSince( start );
+}
+
+std::shared_ptr<const MemoryImage>
+MemoryImage::fromFile( const std::string& filename, ByteOrder order ) {
+    auto start = std::chrono::steady_clock::now();
+
+    FileContents contents { filename };
+
+    // A trailing odd byte is ignored.
+    std::size_t numWords = contents.size() / 2;
+
+    if ( numWords == 0 ) {
         throw error::BadMemoryFile {};
     }
 
-    if ( result.size() > static_cast<unsigned>( size )) {
-        throw error::MemoryFileTooBig { size };
+    if ( numWords > static_cast<std::size_t>( Memory::SIZE ) ) {
+        throw error::MemoryFileTooBig { Memory::SIZE };
+    }
+
+    // Converted a page at a time, straight into the image.
+    std::shared_ptr<MemoryImage> image { new MemoryImage {} };
+    std::array<Word, Memory::PAGE_SIZE> words;
+
+    for ( std::size_t page = 0; page < Memory::NUM_PAGES; ++page ) {
+        auto begin = std::min<std::size_t>( page * Memory::PAGE_SIZE, numWords );
+        auto end = std::min<std::size_t>( begin + Memory::PAGE_SIZE, numWords );
+
+        words.fill( 0 );
+        convert( contents.data() + 2 * begin, reinterpret_cast<unsigned char*>( words.data() ), end - begin, order );
+        image->setPage( page, words.data() );
+    }
+
+    LOG( MEMORY, info ) << format( "Read memory from '%s' in %.3f ms" ) % filename % millisecondsSince( start );
+
+    return image;
+}
+
+std::shared_ptr<Memory>
+Memory::fromFile( const std::string& filename, ByteOrder order ) {
+    return std::make_shared<Memory>( MemoryImage::fromFile( filename, order ) );
+}
+
+MemoryImage::MemoryImage( const Word* words, std::size_t count ) {
+    count = std::min<std::size_t>( count, Memory::SIZE );
+    std::array<Word, Memory::PAGE_SIZE> padded;
+
+    for ( std::size_t page = 0; page < Memory::NUM_PAGES; ++page ) {
+        auto begin = std::min<std::size_t>( page * Memory::PAGE_SIZE, count );
+        auto end = std::min<std::size_t>( begin + Memory::PAGE_SIZE, count );
+
+        // Only the last page that has any words needs padding.
+        if ( end - begin == static_cast<std::size_t>( Memory::PAGE_SIZE ) ) {
+            setPage( page, words + begin );
+        } else {
+            padded.fill( 0 );
+            std::copy( words + begin, words + end, padded.begin() );
+            setPage( page, padded.data() );
+        }
+    }
+}
+
+void MemoryImage::setPage( std::size_t page, const Word* words ) {
+    if ( std::all_of( words, words + Memory::PAGE_SIZE, [] ( Word word ) { return word == 0; } ) ) {
+        _pages[page] = &ZERO_PAGE;
+        return;
+    }
+
+    std::shared_ptr<Memory::Page> stored { new Memory::Page };
+
+    for ( std::size_t i = 0; i < static_cast<std::size_t>( Memory::PAGE_SIZE ); ++i ) {
+        (*stored)[i].store( words[i], std::memory_order_relaxed );
+    }
+
+    _pages[page] = stored.get();
+    _storage[page] = std::move( stored );
+}
+
+std::size_t MemoryImage::numStoredPages() const noexcept {
+    return std::count_if( _storage.begin(), _storage.end(), [] ( const std::shared_ptr<Memory::Page>& page ) {
+            return page != nullptr;
+        } );
+}
+
+std::size_t MemoryImage::numStoredPagesNotIn( const MemoryImage& other ) const noexcept {
+    std::size_t count = 0;
+
+    for ( std::size_t page = 0; page < Memory::NUM_PAGES; ++page ) {
+        if ( _storage[page] && _storage[page] != other._storage[page] ) {
+            ++count;
+        }
+    }
+
+    return count;
+}
+
+void MemoryImage::save( SnapshotWriter& writer ) const {
+    std::vector<std::uint8_t> pages {};
+
+    for ( int page = 0; page < Memory::NUM_PAGES; ++page ) {
+        if ( _pages[page] != &ZERO_PAGE ) {
+            pages.push_back( static_cast<std::uint8_t>( page ) );
+        }
     }
 
-    auto mem = std::make_shared<Memory>( size );
-    std::move( result.begin(), result.end(), mem->_vec.begin() );
+    writer.write( static_cast<std::uint16_t>( pages.size() ) );
 
-    LOG( MEMORY, info ) << format( "Read memory successfully from '%s'" ) % filename;
+    std::array<Word, Memory::PAGE_SIZE> words;
 
-    return mem;
+    for ( auto page : pages ) {
+        for ( int i = 0; i < Memory::PAGE_SIZE; ++i ) {
+            words[i] = (*_pages[page])[i].load( std::memory_order_relaxed );
+        }
+
+        writer.write( page );
+        writer.writeWords( words.data(), words.size() );
+    }
 }
 
 }
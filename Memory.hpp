@@ -18,38 +18,18 @@
 
 #include "Fundamental.hpp"
 
-#include <chrono>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
 #include <memory>
-#include <mutex>
 #include <stdexcept>
 #include <vector>
 
 namespace nebula {
 
-enum class MemoryOperation {
-    Read, Write
-};
-
 namespace error {
 
-class InvalidMemoryLocation : public std::out_of_range {
-    MemoryOperation _operation;
-    Word _location;
-public:
-    explicit InvalidMemoryLocation( MemoryOperation operation, Word location ) :
-        std::out_of_range {
-            (format( "Cannot %s at memory location 0x%04x" )
-                 % (operation == MemoryOperation::Read ? "read" : "write")
-                 % location ).str()
-        },
-        _operation { operation },
-        _location { location } {
-    }
-
-    inline MemoryOperation operation() const noexcept { return _operation; }
-    inline Word location() const noexcept{ return _location; }
-};
-
 class BadMemoryFile : public std::out_of_range {
 public:
     explicit BadMemoryFile() :
@@ -99,26 +79,286 @@ enum class ByteOrder {
     LittleEndian
 };
 
-const std::chrono::microseconds MEMORY_READ_DURATION { 5 };
-const std::chrono::microseconds MEMORY_WRITE_DURATION { 10 };
+// Extra cycles that the processor spends accessing data at a location, on top
+// of the cycles of the instruction. Fetching instructions (and their next
+// words) is already accounted for by the instruction, so it has none.
+struct WaitStates {
+    std::uint8_t read;
+    std::uint8_t write;
+};
+
+// Notified after every write to memory, on the thread that made it.
+class MemoryObserver {
+public:
+    virtual void written( Word offset ) noexcept = 0;
+
+    virtual ~MemoryObserver() {}
+};
 
+class MemoryImage;
+class SnapshotReader;
+class SnapshotWriter;
+
+// Memory is shared by the processor and every device, each on its own thread,
+// without locks. Every word is accessed atomically, so a read never observes
+// half of a write, but accesses to different words are not ordered with
+// respect to each other (they are relaxed). Devices synchronize with the
+// processor through interrupts, which do order everything that happened
+// before them.
+//
+// Memory spans the whole address space of the DCPU-16, so every `Word` is a
+// valid location and accesses need no bounds checks.
+//
+// Every write advances the generation of memory, and records the new
+// generation for the page that was written. Anything that keeps data derived
+// from memory, on any thread, can check whether the source has changed since a
+// generation it took (see `isChangedSince`).
+//
+// Single words are only written by one thread at a time (the processor's), so
+// it counts them with plain stores rather than read-modify-writes. A reader
+// that takes a generation which includes a word is ordered after it, and
+// otherwise the page records a later generation. Blocks are written from any
+// thread, and counted separately.
+//
+// Memory is divided into pages which start out shared with an image (see
+// `MemoryImage`), or with a page of zeros, and a page is only copied the
+// first time it's written. Many instances of the same image only pay for the
+// pages that they've changed.
 class Memory final {
-    std::vector<Word> _vec;
-    std::mutex _mutex {};
 public:
-    static std::shared_ptr<Memory> fromFile( const std::string& filename, int size, ByteOrder order );
+    static constexpr int SIZE = 0x10000;
+    static constexpr int PAGE_SIZE = 0x100;
+    static constexpr int NUM_PAGES = SIZE / PAGE_SIZE;
+
+    // How many words and blocks had been written.
+    struct Generation {
+        std::uint64_t words;
+        std::uint64_t blocks;
+    };
+
+    using Page = std::array<std::atomic<Word>, PAGE_SIZE>;
+private:
+    // Each page is either shared, in which case it's never written, or
+    // private to this memory.
+    std::array<std::atomic<Page*>, NUM_PAGES> _pages;
+    std::array<Page*, NUM_PAGES> _sharedPages;
+    std::shared_ptr<const MemoryImage> _image { nullptr };
+
+    std::atomic<MemoryObserver*> _observer { nullptr };
+
+    // Only ever modified by the thread writing words.
+    std::atomic<std::uint64_t> _wordGeneration { 0 };
+
+    std::atomic<std::uint64_t> _blockGeneration { 0 };
+
+    // The generation of the last write to each page, of each kind.
+    std::array<std::atomic<std::uint64_t>, NUM_PAGES> _pageWordGenerations {};
+    std::array<std::atomic<std::uint64_t>, NUM_PAGES> _pageBlockGenerations {};
+
+    // Replace a shared page with a private copy, unless another thread got
+    // there first.
+    Page& copyPage( std::size_t page ) noexcept;
+
+    inline Page& writablePage( std::size_t page ) noexcept {
+        auto pointer = _pages[page].load( std::memory_order_acquire );
+        return pointer != _sharedPages[page] ? *pointer : copyPage( page );
+    }
+
+    // Write without notifying anybody.
+    inline void store( Word offset, Word value ) noexcept {
+        writablePage( offset / PAGE_SIZE )[offset % PAGE_SIZE].store( value, std::memory_order_relaxed );
+    }
+
+    // Called after writing a word to `page`. The word is released with the
+    // generation, so whoever acquires this generation (or a later one) reads
+    // the word, and whoever took an earlier one finds the page changed.
+    inline void touch( std::size_t page ) noexcept {
+        auto generation = _wordGeneration.load( std::memory_order_relaxed ) + 1;
+        _wordGeneration.store( generation, std::memory_order_release );
+        _pageWordGenerations[page].store( generation, std::memory_order_release );
+    }
+
+    // Called after writing a block, from any thread. Writes to the same page
+    // from different threads can finish in either order, so a page's
+    // generation only ever increases.
+    void touchBlock( Word offset, std::size_t count ) noexcept;
+
+    // Free the pages that were copied.
+    void releasePages() noexcept;
+
+    // Empty if there are no wait states anywhere.
+    std::vector<WaitStates> _waitStates {};
+public:
+    static std::shared_ptr<Memory> fromFile( const std::string& filename, ByteOrder order );
 
     static void dumpToFile( const std::string& filename,
                             std::shared_ptr<Memory> mem,
                             ByteOrder order );
 
-    explicit Memory( int size ) :
-        _vec { std::vector<Word>( size ) } {}
+    // Every location is zero.
+    explicit Memory();
+
+    // Memory starts with the contents of `image`.
+    explicit Memory( std::shared_ptr<const MemoryImage> image );
+
+    Memory( const Memory& ) = delete;
+    Memory& operator=( const Memory& ) = delete;
+
+    ~Memory();
 
-    Word read( Word offset );
-    void write( Word offset, Word value );
+    inline Word read( Word offset ) const noexcept {
+        auto page = _pages[offset / PAGE_SIZE].load( std::memory_order_acquire );
+        return (*page)[offset % PAGE_SIZE].load( std::memory_order_relaxed );
+    }
+
+    inline void write( Word offset, Word value ) noexcept {
+        store( offset, value );
+        touch( offset / PAGE_SIZE );
+
+        auto observer = _observer.load( std::memory_order_acquire );
+
+        if ( observer ) {
+            observer->written( offset );
+        }
+    }
 
-    int size();
+    static constexpr int size() noexcept { return SIZE; }
+
+    // The number of pages that have been copied from the image.
+    int numPrivatePages() const noexcept;
+
+    // Replace the contents of memory with `image`, as though every location
+    // was written. This must only happen while nothing else is accessing
+    // memory.
+    void reset( std::shared_ptr<const MemoryImage> image );
+
+    // A copy of memory as it is now, which nothing may be writing to. Pages
+    // that haven't been written since `base` was captured from this memory
+    // are shared with it, as are pages that haven't been copied from the
+    // image, so only the pages written in the meantime are copied. Of those,
+    // a page that ends up the same as in `base` is shared too.
+    std::shared_ptr<const MemoryImage> capture( const std::shared_ptr<const MemoryImage>& base = nullptr ) const;
+
+    // Only locations that aren't zero take up space in a snapshot. Like
+    // `reset`, restoring must only happen while nothing else is accessing
+    // memory.
+    void save( SnapshotWriter& writer ) const;
+    void restore( SnapshotReader& reader );
+
+    // Anything written after this is taken has a later generation.
+    inline Generation generation() const noexcept {
+        return Generation {
+            _wordGeneration.load( std::memory_order_acquire ),
+            _blockGeneration.load( std::memory_order_acquire )
+        };
+    }
+
+    inline bool isPageChangedSince( std::size_t page, const Generation& generation ) const noexcept {
+        return _pageWordGenerations[page].load( std::memory_order_acquire ) > generation.words ||
+            _pageBlockGenerations[page].load( std::memory_order_acquire ) > generation.blocks;
+    }
+
+    // Whether anything in [begin, end) may have been written since
+    // `generation`. Writes are tracked by page, so this may also be true of
+    // writes near the range.
+    bool isChangedSince( int begin, int end, const Generation& generation ) const noexcept;
+
+    // Blocks of consecutive locations wrap around the end of memory, like the
+    // addresses computed by the processor. Each word of a block is accessed
+    // atomically, but not the block as a whole.
+
+    void readBlock( Word offset, Word* words, std::size_t count ) const noexcept;
+    void writeBlock( Word offset, const Word* words, std::size_t count ) noexcept;
+
+    // The blocks may overlap, in which case the source is copied as it was
+    // before the copy began.
+    void copyBlock( Word destination, Word source, std::size_t count );
+
+    class View;
+    inline View view( Word offset, std::size_t count ) const noexcept;
+
+    // Set the wait states of locations in [begin, end). This must happen
+    // before the simulation starts, since it isn't synchronized.
+    void setWaitStates( int begin, int end, WaitStates waitStates );
+
+    inline int readWaitStates( Word offset ) const noexcept {
+        return offset < _waitStates.size() ? _waitStates[offset].read : 0;
+    }
+
+    inline int writeWaitStates( Word offset ) const noexcept {
+        return offset < _waitStates.size() ? _waitStates[offset].write : 0;
+    }
+
+    // The wait states of every location in a block, or nothing if they
+    // differ.
+    optional<WaitStates> blockWaitStates( Word offset, std::size_t count ) const noexcept;
+
+    // There is at most one observer. `nullptr` removes it.
+    inline void setObserver( MemoryObserver* observer ) noexcept {
+        _observer.store( observer, std::memory_order_release );
+    }
 };
 
+// Read-only access to a block of memory (see `Memory::readBlock`). Locations
+// are read when they're accessed, not when the view is created.
+class Memory::View final {
+    const Memory* _memory;
+    Word _offset;
+    std::size_t _size;
+public:
+    explicit View( const Memory& memory, Word offset, std::size_t size ) :
+        _memory { &memory },
+        _offset { offset },
+        _size { size } {}
+
+    inline Word operator[]( std::size_t index ) const noexcept {
+        return _memory->read( static_cast<Word>( _offset + index ) );
+    }
+
+    inline Word offset() const noexcept { return _offset; }
+    inline std::size_t size() const noexcept { return _size; }
+
+    inline void copyTo( Word* words ) const noexcept { _memory->readBlock( _offset, words, _size ); }
+};
+
+// The initial contents of memory, which are never modified and can be shared
+// by any number of instances of `Memory`.
+class MemoryImage final {
+    std::array<Memory::Page*, Memory::NUM_PAGES> _pages;
+
+    // Pages may be shared with other images. The page of zeros isn't stored.
+    std::array<std::shared_ptr<Memory::Page>, Memory::NUM_PAGES> _storage {};
+
+    // The generation of the memory that the image was captured from.
+    Memory::Generation _generation {};
+
+    explicit MemoryImage() = default;
+
+    // Store a page of words, unless they're all zero.
+    void setPage( std::size_t page, const Word* words );
+
+    friend class Memory;
+public:
+    // `count` words, followed by zeros.
+    explicit MemoryImage( const Word* words, std::size_t count );
+
+    MemoryImage( const MemoryImage& ) = delete;
+    MemoryImage& operator=( const MemoryImage& ) = delete;
+
+    static std::shared_ptr<const MemoryImage> fromFile( const std::string& filename, ByteOrder order );
+
+    // Pages of zeros aren't stored.
+    std::size_t numStoredPages() const noexcept;
+
+    // The pages that are stored by this image but not shared with `other`.
+    std::size_t numStoredPagesNotIn( const MemoryImage& other ) const noexcept;
+
+    // In the same format as `Memory::save`.
+    void save( SnapshotWriter& writer ) const;
+};
+
+Memory::View Memory::view( Word offset, std::size_t count ) const noexcept {
+    return View { *this, offset, count };
+}
+
 }
@@ -0,0 +1,257 @@
+// NativeImage.cpp
+//
+// Copyright 2013 Jesse Haber-Kucharsky
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "NativeImage.hpp"
+#include "Translator.hpp"
+
+#include <algorithm>
+#include <type_traits>
+
+#if defined( __unix__ ) || defined( __APPLE__ )
+#define NEBULA_NATIVE_IMAGE_SUPPORTED
+#include <dlfcn.h>
+#endif
+
+DEFINE_LOGGER( NATIVE, "Native image" )
+
+namespace nebula {
+
+namespace {
+
+static_assert( std::is_standard_layout<native::Context>::value,
+               "Translated code requires the layout of the context to be standard." );
+
+// Matches `nebula_block` in the output of the translator.
+struct BlockEntry {
+    Word address;
+    void (*function)( native::Context* context );
+    std::uint32_t firstWord;
+    std::uint32_t numWords;
+};
+
+}
+
+NativeImage::NativeImage( std::shared_ptr<Memory> memory, const std::string& path ) :
+    _memory { memory },
+    _functions( 0x10000, nullptr ),
+    _pageBlocks( native::NUM_PAGES ),
+    _isTranslated { new std::atomic<bool>[0x10000] },
+    _isPageDirty { new std::atomic<bool>[native::NUM_PAGES] } {
+    for ( std::size_t i = 0; i < 0x10000; ++i ) {
+        _isTranslated[i].store( false );
+    }
+
+    for ( std::size_t i = 0; i < native::NUM_PAGES; ++i ) {
+        _isPageDirty[i].store( false );
+    }
+
+    _context.doSkip = 0;
+    _context.cycles = 0;
+    _context.host = this;
+    _context.read = &NativeImage::readMemory;
+    _context.write = &NativeImage::writeMemory;
+
+    load( path );
+    _memory->setObserver( this );
+}
+
+NativeImage::~NativeImage() {
+    _memory->setObserver( nullptr );
+
+#if defined( NEBULA_NATIVE_IMAGE_SUPPORTED )
+    dlclose( _library );
+#endif
+}
+
+void NativeImage::load( const std::string& path ) {
+#if defined( NEBULA_NATIVE_IMAGE_SUPPORTED )
+    // `dlopen` only searches for bare file names.
+    auto qualified = path.find( '/' ) == std::string::npos ? "./" + path : path;
+    _library = dlopen( qualified.c_str(), RTLD_NOW | RTLD_LOCAL );
+
+    if ( ! _library ) {
+        throw error::BadNativeImage { path, dlerror() };
+    }
+
+    auto version = static_cast<const std::uint32_t*>( dlsym( _library, "nebula_abi_version" ) );
+    auto numBlocks = static_cast<const std::uint32_t*>( dlsym( _library, "nebula_num_blocks" ) );
+    auto entries = static_cast<const BlockEntry*>( dlsym( _library, "nebula_blocks" ) );
+    auto words = static_cast<const Word*>( dlsym( _library, "nebula_words" ) );
+
+    if ( ! (version && numBlocks && entries && words) ) {
+        dlclose( _library );
+        throw error::BadNativeImage { path, "not a translated memory image" };
+    }
+
+    if ( *version != static_cast<std::uint32_t>( translation::ABI_VERSION ) ) {
+        dlclose( _library );
+        throw error::BadNativeImage { path, (format( "unsupported version %d" ) % *version).str() };
+    }
+
+    std::uint32_t numMismatched = 0;
+
+    for ( std::uint32_t i = 0; i < *numBlocks; ++i ) {
+        const auto& entry = entries[i];
+        Block block { entry.address, {} };
+        bool isMatching = true;
+
+        for ( std::uint32_t j = 0; j < entry.numWords; ++j ) {
+            auto address = words[2 * (entry.firstWord + j)];
+            auto value = words[2 * (entry.firstWord + j) + 1];
+
+            if ( _memory->read( address ) != value ) {
+                isMatching = false;
+                break;
+            }
+
+            block.words.push_back( address );
+        }
+
+        if ( ! isMatching ) {
+            ++numMismatched;
+            continue;
+        }
+
+        for ( auto address : block.words ) {
+            auto page = address / native::PAGE_SIZE;
+            _isTranslated[address].store( true );
+
+            if ( _pageBlocks[page].empty() || _pageBlocks[page].back() != _blocks.size() ) {
+                _pageBlocks[page].push_back( _blocks.size() );
+            }
+        }
+
+        _functions[entry.address] = entry.function;
+        _blocks.push_back( std::move( block ) );
+    }
+
+    LOG( NATIVE, info ) << format( "Loaded %d blocks from '%s'." ) % _blocks.size() % path;
+
+    if ( numMismatched != 0 ) {
+        LOG( NATIVE, warning ) << format( "Ignoring %d blocks translated from different code." ) % numMismatched;
+    }
+#else
+    throw error::BadNativeImage { path, "unsupported host" };
+#endif
+}
+
+// Discard the blocks that read pages which have since been written.
+void NativeImage::invalidate() {
+    // This happens first so that no write is missed.
+    _isStale.store( false );
+
+    for ( std::size_t page = 0; page < native::NUM_PAGES; ++page ) {
+        if ( ! _isPageDirty[page].exchange( false ) ) {
+            continue;
+        }
+
+        for ( auto index : _pageBlocks[page] ) {
+            _functions[_blocks[index].address] = nullptr;
+        }
+
+        _pageBlocks[page].clear();
+
+        // Every block that read the page is gone.
+        for ( std::size_t address = page * native::PAGE_SIZE; address < (page + 1) * native::PAGE_SIZE; ++address ) {
+            _isTranslated[address].store( false, std::memory_order_relaxed );
+        }
+
+        LOG( NATIVE, info ) << format( "Page 0x%04x was modified. Discarding its blocks." ) % (page * native::PAGE_SIZE);
+    }
+}
+
+std::size_t NativeImage::size() const noexcept {
+    return std::count_if( _functions.begin(), _functions.end(), [] ( Function f ) { return f != nullptr; } );
+}
+
+// Called from translated code.
+
+Word NativeImage::readMemory( void* host, Word address ) {
+    auto image = static_cast<NativeImage*>( host );
+    image->_context.cycles += image->_memory->readWaitStates( address );
+
+    return image->_memory->read( address );
+}
+
+int NativeImage::writeMemory( void* host, Word address, Word value ) {
+    auto image = static_cast<NativeImage*>( host );
+    image->_context.cycles += image->_memory->writeWaitStates( address );
+    image->_memory->write( address, value );
+
+    return image->_isStale.load() ? 1 : 0;
+}
+
+bool NativeImage::execute( ProcessorState& proc, int cycleBudget ) {
+    if ( proc.doSkip ) {
+        return false;
+    }
+
+    for ( int i = 0; i < 8; ++i ) {
+        _context.registers[i] = proc.read( static_cast<Register>( i ) );
+    }
+
+    _context.pc = proc.read( Special::Pc );
+    _context.sp = proc.read( Special::Sp );
+    _context.ex = proc.read( Special::Ex );
+    _context.doSkip = 0;
+    _context.cycles = 0;
+
+    bool isExhausted = false;
+
+    while ( true ) {
+        if ( _isStale.load() ) {
+            invalidate();
+        }
+
+        if ( _context.cycles >= cycleBudget ) {
+            isExhausted = true;
+            break;
+        }
+
+        auto function = _functions[_context.pc];
+
+        if ( ! function ) {
+            break;
+        }
+
+        function( &_context );
+
+        if ( _context.doSkip ) {
+            break;
+        }
+    }
+
+    for ( int i = 0; i < 8; ++i ) {
+        proc.write( static_cast<Register>( i ), _context.registers[i] );
+    }
+
+    proc.write( Special::Pc, _context.pc );
+    proc.write( Special::Sp, _context.sp );
+    proc.write( Special::Ex, _context.ex );
+    proc.doSkip = _context.doSkip != 0;
+    proc.tickClock( static_cast<int>( _context.cycles ) );
+
+    return isExhausted;
+}
+
+void NativeImage::written( Word offset ) noexcept {
+    if ( _isTranslated[offset].load( std::memory_order_relaxed ) ) {
+        _isPageDirty[offset / native::PAGE_SIZE].store( true );
+        _isStale.store( true );
+    }
+}
+
+}
@@ -0,0 +1,139 @@
+// NativeImage.hpp
+//
+// Copyright 2013 Jesse Haber-Kucharsky
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "Memory.hpp"
+#include "ProcessorState.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace nebula {
+
+namespace error {
+
+class BadNativeImage : public std::runtime_error {
+    std::string _path;
+public:
+    explicit BadNativeImage( const std::string& path, const std::string& reason ) :
+        std::runtime_error {
+            (format( "Unable to load native image '%s': %s" ) % path % reason).str()
+        },
+        _path { path } {}
+
+    const std::string& path() const noexcept { return _path; }
+};
+
+}
+
+namespace native {
+
+// Translated code is invalidated by pages of memory.
+const std::size_t PAGE_SIZE = 0x100;
+const std::size_t NUM_PAGES = 0x10000 / PAGE_SIZE;
+
+// The state that translated code operates on. This must match
+// `nebula_context` in the output of the translator.
+struct Context {
+    Word registers[8];
+    Word pc;
+    Word sp;
+    Word ex;
+    std::uint8_t doSkip;
+    std::int64_t cycles;
+    void* host;
+    Word (*read)( void* host, Word address );
+
+    // Returns non-zero if translated code was modified.
+    int (*write)( void* host, Word address, Word value );
+};
+
+}
+
+// Code translated ahead of time from a memory image (see `translation`),
+// loaded from a shared object.
+//
+// Only blocks whose code in memory matches what was translated are used.
+// Writing to a location that was read to translate a block stops translated
+// code after the current instruction, and then every block that read the
+// same page is discarded for good. Execution falls back to the processor
+// wherever there isn't a block.
+class NativeImage final : public MemoryObserver {
+    std::shared_ptr<Memory> _memory;
+    native::Context _context;
+
+    // The handle returned by `dlopen`.
+    void* _library { nullptr };
+
+    using Function = void (*)( native::Context* context );
+
+    std::vector<Function> _functions;
+
+    struct Block {
+        Word address;
+        std::vector<Word> words;
+    };
+
+    std::vector<Block> _blocks {};
+
+    // The blocks that read each page of memory.
+    std::vector<std::vector<std::size_t>> _pageBlocks;
+
+    // Whether each memory location was read to translate a block in use.
+    std::unique_ptr<std::atomic<bool>[]> _isTranslated;
+
+    // Whether a location in each page that was read to translate a block has
+    // since been written.
+    std::unique_ptr<std::atomic<bool>[]> _isPageDirty;
+
+    std::atomic<bool> _isStale { false };
+
+    void load( const std::string& path );
+    void invalidate();
+
+    static Word readMemory( void* host, Word address );
+    static int writeMemory( void* host, Word address, Word value );
+public:
+    // Load the shared object at `path`, which was translated for the contents
+    // of `memory`.
+    explicit NativeImage( std::shared_ptr<Memory> memory, const std::string& path );
+
+    NativeImage( const NativeImage& ) = delete;
+    NativeImage& operator=( const NativeImage& ) = delete;
+
+    virtual ~NativeImage();
+
+    // The number of blocks that are still in use.
+    std::size_t size() const noexcept;
+
+    // Execute translated code until at least `cycleBudget` cycles have elapsed
+    // (ticked on the processor's clock), or until there is no block for the
+    // next instruction.
+    //
+    // Returns `false` in the second case, when the processor must execute the
+    // next instruction itself.
+    bool execute( ProcessorState& proc, int cycleBudget );
+
+    virtual void written( Word offset ) noexcept override;
+};
+
+}
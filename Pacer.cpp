@@ -0,0 +1,142 @@
+// Pacer.cpp
+//
+// Copyright 2013 Jesse Haber-Kucharsky
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "Pacer.hpp"
+
+#include <algorithm>
+#include <thread>
+
+DEFINE_LOGGER( PACER, "Pacer" )
+
+namespace nebula {
+
+Pacer::Pacer( std::uint64_t clockHz, double spinLimit ) :
+    _clockHz { std::max<std::uint64_t>( clockHz, 1 ) },
+    _spinLimit { std::min( std::max( spinLimit, 0.0 ), 1.0 ) },
+    _quantum {
+        static_cast<int>( std::max<std::uint64_t>( _clockHz * pacing::MIN_WAIT.count() / 1000000, 1 ) )
+    } {
+    start();
+}
+
+Pacer::Clock::duration Pacer::duration( std::uint64_t cycles ) const noexcept {
+    // Whole seconds are separated so that this doesn't overflow.
+    auto seconds = std::chrono::seconds { cycles / _clockHz };
+    auto rest = std::chrono::nanoseconds { (cycles % _clockHz) * 1000000000 / _clockHz };
+
+    return std::chrono::duration_cast<Clock::duration>( seconds ) +
+        std::chrono::duration_cast<Clock::duration>( rest );
+}
+
+void Pacer::start() {
+    _epoch = Clock::now();
+    _scheduledCycles = 0;
+    _pendingCycles = 0;
+    beginWindow( _epoch );
+}
+
+void Pacer::beginWindow( Clock::time_point now ) {
+    _windowStart = now;
+    _windowCycles = 0;
+    _windowSpin = Clock::duration::zero();
+    _totalJitter = Clock::duration::zero();
+    _maxJitter = Clock::duration::zero();
+    _numWaits = 0;
+}
+
+void Pacer::pace( int cycles ) {
+    _pendingCycles += cycles;
+
+    if ( _pendingCycles < _quantum ) {
+        return;
+    }
+
+    _scheduledCycles += _pendingCycles;
+    _windowCycles += _pendingCycles;
+    _pendingCycles = 0;
+
+    auto now = Clock::now();
+    auto deadline = _epoch + duration( _scheduledCycles );
+
+    if ( now < deadline ) {
+        wait( now, deadline );
+    } else if ( now - deadline > pacing::MAX_LAG ) {
+        LOG( PACER, info ) << format( "Fell behind by %d ms. Starting the schedule over." )
+            % std::chrono::duration_cast<std::chrono::milliseconds>( now - deadline ).count();
+
+        _epoch = now;
+        _scheduledCycles = 0;
+    }
+
+    now = Clock::now();
+
+    if ( now - _windowStart >= pacing::REPORT_WINDOW ) {
+        auto r = report();
+
+        LOG( PACER, info ) << format( "Achieved %.0f Hz (jitter %d us mean, %d us max, spinning %.1f%%)." )
+            % r.achievedHz
+            % std::chrono::duration_cast<std::chrono::microseconds>( r.meanJitter ).count()
+            % std::chrono::duration_cast<std::chrono::microseconds>( r.maxJitter ).count()
+            % (100.0 * r.spinFraction);
+
+        beginWindow( now );
+    }
+}
+
+void Pacer::wait( Clock::time_point now, Clock::time_point deadline ) {
+    bool canSpin = _windowSpin < std::chrono::duration_cast<Clock::duration>( (now - _windowStart) * _spinLimit );
+    auto wake = canSpin ? deadline - 2 * _oversleep : deadline;
+
+    if ( now < wake ) {
+        std::this_thread::sleep_until( wake );
+
+        auto woke = Clock::now();
+        _oversleep += ((woke - wake) - _oversleep) / 8;
+        now = woke;
+    }
+
+    if ( canSpin && now < deadline ) {
+        auto spinStart = now;
+
+        while ( now < deadline ) {
+            now = Clock::now();
+        }
+
+        _windowSpin += now - spinStart;
+    }
+
+    auto late = now - deadline;
+    _totalJitter += late;
+    _maxJitter = std::max( _maxJitter, late );
+    ++_numWaits;
+}
+
+PacingReport Pacer::report() const {
+    using std::chrono::duration_cast;
+    using std::chrono::nanoseconds;
+    using Seconds = std::chrono::duration<double>;
+
+    auto elapsed = duration_cast<Seconds>( Clock::now() - _windowStart ).count();
+
+    return PacingReport {
+        elapsed > 0.0 ? _windowCycles / elapsed : 0.0,
+        _numWaits != 0 ? duration_cast<nanoseconds>( _totalJitter / _numWaits ) : nanoseconds::zero(),
+        duration_cast<nanoseconds>( _maxJitter ),
+        elapsed > 0.0 ? duration_cast<Seconds>( _windowSpin ).count() / elapsed : 0.0
+    };
+}
+
+}
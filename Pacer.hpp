@@ -0,0 +1,116 @@
+// Pacer.hpp
+//
+// Copyright 2013 Jesse Haber-Kucharsky
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "Fundamental.hpp"
+
+#include <chrono>
+#include <cstdint>
+
+namespace nebula {
+
+namespace pacing {
+
+// The DCPU-16 runs at 100 kHz.
+const std::uint64_t DEFAULT_CLOCK_HZ = 100000;
+
+// At most this fraction of the time is spent spinning, by default.
+const double DEFAULT_SPIN_LIMIT = 0.1;
+
+// Cycles are accumulated until waiting for them would take at least this
+// long, since shorter waits aren't worth reading the clock for.
+const std::chrono::microseconds MIN_WAIT { 500 };
+
+// Falling further behind the schedule than this (for example, while the
+// host was suspended) isn't made up for. The schedule starts over instead.
+const std::chrono::milliseconds MAX_LAG { 100 };
+
+// The achieved rate and jitter are reported over windows of this length.
+const std::chrono::seconds REPORT_WINDOW { 5 };
+
+}
+
+// How closely the schedule was kept over a window of time.
+struct PacingReport {
+    double achievedHz;
+
+    // How late waits ended, relative to the schedule.
+    std::chrono::nanoseconds meanJitter;
+    std::chrono::nanoseconds maxJitter;
+
+    // The fraction of the window that was spent spinning.
+    double spinFraction;
+};
+
+// Keeps the processor at a target clock rate by waiting after batches of
+// cycles.
+//
+// Every cycle is scheduled relative to a fixed starting point on a monotonic
+// clock, so oversleeping and rounding don't accumulate: time lost in one wait
+// is made up in the next ones.
+//
+// Waiting sleeps until shortly before the deadline (by as much as sleeps have
+// recently overshot), and then spins for the rest, as long as no more than
+// the spin limit of the current window has been spent spinning. Otherwise,
+// it only sleeps.
+class Pacer final {
+public:
+    using Clock = std::chrono::steady_clock;
+private:
+    std::uint64_t _clockHz;
+    double _spinLimit;
+
+    // Cycles are accumulated until there are this many.
+    int _quantum;
+    int _pendingCycles { 0 };
+
+    Clock::time_point _epoch {};
+    std::uint64_t _scheduledCycles { 0 };
+
+    // A moving average of how much sleeps overshoot.
+    Clock::duration _oversleep { std::chrono::microseconds { 50 } };
+
+    Clock::time_point _windowStart {};
+    std::uint64_t _windowCycles { 0 };
+    Clock::duration _windowSpin { 0 };
+    Clock::duration _totalJitter { 0 };
+    Clock::duration _maxJitter { 0 };
+    std::uint64_t _numWaits { 0 };
+
+    void beginWindow( Clock::time_point now );
+    void wait( Clock::time_point now, Clock::time_point deadline );
+public:
+    // `spinLimit` is a fraction between 0 (never spin) and 1.
+    explicit Pacer( std::uint64_t clockHz = pacing::DEFAULT_CLOCK_HZ,
+                    double spinLimit = pacing::DEFAULT_SPIN_LIMIT );
+
+    inline std::uint64_t clockHz() const noexcept { return _clockHz; }
+
+    // The time that `cycles` take at the target rate.
+    Clock::duration duration( std::uint64_t cycles ) const noexcept;
+
+    // Begin the schedule now.
+    void start();
+
+    // Account for `cycles`, and wait if they were executed ahead of schedule.
+    void pace( int cycles );
+
+    // How the schedule has been kept since the current window began.
+    PacingReport report() const;
+};
+
+}
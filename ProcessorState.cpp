@@ -15,592 +15,653 @@
 // limitations under the License.
 
 #include "ProcessorState.hpp"
+#include "InstructionCache.hpp"
+#include "Snapshot.hpp"
 
-#include <functional>
+#include <algorithm>
+#include <cassert>
+#include <limits>
 #include <sstream>
 
-#include <boost/phoenix/bind.hpp>
-#include <boost/phoenix/core.hpp>
-#include <boost/phoenix/operator.hpp>
-
 namespace nebula {
 
-Word ProcessorState::read( Register reg ) const noexcept {
-    return _registers[registerIndex( reg )];
+Word Operand::next( ProcessorState& proc ) {
+    if ( ! _next ) {
+        _next = fetchNextWord( proc );
+    }
+
+    return *_next;
 }
 
-Word ProcessorState::read( Special spec ) const noexcept {
-    switch ( spec ) {
-    case Special::Pc: return _pc;
-    case Special::Sp: return _sp;
-    case Special::Ex: return _ex;
+Word Operand::load( ProcessorState& proc ) {
+    const auto& spec = isa::OPERANDS[_code];
+    auto reg = static_cast<Register>( spec.value );
+
+    switch ( spec.operandClass ) {
+    case isa::OperandClass::Register:
+        return proc.read( reg );
+    case isa::OperandClass::RegisterIndirect:
+        return proc.readMemory( proc.read( reg ) );
+    case isa::OperandClass::RegisterIndirectOffset:
+        return proc.readMemory( proc.read( reg ) + next( proc ) );
+    case isa::OperandClass::Stack:
+        if ( _context == AddressContext::A ) {
+            return pop( proc );
+        } else {
+            assert( ! "Attempt to load from a 'push' address!" );
+            return 0;
+        }
+    case isa::OperandClass::Peek:
+        return proc.readMemory( proc.read( Special::Sp ) );
+    case isa::OperandClass::Pick:
+        return proc.readMemory( proc.read( Special::Sp ) + next( proc ) );
+    case isa::OperandClass::Sp:
+        return proc.read( Special::Sp );
+    case isa::OperandClass::Pc:
+        return proc.read( Special::Pc );
+    case isa::OperandClass::Ex:
+        return proc.read( Special::Ex );
+    case isa::OperandClass::Indirect:
+        return proc.readMemory( next( proc ) );
+    case isa::OperandClass::Direct:
+        return next( proc );
+    case isa::OperandClass::Literal:
+        return spec.value;
     }
 
-    // This shouldn't be necessary, but GCC complains (wrongly) that
-    // not all cases are handled in the above.
     return 0;
 }
 
-void ProcessorState::write( Register reg, Word value ) noexcept {
-    _registers[registerIndex( reg )] = value;
-}
+void Operand::store( ProcessorState& proc, Word value ) {
+    const auto& spec = isa::OPERANDS[_code];
+    auto reg = static_cast<Register>( spec.value );
 
-void ProcessorState::write( Special spec, Word value ) noexcept {
-    switch ( spec ) {
-    case Special::Pc: _pc = value; return;
-    case Special::Sp: _sp = value; return;
-    case Special::Ex: _ex = value; return;
+    switch ( spec.operandClass ) {
+    case isa::OperandClass::Register:
+        proc.write( reg, value );
+        break;
+    case isa::OperandClass::RegisterIndirect:
+        proc.writeMemory( proc.read( reg ), value );
+        break;
+    case isa::OperandClass::RegisterIndirectOffset:
+        proc.writeMemory( proc.read( reg ) + next( proc ), value );
+        break;
+    case isa::OperandClass::Stack:
+        if ( _context == AddressContext::B ) {
+            push( proc, value );
+        } else {
+            assert( ! "Attempt to store to a 'pop' address!" );
+        }
+
+        break;
+    case isa::OperandClass::Peek:
+        proc.writeMemory( proc.read( Special::Sp ), value );
+        break;
+    case isa::OperandClass::Pick:
+        proc.writeMemory( proc.read( Special::Sp ) + next( proc ), value );
+        break;
+    case isa::OperandClass::Sp:
+        proc.write( Special::Sp, value );
+        break;
+    case isa::OperandClass::Pc:
+        proc.write( Special::Pc, value );
+        break;
+    case isa::OperandClass::Ex:
+        proc.write( Special::Ex, value );
+        break;
+    case isa::OperandClass::Indirect:
+        proc.writeMemory( next( proc ), value );
+        break;
+    case isa::OperandClass::Direct:
+        // Storing to a literal has no effect, but the next word is still consumed.
+        next( proc );
+        break;
+    case isa::OperandClass::Literal:
+        // Nothing.
+        break;
     }
 }
 
-static Word fetchNextWord( ProcessorState& proc ) {
-    proc.tickClock( 1 );
+template <>
+optional<Register> decode( const Word& w ) {
+    if ( w < 8 ) {
+        return static_cast<Register>( w );
+    } else {
+        return {};
+    }
+}
 
-    auto pc = proc.read( Special::Pc );
-    proc.write( Special::Pc, pc + 1 );
-    return proc.memory()->read( pc );
+template <>
+optional<Opcode> decode( const Word& w ) {
+    if ( w < 0x20 && isa::OPCODES[w].isValid() ) {
+        return static_cast<Opcode>( w );
+    } else {
+        return {};
+    }
 }
 
-Word LongAddressingMode::next( ProcessorState& proc ) {
-    if ( ! _next ) {
-        _next = fetchNextWord( proc );
+template <>
+optional<SpecialOpcode> decode( const Word& w ) {
+    if ( w < 0x20 && isa::SPECIAL_OPCODES[w].isValid() ) {
+        return static_cast<SpecialOpcode>( w );
+    } else {
+        return {};
     }
+}
 
-    return *_next;
+void ProcessorState::execute( const DecodedInstruction& ins ) {
+    ins.handler( *this, ins );
+    tickClock( ins.cycles );
 }
 
-namespace mode {
+void ProcessorState::executeNext() {
+    // !!!
+    // dumpToLog( *this );
 
-Word RegisterIndirectOffset::load( ProcessorState& proc ) {
-    return proc.memory()->read( proc.read( reg ) + fetchNextWord( proc ) );
-}
+    // When fusing, the instruction is decoded along with any that follow it.
+    const FusedChain* chain = isFusing ? &chainAt( _pc ) : nullptr;
+    const auto& ins = chain ? *chain->leader : decodeCached( _memory->read( _pc ) );
 
-void RegisterIndirectOffset::store( ProcessorState& proc, Word value ) {
-    proc.memory()->write( proc.read( reg ) + fetchNextWord( proc ), value );
-}
+    if ( ins.kind == InstructionKind::Malformed ) {
+        setFault( Fault::MalformedInstruction, _memory->read( _pc ) );
+        _lastInstruction = nullptr;
+        return;
+    }
 
-void Push::store( ProcessorState& proc, Word value ) {
-    auto sp = proc.read( Special::Sp );
-    proc.memory()->write( sp - 1, value );
-    proc.write( Special::Sp, sp - 1 );
-}
+    ++_pc;
 
-Word Pop::load( ProcessorState& proc ) {
-    auto sp = proc.read( Special::Sp );
-    auto word = proc.memory()->read( sp );
-    proc.write( Special::Sp, sp + 1 );
+    if ( doSkip ) {
+        skip( *this, ins );
+        _lastInstruction = nullptr;
+        return;
+    }
 
-    return word;
-}
+    execute( ins );
+    _lastInstruction = &ins;
 
-Word Pick::load( ProcessorState& proc ) {
-    auto sp = proc.read( Special::Sp );
-    return proc.memory()->read( sp + next( proc ) );
+    if ( chain ) {
+        if ( chain->count != 0 ) {
+            fuse( *chain );
+        } else if ( ins.fusion == Fusion::BlockTransfer ) {
+            transfer( ins );
+        }
+    }
 }
 
-void Pick::store( ProcessorState& proc, Word value ) {
-    auto sp = proc.read( Special::Sp );
-    proc.memory()->write( sp + next( proc ), value );
-}
+// Execute the next instruction, and check if that ends the batch.
+optional<BatchEnd> ProcessorState::executeInBatch() {
+    Word address = _pc;
+    executeNext();
 
-Word Indirect::load( ProcessorState& proc ) {
-    return proc.memory()->read( next( proc ) );
+    if ( ! _lastInstruction ) {
+        if ( _fault != Fault::None ) {
+            return BatchEnd::Fault;
+        }
+
+        return {};
+    }
+
+    if ( _lastInstruction->kind == InstructionKind::Unary &&
+         _lastInstruction->specialOpcode() != SpecialOpcode::Jsr ) {
+        return BatchEnd::Special;
+    }
+
+    if ( _pc <= address && address - _pc < processor::MAX_LOOP_WORDS ) {
+        return BatchEnd::Loop;
+    }
+
+    return {};
 }
 
-void Indirect::store( ProcessorState& proc, Word value ) {
-    proc.memory()->write( next( proc ), value );
+void ProcessorState::setBreakpoint( Word address, bool isSet ) {
+    if ( _breakpoints.empty() ) {
+        _breakpoints.resize( 0x10000, false );
+    }
+
+    _breakpoints[address] = isSet;
 }
 
-Word Direct::load( ProcessorState& proc ) {
-    return next( proc );
+SnapshotPart ProcessorState::capture() const {
+    auto registers = _registers;
+    auto pc = _pc;
+    auto sp = _sp;
+    auto ex = _ex;
+    auto doSkip = this->doSkip;
+    auto clock = _clock;
+    auto fault = _fault;
+    auto faultWord = _faultWord;
+
+    return [=] ( SnapshotWriter& writer ) {
+        for ( auto value : registers ) {
+            writer.write( value );
+        }
+
+        writer.write( pc );
+        writer.write( sp );
+        writer.write( ex );
+        writer.write( doSkip );
+        writer.write( static_cast<std::int32_t>( clock ) );
+        writer.write( fault );
+        writer.write( faultWord );
+    };
 }
 
-void Direct::store( ProcessorState&, Word ) {
-    // Nothing.
+void ProcessorState::save( SnapshotWriter& writer ) const {
+    capture()( writer );
 }
 
+void ProcessorState::restore( SnapshotReader& reader ) {
+    for ( auto& value : _registers ) {
+        value = reader.read<Word>();
+    }
+
+    _pc = reader.read<Word>();
+    _sp = reader.read<Word>();
+    _ex = reader.read<Word>();
+    doSkip = reader.read<bool>();
+    _clock = reader.read<std::int32_t>();
+    _fault = reader.read<Fault>();
+    _faultWord = reader.read<Word>();
+    _lastInstruction = nullptr;
 }
 
-namespace instruction {
-
-void Unary::execute( ProcessorState& proc ) const {
-    Word loc;
-
-    switch ( opcode ) {
-    case SpecialOpcode::Int:
-    case SpecialOpcode::Iag:
-    case SpecialOpcode::Ias:
-    case SpecialOpcode::Rfi:
-    case SpecialOpcode::Iaq:
-    case SpecialOpcode::Hwn:
-    case SpecialOpcode::Hwq:
-    case SpecialOpcode::Hwi:
-        // Handled by the parent simulation.
-        break;
-    case SpecialOpcode::Jsr:
-        loc = address->load( proc );
-        mode::Push {}.store( proc, proc.read( Special::Pc ) );
-        proc.write( Special::Pc, loc );
-        break;
-    default:
-        assert( ! "Unary instruction is unsupported!" );
+namespace {
+
+inline bool mayWriteMemory( const DecodedInstruction& ins ) {
+    if ( ins.isConditional ) {
+        return false;
     }
 
-    proc.tickClock( SPECIAL_OPCODE_CYCLES.at( opcode ) );
+    switch ( isa::OPERANDS[ins.b].operandClass ) {
+    case isa::OperandClass::Register:
+    case isa::OperandClass::Sp:
+    case isa::OperandClass::Pc:
+    case isa::OperandClass::Ex:
+    case isa::OperandClass::Direct:
+    case isa::OperandClass::Literal:
+        return false;
+    default:
+        return true;
+    }
 }
 
-void Binary::execute( ProcessorState& proc ) const {
-    using namespace boost::phoenix::placeholders;
+}
 
-    auto load = [&proc]( std::shared_ptr<AddressingMode> addr ) {
-        return addr->load( proc );
-    };
+// A leader is decoded together with its followers, and they're only decoded
+// again once their page is written. Nothing has to be read or decoded to find
+// out that a leader has no followers.
+const ProcessorState::FusedChain& ProcessorState::decodeChain( Word address ) {
+    if ( _chains.empty() ) {
+        _chains.resize( processor::FUSION_CACHE_SIZE, FusedChain { 0, 0, 0, {}, nullptr, {} } );
 
-    auto store = [&proc]( std::shared_ptr<AddressingMode> addr, Word value ) {
-        addr->store( proc, value );
-    };
+        // Nothing has been decoded yet, so no entry can be for its own index.
+        for ( std::size_t i = 0; i < _chains.size(); ++i ) {
+            _chains[i].address = static_cast<Word>( i + 1 );
+        }
+    }
 
-    auto apply = [&] ( std::function<Word( Word, Word )> f ) {
-        auto y = load( addressA );
-        auto x = load( addressB );
+    auto& chain = _chains[address % processor::FUSION_CACHE_SIZE];
+    auto page = address / Memory::PAGE_SIZE;
 
-        store( addressB, f( x, y ) );
-    };
+    // Anything written after this is noticed, including while the chain is
+    // decoded.
+    chain.generation = _memory->generation();
+    chain.address = address;
+    chain.count = 0;
+    chain.writes = 0;
+    chain.leader = &decodeCached( _memory->read( address ) );
 
-    auto applyDouble = [&]( std::function<DoubleWord( DoubleWord, DoubleWord )> f,
-                            std::function<void( DoubleWord )> action ) {
-        auto yd = DoubleWord { load( addressA ) };
-        auto xd = DoubleWord { load( addressB ) };
-        auto zd = f( xd, yd );
+    auto fusion = chain.leader->fusion;
+    const auto* previous = chain.leader;
 
-        store( addressB, static_cast<Word>( zd ) );
-        action( zd );
-    };
+    if ( fusion == Fusion::BlockTransfer ) {
+        return chain;
+    }
 
-    auto applySigned = [&] ( std::function<SignedWord( SignedWord, SignedWord )> f ) {
-        auto yi = static_cast<SignedWord>( load( addressA ) );
-        auto xi = static_cast<SignedWord>( load( addressB ) );
-        auto zi = f( xi, yi );
-        store( addressB, static_cast<Word>( zi ) );
-    };
+    address += 1 + chain.leader->size;
 
-    auto skipUnless = [&] ( std::function<bool( Word, Word )> f ) {
-        auto y = load( addressA );
-        auto x = load( addressB );
+    while ( chain.count < chain.followers.size() && address / Memory::PAGE_SIZE == page ) {
+        const auto& next = decodeCached( _memory->read( address ) );
 
-        bool skip = ! f( x, y );
-        
-        if ( skip ) {
-            proc.tickClock( 1 );
+        if ( ! continuesFusion( next, fusion ) ) {
+            break;
         }
-        
-        proc.doSkip = skip;
-    };
 
-    auto skipUnlessSigned = [&] ( std::function<bool( SignedWord, SignedWord )> f ) {
-        auto y = load( addressA );
-        auto x = load( addressB );
+        if ( mayWriteMemory( *previous ) ) {
+            chain.writes |= 1u << chain.count;
+        }
 
-        bool skip = ! f( static_cast<SignedWord>( x ),
-                         static_cast<SignedWord>( y ) );
+        chain.followers[chain.count++] = &next;
+        address += 1 + next.size;
+        fusion = next.fusion;
+        previous = &next;
+    }
 
-        if ( skip ) {
-            proc.tickClock( 1 );
-        }
+    return chain;
+}
 
-        proc.doSkip = skip;
-    };
+void ProcessorState::fuse( const FusedChain& chain ) {
+    auto page = chain.address / Memory::PAGE_SIZE;
+    auto fusion = chain.leader->fusion;
 
-    DoubleWord xd, yd, zd;
-    SignedDoubleWord xdi, ydi, zdi;
+    for ( int n = 0; n < chain.count; ++n ) {
+        // The instruction just executed may have modified the ones that
+        // follow.
+        if ( (chain.writes & (1u << n)) && _memory->isPageChangedSince( page, chain.generation ) ) {
+            return;
+        }
 
-    switch ( opcode ) {
-    case Opcode::Set:
-        store( addressB, load( addressA ) );
-        break;
-    case Opcode::Add:
-        applyDouble( arg1 + arg2, [&proc] ( DoubleWord z ) {
-                if ( z > 0xffff ) {
-                    proc.write( Special::Ex, 1 );
-                } else {
-                    proc.write( Special::Ex, 0 );
-                }
-            });
-        break;
-    case Opcode::Sub:
-        applyDouble( arg1 - arg2, [&proc] ( DoubleWord z ) {
-                if ( z > 0xffff ) {
-                    proc.write( Special::Ex, 0xffff );
-                } else {
-                    proc.write( Special::Ex, 0 );
-                }
-            });
-        break;
-    case Opcode::Mul:
-        applyDouble( arg1 * arg2, [&proc] ( DoubleWord z ) {
-                proc.write( Special::Ex, (z >> 16) & 0xffff );
-            });
-        break;
-    case Opcode::Mli:
-        applySigned( arg1 * arg2 );
-        break;
-    case Opcode::Div:
-        yd = DoubleWord { load( addressA ) };
-        xd = DoubleWord { load( addressB ) };
-        
-        if ( yd == 0 ) {
-            zd = 0;
-            proc.write( Special::Ex, 0 );
-        } else {
-            zd = xd / yd;
-            proc.write( Special::Ex, ((xd << 16) / yd) & 0xffff );
+        if ( isStopped() ) {
+            return;
         }
 
-        store( addressB, static_cast<Word>( zd ) );
+        const auto& next = *chain.followers[n];
 
-        break;
-    case Opcode::Dvi:
-        applySigned( [] ( SignedWord xi, SignedWord yi ) {
-                return yi != 0 ? xi / yi : 0;
-            });
-        break;
-    case Opcode::Mod:
-        apply( [] ( Word x, Word y ) {
-                return y != 0 ? x % y : 0;
-            });
-        break;
-    case Opcode::Mdi:
-        applySigned( [] ( SignedWord xi, SignedWord yi ) {
-                return yi != 0 ? xi % yi : 0;
-            });
-        break;
-    case Opcode::And:
-        apply( arg1 & arg2 );
-        break;
-    case Opcode::Bor:
-        apply( arg1 | arg2 );
-        break;
-    case Opcode::Xor:
-        apply( arg1 ^ arg2 );
-        break;
-    case Opcode::Shr:
-        yd = DoubleWord { load( addressA ) };
-        xd = DoubleWord { load( addressB ) };
-        zd = xd >> yd;
+        ++_pc;
+        ++_fusionCounts[static_cast<std::size_t>( fusion )];
 
-        proc.write( Special::Ex, ((xd << 16) >> yd) & 0xffff );
-        store( addressB, static_cast<Word>( zd ) );
+        // Only a failed test leads here. The jump that follows it isn't
+        // conditional, so skipping ends with it.
+        if ( doSkip ) {
+            skip( *this, next );
+            _lastInstruction = nullptr;
+            return;
+        }
 
-        break;
-    case Opcode::Asr:
-        ydi = SignedDoubleWord { load( addressA ) };
-        xdi = SignedDoubleWord { load( addressB ) };
-        zdi = xdi >> ydi;
-        
-        proc.write( Special::Ex, ((xdi << 16) >> ydi) & 0xffff );
-        store( addressB, static_cast<Word>( zdi ) );
+        execute( next );
+        _lastInstruction = &next;
+        fusion = next.fusion;
+    }
+}
 
-        break;
-    case Opcode::Shl:
-        yd = DoubleWord { load( addressA ) };
-        xd = DoubleWord { load( addressB ) };
-        zd = xd << yd;
-        
-        proc.write( Special::Ex, ((xd << yd) >> 16) & 0xffff );
-        store( addressB, static_cast<Word>( zd ) );
+namespace {
 
-        break;
-    case Opcode::Ifb:
-        skipUnless( (arg1 & arg2) != 0 );
-        break;
-    case Opcode::Ifc:
-        skipUnless( (arg1 & arg2) == 0 );
-        break;
-    case Opcode::Ife:
-        skipUnless( arg1 == arg2 );
-        break;
-    case Opcode::Ifn:
-        skipUnless( arg1 != arg2 );
-        break;
-    case Opcode::Ifg:
-        skipUnless( arg1 > arg2 );
-        break;
-    case Opcode::Ifa:
-        skipUnlessSigned( arg1 > arg2 );
-        break;
-    case Opcode::Ifl:
-        skipUnless( arg1 < arg2 );
-        break;
-    case Opcode::Ifu:
-        skipUnlessSigned( arg1 < arg2 );
-        break;
-    case Opcode::Adx:
-        applyDouble( [&proc] ( DoubleWord x, DoubleWord y ) {
-                return x + y + proc.read( Special::Ex );
-            }, [&proc] ( DoubleWord z ) {
-                proc.write( Special::Ex, z > 0xffff ? 1 : 0 );
-            } );
-        break;
-    case Opcode::Sbx:
-        applyDouble( [&proc] ( DoubleWord x, DoubleWord y ) {
-                return x - y + proc.read( Special::Ex );
-            }, [&proc] ( DoubleWord z ) {
-                proc.write( Special::Ex, z > 0xffff ? 1 : 0 );
-            } );
-        break;
-    case Opcode::Sti:
-        store( addressB, load( addressA ) );
-        proc.write( Register::I, proc.read( Register::I ) + 1 );
-        proc.write( Register::J, proc.read( Register::J ) + 1 );
-        break;
-    case Opcode::Std:
-        store( addressB, load( addressA ) );
-        proc.write( Register::I, proc.read( Register::I ) - 1 );
-        proc.write( Register::J, proc.read( Register::J ) - 1 );
-        break;
-    }
+// Operands of a block transfer that never access memory.
+inline bool isImmediate( std::uint8_t code ) {
+    auto operandClass = isa::OPERANDS[code].operandClass;
 
-    // Tick the clock the appropriate number of times.
-    proc.tickClock( OPCODE_CYCLES.at( opcode ) );
+    return operandClass == isa::OperandClass::Register ||
+        operandClass == isa::OperandClass::Direct ||
+        operandClass == isa::OperandClass::Literal;
 }
 
 }
 
-template <>
-optional<Register> decode( const Word &w ) {
-    switch ( w ) {
-    case 0: return Register::A;
-    case 1: return Register::B;
-    case 2: return Register::C;
-    case 3: return Register::X;
-    case 4: return Register::Y;
-    case 5: return Register::Z;
-    case 6: return Register::I;
-    case 7: return Register::J;
-    default: return {};
+// The loop is recognized only after the first STI or STD has executed, so
+// that the test and the jump are read after it has written memory. The
+// remaining iterations are then counted from the registers and the test, and
+// executed as one copy or fill of memory, with the same effects (and cycles)
+// as executing each instruction.
+//
+// Iterations stop at the beginning of the loop when they would write to the
+// loop itself, and before the test when the batch ends. A breakpoint anywhere
+// in the loop prevents the transfer.
+void ProcessorState::transfer( const DecodedInstruction& leader ) {
+    Word start = _pc - 1 - leader.size;
+    Word testAddress = _pc;
+
+    // The leader may have overwritten itself.
+    if ( &decodeCached( _memory->read( start ) ) != &leader ) {
+        return;
     }
-}
 
-template <>
-optional<Opcode> decode( const Word& w ) {
-    switch ( w ) {
-    case 0x01: return Opcode::Set;
-    case 0x02: return Opcode::Add;
-    case 0x03: return Opcode::Sub;
-    case 0x04: return Opcode::Mul;
-    case 0x05: return Opcode::Mli;
-    case 0x06: return Opcode::Div;
-    case 0x07: return Opcode::Dvi;
-    case 0x08: return Opcode::Mod;
-    case 0x09: return Opcode::Mdi;
-    case 0x0a: return Opcode::And;
-    case 0x0b: return Opcode::Bor;
-    case 0x0c: return Opcode::Xor;
-    case 0x0d: return Opcode::Shr;
-    case 0x0e: return Opcode::Asr;
-    case 0x0f: return Opcode::Shl;
-    case 0x10: return Opcode::Ifb;
-    case 0x11: return Opcode::Ifc;
-    case 0x12: return Opcode::Ife;
-    case 0x13: return Opcode::Ifn;
-    case 0x14: return Opcode::Ifg;
-    case 0x15: return Opcode::Ifa;
-    case 0x16: return Opcode::Ifl;
-    case 0x17: return Opcode::Ifu;
-    case 0x1a: return Opcode::Adx;
-    case 0x1b: return Opcode::Sbx;
-    case 0x1e: return Opcode::Sti;
-    case 0x1f: return Opcode::Std;
-    default: return {};
-    }
-}
+    const auto& test = decodeCached( _memory->read( testAddress ) );
 
-template <>
-optional<SpecialOpcode> decode( const Word& w ) {
-    switch ( w ) {
-    case 0x01: return SpecialOpcode::Jsr;
-    case 0x08: return SpecialOpcode::Int;
-    case 0x09: return SpecialOpcode::Iag;
-    case 0x0a: return SpecialOpcode::Ias;
-    case 0x0b: return SpecialOpcode::Rfi;
-    case 0x10: return SpecialOpcode::Hwn;
-    case 0x11: return SpecialOpcode::Hwq;
-    case 0x12: return SpecialOpcode::Hwi;
-    default: return {};
+    if ( test.kind != InstructionKind::Binary ||
+         ! test.isConditional ||
+         ! isImmediate( test.a ) ||
+         ! isImmediate( test.b ) ) {
+        return;
     }
-}
 
-static std::shared_ptr<AddressingMode>
-decodeRegisterDirect( Word w ) {
-    auto reg = decode<Register>( w );
+    Word jumpAddress = testAddress + 1 + test.size;
+    const auto& jump = decodeCached( _memory->read( jumpAddress ) );
 
-    if ( reg ) {
-        return std::make_shared<mode::RegisterDirect>( *reg );
-    } else {
-        return nullptr;
+    if ( jump.kind != InstructionKind::Binary ||
+         jump.binaryOpcode() != Opcode::Set ||
+         isa::OPERANDS[jump.b].operandClass != isa::OperandClass::Pc ||
+         ! isImmediate( jump.a ) ||
+         isa::OPERANDS[jump.a].operandClass == isa::OperandClass::Register ) {
+        return;
     }
-}
 
-static std::shared_ptr<AddressingMode>
-decodeRegisterIndirect( Word w ) {
-    auto reg = decode<Register>( w - 0x8 );
+    Word end = jumpAddress + 1 + jump.size;
 
-    if ( reg ) {
-        return std::make_shared<mode::RegisterIndirect>( *reg );
-    } else {
-        return nullptr;
-    }
-}
+    // Operand a has its next word first.
+    auto nextWords = [this] ( Word address, const DecodedInstruction& ins, Word& a, Word& b ) {
+        if ( isa::OPERANDS[ins.a].size != 0 ) {
+            a = _memory->read( ++address );
+        }
 
-static std::shared_ptr<AddressingMode>
-decodeRegisterIndirectOffset( Word w ) {
-    auto reg = decode<Register>( w - 0x10 );
+        if ( isa::OPERANDS[ins.b].size != 0 ) {
+            b = _memory->read( ++address );
+        }
+    };
 
-    if ( reg ) {
-        return std::make_shared<mode::RegisterIndirectOffset>( *reg );
-    } else {
-        return nullptr;
-    }
-}
+    Word leaderA = 0, leaderB = 0, testA = 0, testB = 0, jumpA = 0, jumpB = 0;
+    nextWords( start, leader, leaderA, leaderB );
+    nextWords( testAddress, test, testA, testB );
+    nextWords( jumpAddress, jump, jumpA, jumpB );
 
-static
-std::shared_ptr<AddressingMode>
-decodeFastDirect( Word w ) {
-    Word value;
+    int step = leader.binaryOpcode() == Opcode::Sti ? 1 : -1;
 
-    if ( w >= 0x20 && w <= 0x3f ) {
-        if ( w == 0x20 ) {
-            value = 0xffff;
-        } else {
-            value = w - 0x21;
+    auto isMoving = [] ( Register reg ) { return reg == Register::I || reg == Register::J; };
+
+    // The value of an operand in iteration `n`, once I and J have moved `n`
+    // times.
+    auto value = [this, step, &isMoving] ( std::uint8_t code, Word next, int n ) -> Word {
+        const auto& spec = isa::OPERANDS[code];
+
+        switch ( spec.operandClass ) {
+        case isa::OperandClass::Register: {
+            auto reg = static_cast<Register>( spec.value );
+            return read( reg ) + (isMoving( reg ) ? static_cast<Word>( n * step ) : 0);
+        }
+        case isa::OperandClass::Direct: return next;
+        default: return spec.value;
         }
+    };
 
-        return std::make_shared<mode::FastDirect>( value );
+    if ( value( jump.a, jumpA, 0 ) != start ) {
+        return;
     }
 
-    return nullptr;
-}
+    for ( Word address = start; address != end; ++address ) {
+        if ( isBreakpoint( address ) ) {
+            return;
+        }
+    }
 
-template <typename T>
-static std::function<std::shared_ptr<T>( Word )>
-decoderByValue( Word value ) {
-    return [value]( Word w ) -> std::shared_ptr<T> {
-        if ( w == value ) {
-            return std::make_shared<T>();
-        } else {
-            return nullptr;
+    auto target = static_cast<Register>( isa::OPERANDS[leader.b].value );
+    auto source = static_cast<Register>( isa::OPERANDS[leader.a].value );
+    bool isCopy = isa::OPERANDS[leader.a].operandClass == isa::OperandClass::RegisterIndirect;
+
+    auto& fusionCount = _fusionCounts[static_cast<std::size_t>( Fusion::BlockTransfer )];
+
+    // Iterations that can't be counted in advance, or that have wait states
+    // that vary, are executed one at a time.
+    auto transferEach = [&] () {
+        Word wordStep = static_cast<Word>( step );
+
+        while ( ! isStopped() ) {
+            fusionCount += 2;
+
+            if ( ! passesTest( test.binaryOpcode(), value( test.b, testB, 0 ), value( test.a, testA, 0 ) ) ) {
+                tickClock( test.cycles + 1 + 1 );
+                _pc = end;
+                _lastInstruction = nullptr;
+                return;
+            }
+
+            tickClock( test.cycles + jump.cycles );
+            _pc = start;
+            _lastInstruction = &jump;
+
+            Word location = read( target );
+
+            if ( static_cast<Word>( location - start ) < static_cast<Word>( end - start ) ) {
+                return;
+            }
+
+            Word word = isCopy ? readMemory( read( source ) ) : value( leader.a, leaderA, 0 );
+            writeMemory( location, word );
+            write( Register::I, read( Register::I ) + wordStep );
+            write( Register::J, read( Register::J ) + wordStep );
+
+            tickClock( leader.cycles );
+            _pc = start + 1 + leader.size;
+            _lastInstruction = &leader;
+            ++fusionCount;
         }
     };
-}
 
-std::shared_ptr<AddressingMode>
-decodeAddress( AddressContext context, Word word ) {
-    std::shared_ptr<AddressingMode> addr = nullptr;
-
-    auto decodePush = decoderByValue<mode::Push>( 0x18 );
-    auto decodePop = decoderByValue<mode::Pop>( 0x18 );
-    auto decodePeek = decoderByValue<mode::Peek>( 0x19 );
-    auto decodePick = decoderByValue<mode::Pick>( 0x1a );
-    auto decodeSp = decoderByValue<mode::Sp>( 0x1b );
-    auto decodePc = decoderByValue<mode::Pc>( 0x1c );
-    auto decodeEx = decoderByValue<mode::Ex>( 0x1d );
-    auto decodeIndirect = decoderByValue<mode::Indirect>( 0x1e );
-    auto decodeDirect = decoderByValue<mode::Direct>( 0x1f );
-
-#define TRY( f ) addr = f( word ); if ( addr ) return addr;
-
-    if ( context == AddressContext::A ) {
-        TRY( decodePop );
-        TRY( decodeFastDirect );
-    }
-
-    if ( context == AddressContext::B ) {
-        TRY( decodePush );
-    }
-
-    TRY( decodeRegisterDirect );
-    TRY( decodeRegisterIndirect );
-    TRY( decodeRegisterIndirectOffset );
-    TRY( decodePush );
-    TRY( decodePeek );
-    TRY( decodePick );
-    TRY( decodeSp );
-    TRY( decodePc );
-    TRY( decodeEx );
-    TRY( decodeIndirect );
-    TRY( decodeDirect );
-    
-#undef TRY
+    // Only writes through I or J can be counted, and a fill needs a value
+    // that doesn't change.
+    if ( ! isMoving( target ) ||
+         (isCopy && ! isMoving( source )) ||
+         (! isCopy && isa::OPERANDS[leader.a].operandClass == isa::OperandClass::Register &&
+          isMoving( source )) ) {
+        transferEach();
+        return;
+    }
 
-    return {};
-}
+    Word location = read( target );
+    Word from = read( source );
 
-static std::shared_ptr<Instruction>
-decodeBinaryInstruction( Word word ) {
-    auto opcode = decode<Opcode>( word & 0x1f );
-    if ( ! opcode ) return nullptr;
+    // The iteration that would write to the loop.
+    int loopIteration;
+    {
+        Word offset = location - start;
+        Word size = end - start;
 
-    auto addrA = decodeAddress( AddressContext::A, (word & 0xfc00) >> 10 );
-    if ( ! addrA ) return nullptr;
+        if ( offset < size ) {
+            loopIteration = 0;
+        } else {
+            loopIteration = step == 1 ? Memory::SIZE - offset : offset - size + 1;
+        }
+    }
 
-    auto addrB = decodeAddress( AddressContext::B, (word & 0x3e0) >> 5 );
-    if ( ! addrB ) return nullptr;
+    // The first iteration whose test fails, if any before `loopIteration`.
+    int failedIteration = loopIteration + 1;
 
-    return std::make_shared<instruction::Binary>( *opcode, addrB, addrA );
-}
+    if ( test.binaryOpcode() == Opcode::Ifn &&
+         isa::OPERANDS[test.a].operandClass != isa::OperandClass::Register ) {
+        Word x = value( test.b, testB, 0 );
+        Word y = value( test.a, testA, 0 );
+        bool isXMoving = isa::OPERANDS[test.b].operandClass == isa::OperandClass::Register &&
+            isMoving( static_cast<Register>( isa::OPERANDS[test.b].value ) );
 
-static std::shared_ptr<Instruction>
-decodeUnaryInstruction( Word word ) {
-    auto opcode = decode<SpecialOpcode>( (word & 0x3e0) >> 5 );
-    if ( ! opcode ) return nullptr;
+        if ( ! isXMoving ) {
+            failedIteration = x == y ? 0 : failedIteration;
+        } else {
+            failedIteration = std::min<int>( failedIteration, static_cast<Word>( (y - x) * step ) );
+        }
+    } else {
+        for ( int n = 0; n <= loopIteration; ++n ) {
+            if ( ! passesTest( test.binaryOpcode(), value( test.b, testB, n ), value( test.a, testA, n ) ) ) {
+                failedIteration = n;
+                break;
+            }
+        }
+    }
 
-    auto addr = decodeAddress( AddressContext::A, (word & 0xfc00) >> 10 );
-    if ( ! addr ) return nullptr;
+    int count = std::min( failedIteration, loopIteration );
 
-    return std::make_shared<instruction::Unary>( *opcode, addr );
-}
+    // Blocks of `size` words from iteration `n` onwards, which go backwards
+    // from `base` for STD.
+    auto blockAt = [step] ( Word base, int n, int size ) -> Word {
+        return step == 1 ? base + n : base - n - size + 1;
+    };
 
-std::shared_ptr<Instruction> decodeInstruction( Word word ) {
-    auto bins = decodeBinaryInstruction( word );
-    if ( bins ) return bins;
+    auto writeWaitStates = _memory->blockWaitStates( blockAt( location, 0, count ), count );
+    auto readWaitStates = isCopy ?
+        _memory->blockWaitStates( blockAt( from, 0, count ), count ) :
+        optional<WaitStates>( WaitStates { 0, 0 } );
 
-    auto uins = decodeUnaryInstruction( word );
-    if ( uins ) return uins;
+    if ( ! writeWaitStates || ! readWaitStates ) {
+        transferEach();
+        return;
+    }
 
-    return nullptr;
-}
+    int iterationCycles = test.cycles + jump.cycles + leader.cycles +
+        writeWaitStates->write + (isCopy ? readWaitStates->read : 0);
 
-static std::shared_ptr<Instruction> fetchNextInstruction( ProcessorState& proc ) {
-    auto word = fetchNextWord( proc );
-    auto ins = decodeInstruction( word );
+    // Iterations that begin before the batch ends.
+    int budget = std::numeric_limits<int>::max();
 
-    if ( ins ) {
-        return ins;
-    } else {
-        throw error::MalformedInstruction { word };
+    if ( _limit ) {
+        if ( _limit->isInterrupted( _limit->context ) || _clock >= _limit->clock ) {
+            budget = 0;
+        } else {
+            budget = (_limit->clock - _clock + iterationCycles - 1) / iterationCycles;
+        }
     }
-}
 
-void ProcessorState::executeNext() {
-    // !!!
-    // dumpToLog( *this );
+    int n = std::min( count, budget );
 
-    auto ins = fetchNextInstruction( *this );
+    if ( n != 0 ) {
+        Word destination = blockAt( location, 0, n );
 
-    if ( doSkip ) {
-        advance( *this, ins->size() );
+        // Where the destination is ahead of the source, every iteration
+        // after the first `ahead` copies a word that was already copied, so
+        // the words repeat. Both this and a fill double the block copied each
+        // time.
+        Word ahead = static_cast<Word>( (location - from) * step );
+        int done;
 
-        // If it's a conditional instruction, then continue skipping at the cost of
-        // of one cycle.
-        if ( ins->isConditional() ) {
-            tickClock( 1 );
+        if ( isCopy && (ahead == 0 || ahead >= n) ) {
+            _memory->copyBlock( destination, blockAt( from, 0, n ), n );
+            done = n;
+        } else if ( isCopy ) {
+            _memory->copyBlock( blockAt( location, 0, ahead ), blockAt( from, 0, ahead ), ahead );
+            done = ahead;
         } else {
-            doSkip = false;
+            Word word = value( leader.a, leaderA, 0 );
+            _memory->writeBlock( blockAt( location, 0, 1 ), &word, 1 );
+            done = 1;
         }
+
+        while ( done < n ) {
+            int size = std::min( done, n - done );
+            _memory->copyBlock( blockAt( location, done, size ), blockAt( location, 0, size ), size );
+            done += size;
+        }
+
+        write( Register::I, read( Register::I ) + static_cast<Word>( n * step ) );
+        write( Register::J, read( Register::J ) + static_cast<Word>( n * step ) );
+        tickClock( n * iterationCycles );
+        _lastInstruction = &leader;
+    }
+
+    fusionCount += 3 * n;
+
+    if ( n == budget ) {
+        _pc = testAddress;
+    } else if ( n == failedIteration ) {
+        // The failed test, and then skipping the jump.
+        tickClock( test.cycles + 1 + 1 );
+        _pc = end;
+        _lastInstruction = nullptr;
+        fusionCount += 2;
     } else {
-        ins->execute( *this );
-        _lastInstruction = ins;
+        tickClock( test.cycles + jump.cycles );
+        _pc = start;
+        _lastInstruction = &jump;
+        fusionCount += 2;
+    }
+}
+
+const char* fusionName( Fusion fusion ) noexcept {
+    switch ( fusion ) {
+    case Fusion::None: return "none";
+    case Fusion::ConditionalJump: return "conditional jump";
+    case Fusion::PushRun: return "push run";
+    case Fusion::PopRun: return "pop run";
+    case Fusion::ExcessTest: return "excess test";
+    case Fusion::BlockTransfer: return "block transfer";
     }
+
+    return "";
 }
 
 void advance( ProcessorState& proc, int numWords ) {
@@ -608,6 +669,19 @@ void advance( ProcessorState& proc, int numWords ) {
     proc.write( Special::Pc, pc + numWords );
 }
 
+void skip( ProcessorState& proc, const DecodedInstruction& ins ) {
+    advance( proc, ins.size );
+    proc.tickClock( 1 );
+
+    // If it's a conditional instruction, then continue skipping at the cost of
+    // of one cycle.
+    if ( ins.isConditional ) {
+        proc.tickClock( 1 );
+    } else {
+        proc.doSkip = false;
+    }
+}
+
 void dumpToLog( ProcessorState& proc ) {
     LOG( PSTATE, info ) << "\n";
     LOG( PSTATE, info ) << format( "PC    : 0x%04x" ) % proc.read( Special::Pc );
@@ -622,6 +696,7 @@ void dumpToLog( ProcessorState& proc ) {
     LOG( PSTATE, info ) << format( "I     : 0x%04x" ) % proc.read( Register::I );
     LOG( PSTATE, info ) << format( "J     : 0x%04x" ) % proc.read( Register::J );
     LOG( PSTATE, info ) << format( "skip  : %s" ) % proc.doSkip;
+    LOG( PSTATE, info ) << "next  : " << isa::disassemble( *proc.memory(), proc.read( Special::Pc ) ).first;
 
     std::stringstream stackContents;
     const int STACK_SIZE = processor::STACK_BEGIN - proc.read( Special::Sp );
@@ -646,6 +721,14 @@ void dumpToLog( ProcessorState& proc ) {
     }
 
     LOG( PSTATE, info ) << "stack : " << stackContents.str();
+
+    for ( std::size_t i = 1; i < NUM_FUSIONS; ++i ) {
+        auto fusion = static_cast<Fusion>( i );
+
+        if ( proc.fusionCount( fusion ) != 0 ) {
+            LOG( PSTATE, info ) << format( "fused : %d (%s)" ) % proc.fusionCount( fusion ) % fusionName( fusion );
+        }
+    }
     LOG( PSTATE, info ) << "\n";
 }
 
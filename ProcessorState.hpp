@@ -16,13 +16,16 @@
 
 #pragma once
 
+#include "Isa.hpp"
 #include "Memory.hpp"
+#include "Snapshot.hpp"
 
 #include <array>
+#include <cstddef>
 #include <cstdint>
-#include <map>
 #include <memory>
 #include <stdexcept>
+#include <vector>
 
 DEFINE_LOGGER( PSTATE, "ProcessorState" )
 
@@ -79,349 +82,460 @@ public:
 
 }
 
-// Forward declaration.
-class Instruction;
+// Sequences of instructions that are executed as single operations when
+// fusion is enabled. Each instruction is classified when it is decoded by the
+// fusion it can begin, and the fusions it can continue.
+enum class Fusion : std::uint8_t {
+    None,
 
-class ProcessorState final {
-    std::array<Word, 8> _registers;
-    Word _pc;
-    Word _sp;
-    Word _ex;
+    // IFx followed by SET PC, label.
+    ConditionalJump,
 
-    int _clock;
-    std::shared_ptr<Instruction> _lastInstruction { nullptr };
+    // Runs of SET PUSH, x.
+    PushRun,
 
-    std::shared_ptr<Memory> _memory = nullptr;
+    // Runs of SET x, POP (which may end with SET PC, POP).
+    PopRun,
 
-    using RegisterIndex = decltype( _registers )::size_type;
-    static inline RegisterIndex registerIndex( Register reg ) noexcept {
-        return static_cast<RegisterIndex>( reg );
-    }
+    // ADD or SUB followed by IFx testing EX.
+    ExcessTest,
 
-public:
-    explicit ProcessorState( std::shared_ptr<Memory> memory ) :
-        _registers { { 0, 0, 0, 0, 0, 0, 0, 0 } },
-        _pc { 0 },
-        _sp { processor::STACK_BEGIN },
-        _ex { 0 },
-        _clock { 0 },
-        _memory { memory } {}
+    // Loops that copy or fill memory, like
+    //
+    //     :loop STI [I], [J]
+    //           IFN I, end
+    //           SET PC, loop
+    //
+    // which are executed for as many iterations as possible at once.
+    BlockTransfer
+};
 
-    bool doSkip { false };
+constexpr std::size_t NUM_FUSIONS = 6;
 
-    Word read( Register reg ) const noexcept;
-    Word read( Special spec ) const noexcept;
+const char* fusionName( Fusion fusion ) noexcept;
 
-    void write( Register reg, Word val ) noexcept;
-    void write( Special spec, Word val ) noexcept;
+namespace processor {
 
-    inline int clock() const noexcept { return _clock; }
-    inline void tickClock( int ticks ) noexcept { _clock += ticks; }
-    inline void clearClock() noexcept { _clock = 0; }
+// No more than this many instructions are executed as one operation, except
+// for block transfers, which stop only where a batch would.
+const int MAX_FUSED_INSTRUCTIONS = 8;
 
-    inline Memory* memory() noexcept { return _memory.get(); }
+// Instructions decoded along with the ones they're fused with are remembered
+// for this many addresses at a time.
+const std::size_t FUSION_CACHE_SIZE = 1024;
 
-    const Instruction* lastInstruction() const noexcept { return _lastInstruction.get(); }
+// Jumps backwards by less than this many words may close an idle loop (see
+// `IdleLoop`), so they end a batch of instructions.
+const int MAX_LOOP_WORDS = 12;
 
-    void executeNext();
-};
+}
 
-class AddressingMode {
-public:
-    virtual Word load( ProcessorState& proc ) = 0;
-    virtual void store( ProcessorState& proc, Word value ) = 0;
-    
-    virtual int size() const noexcept { return 0; }
+// Errors that stop the processor. They are recorded in its state instead of
+// being thrown, so that executing instructions never throws.
+enum class Fault : std::uint8_t {
+    None,
 
-    virtual ~AddressingMode() = default;
+    // An instruction word that doesn't decode to an instruction (see
+    // `ProcessorState::faultWord`).
+    MalformedInstruction,
+
+    // Too many interrupts were queued at once.
+    CaughtFire
 };
 
-class LongAddressingMode : public AddressingMode {
-    optional<Word> _next {};
-public:
-    explicit LongAddressingMode() : AddressingMode {} {}
+// Why `ProcessorState::executeBatch` stopped.
+enum class BatchEnd : std::uint8_t {
+    // The cycle budget was used up.
+    Budget,
 
-    Word next( ProcessorState& proc );
+    // There is an interrupt to handle before the next instruction.
+    Interrupt,
+
+    // A special instruction (other than JSR) was executed, and the simulation
+    // must carry it out.
+    Special,
 
-    virtual int size() const noexcept override { return 1; };
+    // The next instruction is at a breakpoint.
+    Breakpoint,
 
-    virtual ~LongAddressingMode() = default;
+    // The processor faulted, and can't continue.
+    Fault,
+
+    // An instruction jumped a short distance backwards, or to itself (see
+    // `processor::MAX_LOOP_WORDS`). The processor may have halted in an idle
+    // loop.
+    Loop
 };
 
-namespace mode {
+struct BatchResult {
+    BatchEnd end;
+    int cycles;
+};
 
-struct RegisterDirect final : public AddressingMode {
-    Register reg;
+// How the simulation executes instructions (see `Processor`).
+enum class ExecutionMode {
+    // Instructions are executed one at a time by `ProcessorState`.
+    Interpreted,
 
-    explicit RegisterDirect( Register reg ) : reg { reg } {}
+    // Instructions are dispatched by computed jumps from a loop specialized
+    // for the simulation. This is only supported by GCC and Clang; elsewhere
+    // it falls back to the interpreter.
+    Threaded,
 
-    virtual Word load( ProcessorState& proc ) override { return proc.read( reg ); }
-    virtual void store( ProcessorState& proc, Word value ) override { proc.write( reg, value ); }
+    // Code is compiled to native code (see `Jit`). If the compiler isn't
+    // available, then this falls back to the threaded mode.
+    Compiled
 };
 
-struct RegisterIndirect final : public AddressingMode {
-    Register reg;
-
-    explicit RegisterIndirect( Register reg ) : reg { reg } {}
+// Forward declaration.
+struct DecodedInstruction;
 
-    inline virtual Word load( ProcessorState& proc ) override {
-        return proc.memory()->read( proc.read( reg ) );
-    }
+class ProcessorState final {
+    std::array<Word, 8> _registers;
+    Word _pc;
+    Word _sp;
+    Word _ex;
 
-    inline virtual void store( ProcessorState& proc, Word value ) override {
-        proc.memory()->write( proc.read( reg ), value );
-    }
-};
+    int _clock;
+    const DecodedInstruction* _lastInstruction { nullptr };
 
-struct RegisterIndirectOffset final : public LongAddressingMode {
-    Register reg;
+    Fault _fault { Fault::None };
+    Word _faultWord { 0 };
 
-    explicit RegisterIndirectOffset( Register reg ) :
-        LongAddressingMode {},
-        reg { reg } {}
+    // How many times each fusion has joined an instruction to the one
+    // before it.
+    std::array<std::uint64_t, NUM_FUSIONS> _fusionCounts {};
 
-    virtual Word load( ProcessorState& proc ) override;
-    virtual void store( ProcessorState& proc, Word value ) override;
-};
+    std::shared_ptr<Memory> _memory = nullptr;
 
-struct Push final : public AddressingMode {
-    inline virtual Word load( ProcessorState& ) override {
-        assert( ! "Attempt to load from a 'push' address!" );
-        return 0;
+    using RegisterIndex = decltype( _registers )::size_type;
+    static inline RegisterIndex registerIndex( Register reg ) noexcept {
+        return static_cast<RegisterIndex>( reg );
     }
 
-    virtual void store( ProcessorState& proc, Word value ) override;
-};
+    // Addresses where batches stop, or empty if there are none.
+    std::vector<bool> _breakpoints {};
+
+    // Where the batch being executed stops: once the clock reaches `clock`,
+    // or when there's an interrupt to handle.
+    struct BatchLimit {
+        int clock;
+        bool (*isInterrupted)( void* context );
+        void* context;
+    };
 
-struct Pop final : public AddressingMode {
-    virtual Word load( ProcessorState& proc ) override;
+    // Fused instructions stop where executing them one at a time would end
+    // the batch, if there is one.
+    const BatchLimit* _limit { nullptr };
 
-    virtual void store( ProcessorState&, Word ) override {
-        assert( ! "Attempt to store to a 'pop' address!" );
+    template <typename IsInterrupted>
+    static bool callInterrupted( void* context ) {
+        return (*static_cast<IsInterrupted*>( context ))();
     }
-};
 
-struct Peek final : public AddressingMode {
-    inline virtual Word load( ProcessorState& proc ) override {
-        return proc.memory()->read( proc.read( Special::Sp ) );
+    // Whether fused execution stops before the instruction at PC.
+    inline bool isStopped() const {
+        if ( ! doSkip && isBreakpoint( _pc ) ) {
+            return true;
+        }
+
+        return _limit && (_clock >= _limit->clock || _limit->isInterrupted( _limit->context ));
     }
 
-    inline virtual void store( ProcessorState& proc, Word value ) override {
-        proc.memory()->write( proc.read( Special::Sp ), value );
+    // The instruction at `address` and the instructions that continue the
+    // fusion it begins, as they were decoded at `generation`. Only
+    // instructions on the same page are included.
+    //
+    // Bit `n` of `writes` is set when the instruction before follower `n`
+    // might write to memory.
+    struct FusedChain {
+        Word address;
+        std::uint8_t count;
+        std::uint8_t writes;
+        Memory::Generation generation;
+        const DecodedInstruction* leader;
+        std::array<const DecodedInstruction*, processor::MAX_FUSED_INSTRUCTIONS - 1> followers;
+    };
+
+    // Indexed by address, or empty until something is first fused.
+    std::vector<FusedChain> _chains {};
+
+    // The chain of the instruction last decoded by `decodeNext`, when fusing.
+    const FusedChain* _chain { nullptr };
+
+    inline bool isCurrent( const FusedChain& chain, Word address ) const noexcept {
+        return chain.address == address &&
+            ! _memory->isPageChangedSince( address / Memory::PAGE_SIZE, chain.generation );
     }
-};
 
-struct Pick final : public LongAddressingMode {
-    explicit Pick() : LongAddressingMode {} {}
+    const FusedChain& decodeChain( Word address );
 
-    virtual Word load( ProcessorState& proc ) override;
-    virtual void store( ProcessorState& proc, Word value ) override;
-};
+    inline const FusedChain& chainAt( Word address ) {
+        if ( ! _chains.empty() ) {
+            const auto& chain = _chains[address % processor::FUSION_CACHE_SIZE];
 
-struct Sp final : public AddressingMode {
-    virtual inline Word load( ProcessorState& proc ) override {
-        return proc.read( Special::Sp );
-    }
+            if ( isCurrent( chain, address ) ) {
+                return chain;
+            }
+        }
 
-    virtual inline void store( ProcessorState& proc, Word value ) override {
-        proc.write( Special::Sp, value );
+        return decodeChain( address );
     }
-};
 
-struct Pc final : public AddressingMode {
-    virtual inline Word load( ProcessorState& proc ) override {
-        return proc.read( Special::Pc );
-    }
+    void fuse( const FusedChain& chain );
 
-    virtual inline void store( ProcessorState& proc, Word value ) override {
-        proc.write( Special::Pc, value );
-    }
-};
+    void execute( const DecodedInstruction& ins );
+    void transfer( const DecodedInstruction& leader );
+    optional<BatchEnd> executeInBatch();
+public:
+    explicit ProcessorState( std::shared_ptr<Memory> memory ) :
+        _registers { { 0, 0, 0, 0, 0, 0, 0, 0 } },
+        _pc { 0 },
+        _sp { processor::STACK_BEGIN },
+        _ex { 0 },
+        _clock { 0 },
+        _memory { memory } {}
+
+    bool doSkip { false };
+
+    // Whether `executeNext` executes fused sequences of instructions at once.
+    bool isFusing { false };
 
-struct Ex final : public AddressingMode {
-    virtual inline Word load( ProcessorState& proc ) override {
-        return proc.read( Special::Ex );
+    inline Word read( Register reg ) const noexcept { return _registers[registerIndex( reg )]; }
+    inline Word read( Special spec ) const noexcept;
+
+    inline void write( Register reg, Word val ) noexcept { _registers[registerIndex( reg )] = val; }
+    inline void write( Special spec, Word val ) noexcept;
+
+    inline int clock() const noexcept { return _clock; }
+    inline void tickClock( int ticks ) noexcept { _clock += ticks; }
+    inline void clearClock() noexcept { _clock = 0; }
+
+    inline Memory* memory() noexcept { return _memory.get(); }
+
+    // Access data in memory for an instruction, ticking the clock for the
+    // wait states of the location (see `WaitStates`).
+    inline Word readMemory( Word offset ) {
+        auto word = _memory->read( offset );
+        _clock += _memory->readWaitStates( offset );
+        return word;
     }
 
-    virtual inline void store( ProcessorState& proc, Word value ) override {
-        proc.write( Special::Ex, value );
+    inline void writeMemory( Word offset, Word value ) {
+        _memory->write( offset, value );
+        _clock += _memory->writeWaitStates( offset );
     }
-};
 
-struct Indirect final : public LongAddressingMode {
-    explicit Indirect() : LongAddressingMode {} {}
+    // The instruction executed by the last call to `executeNext`, or
+    // `nullptr` if that instruction was skipped.
+    const DecodedInstruction* lastInstruction() const noexcept { return _lastInstruction; }
 
-    virtual Word load( ProcessorState& proc ) override;
-    virtual void store( ProcessorState& proc, Word value ) override;
-};
+    // Execute the next instruction. If it's malformed, then the processor
+    // faults instead and PC is left at the instruction.
+    void executeNext();
 
-struct Direct final : public LongAddressingMode {
-    explicit Direct() : LongAddressingMode {} {}
+    inline Fault fault() const noexcept { return _fault; }
 
-    virtual Word load( ProcessorState& proc ) override;
-    virtual void store( ProcessorState& proc, Word value ) override;
-};
+    // The instruction word that caused a fault.
+    inline Word faultWord() const noexcept { return _faultWord; }
 
-struct FastDirect final : public AddressingMode {
-    Word value;
+    inline void setFault( Fault fault, Word word = 0 ) noexcept {
+        _fault = fault;
+        _faultWord = word;
+    }
+
+    // Execute instructions until at least `cycleBudget` cycles have elapsed,
+    // or until something happens that the simulation must respond to.
+    //
+    // `isInterrupted` is checked before every instruction. A breakpoint at
+    // the first instruction is ignored, so that execution can resume from it.
+    template <typename IsInterrupted>
+    BatchResult executeBatch( int cycleBudget, IsInterrupted isInterrupted );
+
+    void setBreakpoint( Word address, bool isSet = true );
+
+    inline bool isBreakpoint( Word address ) const noexcept {
+        return ! _breakpoints.empty() && _breakpoints[address];
+    }
 
-    explicit FastDirect( Word value ) : value { value } {}
+    // The instruction at PC, for interpreters other than `executeNext`. When
+    // fusing, the instructions that follow it are decoded along with it (and
+    // only again once their page is written).
+    //
+    // This and `fuse` are defined with `DecodedInstruction`.
+    inline const DecodedInstruction& decodeNext();
+
+    // Execute the instructions that follow `leader`, which was decoded by
+    // `decodeNext` and has just been executed, for as long as they continue a
+    // fusion. They stop at a breakpoint, when the clock reaches `clockLimit`,
+    // or when `isInterrupted`.
+    template <typename IsInterrupted>
+    inline void fuse( const DecodedInstruction& leader, int clockLimit, IsInterrupted isInterrupted );
+
+    inline std::uint64_t fusionCount( Fusion fusion ) const noexcept {
+        return _fusionCounts[static_cast<std::size_t>( fusion )];
+    }
 
-    inline virtual Word load( ProcessorState& ) override { return value; }
-    inline virtual void store( ProcessorState&, Word ) override { /* Nothing. */ }
+    // Registers, the clock and any fault. Memory is saved with the computer,
+    // and breakpoints and fusion are settings rather than state.
+    SnapshotPart capture() const;
+    void save( SnapshotWriter& writer ) const;
+    void restore( SnapshotReader& reader );
 };
 
+Word ProcessorState::read( Special spec ) const noexcept {
+    switch ( spec ) {
+    case Special::Pc: return _pc;
+    case Special::Sp: return _sp;
+    case Special::Ex: return _ex;
+    }
+
+    // This shouldn't be necessary, but GCC complains (wrongly) that
+    // not all cases are handled in the above.
+    return 0;
 }
 
-enum class Opcode {
-    Set,
-    Add,
-    Sub,
-    Mul, Mli,
-    Div, Dvi,
-    Mod, Mdi,
-    And, Bor, Xor,
-    Shr, Asr, Shl,
-    Ifb,
-    Ifc,
-    Ife,
-    Ifn,
-    Ifg,
-    Ifa,
-    Ifl,
-    Ifu,
-    Adx, Sbx,
-    Sti, Std,
-};
+void ProcessorState::write( Special spec, Word value ) noexcept {
+    switch ( spec ) {
+    case Special::Pc: _pc = value; return;
+    case Special::Sp: _sp = value; return;
+    case Special::Ex: _ex = value; return;
+    }
+}
 
-const std::map<Opcode, int> OPCODE_CYCLES {
-    { Opcode::Set, 1 },
-    { Opcode::Add, 2 },
-    { Opcode::Sub, 2 },
-    { Opcode::Mul, 2 },
-    { Opcode::Mli, 2 },
-    { Opcode::Div, 3 },
-    { Opcode::Dvi, 3 },
-    { Opcode::Mod, 3 },
-    { Opcode::Mdi, 3 },
-    { Opcode::And, 1 },
-    { Opcode::Bor, 1 },
-    { Opcode::Xor, 1 },
-    { Opcode::Shr, 1 },
-    { Opcode::Asr, 1 },
-    { Opcode::Shl, 1 },
-    { Opcode::Ifb, 2 },
-    { Opcode::Ifc, 2 },
-    { Opcode::Ife, 2 },
-    { Opcode::Ifn, 2 },
-    { Opcode::Ifg, 2 },
-    { Opcode::Ifa, 2 },
-    { Opcode::Ifl, 2 },
-    { Opcode::Ifu, 2 },
-    { Opcode::Adx, 3 },
-    { Opcode::Sbx, 3 },
-    { Opcode::Sti, 2 },
-    { Opcode::Std, 2 },
-};
+template <typename IsInterrupted>
+BatchResult ProcessorState::executeBatch( int cycleBudget, IsInterrupted isInterrupted ) {
+    auto start = _clock;
+    BatchLimit limit { start + cycleBudget, &callInterrupted<IsInterrupted>, &isInterrupted };
+    _limit = &limit;
+
+    optional<BatchEnd> end;
+
+    for ( bool isFirst = true; ! end; isFirst = false ) {
+        auto cycles = _clock - start;
+
+        if ( isInterrupted() ) {
+            end = BatchEnd::Interrupt;
+        } else if ( cycles >= cycleBudget ) {
+            end = BatchEnd::Budget;
+        } else if ( ! isFirst && ! doSkip && isBreakpoint( _pc ) ) {
+            end = BatchEnd::Breakpoint;
+        } else {
+            end = executeInBatch();
+        }
+    }
 
-enum class SpecialOpcode {
-    Jsr,
-    Int,
-    Iag,
-    Ias,
-    Rfi,
-    Iaq,
-    Hwn,
-    Hwq,
-    Hwi
-};
+    _limit = nullptr;
+    return { *end, _clock - start };
+}
 
-const std::map<SpecialOpcode, int> SPECIAL_OPCODE_CYCLES {
-    { SpecialOpcode::Jsr, 3 },
-    { SpecialOpcode::Int, 4 },
-    { SpecialOpcode::Iag, 1 },
-    { SpecialOpcode::Ias, 1 },
-    { SpecialOpcode::Rfi, 3 },
-    { SpecialOpcode::Iaq, 2 },
-    { SpecialOpcode::Hwn, 2 },
-    { SpecialOpcode::Hwq, 4 },
-    { SpecialOpcode::Hwi, 4 }
-};
+// Cycles for fetching words are accounted for by the decoded instruction, so
+// they're not ticked here.
+inline Word fetchNextWord( ProcessorState& proc ) {
+    auto pc = proc.read( Special::Pc );
+    proc.write( Special::Pc, pc + 1 );
+    return proc.memory()->read( pc );
+}
 
-class Instruction {
-public:
-    virtual void execute( ProcessorState& proc ) const = 0;
-    virtual int size() const noexcept = 0;
-    virtual bool isConditional() const noexcept = 0;
-};
+inline void push( ProcessorState& proc, Word value ) {
+    auto sp = proc.read( Special::Sp );
+    proc.writeMemory( sp - 1, value );
+    proc.write( Special::Sp, sp - 1 );
+}
 
-namespace instruction {
+inline Word pop( ProcessorState& proc ) {
+    auto sp = proc.read( Special::Sp );
+    auto word = proc.readMemory( sp );
+    proc.write( Special::Sp, sp + 1 );
 
-struct Unary : public Instruction {
-    SpecialOpcode opcode;
-    std::shared_ptr<AddressingMode> address = nullptr;
+    return word;
+}
 
-    explicit Unary( SpecialOpcode opcode,
-                    std::shared_ptr<AddressingMode> address ) :
-        opcode { opcode },
-        address { address } {
-    }
+enum class AddressContext { A, B };
 
-    virtual void execute( ProcessorState& proc ) const override;
+// An operand of an instruction, identified by its raw encoding.
+//
+// The operand's next word (if it has one) is fetched on first access and
+// then retained, so that read-modify-write instructions consume it only
+// once.
+class Operand final {
+    AddressContext _context;
+    Word _code;
+    optional<Word> _next {};
 
-    inline virtual int size() const noexcept override { return address->size(); }
+    Word next( ProcessorState& proc );
+public:
+    explicit Operand( AddressContext context, Word code ) :
+        _context { context },
+        _code { code } {}
 
-    inline virtual bool isConditional() const noexcept override { return false; }
+    Word load( ProcessorState& proc );
+    void store( ProcessorState& proc, Word value );
 };
 
-struct Binary : public Instruction {
-    Opcode opcode;
-    std::shared_ptr<AddressingMode> addressB { nullptr };
-    std::shared_ptr<AddressingMode> addressA { nullptr };
-
-    explicit Binary( Opcode opcode,
-                     std::shared_ptr<AddressingMode> addressB,
-                     std::shared_ptr<AddressingMode> addressA ) :
-        opcode { opcode },
-        addressB { addressB },
-        addressA { addressA } {
-    }
+// Enumerators have the value of their encoding (see `isa::OPCODES`).
+enum class Opcode : std::uint8_t {
+    Set = 0x01,
+    Add = 0x02,
+    Sub = 0x03,
+    Mul = 0x04, Mli = 0x05,
+    Div = 0x06, Dvi = 0x07,
+    Mod = 0x08, Mdi = 0x09,
+    And = 0x0a, Bor = 0x0b, Xor = 0x0c,
+    Shr = 0x0d, Asr = 0x0e, Shl = 0x0f,
+    Ifb = 0x10,
+    Ifc = 0x11,
+    Ife = 0x12,
+    Ifn = 0x13,
+    Ifg = 0x14,
+    Ifa = 0x15,
+    Ifl = 0x16,
+    Ifu = 0x17,
+    Adx = 0x1a, Sbx = 0x1b,
+    Sti = 0x1e, Std = 0x1f
+};
 
-    virtual void execute( ProcessorState& proc ) const override;
-    
-    inline virtual int size() const noexcept override { return addressA->size() + addressB->size(); }
-
-    inline virtual bool isConditional() const noexcept override {
-        switch ( opcode ) {
-        case Opcode::Ifb:
-        case Opcode::Ifc:
-        case Opcode::Ife:
-        case Opcode::Ifn:
-        case Opcode::Ifg:
-        case Opcode::Ifa:
-        case Opcode::Ifl:
-        case Opcode::Ifu:
-            return true;
-        default:
-            return false;
-        }
-    }
+// Enumerators have the value of their encoding (see `isa::SPECIAL_OPCODES`).
+enum class SpecialOpcode : std::uint8_t {
+    Jsr = 0x01,
+    Int = 0x08,
+    Iag = 0x09,
+    Ias = 0x0a,
+    Rfi = 0x0b,
+    Iaq = 0x0c,
+    Hwn = 0x10,
+    Hwq = 0x11,
+    Hwi = 0x12
 };
 
+constexpr int cycles( Opcode opcode ) {
+    return isa::OPCODES[static_cast<std::size_t>( opcode )].cycles;
+}
+
+constexpr int cycles( SpecialOpcode opcode ) {
+    return isa::SPECIAL_OPCODES[static_cast<std::size_t>( opcode )].cycles;
 }
 
 void advance( ProcessorState& proc, int numWords );
 
-void dumpToLog( ProcessorState& proc );
+// Skip over an instruction whose word has already been fetched. Skipping
+// continues past conditional instructions.
+void skip( ProcessorState& proc, const DecodedInstruction& ins );
 
-enum class AddressContext { A, B };
+void dumpToLog( ProcessorState& proc );
 
 template <typename T>
 optional<T> decode( const Word& ) {
     return {};
 }
 
-std::shared_ptr<AddressingMode> decodeAddress( AddressContext context, Word word );
-std::shared_ptr<Instruction> decodeInstruction( Word word );
+template <>
+optional<Register> decode( const Word& w );
+
+template <>
+optional<Opcode> decode( const Word& w );
+
+template <>
+optional<SpecialOpcode> decode( const Word& w );
 
 }
@@ -15,6 +15,7 @@
 // limitations under the License.
 
 #include "Clock.hpp"
+#include "../Snapshot.hpp"
 
 namespace nebula {
 
@@ -32,32 +33,36 @@ Clock::run() {
             _procInt->waitForTriggerOrDeath( *this );
         }
 
-        auto now = std::chrono::system_clock::now();
+        if ( ! _lastTick ) {
+            _lastTick = _computer.timing().now();
+        }
 
         if ( _procInt->isActive() ) {
+            std::lock_guard<std::mutex> lock { _computer.snapshots().stateMutex() };
+
             LOG( CLOCK, info ) << "Got interrupt.";
 
-            auto proc = _procInt->state();
-            auto a = proc->read( Register::A );
-
-            switch ( a ) {
-            case 0:
-                handleInterrupt( ClockOperation::SetDivider, proc );
-                break;
-            case 1:
-                handleInterrupt( ClockOperation::StoreElapsed, proc );
-                break;
-            case 2:
-                handleInterrupt( ClockOperation::EnableInterrupts, proc );
-                break;
-            }
-            
+            handleInterrupt( _procInt->state() );
             _procInt->respond();
 
             LOG( CLOCK, info ) << "Handled interrupt.";
         }
 
-        std::this_thread::sleep_until( now + (sim::CLOCK_BASE_PERIOD * _state.divider) );
+        if ( ! _state.isOn || ! _lastTick ) {
+            continue;
+        }
+
+        // The processor waits for a response to `HWI` without advancing
+        // simulated time, so the clock must respond while it waits.
+        auto isWoken = [this] { return _procInt->isActive() || ! isActive(); };
+        auto tick = *_lastTick + sim::CLOCK_BASE_PERIOD * _state.divider;
+
+        if ( ! _computer.timing().sleepUntil( tick, isWoken ) ) {
+            continue;
+        }
+
+        std::lock_guard<std::mutex> lock { _computer.snapshots().stateMutex() };
+        _lastTick = tick;
         _state.elapsed += 1;
 
         if ( _state.interruptsEnabled ) {
@@ -69,6 +74,49 @@ Clock::run() {
     return make_unique<ClockState>( _state );
 }
 
+void Clock::schedule( Scheduler& scheduler ) {
+    _scheduler = &scheduler;
+    _procInt->setResponder( [this] ( ProcessorState& proc ) { handleInterrupt( &proc ); } );
+}
+
+void Clock::startTicking() {
+    auto run = ++_run;
+
+    if ( _state.isOn ) {
+        _scheduler->after( sim::CLOCK_BASE_PERIOD * _state.divider, [this, run] { tick( run ); } );
+    }
+}
+
+void Clock::tick( std::uint64_t run ) {
+    if ( run != _run ) {
+        return;
+    }
+
+    _state.elapsed += 1;
+
+    if ( _state.interruptsEnabled ) {
+        _computer.queue().push( _state.message );
+    }
+
+    _scheduler->repeat( sim::CLOCK_BASE_PERIOD * _state.divider, [this, run] { tick( run ); } );
+}
+
+void Clock::handleInterrupt( ProcessorState* proc ) {
+    auto a = proc->read( Register::A );
+
+    switch ( a ) {
+    case 0:
+        handleInterrupt( ClockOperation::SetDivider, proc );
+        break;
+    case 1:
+        handleInterrupt( ClockOperation::StoreElapsed, proc );
+        break;
+    case 2:
+        handleInterrupt( ClockOperation::EnableInterrupts, proc );
+        break;
+    }
+}
+
 void Clock::handleInterrupt( ClockOperation op, ProcessorState* proc ) {
     Word b;
 
@@ -89,6 +137,13 @@ void Clock::handleInterrupt( ClockOperation op, ProcessorState* proc ) {
             _state.isOn = false;
         }
 
+        // The clock starts counting again from now.
+        if ( _scheduler ) {
+            startTicking();
+        } else {
+            _lastTick.reset();
+        }
+
         break;
     case ClockOperation::StoreElapsed:
         LOG( CLOCK, info ) << "'StoreElapsed'";
@@ -113,4 +168,32 @@ void Clock::handleInterrupt( ClockOperation op, ProcessorState* proc ) {
     }
 }
 
+SnapshotPart Clock::capture() const {
+    auto state = _state;
+
+    return [state] ( SnapshotWriter& writer ) {
+        writer.write( state.divider );
+        writer.write( state.isOn );
+        writer.write( state.interruptsEnabled );
+        writer.write( state.elapsed );
+        writer.write( state.message );
+    };
+}
+
+void Clock::save( SnapshotWriter& writer ) const {
+    capture()( writer );
+}
+
+void Clock::restore( SnapshotReader& reader ) {
+    _state.divider = reader.read<Word>();
+    _state.isOn = reader.read<bool>();
+    _state.interruptsEnabled = reader.read<bool>();
+    _state.elapsed = reader.read<Word>();
+    _state.message = reader.read<Word>();
+
+    if ( _scheduler ) {
+        startTicking();
+    }
+}
+
 }
@@ -18,6 +18,7 @@
 
 #include "../Computer.hpp"
 #include "../Simulation.hpp"
+#include "Scheduler.hpp"
 
 DEFINE_LOGGER( CLOCK, "Clock" )
 
@@ -48,6 +49,19 @@ class Clock : public Simulation<ClockState>, public Device {
     std::shared_ptr<ProcessorInterrupt> _procInt { nullptr };
     ClockState _state {};
 
+    // Without a scheduler, when the clock last ticked (or started).
+    optional<Timing::Duration> _lastTick {};
+
+    Scheduler* _scheduler { nullptr };
+
+    // Incremented whenever the clock is started again, so that ticks which
+    // were scheduled before are ignored.
+    std::uint64_t _run { 0 };
+
+    void startTicking();
+    void tick( std::uint64_t run );
+
+    void handleInterrupt( ProcessorState* proc );
     void handleInterrupt( ClockOperation op, ProcessorState* proc );
 public:
     explicit Clock( Computer& computer ) :
@@ -57,6 +71,18 @@ public:
 
     virtual std::unique_ptr<ClockState> run();
 
+    // Instead of `run`, tick on the thread of `scheduler`. This must happen
+    // before the clock is restored.
+    void schedule( Scheduler& scheduler );
+
+    // Only while holding `LiveSnapshots::stateMutex`, or while the
+    // simulation isn't running.
+    SnapshotPart capture() const;
+
+    // Only while the simulation isn't running.
+    void save( SnapshotWriter& writer ) const;
+    void restore( SnapshotReader& reader );
+
     virtual DeviceInfo info() const noexcept override {
         return DeviceInfo {
             device::Id { 0x12d0b402 },
@@ -15,14 +15,30 @@
 // limitations under the License.
 
 #include "FloppyDrive.hpp"
+#include "../Snapshot.hpp"
 
 #include <algorithm>
 #include <random>
+#include <thread>
 
 DEFINE_LOGGER( FLOPPY, "Floppy" )
 
 namespace nebula {
 
+namespace {
+
+// The time taken to move to the track of a sector, before it can be accessed.
+Timing::Duration seekDuration( Word index ) {
+    return sim::FLOPPY_TRACK_SEEK_DURATION * (index / sim::FLOPPY_SECTORS_PER_TRACK);
+}
+
+// The time taken to access sector `index`.
+Timing::Duration accessDuration( Word index ) {
+    return seekDuration( index ) + sim::FLOPPY_WORD_ACCESS_DURATION * sim::FLOPPY_WORDS_PER_SECTOR;
+}
+
+}
+
 FloppyDrive::FloppyDrive( Computer& computer ) :
     Simulation<FloppyDriveState> {},
     _computer( computer ),
@@ -31,6 +47,8 @@ FloppyDrive::FloppyDrive( Computer& computer ) :
 }
 
 void FloppyDrive::insertDisk( bool isWriteProtected ) {
+    std::lock_guard<std::mutex> lock { _computer.snapshots().stateMutex() };
+
     // Only a single disk can be present in the drive at one time.
     if ( _state.disk ) {
         LOG( FLOPPY, warning ) << "There's already a disk in the drive.";
@@ -52,6 +70,7 @@ void FloppyDrive::insertDisk( bool isWriteProtected ) {
     }
 
     _state.isWriteProtected = isWriteProtected;
+    ++_diskGeneration;
     
     if ( isWriteProtected ) {
         _state.stateCode = FloppyDriveStateCode::ReadyWP;
@@ -61,6 +80,8 @@ void FloppyDrive::insertDisk( bool isWriteProtected ) {
 }
 
 void FloppyDrive::ejectDisk() {
+    std::lock_guard<std::mutex> lock { _computer.snapshots().stateMutex() };
+
     if ( ! _state.disk ) {
         LOG( FLOPPY, warning ) << "No disk to eject!";
     } else {
@@ -68,6 +89,7 @@ void FloppyDrive::ejectDisk() {
 
         _state.disk.reset();
         _state.isWriteProtected.reset();
+        ++_diskGeneration;
     }
 }
 
@@ -76,7 +98,6 @@ Sector& FloppyDrive::getSector( Word index ) {
     int relativeSectorIndex = index % sim::FLOPPY_SECTORS_PER_TRACK;
 
     Sector& sector = (*(_state.disk))[trackIndex][relativeSectorIndex];
-    std::this_thread::sleep_for( sim::FLOPPY_TRACK_SEEK_DURATION * trackIndex );
 
     if ( _state.sectorErrors[index] ) {
         _state.errorCode = FloppyDriveErrorCode::BadSector;
@@ -84,6 +105,7 @@ Sector& FloppyDrive::getSector( Word index ) {
 
         // Zero out the sector.
         std::fill( std::begin( sector ), std::end( sector ), 0 );
+        ++_diskGeneration;
     }
 
     return sector;
@@ -95,53 +117,30 @@ std::unique_ptr<FloppyDriveState> FloppyDrive::run() {
     LOG( FLOPPY, info ) << "Simulation is active.";
 
     while ( isActive() ) {
+        std::unique_lock<std::mutex> lock { _computer.snapshots().stateMutex() };
+
         if ( (_isReading || _isWriting) && (! _state.disk) ) {
             _state.errorCode = FloppyDriveErrorCode::Eject;
         }
 
         if ( _isReading && sim::isReady( _readF ) ) {
-            LOG( FLOPPY, info ) << "Reading has completed.";
-            
             _readF.get();
-            _state.stateCode = FloppyDriveStateCode::Ready;
-            _isReading = false;
-            sendInterruptIfEnabled();
+            finishRead();
         } else if ( _isWriting && sim::isReady( _writeF ) ) {
-            LOG( FLOPPY, info ) << "Writing has completed.";
-            
-            auto result = _writeF.get();
-            getSector( result.first ) = result.second;
-            _state.stateCode = FloppyDriveStateCode::Ready;
-            _isWriting = false;
-            sendInterruptIfEnabled();
+            _writeF.get();
+            finishWrite();
         }
 
         if ( _procInt->isActive() ) {
             LOG( FLOPPY, info ) << "Got interrupt.";
 
-            auto proc = _procInt->state();
-            auto a = proc->read( Register::A );
-
-            switch ( a ) {
-            case 0:
-                handleInterrupt( FloppyDriveOperation::Poll, proc );
-                break;
-            case 1:
-                handleInterrupt( FloppyDriveOperation::EnableInterrupts, proc );
-                break;
-            case 2:
-                handleInterrupt( FloppyDriveOperation::Read, proc );
-                break;
-            case 3:
-                handleInterrupt( FloppyDriveOperation::Write, proc );
-                break;
-            }
-
+            handleInterrupt( _procInt->state() );
             _procInt->respond();
 
             LOG( FLOPPY, info ) << "Handled interrupt.";
         }
 
+        lock.unlock();
         std::this_thread::sleep_for( sim::FLOPPY_SLEEP_DURATION );
     }
     
@@ -149,12 +148,105 @@ std::unique_ptr<FloppyDriveState> FloppyDrive::run() {
     return {};
 }
 
+void FloppyDrive::schedule( Scheduler& scheduler ) {
+    _scheduler = &scheduler;
+    _procInt->setResponder( [this] ( ProcessorState& proc ) { handleInterrupt( &proc ); } );
+}
+
+std::future<void> FloppyDrive::waitFor( Word index ) {
+    auto& timing = _computer.timing();
+
+    return std::async( std::launch::async,
+                       [index, &timing] {
+                           timing.sleepFor( accessDuration( index ) );
+                       } );
+}
+
+void FloppyDrive::startRead( Word index, Word address, Sector sector ) {
+    _pendingSector = index;
+    _pendingAddress = address;
+    _transfer = std::move( sector );
+    _isReading = true;
+
+    if ( ! _scheduler ) {
+        _readF = waitFor( index );
+        return;
+    }
+
+    _scheduler->after( accessDuration( index ), [this] {
+        if ( ! _state.disk ) {
+            _state.errorCode = FloppyDriveErrorCode::Eject;
+        }
+
+        finishRead();
+    } );
+}
+
+void FloppyDrive::startWrite( Word index, Word address, Sector sector ) {
+    _pendingSector = index;
+    _pendingAddress = address;
+    _transfer = std::move( sector );
+    _isWriting = true;
+
+    if ( ! _scheduler ) {
+        _writeF = waitFor( index );
+        return;
+    }
+
+    _scheduler->after( accessDuration( index ), [this] {
+        if ( ! _state.disk ) {
+            _state.errorCode = FloppyDriveErrorCode::Eject;
+        }
+
+        finishWrite();
+    } );
+}
+
+void FloppyDrive::finishRead() {
+    LOG( FLOPPY, info ) << "Reading has completed.";
+
+    _memory->writeBlock( _pendingAddress, _transfer.data(), _transfer.size() );
+    _computer.inputs().deviceWrote( _pendingAddress, _transfer.data(), _transfer.size() );
+    _state.stateCode = FloppyDriveStateCode::Ready;
+    _isReading = false;
+    sendInterruptIfEnabled();
+}
+
+void FloppyDrive::finishWrite() {
+    LOG( FLOPPY, info ) << "Writing has completed.";
+
+    getSector( _pendingSector ) = _transfer;
+    ++_diskGeneration;
+    _state.stateCode = FloppyDriveStateCode::Ready;
+    _isWriting = false;
+    sendInterruptIfEnabled();
+}
+
 void FloppyDrive::sendInterruptIfEnabled() {
     if ( _state.interruptsEnabled ) {
         _computer.queue().push( _state.message );
     }
 }
 
+void FloppyDrive::handleInterrupt( ProcessorState* proc ) {
+    auto a = proc->read( Register::A );
+
+    switch ( a ) {
+    case 0:
+        handleInterrupt( FloppyDriveOperation::Poll, proc );
+        break;
+    case 1:
+        handleInterrupt( FloppyDriveOperation::EnableInterrupts, proc );
+        break;
+    case 2:
+        handleInterrupt( FloppyDriveOperation::Read, proc );
+        break;
+    case 3:
+        handleInterrupt( FloppyDriveOperation::Write, proc );
+        break;
+    }
+}
+
 void FloppyDrive::handleInterrupt( FloppyDriveOperation op, ProcessorState* proc ) {
     Word x = proc->read( Register::X );
     Word y = proc->read( Register::Y );
@@ -188,21 +280,8 @@ void FloppyDrive::handleInterrupt( FloppyDriveOperation op, ProcessorState* proc
             LOG( FLOPPY, info ) << format( "Reading sector %d into memory at 0x%04x" ) % x % y;
 
             _state.stateCode = FloppyDriveStateCode::Busy;
-
-            Sector sector = getSector( x );
-            auto loc = y;
-            auto mem = _memory;
-
-            _readF = std::async( std::launch::async,
-                                   [mem, loc, sector] {
-                                       for ( Word i = 0; i < sim::FLOPPY_WORDS_PER_SECTOR; ++i ) {
-                                           mem->write( loc + i, sector[i] );
-                                           std::this_thread::sleep_for( sim::FLOPPY_WORD_ACCESS_DURATION );
-                                       }
-                                   } );
-
+            startRead( x, y, getSector( x ) );
             proc->write( Register::B, 1 );
-            _isReading = true;
         } else {
             proc->write( Register::B, 0xdead );
 
@@ -228,23 +307,12 @@ void FloppyDrive::handleInterrupt( FloppyDriveOperation op, ProcessorState* proc
             LOG( FLOPPY, info ) << format( "Writing sector %d from memory at 0x%04x" ) % x % y;
 
             _state.stateCode = FloppyDriveStateCode::Busy;
+            // The sector is read from memory straight away.
+            Sector sector( sim::FLOPPY_WORDS_PER_SECTOR );
+            _memory->readBlock( y, sector.data(), sector.size() );
 
-            auto loc = y;
-            auto mem = _memory;
-
-            _writeF = std::async( std::launch::async,
-                                  [mem, loc, x] {
-                                      Sector sector;
-                                      
-                                      for ( Word i = 0; i < sim::FLOPPY_WORDS_PER_SECTOR; ++i ) {
-                                          sector.push_back( mem->read( loc + i ) );
-                                          std::this_thread::sleep_for( sim::FLOPPY_WORD_ACCESS_DURATION );
-                                      }
-                                      
-                                      return std::make_pair( x, sector );
-                                  } );
+            startWrite( x, y, std::move( sector ) );
             proc->write( Register::B, 1 );
-            _isWriting = true;
         } else {
             proc->write( Register::B, 0xdead );
             switch ( _state.stateCode ) {
@@ -268,4 +336,126 @@ void FloppyDrive::handleInterrupt( FloppyDriveOperation op, ProcessorState* proc
     }
 }
 
+// Sectors of zeros are left out.
+SnapshotPart FloppyDrive::capture() const {
+    if ( ! _state.disk ) {
+        _capturedDisk = nullptr;
+    } else if ( ! _capturedDisk || _capturedDiskGeneration != _diskGeneration ) {
+        _capturedDisk = std::make_shared<const Disk>( *_state.disk );
+        _capturedDiskGeneration = _diskGeneration;
+    }
+
+    auto disk = _capturedDisk;
+    auto isWriteProtected = _state.isWriteProtected;
+    auto stateCode = _state.stateCode;
+    auto errorCode = _state.errorCode;
+    auto interruptsEnabled = _state.interruptsEnabled;
+    auto message = _state.message;
+    auto sectorErrors = _state.sectorErrors;
+    auto isReading = _isReading;
+    auto isWriting = _isWriting;
+    auto pendingSector = _pendingSector;
+    auto pendingAddress = _pendingAddress;
+    auto transfer = (isReading || isWriting) ? _transfer : Sector {};
+
+    return [=] ( SnapshotWriter& writer ) {
+        writer.write( static_cast<bool>( disk ) );
+
+        if ( disk ) {
+            for ( const auto& track : *disk ) {
+                for ( const auto& sector : track ) {
+                    bool isEmpty = std::all_of( sector.begin(), sector.end(), [] ( Word word ) { return word == 0; } );
+                    writer.write( ! isEmpty );
+
+                    if ( ! isEmpty ) {
+                        writer.writeWords( sector.data(), sector.size() );
+                    }
+                }
+            }
+        }
+
+        writer.write( static_cast<bool>( isWriteProtected ) );
+        writer.write( isWriteProtected ? *isWriteProtected : false );
+        writer.write( stateCode );
+        writer.write( errorCode );
+        writer.write( interruptsEnabled );
+        writer.write( message );
+
+        for ( int i = 0; i < sim::FLOPPY_SECTORS_PER_DISK; ++i ) {
+            writer.write( static_cast<bool>( sectorErrors[i] ) );
+        }
+
+        writer.write( isReading );
+        writer.write( isWriting );
+        writer.write( pendingSector );
+        writer.write( pendingAddress );
+
+        if ( isReading || isWriting ) {
+            writer.writeWords( transfer.data(), transfer.size() );
+        }
+    };
+}
+
+void FloppyDrive::save( SnapshotWriter& writer ) const {
+    capture()( writer );
+}
+
+void FloppyDrive::restore( SnapshotReader& reader ) {
+    if ( reader.read<bool>() ) {
+        _state.disk = Disk( sim::FLOPPY_TRACKS_PER_DISK,
+                            Track( sim::FLOPPY_SECTORS_PER_TRACK,
+                                   Sector( sim::FLOPPY_WORDS_PER_SECTOR, 0 ) ) );
+
+        for ( auto& track : *_state.disk ) {
+            for ( auto& sector : track ) {
+                if ( reader.read<bool>() ) {
+                    reader.readWords( sector.data(), sector.size() );
+                }
+            }
+        }
+    } else {
+        _state.disk.reset();
+    }
+
+    ++_diskGeneration;
+
+    auto hasWriteProtection = reader.read<bool>();
+    auto isWriteProtected = reader.read<bool>();
+
+    if ( hasWriteProtection ) {
+        _state.isWriteProtected = isWriteProtected;
+    } else {
+        _state.isWriteProtected.reset();
+    }
+
+    _state.stateCode = reader.read<FloppyDriveStateCode>();
+    _state.errorCode = reader.read<FloppyDriveErrorCode>();
+    _state.interruptsEnabled = reader.read<bool>();
+    _state.message = reader.read<Word>();
+
+    for ( int i = 0; i < sim::FLOPPY_SECTORS_PER_DISK; ++i ) {
+        _state.sectorErrors[i] = reader.read<bool>();
+    }
+
+    auto isReading = reader.read<bool>();
+    auto isWriting = reader.read<bool>();
+    auto index = reader.read<Word>();
+    auto address = reader.read<Word>();
+
+    if ( (isReading || isWriting) && (! _state.disk || index >= sim::FLOPPY_SECTORS_PER_DISK) ) {
+        throw error::BadSnapshot { "floppy operation without a sector" };
+    }
+
+    if ( isReading || isWriting ) {
+        Sector sector( sim::FLOPPY_WORDS_PER_SECTOR );
+        reader.readWords( sector.data(), sector.size() );
+
+        if ( isReading ) {
+            startRead( index, address, std::move( sector ) );
+        } else {
+            startWrite( index, address, std::move( sector ) );
+        }
+    }
+}
+
 }
@@ -18,6 +18,7 @@
 
 #include "../Computer.hpp"
 #include "../Simulation.hpp"
+#include "Scheduler.hpp"
 
 #include <bitset>
 
@@ -90,15 +91,41 @@ class FloppyDrive : public Simulation<FloppyDriveState>, public Device {
     FloppyDriveState _state;
     std::shared_ptr<Memory> _memory { nullptr };
 
-    // The results of an asynchronous read or write operation.
+    // Reads and writes take time, which passes asynchronously. The data is
+    // transferred by the simulation when the operation completes, so that it
+    // happens at the same time as the change to the state of the drive.
     bool _isReading { false };
     std::future<void> _readF;
 
     bool _isWriting { false };
-    std::future<std::pair<Word, Sector>> _writeF;
+    std::future<void> _writeF;
+
+    // The sector and location in memory of the operation in progress, and
+    // the data it transfers.
+    Word _pendingSector { 0 };
+    Word _pendingAddress { 0 };
+    Sector _transfer {};
+
+    // Changed whenever the contents of the disk change, so that the disk is
+    // only copied for a snapshot when it's different.
+    std::uint64_t _diskGeneration { 0 };
+    mutable std::uint64_t _capturedDiskGeneration { 0 };
+    mutable std::shared_ptr<const Disk> _capturedDisk { nullptr };
+
+    // When set, reads and writes complete at an event instead.
+    Scheduler* _scheduler { nullptr };
+
+    std::future<void> waitFor( Word index );
+
+    void finishRead();
+    void finishWrite();
+
+    void startRead( Word index, Word address, Sector sector );
+    void startWrite( Word index, Word address, Sector sector );
 
     Sector& getSector( Word index );
     void sendInterruptIfEnabled();
+    void handleInterrupt( ProcessorState* proc );
     void handleInterrupt( FloppyDriveOperation op, ProcessorState* proc );
 public:
     explicit FloppyDrive( Computer& computer );
@@ -107,6 +134,19 @@ public:
     void ejectDisk();
 
     virtual std::unique_ptr<FloppyDriveState> run() override;
+
+    // Instead of `run`, respond on the thread of `scheduler`. This must
+    // happen before the drive is restored.
+    void schedule( Scheduler& scheduler );
+
+    // Only while holding `LiveSnapshots::stateMutex`, or while the
+    // simulation isn't running. A read or write that is in progress is
+    // saved, and started again when it's restored.
+    SnapshotPart capture() const;
+
+    // Only while the simulation isn't running.
+    void save( SnapshotWriter& writer ) const;
+    void restore( SnapshotReader& reader );
     
     inline virtual DeviceInfo info() const noexcept override {
         return DeviceInfo {
@@ -15,6 +15,9 @@
 // limitations under the License.
 
 #include "Keyboard.hpp"
+#include "../Snapshot.hpp"
+
+#include <thread>
 
 namespace nebula {
 
@@ -65,11 +68,42 @@ void KeyboardState::setKey( const SDL_keysym* ks ) noexcept {
 
     if ( k != 0 ) {
         LOG( KEYBOARD, info ) << format( "Got <%d>" ) % k;
+        setKey( k );
+    }
+}
+
+SnapshotPart Keyboard::capture() const {
+    auto key = _state.key();
+    auto interruptSent = _state.interruptSent;
+    auto interruptsEnabled = _state.interruptsEnabled;
+    auto message = _state.message;
+
+    return [=] ( SnapshotWriter& writer ) {
+        writer.write( static_cast<bool>( key ) );
+        writer.write( key ? *key : Word { 0 } );
+        writer.write( interruptSent );
+        writer.write( interruptsEnabled );
+        writer.write( message );
+    };
+}
+
+void Keyboard::save( SnapshotWriter& writer ) const {
+    capture()( writer );
+}
 
-        _key.store( k );
-        _hasKey.store( true );
-        interruptSent = false;
+void Keyboard::restore( SnapshotReader& reader ) {
+    auto hasKey = reader.read<bool>();
+    auto key = reader.read<Word>();
+
+    _state.clear();
+
+    if ( hasKey ) {
+        _state.setKey( key );
     }
+
+    _state.interruptSent = reader.read<bool>();
+    _state.interruptsEnabled = reader.read<bool>();
+    _state.message = reader.read<Word>();
 }
 
 std::unique_ptr<KeyboardState> Keyboard::run() {
@@ -78,40 +112,20 @@ std::unique_ptr<KeyboardState> Keyboard::run() {
     LOG( KEYBOARD, info ) << "Simulation is active.";
 
     while ( isActive() ) {
-        if ( _state.hasKey() &&
-             _state.interruptsEnabled &&
-             ! _state.interruptSent ) {
+        std::unique_lock<std::mutex> lock { _computer.snapshots().stateMutex() };
 
-            _computer.queue().push( _state.message );
-            _state.interruptSent = true;
-        }
+        sendInterruptIfPressed();
 
         if ( _procInt->isActive() ) {
             LOG( KEYBOARD, info ) << "Got interrupt.";
 
-            auto proc = _procInt->state();
-            auto a = proc->read( Register::A );
-
-            switch ( a ) {
-            case 0:
-                handleInterrupt( KeyboardOperation::Clear, proc );
-                break;
-            case 1:
-                handleInterrupt( KeyboardOperation::Store, proc );
-                break;
-            case 2:
-                handleInterrupt( KeyboardOperation::Query, proc );
-                break;
-            case 3:
-                handleInterrupt( KeyboardOperation::EnableInterrupts, proc );
-                break;
-            }
-
+            handleInterrupt( _procInt->state() );
             _procInt->respond();
 
             LOG( KEYBOARD, info ) << "Handled interrupt.";
         }
 
+        lock.unlock();
         std::this_thread::sleep_for( sim::KEYBOARD_SLEEP_DURATION );
     }
 
@@ -119,6 +133,46 @@ std::unique_ptr<KeyboardState> Keyboard::run() {
     return make_unique<KeyboardState>( _state );
 }
 
+void Keyboard::schedule( Scheduler& scheduler ) {
+    _scheduler = &scheduler;
+    _procInt->setResponder( [this] ( ProcessorState& proc ) { handleInterrupt( &proc ); } );
+    _scheduler->after( sim::KEYBOARD_SLEEP_DURATION, [this] { poll(); } );
+}
+
+void Keyboard::sendInterruptIfPressed() {
+    if ( _state.hasKey() &&
+         _state.interruptsEnabled &&
+         ! _state.interruptSent ) {
+
+        _computer.queue().push( _state.message );
+        _state.interruptSent = true;
+    }
+}
+
+void Keyboard::poll() {
+    sendInterruptIfPressed();
+    _scheduler->repeat( sim::KEYBOARD_SLEEP_DURATION, [this] { poll(); } );
+}
+
+void Keyboard::handleInterrupt( ProcessorState* proc ) {
+    auto a = proc->read( Register::A );
+
+    switch ( a ) {
+    case 0:
+        handleInterrupt( KeyboardOperation::Clear, proc );
+        break;
+    case 1:
+        handleInterrupt( KeyboardOperation::Store, proc );
+        break;
+    case 2:
+        handleInterrupt( KeyboardOperation::Query, proc );
+        break;
+    case 3:
+        handleInterrupt( KeyboardOperation::EnableInterrupts, proc );
+        break;
+    }
+}
+
 void Keyboard::handleInterrupt( KeyboardOperation op, ProcessorState* proc ) {
     Word b;
 
@@ -19,6 +19,7 @@
 #include "../Computer.hpp"
 #include "../Simulation.hpp"
 #include "../Sdl.hpp"
+#include "Scheduler.hpp"
 
 #include <atomic>
 
@@ -59,6 +60,12 @@ public:
 
     void setKey( const SDL_keysym* ks ) noexcept;
 
+    inline void setKey( Word key ) noexcept {
+        _key.store( key );
+        _hasKey.store( true );
+        interruptSent = false;
+    }
+
     inline optional<Word> key() const noexcept {
         if ( hasKey() ) {
             return _key.load();
@@ -75,6 +82,12 @@ class Keyboard : public Simulation<KeyboardState>, public Device {
     std::shared_ptr<ProcessorInterrupt> _procInt { nullptr };
     KeyboardState _state {};
 
+    Scheduler* _scheduler { nullptr };
+
+    void sendInterruptIfPressed();
+    void poll();
+
+    void handleInterrupt( ProcessorState* proc );
     void handleInterrupt( KeyboardOperation op, ProcessorState* proc );
 public:
     explicit Keyboard( Computer& computer ) :
@@ -84,8 +97,19 @@ public:
 
     virtual std::unique_ptr<KeyboardState> run() override;
 
+    // Instead of `run`, check for keys on the thread of `scheduler`.
+    void schedule( Scheduler& scheduler );
+
     inline KeyboardState& state() noexcept { return _state; }
 
+    // Only while holding `LiveSnapshots::stateMutex`, or while the
+    // simulation isn't running.
+    SnapshotPart capture() const;
+
+    // Only while the simulation isn't running.
+    void save( SnapshotWriter& writer ) const;
+    void restore( SnapshotReader& reader );
+
     virtual DeviceInfo info() const noexcept override {
         return DeviceInfo {
             device::Id { 0x30cf7406 },
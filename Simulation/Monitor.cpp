@@ -16,6 +16,7 @@
 
 #include "../Sdl.hpp"
 #include "Monitor.hpp"
+#include "../Snapshot.hpp"
 
 DEFINE_LOGGER( MONITOR, "Monitor" )
 
@@ -51,6 +52,8 @@ std::unique_ptr<MonitorState> Monitor::run() {
     _screen = std::move( sdl::SCREEN );
 
     while ( isActive() )  {
+        auto frameStart = _computer.timing().now();
+
         if ( ! _state.isConnected ) {
             LOG( MONITOR, info ) << "Disconnected. Waiting for interrupt.";
 
@@ -58,71 +61,94 @@ std::unique_ptr<MonitorState> Monitor::run() {
         }
 
         if ( _procInt->isActive() ) {
-            LOG( MONITOR, info ) << "Got interrupt.";
-
-            auto proc = _procInt->state();
-            auto a = proc->read( Register::A );
-
-            switch ( a ) {
-            case 0:
-                handleInterrupt( MonitorOperation::MapVideoMemory, proc );
-                break;
-            case 1:
-                handleInterrupt( MonitorOperation::MapFontMemory, proc );
-                break;
-            case 2:
-                handleInterrupt( MonitorOperation::MapPaletteMemory, proc );
-                break;
-            case 3:
-                handleInterrupt( MonitorOperation::SetBorderColor, proc );
-                break;
-            case 4:
-                handleInterrupt( MonitorOperation::DumpFont, proc );
-                break;
-            case 5:
-                handleInterrupt( MonitorOperation::DumpPalette, proc );
-                break;
-            }
+            respond();
+        }
 
-            _procInt->respond();
+        drawFrame();
 
-            LOG( MONITOR, info ) << "Handled interrupt.";
+        // The processor waits for a response to `HWI` without advancing
+        // simulated time, so the monitor must respond while it waits.
+        auto isWoken = [this] { return _procInt->isActive() || ! isActive(); };
+
+        while ( ! _computer.timing().sleepUntil( frameStart + sim::MONITOR_FRAME_DURATION, isWoken ) &&
+                isActive() ) {
+            respond();
         }
 
-        clear();
+        // Frames can take longer than they should to draw when the processor
+        // is unthrottled, so the start-up image and blinking follow the
+        // simulated time that has passed rather than the number of frames.
+        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>( _computer.timing().now() - frameStart );
 
-        if ( _state.isConnected ) {
-            // Show the start-up image if the monitor is still initializing.
-            if ( _state.timeSinceConnected ) {
-                *_state.timeSinceConnected += sim::MONITOR_FRAME_DURATION;
-                drawStartUp();
+        std::lock_guard<std::mutex> lock { _computer.snapshots().stateMutex() };
+        advance( elapsed );
+    }
 
-                if ( *_state.timeSinceConnected >=
-                     std::chrono::duration_cast<std::chrono::microseconds>( sim::MONITOR_START_UP_DURATION ) ) {
+    LOG( MONITOR, info ) << "Shutting down.";
+    return {};
+}
 
-                    _state.timeSinceConnected.reset();
-                }
-            } else {
-                drawBorder();
-                drawFromMemory();
-            }
+void Monitor::respond() {
+    std::lock_guard<std::mutex> lock { _computer.snapshots().stateMutex() };
+
+    LOG( MONITOR, info ) << "Got interrupt.";
+
+    handleInterrupt( _procInt->state() );
+    _procInt->respond();
+
+    LOG( MONITOR, info ) << "Handled interrupt.";
+}
+
+void Monitor::schedule( Scheduler& scheduler ) {
+    _scheduler = &scheduler;
+    _screen = std::move( sdl::SCREEN );
+    _procInt->setResponder( [this] ( ProcessorState& proc ) { handleInterrupt( &proc ); } );
+    _scheduler->after( sim::MONITOR_FRAME_DURATION, [this] { frame(); } );
+}
+
+// Frames are exactly as long as they should be in simulated time, however long
+// they take to draw.
+void Monitor::frame() {
+    drawFrame();
+    advance( sim::MONITOR_FRAME_DURATION );
+    _scheduler->repeat( sim::MONITOR_FRAME_DURATION, [this] { frame(); } );
+}
+
+void Monitor::drawFrame() {
+    clear();
+
+    if ( _state.isConnected ) {
+        // Show the start-up image if the monitor is still initializing.
+        if ( _state.timeSinceConnected ) {
+            drawStartUp();
+        } else {
+            drawBorder();
+            drawFromMemory();
         }
+    }
 
-        update();
-        std::this_thread::sleep_for( sim::MONITOR_FRAME_DURATION );
+    update();
+}
 
-        _state.sinceLastBlink += sim::MONITOR_FRAME_DURATION;
+void Monitor::advance( std::chrono::microseconds elapsed ) {
+    if ( _state.timeSinceConnected ) {
+        *_state.timeSinceConnected += elapsed;
 
-        if ( _state.sinceLastBlink >=
-             std::chrono::duration_cast<std::chrono::microseconds>( sim::MONITOR_BLINK_DURATION ) ) {
+        if ( *_state.timeSinceConnected >=
+             std::chrono::duration_cast<std::chrono::microseconds>( sim::MONITOR_START_UP_DURATION ) ) {
 
-            _state.sinceLastBlink = std::chrono::microseconds { 0 };
-            _state.blinkVisible = ! _state.blinkVisible;
+            _state.timeSinceConnected.reset();
         }
     }
 
-    LOG( MONITOR, info ) << "Shutting down.";
-    return {};
+    _state.sinceLastBlink += elapsed;
+
+    if ( _state.sinceLastBlink >=
+         std::chrono::duration_cast<std::chrono::microseconds>( sim::MONITOR_BLINK_DURATION ) ) {
+
+        _state.sinceLastBlink = std::chrono::microseconds { 0 };
+        _state.blinkVisible = ! _state.blinkVisible;
+    }
 }
 
 void Monitor::drawStartUp() {
@@ -180,22 +206,27 @@ static inline int index( int x, int y ) {
 }
 
 void Monitor::drawFromMemory() {
-    Word w;
+    std::array<Word, sim::MONITOR_CELLS_PER_SCREEN> cells;
+    _memory->readBlock( _state.videoOffset, cells.data(), cells.size() );
+
+    {
+        std::lock_guard<std::mutex> lock { _computer.snapshots().stateMutex() };
+
+        for ( int i = 0; i < sim::MONITOR_CELLS_PER_SCREEN; ++i ) {
+            if ( cells[i] & 0x0080 ) {
+                _state.isBlinking[i] = true;
+            }
+        }
+    }
 
     for ( int y = 0; y < sim::MONITOR_CELLS_PER_SCREEN_HEIGHT; ++y ) {
         for ( int x = 0; x < sim::MONITOR_CELLS_PER_SCREEN_WIDTH; ++x ) {
-            auto loc = (y * sim::MONITOR_CELLS_PER_SCREEN_WIDTH) + x + _state.videoOffset;
-            w = _memory->read( loc );
+            Word w = cells[index( x, y )];
 
-            bool doBlink = (w & 0x0080) != 0;
             auto ch = static_cast<std::uint8_t>( w & 0x007f );
             auto fg = static_cast<std::uint8_t>( (w & 0xf000) >> 12 );
             auto bg = static_cast<std::uint8_t>( (w & 0x0f00) >> 8 );
 
-            if ( doBlink ) {
-                _state.isBlinking[index( x, y )] = true;
-            }
-
             drawCell( x, y,
                       Character { ch },
                       ForegroundColor { fg },
@@ -204,6 +235,31 @@ void Monitor::drawFromMemory() {
     }
 }
 
+void Monitor::handleInterrupt( ProcessorState* proc ) {
+    auto a = proc->read( Register::A );
+
+    switch ( a ) {
+    case 0:
+        handleInterrupt( MonitorOperation::MapVideoMemory, proc );
+        break;
+    case 1:
+        handleInterrupt( MonitorOperation::MapFontMemory, proc );
+        break;
+    case 2:
+        handleInterrupt( MonitorOperation::MapPaletteMemory, proc );
+        break;
+    case 3:
+        handleInterrupt( MonitorOperation::SetBorderColor, proc );
+        break;
+    case 4:
+        handleInterrupt( MonitorOperation::DumpFont, proc );
+        break;
+    case 5:
+        handleInterrupt( MonitorOperation::DumpPalette, proc );
+        break;
+    }
+}
+
 void Monitor::handleInterrupt( MonitorOperation op, ProcessorState* proc ) {
     Word b = proc->read( Register::B );
 
@@ -241,20 +297,24 @@ void Monitor::handleInterrupt( MonitorOperation op, ProcessorState* proc ) {
     case MonitorOperation::DumpFont:
         LOG( MONITOR, info ) << format( "'DumpFont' at %0x%04x" ) % b;
 
-        for ( Word i = 0; i < 2 * sim::MONITOR_DEFAULT_FONT.size(); i += 2 ) {
-            auto letter = sim::MONITOR_DEFAULT_FONT[i];
+        {
+            std::array<Word, 2 * sim::MONITOR_FONT_CHARACTERS> font;
+
+            for ( std::size_t i = 0; i < sim::MONITOR_FONT_CHARACTERS; ++i ) {
+                font[2 * i] = sim::MONITOR_DEFAULT_FONT[i].first;
+                font[2 * i + 1] = sim::MONITOR_DEFAULT_FONT[i].second;
+            }
 
-            _memory->write( b + i, letter.first );
-            _memory->write( b + i + 1, letter.second );
+            _memory->writeBlock( b, font.data(), font.size() );
+            _computer.inputs().deviceWrote( b, font.data(), font.size() );
         }
 
         break;
     case MonitorOperation::DumpPalette:
         LOG( MONITOR, info ) << format( "'DumpPalette' at %0x%04x" ) % b;
 
-        for ( Word i = 0; i < sim::MONITOR_DEFAULT_PALETTE.size(); ++i ) {
-            _memory->write( b + i, sim::MONITOR_DEFAULT_PALETTE[i] );
-        }
+        _memory->writeBlock( b, sim::MONITOR_DEFAULT_PALETTE.data(), sim::MONITOR_DEFAULT_PALETTE.size() );
+        _computer.inputs().deviceWrote( b, sim::MONITOR_DEFAULT_PALETTE.data(), sim::MONITOR_DEFAULT_PALETTE.size() );
 
         break;
     }
@@ -269,12 +329,8 @@ std::pair<Word, Word> Monitor::getCharacter( Character ch ) {
     if ( _state.fontOffset == 0 ) {
         return sim::MONITOR_DEFAULT_FONT[ch.value];
     } else {
-        auto offset = _state.fontOffset + ch.value;
-
-        return {
-            _memory->read( offset ),
-            _memory->read( offset + 1 )
-        };
+        auto glyph = _memory->view( _state.fontOffset + 2 * ch.value, 2 );
+        return { glyph[0], glyph[1] };
     }
 }
 
@@ -337,4 +393,53 @@ void Monitor::drawCell( int x, int y,
     drawColumn( second & 0x00ff, 3 );
 }
 
+SnapshotPart Monitor::capture() const {
+    auto state = _state;
+
+    return [state] ( SnapshotWriter& writer ) {
+        writer.write( static_cast<bool>( state.timeSinceConnected ) );
+        writer.write( static_cast<std::int64_t>( state.timeSinceConnected ? state.timeSinceConnected->count() : 0 ) );
+        writer.write( state.isConnected );
+        writer.write( state.videoOffset );
+        writer.write( state.fontOffset );
+        writer.write( state.paletteOffset );
+        writer.write( state.borderColor.value );
+
+        for ( auto isBlinking : state.isBlinking ) {
+            writer.write( isBlinking );
+        }
+
+        writer.write( state.blinkVisible );
+        writer.write( static_cast<std::int64_t>( state.sinceLastBlink.count() ) );
+    };
+}
+
+void Monitor::save( SnapshotWriter& writer ) const {
+    capture()( writer );
+}
+
+void Monitor::restore( SnapshotReader& reader ) {
+    auto isConnecting = reader.read<bool>();
+    auto timeSinceConnected = std::chrono::microseconds { reader.read<std::int64_t>() };
+
+    if ( isConnecting ) {
+        _state.timeSinceConnected = timeSinceConnected;
+    } else {
+        _state.timeSinceConnected.reset();
+    }
+
+    _state.isConnected = reader.read<bool>();
+    _state.videoOffset = reader.read<Word>();
+    _state.fontOffset = reader.read<Word>();
+    _state.paletteOffset = reader.read<Word>();
+    _state.borderColor = BorderColor { reader.read<std::uint8_t>() };
+
+    for ( auto& isBlinking : _state.isBlinking ) {
+        isBlinking = reader.read<bool>();
+    }
+
+    _state.blinkVisible = reader.read<bool>();
+    _state.sinceLastBlink = std::chrono::microseconds { reader.read<std::int64_t>() };
+}
+
 }
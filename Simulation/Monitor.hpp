@@ -20,6 +20,7 @@
 #include "../Simulation.hpp"
 #include "../Sdl.hpp"
 #include "MonitorFont.hpp"
+#include "Scheduler.hpp"
 
 #include <array>
 #include <chrono>
@@ -124,6 +125,8 @@ class Monitor : public Simulation<MonitorState>, public Device {
     std::unique_ptr<SDL_Rect> _borderHorizontal;
     std::unique_ptr<SDL_Rect> _borderVertical;
 
+    Scheduler* _scheduler { nullptr };
+
     std::pair<Word, Word> getCharacter( Character ch );
 
     DoubleWord getColor( std::uint8_t color ) const;
@@ -140,12 +143,35 @@ class Monitor : public Simulation<MonitorState>, public Device {
     inline void clear() { fill( BackgroundColor { 0 } ); }
     inline void update() { SDL_Flip( _screen.get() ); }
 
+    void drawFrame();
+
+    // Move the start-up image and blinking on by `elapsed`.
+    void advance( std::chrono::microseconds elapsed );
+
+    void frame();
+
+    // Respond to the processor, from the simulation's thread.
+    void respond();
+
+    void handleInterrupt( ProcessorState* proc );
     void handleInterrupt( MonitorOperation op, ProcessorState* proc );
 public:
     explicit Monitor( Computer& computer );
 
     virtual std::unique_ptr<MonitorState> run() override;
 
+    // Instead of `run`, draw frames on the thread of `scheduler`, which must
+    // be the thread that owns `sdl::SCREEN`.
+    void schedule( Scheduler& scheduler );
+
+    // Only while holding `LiveSnapshots::stateMutex`, or while the
+    // simulation isn't running.
+    SnapshotPart capture() const;
+
+    // Only while the simulation isn't running.
+    void save( SnapshotWriter& writer ) const;
+    void restore( SnapshotReader& reader );
+
     inline virtual DeviceInfo info() const noexcept override {
         return DeviceInfo {
             device::Id { 0x7349f615 },
@@ -20,7 +20,9 @@ namespace nebula {
 
 namespace sim {
 
-const std::array<std::pair<Word, Word>, 128> MONITOR_DEFAULT_FONT {{
+const std::size_t MONITOR_FONT_CHARACTERS = 128;
+
+const std::array<std::pair<Word, Word>, MONITOR_FONT_CHARACTERS> MONITOR_DEFAULT_FONT {{
         // NULL
         { B_( 10110111
               10011110 ),
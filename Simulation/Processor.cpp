@@ -15,81 +15,525 @@
 // limitations under the License.
 
 #include "Processor.hpp"
+#include "../InstructionCache.hpp"
 
-#include <thread>
+#include <algorithm>
 
 namespace nebula {
 
 std::unique_ptr<ProcessorState>
 Processor::run() {
+    _computer.inputs().checkExecution( _mode, _proc->isFusing );
     setActive();
 
     LOG( PROC, info ) << "Simulation is active.";
+    _pacer.start();
 
-    while ( isActive() ) {
-        auto now = std::chrono::system_clock::now();
+    if ( _nativeImage ) {
+        LOG( PROC, info ) << "Using the native image.";
+        runTranslated( *_nativeImage );
+    } else {
+        switch ( _mode ) {
+        case ExecutionMode::Interpreted:
+            runInterpreted();
+            break;
+        case ExecutionMode::Threaded:
+            runThreaded();
+            break;
+        case ExecutionMode::Compiled:
+            runCompiled();
+            break;
+        }
+    }
 
-        _proc->executeNext();
+    return finish();
+}
 
-        if ( auto ins = dynamic_cast<const instruction::Unary*>( _proc->lastInstruction() ) ) {
-            executeSpecial( ins );
-        }
+std::unique_ptr<ProcessorState>
+Processor::runScheduled( Scheduler& scheduler ) {
+    _computer.inputs().checkExecution( _mode, _proc->isFusing );
+    setActive();
 
-        std::this_thread::sleep_until( now + (_tickDuration * _proc->clock()) );
-        _proc->clearClock();
+    LOG( PROC, info ) << "Simulation is active, with the scheduler.";
+    _pacer.start();
 
-        if ( _computer.queue().hasInterrupt() &&
-             _computer.ia != 0 &&
-             ! _computer.onlyQueuing ) {
-            handleInterrupt();
-        }
+    // Devices that respond to HWI schedule from the cycle of the instruction,
+    // not the end of the last batch that was paced.
+    scheduler.follow( [this] { return cycles(); } );
+
+    while ( isRunning() ) {
+        runQuantum( scheduler.deadline() );
+        scheduler.runDue();
+    }
+
+    scheduler.follow( nullptr );
+    _quantumEnd.reset();
+    return finish();
+}
+
+std::unique_ptr<ProcessorState> Processor::finish() {
+    if ( _computer.inputs().isRecording() ) {
+        _computer.inputs().recordEnd( cycles() );
     }
 
+    auto report = _pacer.report();
+
+    LOG( PROC, info ) << format( "Recently ran at %.0f Hz, with a target of %d Hz." ) % report.achievedHz % _pacer.clockHz();
     LOG( PROC, info ) << "Shutting down.";
+
+    switch ( _proc->fault() ) {
+    case Fault::None:
+        break;
+    case Fault::MalformedInstruction:
+        throw error::MalformedInstruction { _proc->faultWord() };
+    case Fault::CaughtFire:
+        throw error::CaughtFire {};
+    }
+
     return std::move( _proc );
 }
 
+// Execute until at least cycle `end`.
+void Processor::runQuantum( std::uint64_t end ) {
+    auto hasInterrupt = [this] { return hasPendingInterrupt(); };
+    _quantumEnd = end;
+
+    while ( isRunning() && cycles() < end ) {
+        auto budget = std::min<std::uint64_t>( end - cycles(), sim::INTERPRETED_BATCH_CYCLES );
+        auto result = _proc->executeBatch( static_cast<int>( budget ), hasInterrupt );
+
+        if ( result.end == BatchEnd::Special ) {
+            executeSpecial( *_proc->lastInstruction() );
+        } else if ( result.end == BatchEnd::Loop ) {
+            auto loop = findIdleLoop( *_proc );
+
+            if ( loop ) {
+                park( *loop );
+            }
+        }
+
+        pace();
+    }
+}
+
+void Processor::runInterpreted() {
+    auto hasInterrupt = [this] { return hasPendingInterrupt(); };
+
+    while ( isRunning() ) {
+        int budget = sim::INTERPRETED_BATCH_CYCLES;
+
+        // Pacing is only necessary once the budget is used up, or before
+        // handling an interrupt.
+        while ( budget > 0 ) {
+            auto result = _proc->executeBatch( budget, hasInterrupt );
+            budget -= result.cycles;
+
+            if ( result.end == BatchEnd::Special ) {
+                executeSpecial( *_proc->lastInstruction() );
+            } else if ( result.end == BatchEnd::Loop ) {
+                auto loop = findIdleLoop( *_proc );
+
+                if ( loop ) {
+                    park( *loop );
+                    break;
+                }
+            } else {
+                break;
+            }
+        }
+
+        pace();
+    }
+}
+
+#if defined( __GNUC__ )
+
+// Taking the address of a label is a GNU extension.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+
+void Processor::runThreaded() {
+    LOG( PROC, info ) << "Using the threaded interpreter.";
+
+    // Indexed by `InstructionKind`.
+    static void* const TARGETS[] = { &&malformed, &&binary, &&unary };
+
+    static_assert( static_cast<int>( InstructionKind::Malformed ) == 0 &&
+                   static_cast<int>( InstructionKind::Binary ) == 1 &&
+                   static_cast<int>( InstructionKind::Unary ) == 2,
+                   "Dispatch targets are out of order." );
+
+    Word address;
+    const DecodedInstruction* ins;
+
+    // Every instruction body ends with its own copy of the dispatch, so that
+    // each indirect jump is predicted independently based on the instruction
+    // that precedes it.
+    //
+    // As with the interpreter, pacing is only necessary once a batch of
+    // cycles is used up, or before handling an interrupt.
+#define NEBULA_DISPATCH()                                               \
+    do {                                                                \
+        if ( _proc->clock() >= sim::INTERPRETED_BATCH_CYCLES ||         \
+             hasPendingInterrupt() ) {                                  \
+            pace();                                                     \
+                                                                        \
+            if ( ! isRunning() ) {                                      \
+                return;                                                 \
+            }                                                           \
+        } else if ( _proc->fault() != Fault::None ) {                   \
+            return;                                                     \
+        }                                                               \
+                                                                        \
+        address = _proc->read( Special::Pc );                           \
+        ins = &_proc->decodeNext();                                     \
+        _proc->write( Special::Pc, address + 1 );                       \
+                                                                        \
+        goto *(_proc->doSkip ?                                          \
+               &&skipped :                                              \
+               TARGETS[static_cast<std::size_t>( ins->kind )]);         \
+    } while ( false )
+
+    NEBULA_DISPATCH();
+
+binary:
+    ins->handler( *_proc, *ins );
+    _proc->tickClock( ins->cycles );
+
+    if ( _proc->isFusing ) {
+        _proc->fuse( *ins,
+                     sim::INTERPRETED_BATCH_CYCLES,
+                     [this] { return hasPendingInterrupt(); } );
+    }
+
+    // Only a jump backwards can close a loop.
+    if ( _proc->read( Special::Pc ) <= address ) {
+        parkIfIdle( address );
+    }
+
+    NEBULA_DISPATCH();
+
+unary:
+    ins->handler( *_proc, *ins );
+    _proc->tickClock( ins->cycles );
+    executeSpecial( *ins );
+    NEBULA_DISPATCH();
+
+skipped:
+    if ( ins->kind == InstructionKind::Malformed ) {
+        goto malformed;
+    }
+
+    skip( *_proc, *ins );
+    NEBULA_DISPATCH();
+
+malformed:
+    _proc->setFault( Fault::MalformedInstruction, _proc->memory()->read( address ) );
+    _proc->write( Special::Pc, address );
+    return;
+
+#undef NEBULA_DISPATCH
+}
+
+#pragma GCC diagnostic pop
+
+#else
+
+void Processor::runThreaded() {
+    LOG( PROC, warning ) << "The threaded interpreter is not supported by this compiler.";
+    runInterpreted();
+}
+
+#endif
+
+// Execute with `translation` where possible, interpreting instructions that
+// it can't execute one at a time.
+template <typename Translation>
+void Processor::runTranslated( Translation& translation ) {
+    while ( isRunning() ) {
+        auto address = _proc->read( Special::Pc );
+
+        if ( ! translation.execute( *_proc, sim::COMPILED_BATCH_CYCLES ) ) {
+            _proc->executeNext();
+
+            auto ins = _proc->lastInstruction();
+
+            if ( ins && ins->kind == InstructionKind::Unary ) {
+                executeSpecial( *ins );
+            }
+        }
+
+        parkIfIdle( address );
+        pace();
+    }
+}
+
+void Processor::runCompiled() {
+    std::unique_ptr<Jit> jit { nullptr };
+
+    try {
+        jit = make_unique<Jit>( _computer.memory() );
+    } catch ( error::JitUnavailable& err ) {
+        LOG( PROC, warning ) << err.what();
+        runThreaded();
+        return;
+    }
+
+    LOG( PROC, info ) << "Using the compiler.";
+    runTranslated( *jit );
+}
+
+// Check for an idle loop after executing from `address`.
+void Processor::parkIfIdle( Word address ) {
+    auto pc = _proc->read( Special::Pc );
+
+    // Only short jumps backwards can close a loop, so nothing else is worth
+    // examining.
+    if ( pc > address || address - pc >= processor::MAX_LOOP_WORDS ) {
+        return;
+    }
+
+    auto loop = findIdleLoop( *_proc );
+
+    if ( loop ) {
+        park( *loop );
+    }
+}
+
+// Instead of executing `loop`, wait until something could end it. The clock
+// is ticked for every iteration that would have started in the meantime, so
+// that pacing resumes as if the loop had been executed.
+void Processor::park( const IdleLoop& loop ) {
+    auto& inputs = _computer.inputs();
+
+    if ( inputs.isReplaying() ) {
+        _proc->tickClock( static_cast<int>( inputs.replayIdle( cycles() ) ) );
+        return;
+    }
+
+    if ( _quantumEnd ) {
+        skipToDeadline( loop );
+        return;
+    }
+
+    if ( _computer.timing().isUnthrottled() ) {
+        skipIdle( loop );
+        return;
+    }
+
+    auto start = Pacer::Clock::now();
+
+    auto deadline = start + (loop.isPolling ? sim::POLLING_IDLE_DURATION : sim::MAX_IDLE_DURATION);
+
+    // Interrupts that can't be handled yet don't end the loop.
+    bool isInterruptible = _computer.ia != 0 && ! _computer.onlyQueuing;
+
+    _computer.queue().waitForInterruptOrDeath( *this, isInterruptible, deadline );
+
+    auto period = _pacer.duration( loop.cycles );
+    auto elapsed = Pacer::Clock::now() - start;
+    auto iterations = (elapsed + period - Pacer::Clock::duration { 1 }) / period;
+    auto ticks = static_cast<int>( iterations ) * loop.cycles;
+
+    if ( inputs.isRecording() ) {
+        inputs.recordIdle( cycles(), ticks );
+    }
+
+    _proc->tickClock( ticks );
+}
+
+// When unthrottled, there is nothing to wait for in real time. Instead,
+// simulated time skips ahead one step at a time (as if the loop had been
+// executed) while devices catch up, until something could end the loop.
+void Processor::skipIdle( const IdleLoop& loop ) {
+    auto& timing = _computer.timing();
+    bool isInterruptible = _computer.ia != 0 && ! _computer.onlyQueuing;
+
+    auto step = timing.cycles( sim::UNTHROTTLED_IDLE_STEP );
+    step = std::max<std::uint64_t>( (step + loop.cycles - 1) / loop.cycles, 1 ) * loop.cycles;
+
+    auto deadline = timing.now() + (loop.isPolling ? sim::POLLING_IDLE_DURATION : sim::MAX_IDLE_DURATION);
+    auto start = cycles();
+
+    while ( isActive() && timing.now() < deadline ) {
+        timing.advance( step );
+
+        _computer.queue().waitForInterruptOrDeath( *this, isInterruptible,
+                                                   Pacer::Clock::now() + timing::UNTHROTTLED_POLL_DURATION );
+
+        if ( isInterruptible && _computer.queue().hasInterrupt() ) {
+            break;
+        }
+    }
+
+    if ( _computer.inputs().isRecording() ) {
+        _computer.inputs().recordIdle( start, cycles() - start );
+    }
+}
+
+// When driven by a scheduler, nothing can end the loop before the next event
+// unless an interrupt is already waiting, so the loop is skipped until then.
+void Processor::skipToDeadline( const IdleLoop& loop ) {
+    auto start = cycles();
+    std::uint64_t ticks = 0;
+
+    if ( ! hasPendingInterrupt() && start < *_quantumEnd ) {
+        ticks = (*_quantumEnd - start + loop.cycles - 1) / loop.cycles * loop.cycles;
+    }
+
+    if ( _computer.inputs().isRecording() ) {
+        _computer.inputs().recordIdle( start, ticks );
+    }
+
+    _proc->tickClock( static_cast<int>( ticks ) );
+}
+
+// Wait for the cycles consumed to catch up with the schedule, and then service
+// the next pending hardware interrupt.
+void Processor::pace() {
+    auto& timing = _computer.timing();
+    timing.advance( _proc->clock() );
+
+    if ( ! timing.isUnthrottled() ) {
+        _pacer.pace( _proc->clock() );
+    }
+
+    _proc->clearClock();
+
+    auto& snapshots = _computer.snapshots();
+
+    if ( snapshots.isRequested() ) {
+        snapshots.capture();
+    }
+
+    auto& inputs = _computer.inputs();
+
+    if ( inputs.isReplaying() ) {
+        replayInputs();
+        return;
+    }
+
+    if ( inputs.isRecording() ) {
+        inputs.recordWrites( cycles() );
+    }
+
+    if ( _computer.queue().isOnFire() ) {
+        if ( inputs.isRecording() ) {
+            inputs.recordFire( cycles() );
+        }
+
+        _proc->setFault( Fault::CaughtFire );
+        return;
+    }
+
+    if ( hasPendingInterrupt() ) {
+        handleInterrupt();
+    }
+}
+
+// In the same order as everything is recorded by `pace`. The replay ends
+// where the recording did.
+void Processor::replayInputs() {
+    auto& inputs = _computer.inputs();
+    auto cycle = cycles();
+
+    inputs.replayWrites( cycle, *_computer.memory() );
+
+    if ( inputs.isFireDue( cycle ) ) {
+        inputs.replayFire();
+        _proc->setFault( Fault::CaughtFire );
+        return;
+    }
+
+    if ( hasPendingInterrupt() ) {
+        handleInterrupt();
+    }
+
+    if ( inputs.isEndDue( cycle ) ) {
+        LOG( PROC, info ) << "Reached the end of the replay.";
+        stop();
+    }
+}
+
 void Processor::handleInterrupt() {
-    auto msg = _computer.queue().pop();
-    auto push = mode::Push {};
+    auto& inputs = _computer.inputs();
+    auto msg = inputs.isReplaying() ? inputs.replayInterrupt() : _computer.queue().pop();
 
-    LOG( PROC, info ) << format( "Handling HW interrupt of 0x%04x." ) % msg;
+    if ( inputs.isRecording() ) {
+        inputs.recordInterrupt( cycles(), msg );
+    }
+
+    LOG( PROC, debug ) << format( "Handling HW interrupt of 0x%04x." ) % msg;
     
     _computer.onlyQueuing = true;
-    push.store( *_proc, _proc->read( Special::Pc ) );
-    push.store( *_proc, _proc->read( Register::A ) );
+    push( *_proc, _proc->read( Special::Pc ) );
+    push( *_proc, _proc->read( Register::A ) );
     _proc->write( Special::Pc, _computer.ia );
     _proc->write( Register::A, msg );
 }
 
-void Processor::executeSpecial( const instruction::Unary* ins ) {
-    auto load = [this, ins] { return ins->address->load( *_proc ); };
-    auto store = [this, ins] ( Word value ) { ins->address->store( *_proc, value ); };
+void Processor::executeSpecial( const DecodedInstruction& ins ) {
+    Operand address { AddressContext::A, ins.a };
+    auto opcode = ins.specialOpcode();
+
+    auto load = [this, &address] { return address.load( *_proc ); };
+    auto store = [this, &address] ( Word value ) { address.store( *_proc, value ); };
 
-    if ( ins->opcode == SpecialOpcode::Hwi ) {
+    if ( opcode == SpecialOpcode::Hwi ) {
         Word index = load();
-        auto inter = _computer.interruptByIndex( index );
+        auto& inputs = _computer.inputs();
+        auto cycle = cycles();
 
-        // Trigger the interrupt, and wait for the device to respond.
-        inter->trigger( std::move( _proc ) );
-        _proc = inter->waitForResponse();
-    } else if ( ins->opcode == SpecialOpcode::Hwn ) {
+        if ( inputs.isReplaying() ) {
+            // Only what the device did is needed, not the device.
+            if ( ! inputs.replayHwi( cycle, *_proc ) ) {
+                throw error::BadInputLog { (format( "no HWI was recorded at cycle %d" ) % cycle).str() };
+            }
+
+            inputs.replayWrites( cycle, *_computer.memory() );
+        } else {
+            auto* inter = _computer.interruptByIndex( index );
+            auto before = InputLog::registersOf( *_proc );
+            auto clock = _proc->clock();
+
+            if ( ! inter ) {
+                // Interrupting a device that isn't there does nothing.
+                LOG( PROC, debug ) << format( "No device at index 0x%04x." ) % index;
+            } else if ( inter->responder() ) {
+                inter->responder()( *_proc );
+            } else {
+                // Trigger the interrupt, and wait for the device to respond.
+                inter->trigger( std::move( _proc ) );
+                _proc = inter->waitForResponse();
+            }
+
+            if ( inputs.isRecording() ) {
+                inputs.recordHwi( cycle, before, *_proc, _proc->clock() - clock );
+                inputs.recordWrites( cycle );
+            }
+        }
+    } else if ( opcode == SpecialOpcode::Hwn ) {
         store( _computer.numDevices() );
         _proc->tickClock( 2 );
-    } else if ( ins->opcode == SpecialOpcode::Hwq ) {
+    } else if ( opcode == SpecialOpcode::Hwq ) {
         Word index = load();
         auto info = _computer.infoByIndex( index );
 
-        _proc->write( Register::A, info.id.value & 0xffff );
-        _proc->write( Register::B, (info.id.value & 0xffff0000) >> 16 );
+        // A device that isn't there is all zeros.
+        if ( ! info ) {
+            info = DeviceInfo { device::Id { 0 }, device::Manufacturer { 0 }, device::Version { 0 } };
+        }
+
+        _proc->write( Register::A, info->id.value & 0xffff );
+        _proc->write( Register::B, (info->id.value & 0xffff0000) >> 16 );
 
-        _proc->write( Register::X, info.manufacturer.value & 0xffff );
-        _proc->write( Register::Y, (info.manufacturer.value & 0xffff0000) >> 16 );
+        _proc->write( Register::X, info->manufacturer.value & 0xffff );
+        _proc->write( Register::Y, (info->manufacturer.value & 0xffff0000) >> 16 );
 
-        _proc->write( Register::C, info.version.value );
-    } else if ( ins->opcode == SpecialOpcode::Iag ) {
+        _proc->write( Register::C, info->version.value );
+    } else if ( opcode == SpecialOpcode::Iag ) {
         store( _computer.ia );
-    } else if ( ins->opcode == SpecialOpcode::Ias ) {
+    } else if ( opcode == SpecialOpcode::Ias ) {
         auto value = load();
         _computer.ia = value;
 
@@ -100,18 +544,21 @@ void Processor::executeSpecial( const instruction::Unary* ins ) {
             LOG( PROC, info ) << format( "Enabling incoming HW interrupts at 0x%04x" ) % value;
             _computer.queue().setEnabled( true );
         }
-    } else if ( ins->opcode == SpecialOpcode::Rfi ) {
-        auto pop = mode::Pop {};
-        _proc->write( Register::A, pop.load( *_proc ) );
-        _proc->write( Special::Pc, pop.load( *_proc ) );
+    } else if ( opcode == SpecialOpcode::Rfi ) {
+        _proc->write( Register::A, pop( *_proc ) );
+        _proc->write( Special::Pc, pop( *_proc ) );
         _computer.onlyQueuing = false;
-    } else if ( ins->opcode == SpecialOpcode::Iaq ) {
+    } else if ( opcode == SpecialOpcode::Iaq ) {
         _computer.onlyQueuing = (load() != 0);
-    } else if ( ins->opcode == SpecialOpcode::Int ) {
+    } else if ( opcode == SpecialOpcode::Int ) {
         LOG( PROC, info ) << "Triggering a SW interrupt.";
 
         auto msg = load();
-        _computer.queue().push( msg );
+
+        // When replaying, the interrupt is handled when it was recorded.
+        if ( ! _computer.inputs().isReplaying() ) {
+            _computer.queue().push( msg );
+        }
     }
 }
 
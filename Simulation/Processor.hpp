@@ -17,8 +17,13 @@
 #pragma once
 
 #include "../Computer.hpp"
+#include "../IdleLoop.hpp"
+#include "../Jit.hpp"
+#include "../NativeImage.hpp"
+#include "../Pacer.hpp"
 #include "../ProcessorState.hpp"
 #include "../Simulation.hpp"
+#include "Scheduler.hpp"
 
 #include <atomic>
 #include <chrono>
@@ -29,27 +34,113 @@ namespace nebula {
 
 namespace sim {
 
-const std::chrono::microseconds PROCESSOR_TICK_DURATION { 10 };
+// Compiled and translated code runs for (at least) this many cycles between
+// checks for interrupts.
+const int COMPILED_BATCH_CYCLES = 100;
+
+// The interpreter paces itself after batches of this many cycles. Interrupts
+// still end a batch early.
+const int INTERPRETED_BATCH_CYCLES = 1000;
+
+// An idle processor waits for at most this long before checking if a loop
+// that polls memory is still idle, and for at most the longer duration
+// otherwise (so that the clock can't overflow).
+const std::chrono::milliseconds POLLING_IDLE_DURATION { 1 };
+const std::chrono::milliseconds MAX_IDLE_DURATION { 1000 };
+
+// When unthrottled, an idle processor skips ahead in simulated time by steps
+// of this long.
+const std::chrono::milliseconds UNTHROTTLED_IDLE_STEP { 1 };
 
 }
 
 class Processor : public Simulation<ProcessorState> {
     Computer& _computer;
     std::unique_ptr<ProcessorState> _proc { nullptr };
-    std::chrono::microseconds _tickDuration;
+    Pacer _pacer;
+    ExecutionMode _mode;
+    std::shared_ptr<NativeImage> _nativeImage;
+
+    // When driven by a scheduler, the end of the current quantum.
+    optional<std::uint64_t> _quantumEnd {};
+
+    std::unique_ptr<ProcessorState> finish();
+
+    void runInterpreted();
+    void runQuantum( std::uint64_t end );
+    void runThreaded();
+    void runCompiled();
+
+    template <typename Translation>
+    void runTranslated( Translation& translation );
+
+    void parkIfIdle( Word address );
+    void park( const IdleLoop& loop );
+    void skipIdle( const IdleLoop& loop );
+    void skipToDeadline( const IdleLoop& loop );
+    void pace();
+
+    // Instead of the interrupt queue and devices, when replaying.
+    void replayInputs();
+
+    // Every cycle so far, including the ones that haven't been reported to
+    // `Timing` yet.
+    inline std::uint64_t cycles() const noexcept {
+        return _computer.timing().elapsedCycles() + _proc->clock();
+    }
+
+    // Whether there is an interrupt that can be handled now.
+    inline bool hasPendingInterrupt() noexcept {
+        auto& inputs = _computer.inputs();
+        bool hasInterrupt = inputs.isReplaying() ? inputs.isInterruptDue( cycles() ) : _computer.queue().hasInterrupt();
+
+        return hasInterrupt && _computer.ia != 0 && ! _computer.onlyQueuing;
+    }
+
+    // Whether execution can continue.
+    inline bool isRunning() const noexcept { return isActive() && _proc->fault() == Fault::None; }
 
     void handleInterrupt();
-    void executeSpecial( const instruction::Unary* ins );
+    void executeSpecial( const DecodedInstruction& ins );
 public:
-    explicit Processor( Computer& computer ) :
+    // When there is a native image, it is used instead of `mode`.
+    explicit Processor( Computer& computer,
+                        ExecutionMode mode = ExecutionMode::Interpreted,
+                        std::shared_ptr<NativeImage> nativeImage = nullptr ) :
         Simulation<ProcessorState> {},
         _computer( computer ),
         _proc { make_unique<ProcessorState>( computer.memory() ) },
-        _tickDuration { sim::PROCESSOR_TICK_DURATION } {}
+        _pacer { computer.timing().pacedClockHz() },
+        _mode { mode },
+        _nativeImage { nativeImage } {}
 
     Processor( const Processor& ) = delete;
 
+    // The state of the processor, until `run` returns it.
+    inline ProcessorState& state() noexcept { return *_proc; }
+
+    // Execute common sequences of instructions as single operations when
+    // interpreting (see `Fusion`).
+    inline void setFusing( bool isFusing ) noexcept { _proc->isFusing = isFusing; }
+
+    // The largest fraction of the time that may be spent spinning to keep the
+    // clock rate precise (see `Pacer`).
+    inline void setSpinLimit( double spinLimit ) noexcept {
+        _pacer = Pacer { _pacer.clockHz(), spinLimit };
+    }
+
+    // Faults are thrown from here as errors, once the processor has stopped.
     virtual std::unique_ptr<ProcessorState> run() override;
+
+    // Instead of `run`, execute on the thread of `scheduler`, between the
+    // events that it performs, until the processor stops. Instructions are
+    // interpreted, and idle loops skip ahead to the next event.
+    std::unique_ptr<ProcessorState> runScheduled( Scheduler& scheduler );
+
+    virtual void stop() override {
+        Simulation<ProcessorState>::stop();
+        _computer.timing().halt();
+    }
 };
 
 }
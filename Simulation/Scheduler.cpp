@@ -0,0 +1,47 @@
+// Simulation/Scheduler.cpp
+//
+// Copyright 2013 Jesse Haber-Kucharsky
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "Scheduler.hpp"
+
+namespace nebula {
+
+void Scheduler::at( std::uint64_t cycle, Action action ) {
+    _events.push( Event { cycle, _sequence++, std::move( action ) } );
+}
+
+void Scheduler::after( Timing::Duration d, Action action ) {
+    at( now() + cycles( d ), std::move( action ) );
+}
+
+void Scheduler::repeat( Timing::Duration d, Action action ) {
+    at( _due + cycles( d ), std::move( action ) );
+}
+
+std::uint64_t Scheduler::deadline() const {
+    auto limit = now() + _timing.cycles( sim::SCHEDULER_MAX_QUANTUM );
+    return _events.empty() ? limit : std::min( limit, _events.top().cycle );
+}
+
+void Scheduler::runDue() {
+    while ( ! _events.empty() && _events.top().cycle <= now() ) {
+        auto action = _events.top().action;
+        _due = _events.top().cycle;
+        _events.pop();
+        action();
+    }
+}
+
+}
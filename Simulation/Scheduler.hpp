@@ -0,0 +1,117 @@
+// Simulation/Scheduler.hpp
+//
+// Copyright 2013 Jesse Haber-Kucharsky
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "../Timing.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <queue>
+#include <vector>
+
+namespace nebula {
+
+namespace sim {
+
+// When no device needs anything sooner, the processor still returns to the
+// scheduler after this long.
+const std::chrono::milliseconds SCHEDULER_MAX_QUANTUM { 10 };
+
+}
+
+// Runs the processor and every device on a single thread, instead of each on
+// a thread of its own.
+//
+// Time is the number of cycles that the processor has executed (see
+// `Timing`). Devices schedule what they do next at a point in simulated time,
+// and the processor executes until the earliest of them, so everything
+// happens in an order that only depends on simulated time. Nothing waits for
+// anything else, and the same machine always runs the same way.
+//
+// Devices that are driven by a scheduler respond to the processor directly
+// (see `ProcessorInterrupt::setResponder`), and the processor is run with
+// `Processor::runScheduled` on the same thread.
+class Scheduler final {
+public:
+    using Action = std::function<void ()>;
+
+    using Now = std::function<std::uint64_t ()>;
+private:
+    struct Event {
+        std::uint64_t cycle;
+
+        // Events at the same cycle happen in the order they were scheduled.
+        std::uint64_t sequence;
+
+        Action action;
+    };
+
+    struct IsLater {
+        inline bool operator()( const Event& a, const Event& b ) const noexcept {
+            return a.cycle != b.cycle ? a.cycle > b.cycle : a.sequence > b.sequence;
+        }
+    };
+
+    Timing& _timing;
+    Now _now {};
+    std::priority_queue<Event, std::vector<Event>, IsLater> _events {};
+    std::uint64_t _sequence { 0 };
+
+    // The cycle at which the event being performed was due.
+    std::uint64_t _due { 0 };
+
+    inline std::uint64_t cycles( Timing::Duration d ) const noexcept {
+        return std::max<std::uint64_t>( _timing.cycles( d ), 1 );
+    }
+public:
+    explicit Scheduler( Timing& timing ) :
+        _timing( timing ) {}
+
+    Scheduler( const Scheduler& ) = delete;
+    Scheduler& operator=( const Scheduler& ) = delete;
+
+    inline std::uint64_t now() const { return _now ? _now() : _timing.elapsedCycles(); }
+
+    // Measure time with `now` rather than the cycles that have been paced, so
+    // that events scheduled while the processor is part-way through a batch
+    // are not early. An empty function restores the default.
+    void follow( Now now ) { _now = std::move( now ); }
+
+    void at( std::uint64_t cycle, Action action );
+
+    // At least a cycle from now.
+    void after( Timing::Duration d, Action action );
+
+    // From within an event, schedule `action` at least a cycle after that
+    // event was due rather than after now, so that periodic events don't drift
+    // by however late they run.
+    void repeat( Timing::Duration d, Action action );
+
+    // When the processor must next return to the scheduler.
+    std::uint64_t deadline() const;
+
+    // Perform every event that is due, including any that they schedule for
+    // now.
+    void runDue();
+
+    inline std::size_t numEvents() const noexcept { return _events.size(); }
+};
+
+}
@@ -0,0 +1,201 @@
+// Snapshot.cpp
+//
+// Copyright 2013 Jesse Haber-Kucharsky
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "Snapshot.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+
+DEFINE_LOGGER( SNAPSHOT, "Snapshot" )
+
+namespace nebula {
+
+SnapshotWriter::SnapshotWriter() {
+    write( snapshot::MAGIC );
+    write( snapshot::VERSION );
+}
+
+void SnapshotWriter::writeWords( const Word* words, std::size_t count ) {
+    auto offset = _bytes.size();
+    _bytes.resize( offset + 2 * count );
+
+    for ( std::size_t i = 0; i < count; ++i ) {
+        _bytes[offset + 2 * i] = static_cast<unsigned char>( words[i] );
+        _bytes[offset + 2 * i + 1] = static_cast<unsigned char>( words[i] >> 8 );
+    }
+}
+
+void SnapshotWriter::saveToFile( const std::string& path ) const {
+    std::ofstream file { path, std::ios::out | std::ios::binary };
+
+    if ( ! file.is_open() ) {
+        throw error::SnapshotFile { path };
+    }
+
+    file.write( reinterpret_cast<const char*>( _bytes.data() ), _bytes.size() );
+    file.close();
+
+    if ( ! file ) {
+        throw error::SnapshotFile { path };
+    }
+}
+
+SnapshotReader::SnapshotReader( std::vector<unsigned char> bytes ) :
+    _bytes( std::move( bytes ) ) {
+    if ( read<std::uint32_t>() != snapshot::MAGIC ) {
+        throw error::BadSnapshot { "not a snapshot" };
+    }
+
+    auto version = read<std::uint32_t>();
+
+    if ( version != snapshot::VERSION ) {
+        throw error::BadSnapshot { (format( "unsupported version %d" ) % version).str() };
+    }
+}
+
+SnapshotReader SnapshotReader::fromFile( const std::string& path ) {
+    std::ifstream file { path, std::ios::in | std::ios::binary };
+
+    if ( ! file.is_open() ) {
+        throw error::SnapshotFile { path };
+    }
+
+    return SnapshotReader {
+        std::vector<unsigned char>( std::istreambuf_iterator<char> { file }, std::istreambuf_iterator<char> {} )
+    };
+}
+
+void SnapshotReader::require( std::size_t count ) const {
+    if ( _bytes.size() - _position < count ) {
+        throw error::BadSnapshot { "truncated" };
+    }
+}
+
+void SnapshotReader::readWords( Word* words, std::size_t count ) {
+    require( 2 * count );
+
+    for ( std::size_t i = 0; i < count; ++i ) {
+        words[i] = static_cast<Word>( _bytes[_position + 2 * i] | (_bytes[_position + 2 * i + 1] << 8) );
+    }
+
+    _position += 2 * count;
+}
+
+LiveSnapshots::~LiveSnapshots() {
+    {
+        std::lock_guard<std::mutex> lock { _mutex };
+        _isStopping = true;
+    }
+
+    _condition.notify_all();
+
+    if ( _thread.joinable() ) {
+        _thread.join();
+    }
+}
+
+void LiveSnapshots::add( Capture capture ) {
+    _captures.push_back( std::move( capture ) );
+}
+
+void LiveSnapshots::request( const std::string& path ) {
+    std::lock_guard<std::mutex> lock { _mutex };
+
+    _requestedPath = path;
+    _isRequested.store( true );
+}
+
+void LiveSnapshots::capture() {
+    auto start = std::chrono::steady_clock::now();
+    std::vector<SnapshotPart> parts {};
+
+    {
+        std::lock_guard<std::mutex> lock { _stateMutex };
+
+        for ( auto& capture : _captures ) {
+            parts.push_back( capture() );
+        }
+    }
+
+    auto pause = std::chrono::duration_cast<std::chrono::microseconds>( std::chrono::steady_clock::now() - start );
+
+    {
+        std::lock_guard<std::mutex> lock { _mutex };
+
+        _pending.emplace_back( _requestedPath, std::move( parts ) );
+        _isRequested.store( false );
+
+        if ( ! _thread.joinable() ) {
+            _thread = std::thread { [this] { writePending(); } };
+        }
+    }
+
+    _condition.notify_all();
+
+    LOG( SNAPSHOT, info ) << format( "Captured a snapshot in %d us." ) % pause.count();
+}
+
+void LiveSnapshots::wait() {
+    std::unique_lock<std::mutex> lock { _mutex };
+    _condition.wait( lock, [this] { return _pending.empty() && ! _isWriting; } );
+}
+
+// A snapshot is written next to its destination first, so that a snapshot
+// that was written before is never left incomplete.
+void LiveSnapshots::writePending() {
+    std::unique_lock<std::mutex> lock { _mutex };
+
+    while ( true ) {
+        _condition.wait( lock, [this] { return _isStopping || ! _pending.empty(); } );
+
+        if ( _pending.empty() ) {
+            return;
+        }
+
+        auto snapshot = std::move( _pending.front() );
+        _pending.pop_front();
+        _isWriting = true;
+
+        lock.unlock();
+
+        try {
+            SnapshotWriter writer {};
+
+            for ( auto& part : snapshot.second ) {
+                part( writer );
+            }
+
+            auto temporary = snapshot.first + ".tmp";
+            writer.saveToFile( temporary );
+
+            if ( std::rename( temporary.c_str(), snapshot.first.c_str() ) != 0 ) {
+                throw error::SnapshotFile { snapshot.first };
+            }
+
+            LOG( SNAPSHOT, info ) << format( "Wrote a snapshot to '%s'." ) % snapshot.first;
+        } catch ( error::SnapshotFile& err ) {
+            LOG( SNAPSHOT, error ) << err.what();
+        }
+
+        lock.lock();
+        _isWriting = false;
+        _condition.notify_all();
+    }
+}
+
+}
@@ -0,0 +1,210 @@
+// Snapshot.hpp
+//
+// Copyright 2013 Jesse Haber-Kucharsky
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "Fundamental.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace nebula {
+
+namespace snapshot {
+
+// "NEBS", in little endian order.
+const std::uint32_t MAGIC = 0x5342454e;
+
+// Incremented whenever the fields of a snapshot change.
+const std::uint32_t VERSION = 2;
+
+}
+
+namespace error {
+
+class BadSnapshot : public std::runtime_error {
+public:
+    explicit BadSnapshot( const std::string& reason ) :
+        std::runtime_error {
+            (format( "Invalid snapshot: %s" ) % reason).str()
+        } {}
+};
+
+class SnapshotFile : public std::runtime_error {
+    std::string _path;
+public:
+    explicit SnapshotFile( const std::string& path ) :
+        std::runtime_error {
+            (format( "Unable to access snapshot file '%s'" ) % path).str()
+        },
+        _path { path } {}
+
+    const std::string& path() const noexcept { return _path; }
+};
+
+}
+
+namespace snapshot {
+
+// The integer that represents a field.
+template <typename T, bool = std::is_enum<T>::value>
+struct Representation {
+    using Type = T;
+};
+
+template <typename T>
+struct Representation<T, true> {
+    using Type = typename std::underlying_type<T>::type;
+};
+
+}
+
+// A snapshot is the state of a machine, as a sequence of integers in little
+// endian order without any names or padding. Every part of the machine
+// writes its own fields, and reads them back in the same order (see the
+// `save` and `restore` functions of each).
+class SnapshotWriter final {
+    std::vector<unsigned char> _bytes {};
+public:
+    explicit SnapshotWriter();
+
+    template <typename T>
+    void write( T value ) {
+        static_assert( std::is_integral<T>::value || std::is_enum<T>::value,
+                       "Only integers and enumerations can be written to a snapshot." );
+
+        using Type = typename snapshot::Representation<T>::Type;
+        auto bits = static_cast<std::uint64_t>( static_cast<Type>( value ) );
+
+        for ( std::size_t i = 0; i < sizeof( T ); ++i ) {
+            _bytes.push_back( static_cast<unsigned char>( bits >> (8 * i) ) );
+        }
+    }
+
+    void writeWords( const Word* words, std::size_t count );
+
+    inline const std::vector<unsigned char>& bytes() const noexcept { return _bytes; }
+
+    void saveToFile( const std::string& path ) const;
+};
+
+class SnapshotReader final {
+    std::vector<unsigned char> _bytes;
+    std::size_t _position { 0 };
+
+    // Throws if fewer than `count` bytes remain.
+    void require( std::size_t count ) const;
+public:
+    explicit SnapshotReader( std::vector<unsigned char> bytes );
+
+    static SnapshotReader fromFile( const std::string& path );
+
+    template <typename T>
+    T read() {
+        static_assert( std::is_integral<T>::value || std::is_enum<T>::value,
+                       "Only integers and enumerations can be read from a snapshot." );
+
+        using Type = typename snapshot::Representation<T>::Type;
+        std::uint64_t bits = 0;
+
+        require( sizeof( T ) );
+
+        for ( std::size_t i = 0; i < sizeof( T ); ++i ) {
+            bits |= static_cast<std::uint64_t>( _bytes[_position++] ) << (8 * i);
+        }
+
+        return static_cast<T>( static_cast<Type>( bits ) );
+    }
+
+    void readWords( Word* words, std::size_t count );
+
+    inline bool isAtEnd() const noexcept { return _position == _bytes.size(); }
+};
+
+// Part of a snapshot of a running machine, which was captured at one point
+// and is written later (see `LiveSnapshots`).
+using SnapshotPart = std::function<void ( SnapshotWriter& writer )>;
+
+// Snapshots of a machine that keeps running while they're written.
+//
+// A snapshot can be requested from any thread. The processor captures it
+// between instructions, and every part of the machine copies its state then
+// (see the `capture` function of each). Devices change their state while
+// holding `stateMutex`, so the processor holds it to see all of them at the
+// same point. Writing out the snapshot happens on a thread of its own, so the
+// processor only pauses for the copies. Memory only copies the pages written
+// since the last snapshot.
+class LiveSnapshots final {
+public:
+    using Capture = std::function<SnapshotPart ()>;
+private:
+    std::vector<Capture> _captures {};
+
+    std::mutex _stateMutex {};
+
+    std::atomic<bool> _isRequested { false };
+    std::string _requestedPath {};
+
+    // Captured snapshots which have yet to be written, and where to.
+    std::deque<std::pair<std::string, std::vector<SnapshotPart>>> _pending {};
+    bool _isWriting { false };
+    bool _isStopping { false };
+
+    std::mutex _mutex {};
+    std::condition_variable _condition {};
+
+    // Only started once there is something to write.
+    std::thread _thread {};
+
+    void writePending();
+public:
+    explicit LiveSnapshots() = default;
+
+    LiveSnapshots( const LiveSnapshots& ) = delete;
+    LiveSnapshots& operator=( const LiveSnapshots& ) = delete;
+
+    ~LiveSnapshots();
+
+    // Parts are captured in the order that they're added, which must happen
+    // before the simulation starts.
+    void add( Capture capture );
+
+    inline std::mutex& stateMutex() noexcept { return _stateMutex; }
+
+    // Capture a snapshot at the next opportunity, and write it to `path`.
+    void request( const std::string& path );
+
+    inline bool isRequested() const noexcept { return _isRequested.load( std::memory_order_relaxed ); }
+
+    // Called by the processor between instructions.
+    void capture();
+
+    // Block until every snapshot that has been captured is written.
+    void wait();
+};
+
+}
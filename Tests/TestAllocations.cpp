@@ -0,0 +1,301 @@
+// Tests/TestAllocations.cpp
+//
+// Copyright 2013 Jesse Haber-Kucharsky
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "../Computer.hpp"
+#include "../IdleLoop.hpp"
+#include "../Jit.hpp"
+#include "../ProcessorState.hpp"
+#include "../Simulation/Processor.hpp"
+#include "../Simulation/Scheduler.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <initializer_list>
+#include <new>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+using namespace nebula;
+
+// Every allocation in the test program is counted.
+
+namespace {
+
+std::atomic<std::size_t> numAllocations { 0 };
+
+}
+
+void* operator new( std::size_t size ) {
+    ++numAllocations;
+
+    if ( void* p = std::malloc( size == 0 ? 1 : size ) ) {
+        return p;
+    }
+
+    throw std::bad_alloc {};
+}
+
+void operator delete( void* p ) noexcept {
+    std::free( p );
+}
+
+// Once everything has been executed at least once, executing instructions
+// must never allocate.
+class AllocationTest : public ::testing::Test {
+protected:
+    std::shared_ptr<Memory> _memory;
+    ProcessorState _proc;
+public:
+    explicit AllocationTest() :
+        _memory { std::make_shared<Memory>() },
+        _proc { _memory } {
+        load( {
+            0xc401,         // 0x00: SET A, 0x10
+            0x7cc1, 0x0100, // 0x01: SET I, 0x100
+            0x7ce1, 0x0200, // 0x03: SET J, 0x200
+            0x3dde,         // 0x05: STI [I], [J]
+            0x7cd3, 0x0108, // 0x06: IFN I, 0x108
+            0x9b81,         // 0x08: SET PC, 5
+            0x0301,         // 0x09: SET PUSH, A
+            0xd420,         // 0x0a: JSR 0x14
+            0x6021,         // 0x0b: SET B, POP
+            0x9024,         // 0x0c: MUL B, 3
+            0x8803,         // 0x0d: SUB A, 1
+            0x8413,         // 0x0e: IFN A, 0
+            0x8b81,         // 0x0f: SET PC, 1
+            0x8781,         // 0x10: SET PC, 0
+            0x0000,
+            0x0000,
+            0x0000,
+            0x7862, 0x0201, // 0x14: ADD X, [0x201]
+            0x6381          // 0x16: SET PC, POP
+        } );
+    }
+
+    void load( std::initializer_list<Word> words ) {
+        Word loc = 0;
+
+        for ( auto w : words ) {
+            _memory->write( loc++, w );
+        }
+    }
+
+    std::size_t countAllocations( int numInstructions ) {
+        auto before = numAllocations.load();
+
+        for ( int i = 0; i < numInstructions; ++i ) {
+            _proc.executeNext();
+        }
+
+        return numAllocations.load() - before;
+    }
+};
+
+TEST_F( AllocationTest, Interpreted ) {
+    countAllocations( 500 );
+    EXPECT_EQ( 0u, countAllocations( 2000 ) );
+}
+
+TEST_F( AllocationTest, Fused ) {
+    _proc.isFusing = true;
+
+    countAllocations( 500 );
+    EXPECT_EQ( 0u, countAllocations( 2000 ) );
+}
+
+TEST_F( AllocationTest, Batched ) {
+    auto never = [] { return false; };
+
+    auto run = [this, &never] {
+        for ( int i = 0; i < 50; ++i ) {
+            _proc.executeBatch( 100, never );
+        }
+    };
+
+    run();
+
+    auto before = numAllocations.load();
+    run();
+    EXPECT_EQ( 0u, numAllocations.load() - before );
+}
+
+TEST_F( AllocationTest, Compiled ) {
+    std::unique_ptr<Jit> jit { nullptr };
+
+    try {
+        jit = make_unique<Jit>( _memory );
+    } catch ( error::JitUnavailable& ) {
+        return;
+    }
+
+    auto run = [this, &jit] {
+        for ( int i = 0; i < 200; ++i ) {
+            if ( ! jit->execute( _proc, 100 ) ) {
+                _proc.executeNext();
+            }
+        }
+    };
+
+    // Compiling allocates, but only the first time.
+    run();
+
+    auto before = numAllocations.load();
+    run();
+    EXPECT_EQ( 0u, numAllocations.load() - before );
+}
+
+TEST_F( AllocationTest, IdleLoop ) {
+    load( {
+        0x8b83 // SUB PC, 1
+    } );
+
+    auto before = numAllocations.load();
+    auto loop = findIdleLoop( _proc );
+    EXPECT_EQ( 0u, numAllocations.load() - before );
+    EXPECT_TRUE( static_cast<bool>( loop ) );
+}
+
+TEST( InterruptQueueAllocationTest, PushAndPop ) {
+    InterruptQueue queue {};
+
+    auto before = numAllocations.load();
+
+    for ( int i = 0; i < 1000; ++i ) {
+        queue.push( static_cast<Word>( i ) );
+        queue.push( static_cast<Word>( i + 1 ) );
+        EXPECT_EQ( static_cast<Word>( i ), queue.pop() );
+        EXPECT_EQ( static_cast<Word>( i + 1 ), queue.pop() );
+    }
+
+    EXPECT_EQ( 0u, numAllocations.load() - before );
+    EXPECT_FALSE( queue.hasInterrupt() );
+}
+
+namespace {
+
+// Asks a device for a value and handles interrupts, counting them at 0x1000.
+const std::vector<Word> INTERRUPT_PROGRAM = {
+    0x7d40, 0x0010, // 0x00: IAS 0x10
+    0x8a40,         // 0x02: HWI 1
+    0x0862,         // 0x03: ADD X, C
+    0x8f81,         // 0x04: SET PC, 2
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0x8bc2, 0x1000, // 0x10: ADD [0x1000], 1
+    0x8560          // 0x12: RFI 0
+};
+
+class Responder final : public Device {
+public:
+    inline virtual DeviceInfo info() const noexcept override {
+        return DeviceInfo { device::Id { 1 }, device::Manufacturer { 2 }, device::Version { 3 } };
+    }
+};
+
+// A machine that runs `INTERRUPT_PROGRAM`, with a device that responds to HWI
+// on the processor's thread.
+struct Machine {
+    std::shared_ptr<Memory> memory;
+    Computer computer;
+    Responder device;
+    std::shared_ptr<ProcessorInterrupt> inter;
+
+    explicit Machine() :
+        memory { std::make_shared<Memory>( std::make_shared<const MemoryImage>( INTERRUPT_PROGRAM.data(),
+                                                                                INTERRUPT_PROGRAM.size() ) ) },
+        computer { memory, pacing::DEFAULT_CLOCK_HZ, timing::UNTHROTTLED },
+        device {},
+        inter { computer.nextInterrupt( &device ) } {
+        inter->setResponder( [] ( ProcessorState& proc ) { proc.write( Register::C, 1 ); } );
+    }
+
+    inline Word numInterrupts() const noexcept { return memory->read( 0x1000 ); }
+};
+
+// As when nebula runs without `--verbose`, since formatting messages
+// allocates.
+class WithoutLogging final {
+public:
+    explicit WithoutLogging() { logging::core::get()->set_logging_enabled( false ); }
+    ~WithoutLogging() { logging::core::get()->set_logging_enabled( true ); }
+};
+
+// Queues an interrupt every time it happens, like a device on the scheduler.
+struct Interrupter {
+    Computer& computer;
+    Scheduler& scheduler;
+
+    void operator()() {
+        computer.queue().push( 1 );
+        scheduler.repeat( std::chrono::microseconds { 100 }, [this] { (*this)(); } );
+    }
+};
+
+}
+
+// Pacing, handling interrupts and carrying out HWI must not allocate either,
+// once the processor is running.
+TEST( ProcessorAllocationTest, Running ) {
+    WithoutLogging withoutLogging {};
+
+    for ( auto mode : { ExecutionMode::Interpreted, ExecutionMode::Threaded } ) {
+        Machine machine {};
+        Processor proc { machine.computer, mode };
+        auto procF = sim::launch( proc );
+
+        auto waitFor = [&machine] ( Word numInterrupts ) {
+            while ( machine.numInterrupts() < numInterrupts ) {
+                machine.computer.queue().push( 1 );
+                std::this_thread::sleep_for( std::chrono::microseconds { 100 } );
+            }
+        };
+
+        waitFor( 50 );
+        auto before = numAllocations.load();
+        waitFor( 500 );
+        auto after = numAllocations.load();
+
+        proc.stop();
+        procF.get();
+
+        EXPECT_EQ( 0u, after - before );
+    }
+}
+
+TEST( ProcessorAllocationTest, Scheduled ) {
+    WithoutLogging withoutLogging {};
+    Machine machine {};
+    Scheduler scheduler { machine.computer.timing() };
+    Processor proc { machine.computer, ExecutionMode::Interpreted };
+    Interrupter interrupter { machine.computer, scheduler };
+
+    std::size_t before = 0;
+    std::size_t after = 0;
+
+    scheduler.after( std::chrono::microseconds { 100 }, [&interrupter] { interrupter(); } );
+    scheduler.at( pacing::DEFAULT_CLOCK_HZ / 10, [&before] { before = numAllocations.load(); } );
+    scheduler.at( pacing::DEFAULT_CLOCK_HZ, [&after, &proc] {
+            after = numAllocations.load();
+            proc.stop();
+        } );
+
+    proc.runScheduled( scheduler );
+
+    EXPECT_LT( 1000, machine.numInterrupts() );
+    EXPECT_EQ( 0u, after - before );
+}
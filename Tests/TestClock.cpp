@@ -0,0 +1,70 @@
+// Tests/TestClock.cpp
+//
+// Copyright 2013 Jesse Haber-Kucharsky
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "../Simulation/Clock.hpp"
+#include "../Simulation/Processor.hpp"
+
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+using namespace nebula;
+
+namespace {
+
+// Starts the clock (the first device) at 60 Hz, enables its interrupts, and
+// counts them at 0x1000 while idle.
+const std::vector<Word> PROGRAM = {
+    0x8401,         // SET A, 0
+    0x8821,         // SET B, 1
+    0x8a40,         // HWI 1
+    0x8c01,         // SET A, 2
+    0x7c21, 0x0055, // SET B, 0x55
+    0x7d40, 0x000a, // IAS 10
+    0x8a40,         // HWI 1
+    0xab81,         // SET PC, 9
+    0x8bc2, 0x1000, // ADD [0x1000], 1
+    0x8560          // RFI 0
+};
+
+}
+
+// The processor doesn't advance simulated time while it waits for the clock to
+// respond, so the clock can't wait for simulated time to pass before it does.
+TEST( ClockTest, ThreadedUnthrottled ) {
+    auto memory = std::make_shared<Memory>( std::make_shared<const MemoryImage>( PROGRAM.data(), PROGRAM.size() ) );
+    Computer computer { memory, pacing::DEFAULT_CLOCK_HZ, timing::UNTHROTTLED };
+    Clock clock { computer };
+    Processor proc { computer, ExecutionMode::Interpreted };
+
+    auto procF = sim::launch( proc );
+    auto clockF = sim::launch( clock );
+
+    auto start = std::chrono::steady_clock::now();
+
+    while ( memory->read( 0x1000 ) < 5 && std::chrono::steady_clock::now() - start < std::chrono::seconds { 5 } ) {
+        std::this_thread::sleep_for( std::chrono::milliseconds { 1 } );
+    }
+
+    proc.stop();
+    clock.stop();
+    procF.get();
+    clockF.get();
+
+    EXPECT_GE( memory->read( 0x1000 ), 5 );
+    EXPECT_GT( computer.timing().elapsedCycles(), 0u );
+}
@@ -0,0 +1,88 @@
+// Tests/TestComputer.cpp
+//
+// Copyright 2013 Jesse Haber-Kucharsky
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "../Computer.hpp"
+#include "../Simulation/Processor.hpp"
+#include "../Simulation/Scheduler.hpp"
+
+#include <vector>
+
+#include <gtest/gtest.h>
+
+using namespace nebula;
+
+namespace {
+
+class Lamp final : public Device {
+public:
+    inline virtual DeviceInfo info() const noexcept override {
+        return DeviceInfo { device::Id { 0x12345678 }, device::Manufacturer { 2 }, device::Version { 3 } };
+    }
+};
+
+// Asks about devices that aren't there.
+const std::vector<Word> PROGRAM = {
+    0xa001, // SET A, 7
+    0xa021, // SET B, 7
+    0xa041, // SET C, 7
+    0xa061, // SET X, 7
+    0xa081, // SET Y, 7
+    0x9a40, // HWI 5
+    0x8640, // HWI 0
+    0x9a20, // HWQ 5
+    0xa781  // SET PC, 8
+};
+
+}
+
+TEST( ComputerTest, DeviceIndices ) {
+    Computer computer { std::make_shared<Memory>() };
+    Lamp lamp {};
+    computer.nextInterrupt( &lamp );
+
+    EXPECT_EQ( 2u, computer.numDevices() );
+    EXPECT_NE( nullptr, computer.interruptByIndex( 1 ) );
+    ASSERT_TRUE( static_cast<bool>( computer.infoByIndex( 1 ) ) );
+    EXPECT_EQ( 0x12345678u, computer.infoByIndex( 1 )->id.value );
+
+    for ( std::size_t index : { 0, 2, 0xffff } ) {
+        EXPECT_EQ( nullptr, computer.interruptByIndex( index ) );
+        EXPECT_FALSE( static_cast<bool>( computer.infoByIndex( index ) ) );
+    }
+}
+
+TEST( ComputerTest, MissingDevices ) {
+    for ( auto mode : { ExecutionMode::Interpreted, ExecutionMode::Threaded } ) {
+        auto memory = std::make_shared<Memory>( std::make_shared<const MemoryImage>( PROGRAM.data(), PROGRAM.size() ) );
+        Computer computer { memory, pacing::DEFAULT_CLOCK_HZ, timing::UNTHROTTLED };
+        Lamp lamp {};
+        computer.nextInterrupt( &lamp );
+
+        Scheduler scheduler { computer.timing() };
+        Processor proc { computer, mode };
+        scheduler.at( 1000, [&proc] { proc.stop(); } );
+
+        // HWI does nothing, and HWQ finds only zeros.
+        auto state = proc.runScheduled( scheduler );
+
+        EXPECT_EQ( Fault::None, state->fault() );
+        EXPECT_EQ( 8, state->read( Special::Pc ) );
+
+        for ( auto reg : { Register::A, Register::B, Register::C, Register::X, Register::Y } ) {
+            EXPECT_EQ( 0, state->read( reg ) );
+        }
+    }
+}
@@ -0,0 +1,146 @@
+// Tests/TestHistory.cpp
+//
+// Copyright 2013 Jesse Haber-Kucharsky
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "../History.hpp"
+
+#include <vector>
+
+#include <gtest/gtest.h>
+
+using namespace nebula;
+
+namespace {
+
+// Counts in A, writing every count to a location of its own.
+const std::vector<Word> COUNTER = {
+    0x8802,         // ADD A, 1
+    0x0201, 0x1000, // SET [0x1000 + A], A
+    0x8781          // SET PC, 0
+};
+
+struct Point {
+    std::uint64_t cycles;
+    Word pc;
+    Word a;
+};
+
+}
+
+class HistoryTest : public ::testing::Test {
+protected:
+    std::shared_ptr<Memory> _memory;
+    Computer _computer;
+    ProcessorState _proc;
+public:
+    explicit HistoryTest() :
+        _memory { std::make_shared<Memory>( std::make_shared<const MemoryImage>( COUNTER.data(), COUNTER.size() ) ) },
+        _computer { _memory },
+        _proc { _memory } {}
+
+    Point point( const History& history ) const {
+        return Point { history.cycles(), _proc.read( Special::Pc ), _proc.read( Register::A ) };
+    }
+
+    void expectAt( const Point& expected, const History& history ) const {
+        EXPECT_EQ( expected.cycles, history.cycles() );
+        EXPECT_EQ( expected.pc, _proc.read( Special::Pc ) );
+        EXPECT_EQ( expected.a, _proc.read( Register::A ) );
+
+        // Nothing that happens later has been written yet. Between adding
+        // and writing, the count is one ahead of memory.
+        Word written = expected.pc == 1 ? expected.a - 1 : expected.a;
+        EXPECT_EQ( written, _memory->read( 0x1000 + written ) );
+        EXPECT_EQ( 0, _memory->read( 0x1000 + written + 1 ) );
+    }
+};
+
+TEST_F( HistoryTest, StepBack ) {
+    History history { _computer, _proc, nullptr, 100 };
+    std::vector<Point> points {};
+
+    for ( int i = 0; i < 3000; ++i ) {
+        points.push_back( point( history ) );
+        history.step();
+    }
+
+    EXPECT_EQ( 3000u, history.instructions() );
+    EXPECT_LT( 1u, history.numCheckpoints() );
+
+    for ( int i = 2999; i >= 2500; --i ) {
+        ASSERT_TRUE( history.stepBack() );
+        EXPECT_EQ( static_cast<std::uint64_t>( i ), history.instructions() );
+        expectAt( points[i], history );
+    }
+
+    // Executing forward again from the middle of the history.
+    for ( int i = 2500; i < 2800; ++i ) {
+        expectAt( points[i], history );
+        history.step();
+    }
+
+    ASSERT_TRUE( history.rewindToInstruction( 0 ) );
+    expectAt( points[0], history );
+    EXPECT_FALSE( history.stepBack() );
+}
+
+TEST_F( HistoryTest, Rewind ) {
+    History history { _computer, _proc, nullptr, 250 };
+    std::vector<Point> points {};
+
+    for ( int i = 0; i < 2000; ++i ) {
+        points.push_back( point( history ) );
+        history.step();
+    }
+
+    // Every instruction takes more than one cycle, so cycles in the middle of
+    // an instruction go back to its start.
+    for ( int i : { 1500, 1499, 700, 12, 0 } ) {
+        ASSERT_TRUE( history.rewindTo( points[i].cycles + 1 ) );
+        EXPECT_EQ( static_cast<std::uint64_t>( i ), history.instructions() );
+        expectAt( points[i], history );
+    }
+
+    // Going forward isn't rewinding.
+    EXPECT_TRUE( history.rewindTo( 1000000 ) );
+    EXPECT_FALSE( history.rewindToInstruction( 1 ) );
+}
+
+TEST_F( HistoryTest, Budget ) {
+    // The count fills about 30 pages, which leaves enough for a handful of
+    // checkpoints.
+    const std::size_t budget = 40 * sizeof( Memory::Page );
+    History history { _computer, _proc, nullptr, 50, budget };
+
+    std::vector<Point> points {};
+
+    for ( int i = 0; i < 20000; ++i ) {
+        points.push_back( point( history ) );
+        history.step();
+        ASSERT_LE( history.size(), budget );
+    }
+
+    // Checkpoints share the pages that haven't changed.
+    EXPECT_LT( 4u, history.numCheckpoints() );
+
+    auto earliest = history.earliestCycle();
+    EXPECT_LT( 0u, earliest );
+    EXPECT_FALSE( history.rewindTo( earliest - 1 ) );
+    EXPECT_FALSE( history.rewindToInstruction( 0 ) );
+
+    ASSERT_TRUE( history.rewindTo( earliest ) );
+    EXPECT_EQ( earliest, history.cycles() );
+    expectAt( points[history.instructions()], history );
+}
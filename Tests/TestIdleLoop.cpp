@@ -0,0 +1,97 @@
+// Tests/TestIdleLoop.cpp
+//
+// Copyright 2013 Jesse Haber-Kucharsky
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "../IdleLoop.hpp"
+
+#include <initializer_list>
+
+#include <gtest/gtest.h>
+
+using namespace nebula;
+
+class IdleLoopTest : public ::testing::Test {
+protected:
+    std::shared_ptr<Memory> _memory;
+    ProcessorState _proc;
+public:
+    explicit IdleLoopTest() :
+        _memory { std::make_shared<Memory>() },
+        _proc { _memory } {}
+
+    void load( std::initializer_list<Word> words ) {
+        Word loc = 0;
+
+        for ( auto w : words ) {
+            _memory->write( loc++, w );
+        }
+    }
+};
+
+TEST_F( IdleLoopTest, SelfLoop ) {
+    load( {
+        0x8781 // SET PC, 0
+    } );
+
+    auto loop = findIdleLoop( _proc );
+    ASSERT_TRUE( static_cast<bool>( loop ) );
+    EXPECT_EQ( 0, loop->address );
+    EXPECT_FALSE( loop->isPolling );
+
+    _proc.executeNext();
+    EXPECT_EQ( _proc.clock(), loop->cycles );
+}
+
+TEST_F( IdleLoopTest, ExcessMustSettle ) {
+    load( {
+        0x8b83 // SUB PC, 1
+    } );
+
+    // The first iteration clears EX.
+    _proc.write( Special::Ex, 0x1234 );
+    EXPECT_FALSE( static_cast<bool>( findIdleLoop( _proc ) ) );
+
+    _proc.executeNext();
+    EXPECT_TRUE( static_cast<bool>( findIdleLoop( _proc ) ) );
+}
+
+TEST_F( IdleLoopTest, Polling ) {
+    load( {
+        0x87d2, 0x0010, // IFE [0x10], 0
+        0x8781          // SET PC, 0
+    } );
+
+    auto loop = findIdleLoop( _proc );
+    ASSERT_TRUE( static_cast<bool>( loop ) );
+    EXPECT_TRUE( loop->isPolling );
+
+    _proc.executeNext();
+    _proc.executeNext();
+    EXPECT_EQ( _proc.clock(), loop->cycles );
+
+    // Once the flag is set, the loop ends.
+    _memory->write( 0x10, 1 );
+    EXPECT_FALSE( static_cast<bool>( findIdleLoop( _proc ) ) );
+}
+
+TEST_F( IdleLoopTest, SideEffects ) {
+    load( {
+        0x8802, // ADD A, 1
+        0x8781  // SET PC, 0
+    } );
+
+    EXPECT_FALSE( static_cast<bool>( findIdleLoop( _proc ) ) );
+    EXPECT_EQ( 0, _proc.read( Register::A ) );
+}
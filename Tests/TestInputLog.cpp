@@ -0,0 +1,219 @@
+// Tests/TestInputLog.cpp
+//
+// Copyright 2013 Jesse Haber-Kucharsky
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "../InputLog.hpp"
+#include "../Simulation/Processor.hpp"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+using namespace nebula;
+
+TEST( InputLogTest, Events ) {
+    ProcessorState proc { 0 };
+    InputLog log {};
+    log.startRecording( ExecutionMode::Interpreted, false );
+
+    log.recordInterrupt( 10, 0x1234 );
+
+    auto before = InputLog::registersOf( proc );
+    proc.write( Register::C, 0xbeef );
+    proc.write( Special::Ex, 1 );
+    log.recordHwi( 300, before, proc, 4 );
+
+    Word words[] = { 1, 2, 3 };
+    log.deviceWrote( 0x8000, words, 3 );
+    log.recordWrites( 300 );
+    log.recordIdle( 100000, 5000 );
+    log.recordEnd( 200000 );
+
+    InputLog replay {};
+    replay.startReplaying( log.bytes() );
+    EXPECT_TRUE( replay.isReplaying() );
+
+    EXPECT_FALSE( replay.isInterruptDue( 9 ) );
+    ASSERT_TRUE( replay.isInterruptDue( 10 ) );
+    EXPECT_EQ( 0x1234, replay.replayInterrupt() );
+
+    ProcessorState replayed { 0 };
+    EXPECT_FALSE( replay.replayHwi( 299, replayed ) );
+    EXPECT_FALSE( replay.replayHwi( 301, replayed ) );
+    EXPECT_TRUE( replay.replayHwi( 300, replayed ) );
+    EXPECT_EQ( 0xbeef, replayed.read( Register::C ) );
+    EXPECT_EQ( 1, replayed.read( Special::Ex ) );
+    EXPECT_EQ( 4, replayed.clock() );
+
+    Memory memory {};
+    replay.replayWrites( 300, memory );
+    EXPECT_EQ( 1, memory.read( 0x8000 ) );
+    EXPECT_EQ( 3, memory.read( 0x8002 ) );
+
+    EXPECT_EQ( 0u, replay.replayIdle( 99999 ) );
+    EXPECT_EQ( 5000u, replay.replayIdle( 100000 ) );
+    EXPECT_FALSE( replay.isEndDue( 199999 ) );
+    EXPECT_TRUE( replay.isEndDue( 200000 ) );
+}
+
+TEST( InputLogTest, BadLogs ) {
+    InputLog log {};
+    EXPECT_THROW( log.startReplaying( std::vector<unsigned char>( 2 ) ), error::BadInputLog );
+    EXPECT_THROW( log.startReplaying( std::vector<unsigned char>( 8 ) ), error::BadInputLog );
+
+    InputLog recorded {};
+    recorded.startRecording( ExecutionMode::Threaded, true );
+    recorded.recordInterrupt( 10, 1 );
+
+    auto truncated = recorded.bytes();
+    truncated.pop_back();
+    log.startReplaying( truncated );
+    EXPECT_THROW( log.replayInterrupt(), error::BadInputLog );
+
+    // Only the same way as it was recorded.
+    log.startReplaying( recorded.bytes() );
+    EXPECT_NO_THROW( log.checkExecution( ExecutionMode::Threaded, true ) );
+    EXPECT_THROW( log.checkExecution( ExecutionMode::Interpreted, true ), error::BadInputLog );
+    EXPECT_THROW( log.checkExecution( ExecutionMode::Threaded, false ), error::BadInputLog );
+
+    EXPECT_THROW( log.startReplayingFile( "nebula-missing-input-log.bin" ), error::InputLogFile );
+}
+
+namespace {
+
+// Adds a value from a device and interrupt messages, and copies what the
+// device writes to memory.
+const std::vector<Word> PROGRAM = {
+    0x7d40, 0x0010, // IAS 0x10
+    0x8a40,         // HWI 1
+    0x0862,         // ADD X, C
+    0x78a2, 0x2000, // ADD Z, [0x2000]
+    0x8f81,         // SET PC, 2
+    0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0x0082,         // ADD Y, A
+    0x8560          // RFI 0
+};
+
+class Counter final : public Device {
+public:
+    inline virtual DeviceInfo info() const noexcept override {
+        return DeviceInfo { device::Id { 1 }, device::Manufacturer { 2 }, device::Version { 3 } };
+    }
+};
+
+struct Outcome {
+    std::uint64_t cycles;
+    InputLog::Registers registers;
+    Word written;
+    std::vector<unsigned char> log;
+};
+
+// Run the program, with a device and interrupts if `replay` is empty.
+Outcome run( ExecutionMode mode, const std::vector<unsigned char>* replay ) {
+    auto memory = std::make_shared<Memory>( std::make_shared<const MemoryImage>( PROGRAM.data(), PROGRAM.size() ) );
+    Computer computer { memory, pacing::DEFAULT_CLOCK_HZ, timing::UNTHROTTLED };
+    Counter counter {};
+    auto inter = computer.nextInterrupt( &counter );
+
+    auto& inputs = computer.inputs();
+
+    if ( replay ) {
+        inputs.startReplaying( *replay );
+    } else {
+        inputs.startRecording( mode, false );
+    }
+
+    Processor proc { computer, mode };
+    auto procF = sim::launch( proc );
+
+    std::atomic<bool> isDone { false };
+    std::vector<std::thread> devices {};
+
+    if ( ! replay ) {
+        devices.emplace_back( [&] {
+                Word count = 0;
+
+                while ( ! isDone.load() ) {
+                    inter->waitForTriggerOrDeath( proc );
+
+                    if ( inter->isActive() ) {
+                        ++count;
+                        inter->state()->write( Register::C, count );
+                        Word value = count * 3;
+                        memory->write( 0x2000, value );
+                        inputs.deviceWrote( 0x2000, &value, 1 );
+                        inter->respond();
+                    }
+                }
+            } );
+
+        devices.emplace_back( [&] {
+                for ( Word message = 1; ! isDone.load(); ++message ) {
+                    computer.queue().push( message );
+                    std::this_thread::sleep_for( std::chrono::microseconds { 200 } );
+                }
+            } );
+
+        std::this_thread::sleep_for( std::chrono::milliseconds { 50 } );
+        proc.stop();
+    }
+
+    auto state = procF.get();
+    isDone.store( true );
+
+    for ( auto& device : devices ) {
+        device.join();
+    }
+
+    return Outcome {
+        computer.timing().elapsedCycles() + state->clock(),
+        InputLog::registersOf( *state ),
+        memory->read( 0x2000 ),
+        inputs.bytes()
+    };
+}
+
+}
+
+TEST( InputLogTest, Replay ) {
+    for ( auto mode : { ExecutionMode::Interpreted, ExecutionMode::Threaded } ) {
+        auto recorded = run( mode, nullptr );
+
+        // The program saw the device and the interrupts (in X, Y and Z).
+        ASSERT_NE( 0, recorded.registers[3] );
+        ASSERT_NE( 0, recorded.registers[4] );
+        ASSERT_NE( 0, recorded.registers[5] );
+
+        auto replayed = run( mode, &recorded.log );
+
+        EXPECT_EQ( recorded.cycles, replayed.cycles );
+        EXPECT_EQ( recorded.registers, replayed.registers );
+        EXPECT_EQ( recorded.written, replayed.written );
+    }
+}
+
+TEST( InputLogTest, Diverged ) {
+    auto recorded = run( ExecutionMode::Interpreted, nullptr );
+    EXPECT_THROW( run( ExecutionMode::Threaded, &recorded.log ), error::BadInputLog );
+
+    // The program executes HWI, but the log has nothing for it.
+    InputLog empty {};
+    empty.startRecording( ExecutionMode::Interpreted, false );
+    empty.recordEnd( pacing::DEFAULT_CLOCK_HZ );
+
+    EXPECT_THROW( run( ExecutionMode::Interpreted, &empty.bytes() ), error::BadInputLog );
+}
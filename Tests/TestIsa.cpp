@@ -0,0 +1,99 @@
+// Tests/TestIsa.cpp
+//
+// Copyright 2013 Jesse Haber-Kucharsky
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "../InstructionCache.hpp"
+#include "../Isa.hpp"
+#include "../Memory.hpp"
+
+#include <gtest/gtest.h>
+
+using namespace nebula;
+
+TEST( IsaTest, DecodeMatchesTable ) {
+    for ( DoubleWord w = 0; w <= 0xffff; ++w ) {
+        auto word = static_cast<Word>( w );
+        const auto& ins = decodeCached( word );
+
+        if ( isa::isBinary( word ) ) {
+            const auto& spec = isa::OPCODES[isa::opcodeField( word )];
+
+            ASSERT_EQ( InstructionKind::Binary, ins.kind );
+            ASSERT_EQ( spec.isConditional, ins.isConditional );
+            ASSERT_EQ( spec.cycles + isa::size( word ), ins.cycles );
+        } else if ( isa::isUnary( word ) ) {
+            ASSERT_EQ( InstructionKind::Unary, ins.kind );
+        } else {
+            ASSERT_EQ( InstructionKind::Malformed, ins.kind );
+        }
+
+        if ( ins.kind != InstructionKind::Malformed ) {
+            ASSERT_EQ( isa::size( word ), ins.size + 1 );
+        }
+    }
+}
+
+TEST( IsaTest, InterruptQueueing ) {
+    // IAQ was missing from the original hand-written decoder.
+    EXPECT_TRUE( isa::isUnary( 0x8580 ) );
+    EXPECT_EQ( SpecialOpcode::Iaq, decodeCached( 0x8580 ).specialOpcode() );
+}
+
+class DisassemblyTest : public ::testing::Test {
+protected:
+    Memory _memory;
+public:
+    explicit DisassemblyTest() : _memory {} {}
+
+    std::pair<std::string, int> disassemble( std::initializer_list<Word> words ) {
+        Word loc = 0;
+
+        for ( auto w : words ) {
+            _memory.write( loc++, w );
+        }
+
+        return isa::disassemble( _memory, 0 );
+    }
+};
+
+TEST_F( DisassemblyTest, Binary ) {
+    EXPECT_EQ( std::make_pair( std::string { "SET A, 0x0030" } , 2 ),
+               disassemble( { 0x7c01, 0x0030 } ) );
+
+    EXPECT_EQ( std::make_pair( std::string { "ADD [B + 0x0002], 0x0002" }, 2 ),
+               disassemble( { 0x8e22, 0x0002 } ) );
+
+    EXPECT_EQ( std::make_pair( std::string { "SET [0x1000], [0x2000]" }, 3 ),
+               disassemble( { 0x7bc1, 0x2000, 0x1000 } ) );
+
+    EXPECT_EQ( std::make_pair( std::string { "SET PC, POP" }, 1 ),
+               disassemble( { 0x6381 } ) );
+
+    EXPECT_EQ( std::make_pair( std::string { "SET PUSH, 0xffff" }, 1 ),
+               disassemble( { 0x8301 } ) );
+}
+
+TEST_F( DisassemblyTest, Unary ) {
+    EXPECT_EQ( std::make_pair( std::string { "JSR 0x0010" }, 2 ),
+               disassemble( { 0x7c20, 0x0010 } ) );
+
+    EXPECT_EQ( std::make_pair( std::string { "HWI X" }, 1 ),
+               disassemble( { 0x0e40 } ) );
+}
+
+TEST_F( DisassemblyTest, Malformed ) {
+    EXPECT_EQ( std::make_pair( std::string { "DAT 0x0018" }, 1 ),
+               disassemble( { 0x0018 } ) );
+}
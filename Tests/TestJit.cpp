@@ -0,0 +1,176 @@
+// Tests/TestJit.cpp
+//
+// Copyright 2013 Jesse Haber-Kucharsky
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "../Jit.hpp"
+#include "../ProcessorState.hpp"
+
+#include <initializer_list>
+
+#include <gtest/gtest.h>
+
+using namespace nebula;
+
+// Compares compiled execution with the interpreter. Programs end at a
+// malformed instruction, which compiled code stops before.
+class JitTest : public ::testing::Test {
+protected:
+    std::shared_ptr<Memory> _expectedMemory;
+    std::shared_ptr<Memory> _memory;
+    ProcessorState _expected;
+    ProcessorState _proc;
+public:
+    explicit JitTest() :
+        _expectedMemory { std::make_shared<Memory>() },
+        _memory { std::make_shared<Memory>() },
+        _expected { _expectedMemory },
+        _proc { _memory } {}
+
+    void load( std::initializer_list<Word> words ) {
+        Word loc = 0;
+
+        for ( auto w : words ) {
+            _expectedMemory->write( loc, w );
+            _memory->write( loc, w );
+            ++loc;
+        }
+    }
+
+    void runUntil( Word end ) {
+        while ( _expected.read( Special::Pc ) != end ) {
+            _expected.executeNext();
+        }
+
+        Jit jit { _memory };
+
+        // The smallest budget stops at every block.
+        while ( jit.execute( _proc, 1 ) ) {}
+
+        EXPECT_EQ( end, _proc.read( Special::Pc ) );
+    }
+
+    void expectSameState() {
+        for ( int i = 0; i < 8; ++i ) {
+            auto reg = static_cast<Register>( i );
+            EXPECT_EQ( _expected.read( reg ), _proc.read( reg ) );
+        }
+
+        EXPECT_EQ( _expected.read( Special::Sp ), _proc.read( Special::Sp ) );
+        EXPECT_EQ( _expected.read( Special::Ex ), _proc.read( Special::Ex ) );
+        EXPECT_EQ( _expected.clock(), _proc.clock() );
+    }
+};
+
+TEST_F( JitTest, Loop ) {
+    if ( ! Jit::isSupported() ) {
+        return;
+    }
+
+    load( {
+        0xac01, // SET A, 10
+        0x8421, // SET B, 0
+        0x0022, // ADD B, A
+        0x8803, // SUB A, 1
+        0x8413, // IFN A, 0
+        0x8f81, // SET PC, 2
+        0x0000
+    } );
+
+    runUntil( 6 );
+    expectSameState();
+    EXPECT_EQ( 55, _proc.read( Register::B ) );
+}
+
+TEST_F( JitTest, WaitStates ) {
+    if ( ! Jit::isSupported() ) {
+        return;
+    }
+
+    load( {
+        0x7c21, 0x0100, // SET B, 0x100
+        0x2401,         // SET A, [B]
+        0x0121,         // SET [B], A
+        0x0301,         // SET PUSH, A
+        0x0000
+    } );
+
+    for ( auto memory : { _expectedMemory, _memory } ) {
+        memory->setWaitStates( 0x0100, 0x0101, WaitStates { 1, 2 } );
+        memory->setWaitStates( 0xff00, 0x10000, WaitStates { 4, 8 } );
+    }
+
+    runUntil( 5 );
+    expectSameState();
+    EXPECT_EQ( 3 + 2 + 1 + 2 + 2 + 2 + 8, _proc.clock() );
+}
+
+TEST_F( JitTest, SkipChainAndSubroutine ) {
+    if ( ! Jit::isSupported() ) {
+        return;
+    }
+
+    load( {
+        0x8801, // SET A, 1
+        0x8c12, // IFE A, 2
+        0x8812, // IFE A, 1
+        0x9821, // SET B, 5
+        0xa020, // JSR 7
+        0x9041, // SET C, 3
+        0x0000,
+        0x6061, // SET X, POP
+        0x0f81  // SET PC, X
+    } );
+
+    runUntil( 6 );
+    expectSameState();
+    EXPECT_EQ( 0, _proc.read( Register::B ) );
+    EXPECT_EQ( 3, _proc.read( Register::C ) );
+    EXPECT_EQ( 5, _proc.read( Register::X ) );
+}
+
+TEST_F( JitTest, SelfModifyingCode ) {
+    if ( ! Jit::isSupported() ) {
+        return;
+    }
+
+    load( {
+        0x8801,                 // SET A, 1
+        0x7fc1, 0x8c01, 0x0004, // SET [4], 0x8c01
+        0x8801,                 // SET A, 1 (replaced by SET A, 2)
+        0x0000
+    } );
+
+    runUntil( 5 );
+    expectSameState();
+    EXPECT_EQ( 2, _proc.read( Register::A ) );
+}
+
+TEST_F( JitTest, SpecialInstructionsAreInterpreted ) {
+    if ( ! Jit::isSupported() ) {
+        return;
+    }
+
+    load( {
+        0x8801, // SET A, 1
+        0x0200  // HWN A
+    } );
+
+    Jit jit { _memory };
+
+    EXPECT_FALSE( jit.execute( _proc, 100 ) );
+    EXPECT_EQ( 1, _proc.read( Special::Pc ) );
+    EXPECT_EQ( 1, _proc.read( Register::A ) );
+    EXPECT_EQ( 2, _proc.clock() );
+}
@@ -17,7 +17,12 @@
 #include "Random.hpp"
 #include "../Memory.hpp"
 
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
 #include <thread>
+#include <vector>
 
 #include <gtest/gtest.h>
 
@@ -29,7 +34,7 @@ class MemoryTest : public ::testing::Test {
 protected:
     Memory _memory;
 public:
-    explicit MemoryTest() : _memory { 0x10000 } {}
+    explicit MemoryTest() : _memory {} {}
 };
 
 TEST_F( MemoryTest, Initialization ) {
@@ -74,3 +79,351 @@ TEST_F( MemoryTest, ConcurrentReadWrite ) {
     th1.join();
     th2.join();
 }
+
+TEST_F( MemoryTest, ConcurrentWordsAreAtomic ) {
+    constexpr Word MAX_LOCATION = 0x10;
+
+    std::atomic<bool> isDone { false };
+    NumericGenerator<Word> locationGen { 0, MAX_LOCATION };
+
+    // Each byte of a value differs from the others, so a torn word would be
+    // noticed.
+    auto writer = [&] ( Word value ) {
+        return [&, value] {
+            for ( int i = 0; i < NUM_OPS; ++i ) {
+                _memory.write( locationGen.next(), value );
+            }
+        };
+    };
+
+    std::thread w1 { writer( 0x00ff ) };
+    std::thread w2 { writer( 0xff00 ) };
+
+    std::thread reader { [&] {
+            while ( ! isDone.load() ) {
+                for ( Word loc = 0; loc <= MAX_LOCATION; ++loc ) {
+                    auto value = _memory.read( loc );
+                    ASSERT_TRUE( value == 0 || value == 0x00ff || value == 0xff00 );
+                }
+            }
+        } };
+
+    w1.join();
+    w2.join();
+    isDone.store( true );
+    reader.join();
+}
+
+TEST_F( MemoryTest, WaitStates ) {
+    EXPECT_EQ( 0, _memory.readWaitStates( 0x1000 ) );
+    EXPECT_EQ( 0, _memory.writeWaitStates( 0x1000 ) );
+
+    _memory.setWaitStates( 0x1000, 0x2000, WaitStates { 2, 3 } );
+    _memory.setWaitStates( 0x1800, 0x10000, WaitStates { 0, 1 } );
+
+    EXPECT_EQ( 0, _memory.readWaitStates( 0x0fff ) );
+    EXPECT_EQ( 2, _memory.readWaitStates( 0x1000 ) );
+    EXPECT_EQ( 3, _memory.writeWaitStates( 0x17ff ) );
+    EXPECT_EQ( 0, _memory.readWaitStates( 0x1800 ) );
+    EXPECT_EQ( 1, _memory.writeWaitStates( 0xffff ) );
+}
+
+TEST_F( MemoryTest, Blocks ) {
+    std::vector<Word> words { 1, 2, 3, 4 };
+    std::vector<Word> result( 4 );
+
+    // Blocks wrap around the end of memory.
+    _memory.writeBlock( 0xfffe, words.data(), words.size() );
+    EXPECT_EQ( 2, _memory.read( 0xffff ) );
+    EXPECT_EQ( 3, _memory.read( 0x0000 ) );
+
+    _memory.readBlock( 0xfffe, result.data(), result.size() );
+    EXPECT_EQ( words, result );
+
+    auto view = _memory.view( 0xffff, 3 );
+    EXPECT_EQ( 3u, view.size() );
+    EXPECT_EQ( 2, view[0] );
+    EXPECT_EQ( 4, view[2] );
+
+    // Views read memory when accessed.
+    _memory.write( 0x0001, 5 );
+    EXPECT_EQ( 5, view[2] );
+}
+
+TEST_F( MemoryTest, CopyOverlappingBlocks ) {
+    std::vector<Word> words { 1, 2, 3, 4, 5 };
+    std::vector<Word> result( 5 );
+
+    _memory.writeBlock( 0x100, words.data(), words.size() );
+    _memory.copyBlock( 0x102, 0x100, 5 );
+    _memory.readBlock( 0x102, result.data(), result.size() );
+    EXPECT_EQ( words, result );
+
+    _memory.copyBlock( 0x101, 0x102, 5 );
+    _memory.readBlock( 0x101, result.data(), result.size() );
+    EXPECT_EQ( words, result );
+
+    // Overlapping at both ends, around the end of memory.
+    std::vector<Word> all( Memory::SIZE );
+
+    for ( int i = 0; i < Memory::SIZE; ++i ) {
+        all[i] = static_cast<Word>( i );
+    }
+
+    _memory.writeBlock( 0, all.data(), all.size() );
+    _memory.copyBlock( 0x0010, 0x0000, 0xfff8 );
+
+    for ( int i = 0; i < 0xfff8; ++i ) {
+        EXPECT_EQ( static_cast<Word>( i ), _memory.read( static_cast<Word>( 0x0010 + i ) ) );
+    }
+}
+
+class MemoryFileTest : public ::testing::Test {
+protected:
+    const std::string _path { "nebula-test-memory.bin" };
+
+    void writeFile( const std::vector<unsigned char>& bytes ) {
+        std::ofstream file { _path, std::ios::out | std::ios::binary };
+        file.write( reinterpret_cast<const char*>( bytes.data() ), bytes.size() );
+    }
+
+    std::vector<unsigned char> readFile() {
+        std::ifstream file { _path, std::ios::in | std::ios::binary };
+        return { std::istreambuf_iterator<char> { file }, std::istreambuf_iterator<char> {} };
+    }
+public:
+    virtual ~MemoryFileTest() { std::remove( _path.c_str() ); }
+};
+
+TEST_F( MemoryFileTest, ByteOrder ) {
+    // The trailing odd byte is ignored.
+    writeFile( { 0x12, 0x34, 0xab, 0xcd, 0xff } );
+
+    auto big = Memory::fromFile( _path, ByteOrder::BigEndian );
+    EXPECT_EQ( 0x1234, big->read( 0 ) );
+    EXPECT_EQ( 0xabcd, big->read( 1 ) );
+    EXPECT_EQ( 0x0000, big->read( 2 ) );
+
+    auto little = Memory::fromFile( _path, ByteOrder::LittleEndian );
+    EXPECT_EQ( 0x3412, little->read( 0 ) );
+    EXPECT_EQ( 0xcdab, little->read( 1 ) );
+
+    Memory::dumpToFile( _path, big, ByteOrder::LittleEndian );
+    auto bytes = readFile();
+
+    ASSERT_EQ( 2u * Memory::SIZE, bytes.size() );
+    EXPECT_EQ( 0x34, bytes[0] );
+    EXPECT_EQ( 0x12, bytes[1] );
+    EXPECT_EQ( 0xcd, bytes[2] );
+    EXPECT_EQ( 0xab, bytes[3] );
+}
+
+// Only pages that aren't all zero are stored, including a partial last page.
+TEST_F( MemoryFileTest, Pages ) {
+    std::vector<unsigned char> bytes( 2 * 0x180 );
+    bytes[2 * 0x17f] = 0x12;
+    bytes[2 * 0x17f + 1] = 0x34;
+    writeFile( bytes );
+
+    auto image = MemoryImage::fromFile( _path, ByteOrder::BigEndian );
+    EXPECT_EQ( 1u, image->numStoredPages() );
+
+    Memory memory { image };
+    EXPECT_EQ( 0x1234, memory.read( 0x17f ) );
+    EXPECT_EQ( 0x0000, memory.read( 0x180 ) );
+}
+
+TEST_F( MemoryFileTest, RoundTrip ) {
+    auto memory = std::make_shared<Memory>();
+    NumericGenerator<Word> valueGen;
+
+    for ( int i = 0; i < Memory::SIZE; ++i ) {
+        memory->write( static_cast<Word>( i ), valueGen.next() );
+    }
+
+    for ( auto order : { ByteOrder::BigEndian, ByteOrder::LittleEndian } ) {
+        Memory::dumpToFile( _path, memory, order );
+        auto loaded = Memory::fromFile( _path, order );
+
+        for ( int i = 0; i < Memory::SIZE; ++i ) {
+            ASSERT_EQ( memory->read( static_cast<Word>( i ) ), loaded->read( static_cast<Word>( i ) ) );
+        }
+    }
+}
+
+TEST_F( MemoryFileTest, Errors ) {
+    EXPECT_THROW( Memory::fromFile( "nebula-no-such-file.bin", ByteOrder::BigEndian ), error::MissingMemoryFile );
+
+    writeFile( {} );
+    EXPECT_THROW( Memory::fromFile( _path, ByteOrder::BigEndian ), error::BadMemoryFile );
+
+    writeFile( std::vector<unsigned char>( 2 * Memory::SIZE + 2 ) );
+    EXPECT_THROW( Memory::fromFile( _path, ByteOrder::BigEndian ), error::MemoryFileTooBig );
+}
+
+TEST_F( MemoryTest, Generations ) {
+    auto start = _memory.generation();
+    EXPECT_FALSE( _memory.isChangedSince( 0, Memory::SIZE, start ) );
+
+    _memory.write( 0x1234, 1 );
+    EXPECT_TRUE( _memory.isChangedSince( 0x1200, 0x1300, start ) );
+    EXPECT_TRUE( _memory.isChangedSince( 0x1234, 0x1235, start ) );
+    EXPECT_FALSE( _memory.isChangedSince( 0x1300, 0x2000, start ) );
+    EXPECT_FALSE( _memory.isChangedSince( 0x0000, 0x1200, start ) );
+
+    auto afterWrite = _memory.generation();
+    EXPECT_FALSE( _memory.isChangedSince( 0, Memory::SIZE, afterWrite ) );
+
+    // Blocks mark every page they touch, around the end of memory.
+    std::vector<Word> words( 0x102 );
+    _memory.writeBlock( 0xffff, words.data(), words.size() );
+
+    EXPECT_TRUE( _memory.isChangedSince( 0xff00, 0x10000, afterWrite ) );
+    EXPECT_TRUE( _memory.isChangedSince( 0x0000, 0x0100, afterWrite ) );
+    EXPECT_TRUE( _memory.isChangedSince( 0x0100, 0x0101, afterWrite ) );
+    EXPECT_FALSE( _memory.isChangedSince( 0x0200, 0xff00, afterWrite ) );
+
+    auto afterBlock = _memory.generation();
+    _memory.copyBlock( 0x5000, 0x1234, 1 );
+    EXPECT_TRUE( _memory.isChangedSince( 0x5000, 0x5001, afterBlock ) );
+    EXPECT_FALSE( _memory.isChangedSince( 0x1234, 0x1235, afterBlock ) );
+
+    // Taking a generation doesn't change anything.
+    auto again = _memory.generation();
+    EXPECT_FALSE( _memory.isChangedSince( 0, Memory::SIZE, again ) );
+    EXPECT_FALSE( _memory.isChangedSince( 0, Memory::SIZE, _memory.generation() ) );
+}
+
+// Anything that reads memory after taking a generation sees every write made
+// since, or else finds the page changed. Like the processor, one thread writes
+// words, and like a device, the other writes blocks.
+TEST_F( MemoryTest, ConcurrentGenerations ) {
+    std::atomic<bool> isDone { false };
+
+    std::thread processor { [&] {
+            for ( Word i = 1; ! isDone.load(); ++i ) {
+                _memory.write( 0x0010, i );
+            }
+        } };
+
+    std::thread device { [&] {
+            for ( Word i = 1; ! isDone.load(); ++i ) {
+                _memory.writeBlock( 0x0210, &i, 1 );
+            }
+        } };
+
+    for ( int i = 0; i < NUM_OPS; ++i ) {
+        for ( Word offset : { 0x0010, 0x0210 } ) {
+            auto generation = _memory.generation();
+            auto first = _memory.read( offset );
+            auto second = _memory.read( offset );
+
+            if ( ! _memory.isChangedSince( offset, offset + 1, generation ) ) {
+                EXPECT_EQ( first, second );
+            }
+        }
+    }
+
+    isDone.store( true );
+    processor.join();
+    device.join();
+}
+
+TEST( MemoryImageTest, CopyOnWrite ) {
+    std::vector<Word> words( 0x300 );
+    words[0x0000] = 0x1111;
+    words[0x0200] = 0x2222;
+
+    // The middle page is all zeros.
+    auto image = std::make_shared<const MemoryImage>( words.data(), words.size() );
+    EXPECT_EQ( 2u, image->numStoredPages() );
+
+    Memory first { image };
+    Memory second { image };
+
+    EXPECT_EQ( 0x1111, first.read( 0x0000 ) );
+    EXPECT_EQ( 0x2222, second.read( 0x0200 ) );
+    EXPECT_EQ( 0, first.numPrivatePages() );
+
+    first.write( 0x0001, 0x3333 );
+    first.write( 0x0150, 0x4444 );
+
+    // Writes copy the page first, and are private to the instance.
+    EXPECT_EQ( 2, first.numPrivatePages() );
+    EXPECT_EQ( 0x1111, first.read( 0x0000 ) );
+    EXPECT_EQ( 0x3333, first.read( 0x0001 ) );
+    EXPECT_EQ( 0x0000, second.read( 0x0001 ) );
+    EXPECT_EQ( 0x0000, second.read( 0x0150 ) );
+    EXPECT_EQ( 0, second.numPrivatePages() );
+
+    std::vector<Word> block( 0x200, 0x5555 );
+    second.writeBlock( 0x01ff, block.data(), block.size() );
+
+    EXPECT_EQ( 3, second.numPrivatePages() );
+    EXPECT_EQ( 0x5555, second.read( 0x0200 ) );
+    EXPECT_EQ( 0x2222, first.read( 0x0200 ) );
+}
+
+// Threads that write to a shared page at the same time end up with the same
+// copy.
+TEST( MemoryImageTest, ConcurrentCopyOnWrite ) {
+    std::vector<Word> words( Memory::SIZE, 0x1234 );
+    auto image = std::make_shared<const MemoryImage>( words.data(), words.size() );
+    Memory memory { image };
+
+    auto writer = [&] ( int offset ) {
+        return [&, offset] {
+            for ( int i = offset; i < Memory::SIZE; i += 2 ) {
+                memory.write( static_cast<Word>( i ), 0 );
+            }
+        };
+    };
+
+    std::thread w1 { writer( 0 ) };
+    std::thread w2 { writer( 1 ) };
+
+    w1.join();
+    w2.join();
+
+    EXPECT_EQ( Memory::NUM_PAGES, memory.numPrivatePages() );
+
+    for ( int i = 0; i < Memory::SIZE; ++i ) {
+        ASSERT_EQ( 0, memory.read( static_cast<Word>( i ) ) );
+    }
+}
+
+// Captures only copy the pages that were written since the last one.
+TEST( MemoryImageTest, Capture ) {
+    std::vector<Word> words( 0x200, 0x1111 );
+    auto image = std::make_shared<const MemoryImage>( words.data(), words.size() );
+    Memory memory { image };
+
+    memory.write( 0x0100, 0x2222 );
+    memory.write( 0x0300, 0x3333 );
+
+    auto first = memory.capture();
+    EXPECT_EQ( 3u, first->numStoredPages() );
+
+    memory.write( 0x0300, 0x4444 );
+    auto second = memory.capture( first );
+
+    // The captures don't change with memory.
+    Memory fromFirst { first };
+    Memory fromSecond { second };
+
+    EXPECT_EQ( 0x1111, fromFirst.read( 0x0000 ) );
+    EXPECT_EQ( 0x2222, fromFirst.read( 0x0100 ) );
+    EXPECT_EQ( 0x3333, fromFirst.read( 0x0300 ) );
+    EXPECT_EQ( 0x2222, fromSecond.read( 0x0100 ) );
+    EXPECT_EQ( 0x4444, fromSecond.read( 0x0300 ) );
+    EXPECT_EQ( 0x0000, fromSecond.read( 0x0400 ) );
+
+    // Only the page that was written is new, and a page that is written with
+    // what it already had isn't new at all.
+    EXPECT_EQ( 1u, second->numStoredPagesNotIn( *first ) );
+
+    memory.write( 0x0100, 0x2222 );
+    memory.write( 0x0300, 0x0000 );
+    memory.write( 0x0300, 0x4444 );
+    EXPECT_EQ( 0u, memory.capture( second )->numStoredPagesNotIn( *second ) );
+}
@@ -0,0 +1,79 @@
+// Tests/TestPacer.cpp
+//
+// Copyright 2013 Jesse Haber-Kucharsky
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "../Pacer.hpp"
+
+#include <thread>
+
+#include <gtest/gtest.h>
+
+using namespace nebula;
+using namespace std::chrono;
+
+TEST( PacerTest, Duration ) {
+    Pacer pacer { 100000 };
+
+    EXPECT_EQ( microseconds { 10 }, duration_cast<microseconds>( pacer.duration( 1 ) ) );
+    EXPECT_EQ( seconds { 3 }, duration_cast<seconds>( pacer.duration( 300000 ) ) );
+
+    // Large enough to overflow if computed naively.
+    EXPECT_EQ( hours { 1000000 }, duration_cast<hours>( pacer.duration( 360000000000000ull ) ) );
+}
+
+TEST( PacerTest, KeepsRate ) {
+    Pacer pacer { 1000000, 0.5 };
+
+    auto start = Pacer::Clock::now();
+
+    // 50 ms worth of cycles, in batches smaller than the pacer waits for.
+    for ( int i = 0; i < 5000; ++i ) {
+        pacer.pace( 10 );
+    }
+
+    auto elapsed = Pacer::Clock::now() - start;
+    EXPECT_GE( elapsed, milliseconds { 49 } );
+    EXPECT_LT( elapsed, milliseconds { 150 } );
+
+    auto report = pacer.report();
+    EXPECT_GT( report.achievedHz, 300000.0 );
+    EXPECT_LT( report.achievedHz, 1100000.0 );
+    EXPECT_LE( report.meanJitter, report.maxJitter );
+}
+
+TEST( PacerTest, CompensatesDrift ) {
+    Pacer pacer { 100000, 0.0 };
+
+    // Running late by less than the maximum lag is made up for without
+    // waiting.
+    std::this_thread::sleep_for( milliseconds { 20 } );
+
+    auto start = Pacer::Clock::now();
+    pacer.pace( 1000 );
+    EXPECT_LT( Pacer::Clock::now() - start, milliseconds { 5 } );
+}
+
+TEST( PacerTest, ForgivesLongLag ) {
+    Pacer pacer { 100000, 0.0 };
+
+    std::this_thread::sleep_for( pacing::MAX_LAG + milliseconds { 50 } );
+
+    // The schedule starts over, so later cycles are paced again.
+    pacer.pace( 100 );
+
+    auto start = Pacer::Clock::now();
+    pacer.pace( 2000 );
+    EXPECT_GE( Pacer::Clock::now() - start, milliseconds { 15 } );
+}
@@ -15,10 +15,14 @@
 // limitations under the License.
 
 #include "Random.hpp"
+#include "../InstructionCache.hpp"
 #include "../ProcessorState.hpp"
 
 #include <array>
+#include <atomic>
+#include <initializer_list>
 #include <limits>
+#include <thread>
 
 #include <gtest/gtest.h>
 
@@ -104,4 +108,503 @@ TEST_F( SpecialTest, ReadWrite ) {
     }
 }
 
+TEST( DecodeTest, Cache ) {
+    // SET A, 0x1234 (with the literal as a next word).
+    auto& set = decodeCached( 0x7c01 );
+    EXPECT_EQ( InstructionKind::Binary, set.kind );
+    EXPECT_EQ( Opcode::Set, set.binaryOpcode() );
+    EXPECT_EQ( 1, set.size );
+    EXPECT_EQ( 3, set.cycles );
+    EXPECT_FALSE( set.isConditional );
 
+    // IFE [A + next], [next].
+    auto& ife = decodeCached( 0x7a12 );
+    EXPECT_EQ( Opcode::Ife, ife.binaryOpcode() );
+    EXPECT_EQ( 2, ife.size );
+    EXPECT_TRUE( ife.isConditional );
+
+    // JSR X.
+    auto& jsr = decodeCached( 0x0c20 );
+    EXPECT_EQ( InstructionKind::Unary, jsr.kind );
+    EXPECT_EQ( SpecialOpcode::Jsr, jsr.specialOpcode() );
+    EXPECT_EQ( 0, jsr.size );
+
+    EXPECT_EQ( InstructionKind::Malformed, decodeCached( 0x0000 ).kind );
+    EXPECT_EQ( InstructionKind::Malformed, decodeCached( 0x0018 ).kind );
+}
+
+TEST( DecodeTest, Handlers ) {
+    for ( DoubleWord word = 0; word <= 0xffff; ++word ) {
+        const auto& ins = decodeCached( static_cast<Word>( word ) );
+
+        if ( ins.kind == InstructionKind::Malformed ) {
+            EXPECT_EQ( nullptr, ins.handler );
+        } else {
+            EXPECT_NE( nullptr, ins.handler );
+        }
+    }
+
+    // Instructions with the same opcode and operand classes share a handler.
+    EXPECT_EQ( decodeCached( 0x0401 ).handler, decodeCached( 0x1c41 ).handler ); // SET A, B / SET C, J
+    EXPECT_NE( decodeCached( 0x0401 ).handler, decodeCached( 0x2401 ).handler ); // SET A, B / SET A, [B]
+    EXPECT_NE( decodeCached( 0x0401 ).handler, decodeCached( 0x0402 ).handler ); // SET A, B / ADD A, B
+}
+
+class ExecutionTest : public ::testing::Test {
+protected:
+    std::shared_ptr<Memory> _memory;
+    ProcessorState _proc;
+public:
+    explicit ExecutionTest() :
+        _memory { std::make_shared<Memory>() },
+        _proc { _memory } {}
+
+    void load( std::initializer_list<Word> words ) {
+        Word loc = 0;
+
+        for ( auto w : words ) {
+            _memory->write( loc++, w );
+        }
+    }
+
+    int run( int numInstructions ) {
+        for ( int i = 0; i < numInstructions; ++i ) {
+            _proc.executeNext();
+        }
+
+        return _proc.clock();
+    }
+};
+
+TEST_F( ExecutionTest, Arithmetic ) {
+    load( {
+        0x7c01, 0xfffe, // SET A, 0xfffe
+        0x8c02,         // ADD A, 2
+        0x7c21, 0x0010, // SET B, 0x10
+        0x0423          // SUB B, B
+    } );
+
+    EXPECT_EQ( 3 + 3, run( 2 ) );
+    EXPECT_EQ( 0x0000, _proc.read( Register::A ) );
+    EXPECT_EQ( 0x0001, _proc.read( Special::Ex ) );
+
+    EXPECT_EQ( 3 + 3 + 3 + 3, run( 2 ) );
+    EXPECT_EQ( 0x0000, _proc.read( Register::B ) );
+    EXPECT_EQ( 0x0000, _proc.read( Special::Ex ) );
+    EXPECT_EQ( 6, _proc.read( Special::Pc ) );
+}
+
+TEST_F( ExecutionTest, SkipChain ) {
+    load( {
+        0x8812,         // IFE A, 1
+        0x8813,         // IFN A, 1
+        0x7c01, 0x1234, // SET A, 0x1234
+        0x8c01          // SET A, 2
+    } );
+
+    // The failed test costs one extra cycle, and skipping the conditional and
+    // then the two-word instruction costs one cycle each, plus one more for
+    // continuing the chain.
+    EXPECT_EQ( 4 + 2 + 1, run( 3 ) );
+    EXPECT_FALSE( _proc.doSkip );
+    EXPECT_EQ( 4, _proc.read( Special::Pc ) );
+
+    run( 1 );
+    EXPECT_EQ( 2, _proc.read( Register::A ) );
+}
+
+TEST_F( ExecutionTest, IndirectOffsetReadModifyWrite ) {
+    load( {
+        0x7c21, 0x0100, // SET B, 0x100
+        0x8e22, 0x0002, // ADD [B + 2], 2
+        0x8c01          // SET A, 2
+    } );
+
+    run( 3 );
+    EXPECT_EQ( 2, _memory->read( 0x0102 ) );
+    EXPECT_EQ( 2, _proc.read( Register::A ) );
+}
+
+TEST_F( ExecutionTest, WaitStates ) {
+    load( {
+        0x7c21, 0x0100, // SET B, 0x100
+        0x2401,         // SET A, [B]
+        0x0121,         // SET [B], A
+        0x0301          // SET PUSH, A
+    } );
+
+    // Fetching instructions has no wait states, even in a slow range.
+    _memory->setWaitStates( 0x0000, 0x0010, WaitStates { 5, 5 } );
+    _memory->setWaitStates( 0x0100, 0x0101, WaitStates { 1, 2 } );
+    _memory->setWaitStates( 0xfffe, 0x10000, WaitStates { 0, 3 } );
+
+    EXPECT_EQ( 3, run( 1 ) );
+    EXPECT_EQ( 3 + 2 + 1, run( 1 ) );
+    EXPECT_EQ( 3 + 2 + 1 + 2 + 2, run( 1 ) );
+    EXPECT_EQ( 3 + 2 + 1 + 2 + 2 + 2 + 3, run( 1 ) );
+}
+
+// A device writes to memory while the processor copies it, as the floppy drive
+// does. Neither ever observes a partially-written word.
+TEST_F( ExecutionTest, ConcurrentDevice ) {
+    load( {
+        0x7bc1, 0x2000, 0x2001, // SET [0x2001], [0x2000]
+        0x8781                  // SET PC, 0
+    } );
+
+    std::atomic<bool> isDone { false };
+
+    std::thread device { [&] {
+            for ( int i = 0; ! isDone.load(); ++i ) {
+                _memory->write( 0x2000, (i % 2) == 0 ? 0x00ff : 0xff00 );
+
+                auto copied = _memory->read( 0x2001 );
+                ASSERT_TRUE( copied == 0 || copied == 0x00ff || copied == 0xff00 );
+            }
+        } };
+
+    for ( int i = 0; i < 100000; ++i ) {
+        run( 2 );
+
+        auto copied = _memory->read( 0x2001 );
+        EXPECT_TRUE( copied == 0 || copied == 0x00ff || copied == 0xff00 );
+    }
+
+    isDone.store( true );
+    device.join();
+}
+
+TEST_F( ExecutionTest, MalformedInstructionFaults ) {
+    load( {
+        0x8801, // SET A, 1
+        0x0000  // Malformed.
+    } );
+
+    auto result = _proc.executeBatch( 100, [] { return false; } );
+
+    EXPECT_EQ( BatchEnd::Fault, result.end );
+    EXPECT_EQ( Fault::MalformedInstruction, _proc.fault() );
+    EXPECT_EQ( 0x0000, _proc.faultWord() );
+    EXPECT_EQ( 1, _proc.read( Special::Pc ) );
+    EXPECT_EQ( 1, _proc.read( Register::A ) );
+}
+
+TEST_F( ExecutionTest, Subroutine ) {
+    load( {
+        0x7c20, 0x0010, // JSR 0x10
+    } );
+
+    _memory->write( 0x10, 0x6381 ); // SET PC, POP
+
+    run( 1 );
+    EXPECT_EQ( 0x10, _proc.read( Special::Pc ) );
+    EXPECT_EQ( 2, _memory->read( _proc.read( Special::Sp ) ) );
+
+    run( 1 );
+    EXPECT_EQ( 2, _proc.read( Special::Pc ) );
+    EXPECT_EQ( processor::STACK_BEGIN, _proc.read( Special::Sp ) );
+}
+
+TEST_F( ExecutionTest, Fusion ) {
+    load( {
+        0x8b01, // SET PUSH, 1
+        0x8f01, // SET PUSH, 2
+        0x6001, // SET A, POP
+        0x6021, // SET B, POP
+        0x9003, // SUB A, 3
+        0x87b3, // IFN EX, 0
+        0xa781, // SET PC, 8
+        0x0000,
+        0x8412, // IFE A, 0
+        0xa381, // SET PC, 7
+        0x9041, // SET C, 3
+        0x0000
+    } );
+
+    ProcessorState unfused { _memory };
+    int unfusedCount = 0;
+
+    while ( unfused.read( Special::Pc ) != 11 ) {
+        unfused.executeNext();
+        ++unfusedCount;
+    }
+
+    _proc.isFusing = true;
+    int fusedCount = 0;
+
+    while ( _proc.read( Special::Pc ) != 11 ) {
+        _proc.executeNext();
+        ++fusedCount;
+    }
+
+    EXPECT_EQ( 10, unfusedCount );
+    EXPECT_EQ( 5, fusedCount );
+
+    EXPECT_EQ( unfused.clock(), _proc.clock() );
+    EXPECT_EQ( unfused.read( Special::Sp ), _proc.read( Special::Sp ) );
+    EXPECT_EQ( unfused.read( Special::Ex ), _proc.read( Special::Ex ) );
+    EXPECT_EQ( 0xffff, _proc.read( Register::A ) );
+    EXPECT_EQ( 1, _proc.read( Register::B ) );
+    EXPECT_EQ( 3, _proc.read( Register::C ) );
+
+    EXPECT_EQ( 1u, _proc.fusionCount( Fusion::PushRun ) );
+    EXPECT_EQ( 1u, _proc.fusionCount( Fusion::PopRun ) );
+    EXPECT_EQ( 1u, _proc.fusionCount( Fusion::ExcessTest ) );
+    EXPECT_EQ( 2u, _proc.fusionCount( Fusion::ConditionalJump ) );
+}
+
+TEST_F( ExecutionTest, BlockTransfer ) {
+    std::initializer_list<Word> code {
+        0x7cc1, 0x0101, // SET I, 0x101
+        0x7ce1, 0x0100, // SET J, 0x100
+        0x3dde,         // STI [I], [J]
+        0x7cd3, 0x0111, // IFN I, 0x111
+        0x9781,         // SET PC, 4
+        0x8801          // SET A, 1
+    };
+
+    load( code );
+    _memory->write( 0x100, 7 );
+
+    // The source and the destination overlap.
+    auto unfusedMemory = std::make_shared<Memory>();
+    Word loc = 0;
+
+    for ( auto w : code ) {
+        unfusedMemory->write( loc++, w );
+    }
+
+    unfusedMemory->write( 0x100, 7 );
+
+    ProcessorState unfused { unfusedMemory };
+
+    while ( unfused.read( Special::Pc ) != 9 ) {
+        unfused.executeNext();
+    }
+
+    _proc.isFusing = true;
+    int fusedCount = 0;
+
+    while ( _proc.read( Special::Pc ) != 9 ) {
+        _proc.executeNext();
+        ++fusedCount;
+    }
+
+    EXPECT_EQ( 4, fusedCount );
+    EXPECT_EQ( unfused.clock(), _proc.clock() );
+    EXPECT_EQ( unfused.read( Register::I ), _proc.read( Register::I ) );
+    EXPECT_EQ( unfused.read( Register::J ), _proc.read( Register::J ) );
+    EXPECT_EQ( unfused.read( Special::Ex ), _proc.read( Special::Ex ) );
+    EXPECT_EQ( 16u * 3 - 1, _proc.fusionCount( Fusion::BlockTransfer ) );
+
+    for ( Word address = 0x100; address <= 0x111; ++address ) {
+        EXPECT_EQ( unfusedMemory->read( address ), _memory->read( address ) );
+    }
+
+    EXPECT_EQ( 7, _memory->read( 0x110 ) );
+    EXPECT_EQ( 0, _memory->read( 0x111 ) );
+}
+
+TEST( BlockTransferTest, MatchesUnfused ) {
+    struct Case {
+        Word leader, i, j, end;
+        bool hasWaitStates;
+    };
+
+    const Case cases[] = {
+        { 0x3ddf, 0x2ff, 0x17f, 0x1ff, false },   // STD [I], [J], apart
+        { 0x01de, 0x8000, 0, 0x8180, false },     // STI [I], A
+        { 0x3ddf, 0x200, 0x201, 0x180, false },   // STD [I], [J], overlapping
+        { 0x3dde, 0x103, 0x100, 0x140, false },   // STI [I], [J], overlapping
+        { 0x3ddf, 0x2ff, 0x17f, 0x1ff, true }     // STD [I], [J], apart
+    };
+
+    for ( const auto& c : cases ) {
+        const Word code[] = {
+            0x7cc1, c.i,    // SET I, i
+            0x7ce1, c.j,    // SET J, j
+            0x7c01, 0x0f20, // SET A, 0x0f20
+            c.leader,
+            0x7cd3, c.end,  // IFN I, end
+            0x9f81,         // SET PC, 6
+            0x8801          // SET A, 1
+        };
+
+        auto load = [&code, &c] ( Memory& memory ) {
+            for ( Word address = 0x100; address < 0x300; ++address ) {
+                memory.write( address, address * 7 );
+            }
+
+            Word loc = 0;
+
+            for ( auto w : code ) {
+                memory.write( loc++, w );
+            }
+
+            if ( c.hasWaitStates ) {
+                memory.setWaitStates( 0x150, 0x160, WaitStates { 1, 2 } );
+            }
+        };
+
+        auto unfusedMemory = std::make_shared<Memory>();
+        auto fusedMemory = std::make_shared<Memory>();
+        load( *unfusedMemory );
+        load( *fusedMemory );
+
+        ProcessorState unfused { unfusedMemory };
+        ProcessorState fused { fusedMemory };
+        fused.isFusing = true;
+
+        while ( unfused.read( Special::Pc ) != 11 ) {
+            unfused.executeNext();
+        }
+
+        int fusedCount = 0;
+
+        while ( fused.read( Special::Pc ) != 11 ) {
+            fused.executeNext();
+            ++fusedCount;
+        }
+
+        EXPECT_EQ( 5, fusedCount );
+        EXPECT_EQ( unfused.clock(), fused.clock() );
+        EXPECT_EQ( unfused.read( Register::I ), fused.read( Register::I ) );
+        EXPECT_EQ( unfused.read( Register::J ), fused.read( Register::J ) );
+
+        for ( int address = 0; address < Memory::SIZE; ++address ) {
+            ASSERT_EQ( unfusedMemory->read( address ), fusedMemory->read( address ) ) << address;
+        }
+    }
+}
+
+TEST_F( ExecutionTest, FusionAfterWrite ) {
+    load( {
+        0x7fc2, 0x004e, 0x0003, // ADD [3], 0x4e
+        0x87b3,                 // IFN EX, 0
+        0x8c21                  // SET B, 2
+    } );
+
+    _proc.isFusing = true;
+
+    // The test is decoded along with the addition, but it's overwritten with
+    // SET A, 1 before it can execute.
+    _proc.executeNext();
+    EXPECT_EQ( 3, _proc.read( Special::Pc ) );
+    EXPECT_EQ( 0u, _proc.fusionCount( Fusion::ExcessTest ) );
+
+    _proc.executeNext();
+    _proc.executeNext();
+    EXPECT_EQ( 1, _proc.read( Register::A ) );
+    EXPECT_EQ( 2, _proc.read( Register::B ) );
+
+    // Nor is a fusion stale after memory is written from elsewhere.
+    _memory->write( 5, 0x8413 ); // IFN A, 0
+    _memory->write( 6, 0x9b81 ); // SET PC, 5
+    _proc.write( Special::Pc, 5 );
+    _proc.executeNext();
+    EXPECT_EQ( 5, _proc.read( Special::Pc ) );
+    EXPECT_EQ( 1u, _proc.fusionCount( Fusion::ConditionalJump ) );
+
+    _memory->write( 6, 0x9021 ); // SET B, 3
+    _proc.executeNext();
+    EXPECT_EQ( 6, _proc.read( Special::Pc ) );
+    EXPECT_EQ( 1u, _proc.fusionCount( Fusion::ConditionalJump ) );
+
+    _proc.executeNext();
+    EXPECT_EQ( 3, _proc.read( Register::B ) );
+}
+
+TEST_F( ExecutionTest, Batch ) {
+    load( {
+        0x8801, // SET A, 1
+        0x8802, // ADD A, 1
+        0x9900, // INT 5
+        0x8c21, // SET B, 2
+        0x8b83  // SUB PC, 1
+    } );
+
+    auto never = [] { return false; };
+    auto always = [] { return true; };
+
+    _proc.setBreakpoint( 1 );
+
+    auto result = _proc.executeBatch( 100, never );
+    EXPECT_EQ( BatchEnd::Breakpoint, result.end );
+    EXPECT_EQ( _proc.clock(), result.cycles );
+    EXPECT_EQ( 1, _proc.read( Special::Pc ) );
+
+    // Execution resumes from the breakpoint.
+    result = _proc.executeBatch( 100, never );
+    EXPECT_EQ( BatchEnd::Special, result.end );
+    EXPECT_EQ( SpecialOpcode::Int, _proc.lastInstruction()->specialOpcode() );
+    EXPECT_EQ( 2, _proc.read( Register::A ) );
+
+    result = _proc.executeBatch( 100, always );
+    EXPECT_EQ( BatchEnd::Interrupt, result.end );
+    EXPECT_EQ( 0, result.cycles );
+
+    result = _proc.executeBatch( 1, never );
+    EXPECT_EQ( BatchEnd::Budget, result.end );
+    EXPECT_EQ( 4, _proc.read( Special::Pc ) );
+
+    result = _proc.executeBatch( 100, never );
+    EXPECT_EQ( BatchEnd::Loop, result.end );
+    EXPECT_EQ( 4, _proc.read( Special::Pc ) );
+}
+
+TEST_F( ExecutionTest, FusedBatch ) {
+    load( {
+        0x8b01,         // SET PUSH, 1
+        0x8f01,         // SET PUSH, 2
+        0x9301,         // SET PUSH, 3
+        0x7cc1, 0x0101, // SET I, 0x101
+        0x7ce1, 0x0100, // SET J, 0x100
+        0x3dde,         // STI [I], [J]
+        0x7cd3, 0x0200, // IFN I, 0x200
+        0xa381,         // SET PC, 7
+        0x8801          // SET A, 1
+    } );
+
+    auto never = [] { return false; };
+    _proc.isFusing = true;
+
+    // A breakpoint on an instruction that would be fused with the one before
+    // it still ends the batch.
+    _proc.setBreakpoint( 2 );
+
+    auto result = _proc.executeBatch( 100, never );
+    EXPECT_EQ( BatchEnd::Breakpoint, result.end );
+    EXPECT_EQ( 2, _proc.read( Special::Pc ) );
+    EXPECT_EQ( 1u, _proc.fusionCount( Fusion::PushRun ) );
+
+    // So does one in a block transfer, after its first iteration.
+    _proc.setBreakpoint( 2, false );
+    _proc.setBreakpoint( 10 );
+
+    result = _proc.executeBatch( 100, never );
+    EXPECT_EQ( BatchEnd::Breakpoint, result.end );
+    EXPECT_EQ( 10, _proc.read( Special::Pc ) );
+    EXPECT_EQ( 0x102, _proc.read( Register::I ) );
+    EXPECT_EQ( 0u, _proc.fusionCount( Fusion::BlockTransfer ) );
+
+    // Without it, the transfer continues only until the budget is used ...
+    _proc.setBreakpoint( 10, false );
+
+    result = _proc.executeBatch( 100, never );
+    EXPECT_EQ( BatchEnd::Loop, result.end );
+
+    result = _proc.executeBatch( 20, never );
+    EXPECT_EQ( BatchEnd::Budget, result.end );
+    EXPECT_GE( result.cycles, 20 );
+    EXPECT_LT( result.cycles, 20 + 8 );
+
+    // ... or there's an interrupt.
+    result = _proc.executeBatch( 100, never );
+    EXPECT_EQ( BatchEnd::Loop, result.end );
+
+    int checks = 0;
+    result = _proc.executeBatch( 1000, [&checks] { return ++checks > 1; } );
+    EXPECT_EQ( BatchEnd::Interrupt, result.end );
+    EXPECT_LT( result.cycles, 8 );
+    EXPECT_NE( 0x200, _proc.read( Register::I ) );
+}
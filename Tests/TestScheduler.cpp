@@ -0,0 +1,157 @@
+// Tests/TestScheduler.cpp
+//
+// Copyright 2013 Jesse Haber-Kucharsky
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "../InputLog.hpp"
+#include "../Simulation/Clock.hpp"
+#include "../Simulation/Processor.hpp"
+#include "../Simulation/Scheduler.hpp"
+
+#include <functional>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+using namespace nebula;
+
+TEST( SchedulerTest, Order ) {
+    Timing timing { pacing::DEFAULT_CLOCK_HZ, timing::UNTHROTTLED };
+    Scheduler scheduler { timing };
+    std::vector<int> order {};
+
+    scheduler.at( 20, [&] { order.push_back( 3 ); } );
+    scheduler.at( 10, [&] { order.push_back( 1 ); } );
+    scheduler.at( 10, [&] {
+            order.push_back( 2 );
+
+            // Scheduled for now, so it happens straight away.
+            scheduler.at( 10, [&] { order.push_back( 4 ); } );
+        } );
+
+    EXPECT_EQ( 3u, scheduler.numEvents() );
+    EXPECT_EQ( 10u, scheduler.deadline() );
+
+    scheduler.runDue();
+    EXPECT_TRUE( order.empty() );
+
+    timing.advance( 10 );
+    scheduler.runDue();
+    EXPECT_EQ( ( std::vector<int> { 1, 2, 4 } ), order );
+    EXPECT_EQ( 20u, scheduler.deadline() );
+
+    timing.advance( 100 );
+    scheduler.runDue();
+    EXPECT_EQ( ( std::vector<int> { 1, 2, 4, 3 } ), order );
+    EXPECT_EQ( 0u, scheduler.numEvents() );
+
+    // Without any events, the processor still returns to the scheduler.
+    EXPECT_EQ( 110 + timing.cycles( sim::SCHEDULER_MAX_QUANTUM ), scheduler.deadline() );
+
+    scheduler.after( std::chrono::microseconds { 0 }, [] {} );
+    EXPECT_EQ( 111u, scheduler.deadline() );
+}
+
+TEST( SchedulerTest, Periodic ) {
+    Timing timing { pacing::DEFAULT_CLOCK_HZ, timing::UNTHROTTLED };
+    Scheduler scheduler { timing };
+
+    // As if the processor had executed cycles that haven't been paced.
+    std::uint64_t cycle = 5;
+    scheduler.follow( [&cycle] { return cycle; } );
+
+    const std::chrono::milliseconds period { 1 };
+    const auto n = timing.cycles( period );
+    std::vector<std::uint64_t> ticks {};
+
+    std::function<void ()> tick = [&] {
+        ticks.push_back( cycle );
+        scheduler.repeat( period, tick );
+    };
+
+    scheduler.after( period, tick );
+    EXPECT_EQ( 5 + n, scheduler.deadline() );
+
+    // Late, but the next tick is still a period after this one was due.
+    cycle = 5 + n + 7;
+    scheduler.runDue();
+    EXPECT_EQ( ( std::vector<std::uint64_t> { 5 + n + 7 } ), ticks );
+    EXPECT_EQ( 5 + 2 * n, scheduler.deadline() );
+
+    scheduler.follow( nullptr );
+    EXPECT_EQ( 0u, scheduler.now() );
+}
+
+namespace {
+
+// Starts the clock (the first device) at 60 Hz with interrupts, and counts
+// them in X while idle.
+const std::vector<Word> PROGRAM = {
+    0x8401,         // SET A, 0
+    0x8821,         // SET B, 1
+    0x8a40,         // HWI 1
+    0x8c01,         // SET A, 2
+    0x7c21, 0x0055, // SET B, 0x55
+    0x7d40, 0x000a, // IAS 10
+    0x8a40,         // HWI 1
+    0xab81,         // SET PC, 9
+    0x8862,         // ADD X, 1
+    0x8560          // RFI 0
+};
+
+const std::uint64_t STOP_CYCLE = pacing::DEFAULT_CLOCK_HZ;
+
+struct Outcome {
+    std::uint64_t cycles;
+    InputLog::Registers registers;
+};
+
+Outcome run() {
+    auto memory = std::make_shared<Memory>( std::make_shared<const MemoryImage>( PROGRAM.data(), PROGRAM.size() ) );
+    Computer computer { memory, pacing::DEFAULT_CLOCK_HZ, timing::UNTHROTTLED };
+    Clock clock { computer };
+    Scheduler scheduler { computer.timing() };
+    Processor proc { computer, ExecutionMode::Interpreted };
+
+    clock.schedule( scheduler );
+    scheduler.at( STOP_CYCLE, [&proc] { proc.stop(); } );
+
+    auto state = proc.runScheduled( scheduler );
+
+    return Outcome {
+        computer.timing().elapsedCycles() + state->clock(),
+        InputLog::registersOf( *state )
+    };
+}
+
+}
+
+TEST( SchedulerTest, Deterministic ) {
+    auto first = run();
+
+    // A second of ticks, less the few cycles before the clock started.
+    EXPECT_GE( first.registers[3], 59 );
+    EXPECT_LE( first.registers[3], 60 );
+
+    // The idle loop was skipped up to the last event, and no further.
+    EXPECT_GE( first.cycles, STOP_CYCLE );
+    EXPECT_LT( first.cycles, STOP_CYCLE + 10 );
+
+    for ( int i = 0; i < 5; ++i ) {
+        auto again = run();
+
+        EXPECT_EQ( first.cycles, again.cycles );
+        EXPECT_EQ( first.registers, again.registers );
+    }
+}
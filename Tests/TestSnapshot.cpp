@@ -0,0 +1,154 @@
+// Tests/TestSnapshot.cpp
+//
+// Copyright 2013 Jesse Haber-Kucharsky
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "../Computer.hpp"
+#include "../Snapshot.hpp"
+
+#include <cstdio>
+
+#include <gtest/gtest.h>
+
+using namespace nebula;
+
+TEST( SnapshotTest, Fields ) {
+    SnapshotWriter writer {};
+    writer.write( std::uint8_t { 0xab } );
+    writer.write( true );
+    writer.write( std::int32_t { -5 } );
+    writer.write( Fault::CaughtFire );
+    writer.write( std::uint64_t { 0x0123456789abcdef } );
+
+    SnapshotReader reader { writer.bytes() };
+    EXPECT_EQ( 0xab, reader.read<std::uint8_t>() );
+    EXPECT_TRUE( reader.read<bool>() );
+    EXPECT_EQ( -5, reader.read<std::int32_t>() );
+    EXPECT_EQ( Fault::CaughtFire, reader.read<Fault>() );
+    EXPECT_EQ( 0x0123456789abcdefu, reader.read<std::uint64_t>() );
+    EXPECT_TRUE( reader.isAtEnd() );
+
+    EXPECT_THROW( reader.read<Word>(), error::BadSnapshot );
+}
+
+TEST( SnapshotTest, BadSnapshots ) {
+    EXPECT_THROW( SnapshotReader { std::vector<unsigned char>( 3 ) }, error::BadSnapshot );
+    EXPECT_THROW( SnapshotReader { std::vector<unsigned char>( 8 ) }, error::BadSnapshot );
+
+    auto bytes = SnapshotWriter {}.bytes();
+    bytes[4] = 0xff;
+    EXPECT_THROW( SnapshotReader { bytes }, error::BadSnapshot );
+}
+
+TEST( SnapshotTest, Machine ) {
+    auto memory = std::make_shared<Memory>();
+    Computer computer { memory, 100000, timing::UNTHROTTLED };
+    ProcessorState proc { memory };
+
+    memory->write( 0x0000, 0x7c01 );
+    memory->write( 0x8000, 0xbeef );
+    memory->write( 0xffff, 0x1234 );
+
+    proc.write( Register::J, 0xabcd );
+    proc.write( Special::Pc, 0x0010 );
+    proc.write( Special::Sp, 0xfff0 );
+    proc.doSkip = true;
+    proc.tickClock( 42 );
+    proc.setFault( Fault::MalformedInstruction, 0x0000 );
+
+    computer.ia = 0x0200;
+    computer.onlyQueuing = true;
+    computer.queue().push( 7 );
+    computer.queue().push( 8 );
+    computer.timing().advance( 1000 );
+
+    SnapshotWriter writer {};
+    computer.save( writer );
+    proc.save( writer );
+
+    // Only the pages that aren't zero are saved.
+    EXPECT_LT( writer.bytes().size(), 4u * Memory::PAGE_SIZE * 2 );
+
+    auto restoredMemory = std::make_shared<Memory>();
+    Computer restoredComputer { restoredMemory, 100000, timing::UNTHROTTLED };
+    ProcessorState restoredProc { restoredMemory };
+
+    SnapshotReader reader { writer.bytes() };
+    restoredComputer.restore( reader );
+    restoredProc.restore( reader );
+    EXPECT_TRUE( reader.isAtEnd() );
+
+    for ( int i = 0; i < Memory::SIZE; ++i ) {
+        ASSERT_EQ( memory->read( static_cast<Word>( i ) ), restoredMemory->read( static_cast<Word>( i ) ) );
+    }
+
+    EXPECT_EQ( 0xabcd, restoredProc.read( Register::J ) );
+    EXPECT_EQ( 0x0010, restoredProc.read( Special::Pc ) );
+    EXPECT_EQ( 0xfff0, restoredProc.read( Special::Sp ) );
+    EXPECT_TRUE( restoredProc.doSkip );
+    EXPECT_EQ( 42, restoredProc.clock() );
+    EXPECT_EQ( Fault::MalformedInstruction, restoredProc.fault() );
+
+    EXPECT_EQ( 0x0200, restoredComputer.ia );
+    EXPECT_TRUE( restoredComputer.onlyQueuing );
+    EXPECT_EQ( computer.timing().now(), restoredComputer.timing().now() );
+
+    ASSERT_TRUE( restoredComputer.queue().hasInterrupt() );
+    EXPECT_EQ( 7, restoredComputer.queue().pop() );
+    EXPECT_EQ( 8, restoredComputer.queue().pop() );
+    EXPECT_FALSE( restoredComputer.queue().hasInterrupt() );
+}
+
+// Snapshots have the state at the moment they were captured, whatever
+// happens while they're written.
+TEST( SnapshotTest, Live ) {
+    const std::string path { "nebula-test-snapshot.bin" };
+
+    auto memory = std::make_shared<Memory>();
+    Computer computer { memory };
+    ProcessorState proc { memory };
+
+    auto& snapshots = computer.snapshots();
+    snapshots.add( [&computer] { return computer.capture(); } );
+    snapshots.add( [&proc] { return proc.capture(); } );
+
+    memory->write( 0x1000, 1 );
+    proc.write( Register::A, 1 );
+
+    EXPECT_FALSE( snapshots.isRequested() );
+    snapshots.request( path );
+    EXPECT_TRUE( snapshots.isRequested() );
+
+    snapshots.capture();
+    EXPECT_FALSE( snapshots.isRequested() );
+
+    memory->write( 0x1000, 2 );
+    proc.write( Register::A, 2 );
+
+    snapshots.wait();
+
+    auto restoredMemory = std::make_shared<Memory>();
+    Computer restoredComputer { restoredMemory };
+    ProcessorState restoredProc { restoredMemory };
+
+    auto reader = SnapshotReader::fromFile( path );
+    restoredComputer.restore( reader );
+    restoredProc.restore( reader );
+    EXPECT_TRUE( reader.isAtEnd() );
+
+    EXPECT_EQ( 1, restoredMemory->read( 0x1000 ) );
+    EXPECT_EQ( 1, restoredProc.read( Register::A ) );
+
+    std::remove( path.c_str() );
+}
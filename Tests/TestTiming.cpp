@@ -0,0 +1,79 @@
+// Tests/TestTiming.cpp
+//
+// Copyright 2013 Jesse Haber-Kucharsky
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "../Timing.hpp"
+
+#include <thread>
+
+#include <gtest/gtest.h>
+
+using namespace nebula;
+using namespace std::chrono;
+
+TEST( TimingTest, Scaled ) {
+    Timing timing { 100000, 10.0 };
+
+    EXPECT_EQ( 1000000u, timing.pacedClockHz() );
+
+    // 100 ms of simulated time pass in 10 ms.
+    auto start = Timing::Host::now();
+    timing.sleepFor( milliseconds { 100 } );
+    auto elapsed = Timing::Host::now() - start;
+
+    EXPECT_GE( elapsed, milliseconds { 9 } );
+    EXPECT_LT( elapsed, milliseconds { 60 } );
+    EXPECT_GE( timing.now(), milliseconds { 100 } );
+}
+
+TEST( TimingTest, UnthrottledFollowsCycles ) {
+    Timing timing { 100000, timing::UNTHROTTLED };
+
+    EXPECT_TRUE( timing.isUnthrottled() );
+    EXPECT_EQ( 100u, timing.cycles( milliseconds { 1 } ) );
+
+    // Nothing passes in real time.
+    std::this_thread::sleep_for( milliseconds { 5 } );
+    EXPECT_EQ( Timing::Duration::zero(), timing.now() );
+
+    timing.advance( 250 );
+    EXPECT_EQ( microseconds { 2500 }, duration_cast<microseconds>( timing.now() ) );
+}
+
+TEST( TimingTest, UnthrottledSleep ) {
+    Timing timing { 100000, timing::UNTHROTTLED };
+
+    std::thread processor { [&timing] {
+            for ( int i = 0; i < 100; ++i ) {
+                timing.advance( 100 );
+                std::this_thread::sleep_for( microseconds { 100 } );
+            }
+        } };
+
+    // Waits until the processor has executed 50 ms worth of cycles.
+    timing.sleepFor( milliseconds { 50 } );
+    EXPECT_GE( timing.now(), milliseconds { 50 } );
+
+    processor.join();
+}
+
+TEST( TimingTest, UnthrottledHalt ) {
+    Timing timing { 100000, timing::UNTHROTTLED };
+    timing.halt();
+
+    // Returns without the processor.
+    timing.sleepFor( seconds { 10 } );
+    EXPECT_EQ( Timing::Duration::zero(), timing.now() );
+}
@@ -0,0 +1,184 @@
+// Tests/TestTranslator.cpp
+//
+// Copyright 2013 Jesse Haber-Kucharsky
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "../NativeImage.hpp"
+#include "../Translator.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <initializer_list>
+#include <sstream>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+using namespace nebula;
+
+class TranslatorTest : public ::testing::Test {
+protected:
+    Memory _memory;
+public:
+    explicit TranslatorTest() : _memory {} {
+        load( {
+            0x8801,         // 0x0: SET A, 1
+            0x8c12,         // 0x1: IFE A, 2
+            0x9821,         // 0x2: SET B, 5
+            0xa420,         // 0x3: JSR 8
+            0x9041,         // 0x4: SET C, 3
+            0x7f81, 0x0005, // 0x5: SET PC, 5
+            0x0000,         // 0x7
+            0x6061,         // 0x8: SET X, POP
+            0x6381,         // 0x9: SET PC, POP
+            0x8801          // 0xa: SET A, 1 (unreachable)
+        } );
+    }
+
+    void load( std::initializer_list<Word> words ) {
+        Word loc = 0;
+
+        for ( auto w : words ) {
+            _memory.write( loc++, w );
+        }
+    }
+};
+
+TEST_F( TranslatorTest, RecoversReachableBlocks ) {
+    auto blocks = translation::recover( _memory );
+
+    std::vector<Word> addresses {};
+
+    for ( const auto& block : blocks ) {
+        addresses.push_back( block.address );
+    }
+
+    EXPECT_EQ( (std::vector<Word> { 0x0, 0x3, 0x4, 0x5, 0x8 }), addresses );
+
+    const auto& first = blocks.front();
+    ASSERT_EQ( 4u, first.steps.size() );
+    EXPECT_EQ( 0x3, first.steps[1].skipTarget );
+    EXPECT_EQ( 2, first.steps[1].skipCycles );
+    EXPECT_TRUE( first.steps[3].writesPc() );
+}
+
+TEST_F( TranslatorTest, EmitsEveryBlock ) {
+    std::ostringstream out {};
+    translation::emit( out, translation::recover( _memory ) );
+
+    auto source = out.str();
+
+    EXPECT_NE( std::string::npos, source.find( "nebula_abi_version" ) );
+    EXPECT_NE( std::string::npos, source.find( "block_0008" ) );
+    EXPECT_EQ( std::string::npos, source.find( "block_000a" ) );
+}
+
+namespace {
+
+// Sums 10 down to 1 in B, and stores each partial sum from 0x100a downwards.
+// A subroutine accumulates into C with a skip. The program ends at a malformed
+// instruction, which translated code stops before.
+const std::vector<Word> PROGRAM = {
+    0xac01,         // 0x00: SET A, 10
+    0x8421,         // 0x01: SET B, 0
+    0x0022,         // 0x02: ADD B, A
+    0x0601, 0x1000, // 0x03: SET [A + 0x1000], B
+    0x7c20, 0x0010, // 0x05: JSR 0x10
+    0x8803,         // 0x07: SUB A, 1
+    0x8413,         // 0x08: IFN A, 0
+    0x8f81,         // 0x09: SET PC, 2
+    0x0000,         // 0x0a
+    0, 0, 0, 0, 0,
+    0x0442,         // 0x10: ADD C, B
+    0x8452,         // 0x11: IFE C, 0
+    0x8061,         // 0x12: SET X, 0xffff
+    0x6381          // 0x13: SET PC, POP
+};
+
+const Word PROGRAM_END = 0x0a;
+
+const std::string SOURCE_PATH { "nebula-test-translation.cpp" };
+const std::string LIBRARY_PATH { "nebula-test-translation.so" };
+
+}
+
+// Compares translated code, built with the host's compiler as
+// `nebula-translate` would build it, with the interpreter.
+TEST( TranslatorDifferentialTest, MatchesInterpreter ) {
+    if ( std::system( "c++ --version > /dev/null 2>&1" ) != 0 ) {
+        return;
+    }
+
+    auto expectedMemory = std::make_shared<Memory>( std::make_shared<const MemoryImage>( PROGRAM.data(), PROGRAM.size() ) );
+    auto memory = std::make_shared<Memory>( std::make_shared<const MemoryImage>( PROGRAM.data(), PROGRAM.size() ) );
+
+    {
+        std::ofstream source { SOURCE_PATH };
+        translation::emit( source, translation::recover( *memory ) );
+    }
+
+    auto command = "c++ -O1 -shared -fPIC -o '" + LIBRARY_PATH + "' '" + SOURCE_PATH + "'";
+    auto status = std::system( command.c_str() );
+    std::remove( SOURCE_PATH.c_str() );
+    ASSERT_EQ( 0, status );
+
+    ProcessorState expected { expectedMemory };
+
+    while ( expected.read( Special::Pc ) != PROGRAM_END ) {
+        expected.executeNext();
+    }
+
+    ProcessorState proc { memory };
+    int numTranslated = 0;
+
+    {
+        NativeImage image { memory, LIBRARY_PATH };
+        EXPECT_LT( 0u, image.size() );
+
+        // As `Processor` does, with the smallest budget so that every block is
+        // entered on its own.
+        while ( proc.read( Special::Pc ) != PROGRAM_END ) {
+            if ( image.execute( proc, 1 ) ) {
+                ++numTranslated;
+            } else {
+                proc.executeNext();
+            }
+        }
+    }
+
+    std::remove( LIBRARY_PATH.c_str() );
+    EXPECT_LT( 0, numTranslated );
+
+    for ( int i = 0; i < 8; ++i ) {
+        auto reg = static_cast<Register>( i );
+        EXPECT_EQ( expected.read( reg ), proc.read( reg ) );
+    }
+
+    EXPECT_EQ( expected.read( Special::Sp ), proc.read( Special::Sp ) );
+    EXPECT_EQ( expected.read( Special::Ex ), proc.read( Special::Ex ) );
+    EXPECT_EQ( expected.clock(), proc.clock() );
+    EXPECT_EQ( 55, proc.read( Register::B ) );
+
+    int numDifferent = 0;
+
+    for ( int offset = 0; offset < Memory::SIZE; ++offset ) {
+        if ( expectedMemory->read( offset ) != memory->read( offset ) ) {
+            ++numDifferent;
+        }
+    }
+
+    EXPECT_EQ( 0, numDifferent );
+    EXPECT_EQ( 55, memory->read( 0x1001 ) );
+}
@@ -0,0 +1,98 @@
+// Timing.cpp
+//
+// Copyright 2013 Jesse Haber-Kucharsky
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "Timing.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+namespace nebula {
+
+Timing::Timing( std::uint64_t clockHz, double speed ) :
+    _clockHz { std::max<std::uint64_t>( clockHz, 1 ) },
+    _speed { std::max( speed, timing::UNTHROTTLED ) },
+    _start { Host::now() } {
+}
+
+std::uint64_t Timing::pacedClockHz() const noexcept {
+    return std::max<std::uint64_t>( std::llround( _clockHz * _speed ), 1 );
+}
+
+Timing::Duration Timing::now() const noexcept {
+    using Seconds = std::chrono::duration<double>;
+
+    if ( isUnthrottled() ) {
+        auto cycles = _cycles.load( std::memory_order_relaxed );
+        return std::chrono::duration_cast<Duration>( Seconds { static_cast<double>( cycles ) / _clockHz } );
+    }
+
+    return std::chrono::duration_cast<Duration>( (Host::now() - _start) * _speed );
+}
+
+void Timing::resumeAt( Duration t ) noexcept {
+    _cycles.store( cycles( t ) );
+
+    if ( ! isUnthrottled() ) {
+        _start = Host::now() - std::chrono::duration_cast<Host::duration>( t / _speed );
+    }
+}
+
+std::uint64_t Timing::cycles( Duration d ) const noexcept {
+    using Seconds = std::chrono::duration<double>;
+    return static_cast<std::uint64_t>( std::chrono::duration_cast<Seconds>( d ).count() * _clockHz );
+}
+
+void Timing::sleepUntil( Duration t ) const {
+    if ( ! isUnthrottled() ) {
+        std::this_thread::sleep_until( _start + std::chrono::duration_cast<Host::duration>( t / _speed ) );
+        return;
+    }
+
+    while ( ! _isHalted.load() && now() < t ) {
+        std::this_thread::sleep_for( timing::UNTHROTTLED_POLL_DURATION );
+    }
+}
+
+bool Timing::sleepUntil( Duration t, const std::function<bool ()>& isWoken ) const {
+    if ( isUnthrottled() ) {
+        while ( ! isWoken() ) {
+            if ( _isHalted.load() || now() >= t ) {
+                return true;
+            }
+
+            std::this_thread::sleep_for( timing::WAKE_POLL_DURATION );
+        }
+
+        return false;
+    }
+
+    auto end = _start + std::chrono::duration_cast<Host::duration>( t / _speed );
+
+    while ( ! isWoken() ) {
+        auto hostNow = Host::now();
+
+        if ( hostNow >= end ) {
+            return true;
+        }
+
+        std::this_thread::sleep_until( std::min( end, hostNow + std::chrono::duration_cast<Host::duration>( timing::WAKE_POLL_DURATION ) ) );
+    }
+
+    return false;
+}
+
+}
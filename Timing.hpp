@@ -0,0 +1,112 @@
+// Timing.hpp
+//
+// Copyright 2013 Jesse Haber-Kucharsky
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "Pacer.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+
+namespace nebula {
+
+namespace timing {
+
+// The speed at which the processor runs as quickly as it can.
+const double UNTHROTTLED = 0.0;
+
+// When unthrottled, waiting for simulated time checks the progress of the
+// processor this often.
+const std::chrono::microseconds UNTHROTTLED_POLL_DURATION { 50 };
+
+// A wait for simulated time that something else can end checks for it this
+// often.
+const std::chrono::microseconds WAKE_POLL_DURATION { 50 };
+
+}
+
+// Simulated time, which devices use for everything that the processor can
+// observe.
+//
+// Normally, simulated time passes at a fixed multiple (the speed) of real
+// time, and the processor is paced to match. When unthrottled, simulated
+// time is instead derived from the cycles that the processor has executed,
+// so it passes exactly as quickly as the processor runs.
+class Timing final {
+public:
+    using Host = std::chrono::steady_clock;
+
+    // Simulated time since the simulation began.
+    using Duration = std::chrono::nanoseconds;
+private:
+    std::uint64_t _clockHz;
+    double _speed;
+    Host::time_point _start;
+
+    // Only the processor advances this.
+    std::atomic<std::uint64_t> _cycles { 0 };
+
+    std::atomic<bool> _isHalted { false };
+public:
+    explicit Timing( std::uint64_t clockHz = pacing::DEFAULT_CLOCK_HZ,
+                     double speed = 1.0 );
+
+    Timing( const Timing& ) = delete;
+    Timing& operator=( const Timing& ) = delete;
+
+    inline std::uint64_t clockHz() const noexcept { return _clockHz; }
+    inline bool isUnthrottled() const noexcept { return _speed == timing::UNTHROTTLED; }
+
+    // The rate at which the processor must run in real time.
+    std::uint64_t pacedClockHz() const noexcept;
+
+    // Called by the processor after executing `cycles`.
+    inline void advance( std::uint64_t cycles ) noexcept {
+        _cycles.store( _cycles.load( std::memory_order_relaxed ) + cycles, std::memory_order_relaxed );
+    }
+
+    // Every cycle that the processor has reported.
+    inline std::uint64_t elapsedCycles() const noexcept { return _cycles.load( std::memory_order_relaxed ); }
+
+    // Called by the processor when it stops, so that nothing waits for it
+    // forever.
+    inline void halt() noexcept { _isHalted.store( true ); }
+
+    Duration now() const noexcept;
+
+    // Continue from simulated time `t`, as when resuming from a snapshot.
+    // This must happen before the simulation starts, since it isn't
+    // synchronized.
+    void resumeAt( Duration t ) noexcept;
+
+    // The number of cycles that the processor executes in `d`.
+    std::uint64_t cycles( Duration d ) const noexcept;
+
+    // Block until simulated time `t`. When unthrottled, this returns early if
+    // the processor has halted.
+    void sleepUntil( Duration t ) const;
+
+    inline void sleepFor( Duration d ) const { sleepUntil( now() + d ); }
+
+    // As `sleepUntil`, but return false as soon as `isWoken` is true. A
+    // device waits like this so that it can still respond to the processor,
+    // which doesn't advance simulated time while it waits for the device.
+    bool sleepUntil( Duration t, const std::function<bool ()>& isWoken ) const;
+};
+
+}
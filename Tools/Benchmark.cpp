@@ -0,0 +1,152 @@
+// Tools/Benchmark.cpp
+//
+// Copyright 2013 Jesse Haber-Kucharsky
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "../Memory.hpp"
+#include "../ProcessorState.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <boost/program_options.hpp>
+
+using namespace nebula;
+
+namespace {
+
+struct Program {
+    std::string name;
+    std::vector<Word> words;
+};
+
+// Small loops, so that the interpreter rather than memory is measured.
+const std::vector<Program> PROGRAMS = {
+    {
+        // Leaders that nothing follows.
+        "arithmetic", {
+            0x8862, // ADD X, 1
+            0x0c82, // ADD Y, X
+            0x8781  // SET PC, 0
+        }
+    },
+    {
+        "conditional jump", {
+            0x8862, // ADD X, 1
+            0x8473, // IFN X, 0
+            0x8781, // SET PC, 0
+            0x8781  // SET PC, 0
+        }
+    },
+    {
+        "stack", {
+            0x0f01, // SET PUSH, X
+            0x1301, // SET PUSH, Y
+            0x6081, // SET Y, POP
+            0x6061, // SET X, POP
+            0x8862, // ADD X, 1
+            0x8473, // IFN X, 0
+            0x8781, // SET PC, 0
+            0x8781  // SET PC, 0
+        }
+    }
+};
+
+// Millions of cycles per second.
+double measure( const Program& program, bool isFusing, int numCycles ) {
+    auto memory = std::make_shared<Memory>();
+    Word address = 0;
+
+    for ( auto word : program.words ) {
+        memory->write( address++, word );
+    }
+
+    ProcessorState proc { memory };
+    proc.isFusing = isFusing;
+
+    auto never = [] { return false; };
+    auto start = std::chrono::steady_clock::now();
+    int cycles = 0;
+
+    while ( cycles < numCycles ) {
+        cycles += proc.executeBatch( numCycles - cycles, never ).cycles;
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return cycles / elapsed.count() / 1e6;
+}
+
+}
+
+int main( int argc, char* argv[] ) {
+    namespace po = boost::program_options;
+
+    po::options_description desc;
+    desc.add_options()
+        ( "help,h", "Produce this message." )
+        ( "cycles,c", po::value<int>()->default_value( 10000000 ), "The cycles executed by each trial." )
+        ( "trials,t", po::value<int>()->default_value( 10 ), "The number of trials, of which the fastest counts." )
+        ;
+
+    po::variables_map vm {};
+
+    try {
+        po::store( po::parse_command_line( argc, argv, desc ), vm );
+        po::notify( vm );
+    } catch ( po::error& err ) {
+        std::cerr << "nebula-benchmark: " << err.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if ( vm.count( "help" ) ) {
+        std::cout << "Measures how quickly the interpreter executes small loops, with and without fusion." << std::endl;
+        std::cout << std::endl;
+        std::cout << "Usage: nebula-benchmark [OPTIONS]" << std::endl;
+        std::cout << std::endl;
+        std::cout << desc << std::endl;
+        return EXIT_SUCCESS;
+    }
+
+    auto numCycles = vm["cycles"].as<int>();
+    auto numTrials = vm["trials"].as<int>();
+
+    std::cout << std::left << std::setw( 20 ) << "Program"
+              << std::right << std::setw( 10 ) << "Unfused"
+              << std::setw( 10 ) << "Fused"
+              << std::setw( 10 ) << "Ratio" << std::endl;
+
+    for ( const auto& program : PROGRAMS ) {
+        // Alternating trials are fairer to both when the host is busy.
+        double unfused = 0.0;
+        double fused = 0.0;
+
+        for ( int trial = 0; trial < numTrials; ++trial ) {
+            unfused = std::max( unfused, measure( program, false, numCycles ) );
+            fused = std::max( fused, measure( program, true, numCycles ) );
+        }
+
+        std::cout << std::left << std::setw( 20 ) << program.name
+                  << std::right << std::fixed << std::setprecision( 0 )
+                  << std::setw( 10 ) << unfused
+                  << std::setw( 10 ) << fused
+                  << std::setprecision( 2 ) << std::setw( 10 ) << fused / unfused << std::endl;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,115 @@
+// Tools/Translate.cpp
+//
+// Copyright 2013 Jesse Haber-Kucharsky
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "../Memory.hpp"
+#include "../Translator.hpp"
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+
+#include <boost/program_options.hpp>
+
+using namespace nebula;
+
+namespace {
+
+bool endsWith( const std::string& s, const std::string& suffix ) {
+    return s.size() >= suffix.size() && s.compare( s.size() - suffix.size(), suffix.size(), suffix ) == 0;
+}
+
+}
+
+int main( int argc, char* argv[] ) {
+    namespace po = boost::program_options;
+
+    po::options_description visible;
+    visible.add_options()
+        ( "help,h", "Produce this message." )
+        ( "little-endian,e", "Assume little endian memory encoding." )
+        ( "output,o", po::value<std::string>()->default_value( "image.so" ),
+          "The file to write. Names ending in \".so\" are built into a shared object for nebula's "
+          "--native-image option (leaving the C++ source alongside); anything else receives the C++ source." )
+        ( "compiler,c", po::value<std::string>()->default_value( "c++" ),
+          "The C++ compiler used to build shared objects." )
+        ;
+
+    po::options_description hidden;
+    hidden.add_options()
+        ( "memory-file", po::value<std::string>(), "The memory file to translate." )
+        ;
+
+    po::options_description desc;
+    desc.add( visible ).add( hidden );
+
+    po::positional_options_description pos;
+    pos.add( "memory-file", 1 );
+
+    po::variables_map vm {};
+
+    try {
+        po::store( po::command_line_parser( argc, argv ).
+                   options( desc ).positional( pos ).run(),
+                   vm );
+        po::notify( vm );
+    } catch ( po::error& err ) {
+        std::cerr << "nebula-translate: " << err.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if ( vm.count( "help" ) || ! vm.count( "memory-file" ) ) {
+        std::cout << "Translates the code reachable in a DCPU-16 memory image to native code." << std::endl;
+        std::cout << std::endl;
+        std::cout << "Usage: nebula-translate [OPTIONS] memory-file" << std::endl;
+        std::cout << std::endl;
+        std::cout << visible << std::endl;
+        return EXIT_SUCCESS;
+    }
+
+    auto byteOrder = vm.count( "little-endian" ) ? ByteOrder::LittleEndian : ByteOrder::BigEndian;
+    auto memory = Memory::fromFile( vm["memory-file"].as<std::string>(), byteOrder );
+
+    auto blocks = translation::recover( *memory );
+    std::cout << "Translating " << blocks.size() << " blocks." << std::endl;
+
+    auto output = vm["output"].as<std::string>();
+    bool isShared = endsWith( output, ".so" );
+    auto sourcePath = isShared ? output.substr( 0, output.size() - 3 ) + ".cpp" : output;
+
+    std::ofstream source { sourcePath };
+
+    if ( ! source ) {
+        std::cerr << "nebula-translate: Unable to write to '" << sourcePath << "'" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    translation::emit( source, blocks );
+    source.close();
+
+    if ( ! isShared ) {
+        return EXIT_SUCCESS;
+    }
+
+    auto command = vm["compiler"].as<std::string>() +
+        " -O2 -shared -fPIC -o '" + output + "' '" + sourcePath + "'";
+
+    if ( std::system( command.c_str() ) != 0 ) {
+        std::cerr << "nebula-translate: Failed to build '" << output << "'" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
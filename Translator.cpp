@@ -0,0 +1,644 @@
+// Translator.cpp
+//
+// Copyright 2013 Jesse Haber-Kucharsky
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "Translator.hpp"
+
+#include <algorithm>
+#include <deque>
+#include <set>
+#include <string>
+
+namespace nebula {
+
+namespace translation {
+
+namespace {
+
+using isa::OperandClass;
+
+inline OperandClass classA( const Step& step ) { return isa::OPERANDS[step.ins->a].operandClass; }
+inline OperandClass classB( const Step& step ) { return isa::OPERANDS[step.ins->b].operandClass; }
+
+// The value of PC observed by each operand.
+inline Word pcA( const Step& step ) { return step.address + 1 + isa::OPERANDS[step.ins->a].size; }
+inline Word pcB( const Step& step ) { return step.following; }
+
+// The value of operand a, if it's the same every time.
+optional<Word> constantA( const Step& step ) {
+    switch ( classA( step ) ) {
+    case OperandClass::Direct: return step.nextA;
+    case OperandClass::Pc: return pcA( step );
+    case OperandClass::Literal: return isa::OPERANDS[step.ins->a].value;
+    default: return {};
+    }
+}
+
+// Where control goes after `step`, when it's known.
+optional<Word> jumpTarget( const Step& step ) {
+    auto a = constantA( step );
+
+    if ( ! a ) {
+        return {};
+    }
+
+    if ( step.ins->kind == InstructionKind::Unary ) {
+        return *a;
+    }
+
+    switch ( step.ins->binaryOpcode() ) {
+    case Opcode::Set: return *a;
+    case Opcode::Add: return static_cast<Word>( pcB( step ) + *a );
+    case Opcode::Sub: return static_cast<Word>( pcB( step ) - *a );
+    default: return {};
+    }
+}
+
+class BlockReader final {
+    Memory& _memory;
+    Block& _block;
+public:
+    explicit BlockReader( Memory& memory, Block& block ) :
+        _memory( memory ),
+        _block( block ) {}
+
+    Word read( Word address ) {
+        auto value = _memory.read( address );
+        _block.words.emplace_back( address, value );
+        return value;
+    }
+};
+
+// Returns `false` if the instruction at `address` can't be translated.
+bool readStep( BlockReader& reader, Word address, Step& step ) {
+    const auto& ins = decodeCached( reader.read( address ) );
+
+    if ( ins.kind == InstructionKind::Malformed ||
+         (ins.kind == InstructionKind::Unary && ins.specialOpcode() != SpecialOpcode::Jsr) ) {
+        return false;
+    }
+
+    step = Step { address, &ins, 0, 0, 0, 0, 0, false };
+    Word cursor = address + 1;
+
+    if ( isa::OPERANDS[ins.a].size != 0 ) {
+        step.nextA = reader.read( cursor++ );
+    }
+
+    if ( ins.kind == InstructionKind::Binary && isa::OPERANDS[ins.b].size != 0 ) {
+        step.nextB = reader.read( cursor++ );
+    }
+
+    step.following = cursor;
+
+    if ( ! ins.isConditional ) {
+        return true;
+    }
+
+    // Work out where skipping stops. Only the instruction words of the skipped
+    // instructions matter.
+    Word target = step.following;
+    int cycles = 1;
+
+    for ( int i = 0; i < MAX_SKIP_CHAIN; ++i ) {
+        const auto& skipped = decodeCached( reader.read( target ) );
+
+        if ( skipped.kind == InstructionKind::Malformed ) {
+            step.isSkipInterrupted = true;
+            break;
+        }
+
+        cycles += skipped.isConditional ? 2 : 1;
+        target += 1 + skipped.size;
+
+        if ( ! skipped.isConditional ) {
+            break;
+        }
+
+        if ( i == MAX_SKIP_CHAIN - 1 ) {
+            return false;
+        }
+    }
+
+    step.skipTarget = target;
+    step.skipCycles = cycles;
+    return true;
+}
+
+//
+// Emitting C++.
+//
+
+const char* PRELUDE = R"(// Translated by nebula-translate. Do not edit.
+
+#include <stdint.h>
+
+extern "C" {
+
+struct nebula_context {
+    uint16_t registers[8];
+    uint16_t pc;
+    uint16_t sp;
+    uint16_t ex;
+    uint8_t do_skip;
+    int64_t cycles;
+    void* host;
+    uint16_t (*read)(void* host, uint16_t address);
+    int (*write)(void* host, uint16_t address, uint16_t value);
+};
+
+typedef void (*nebula_block_function)(nebula_context* c);
+
+struct nebula_block {
+    uint16_t address;
+    nebula_block_function function;
+    uint32_t first_word;
+    uint32_t num_words;
+};
+
+}
+
+static inline uint16_t rd(nebula_context* c, uint16_t address) { return c->read(c->host, address); }
+static inline int wr(nebula_context* c, uint16_t address, uint16_t value) { return c->write(c->host, address, value); }
+
+)";
+
+std::string hex( Word value ) {
+    return (format( "0x%04x" ) % value).str();
+}
+
+const char* mnemonic( const Step& step ) {
+    return step.ins->kind == InstructionKind::Binary ?
+        isa::OPCODES[step.ins->opcode].mnemonic :
+        isa::SPECIAL_OPCODES[step.ins->opcode].mnemonic;
+}
+
+std::string registerAt( Word code ) {
+    return (format( "c->registers[%d]" ) % (code & 0x7)).str();
+}
+
+class StepEmitter final {
+    std::ostream& _out;
+    const Block& _block;
+    const Step& _step;
+
+
+    OperandClass classA() const { return translation::classA( _step ); }
+    OperandClass classB() const { return translation::classB( _step ); }
+
+    void line( const std::string& text ) { _out << "        " << text << "\n"; }
+
+    // Whether the instruction writes memory, and so may modify translated
+    // code.
+    bool isWriting() const;
+
+    std::string valueA();
+    void resolveB();
+    std::string loadB();
+    void storeB( const std::string& value );
+
+    void emitBinary();
+    void emitConditional( const std::string& condition );
+    void emitJsr();
+
+    std::string continueAt( Word address ) const;
+public:
+    explicit StepEmitter( std::ostream& out, const Block& block, const Step& step ) :
+        _out( out ),
+        _block( block ),
+        _step( step ) {}
+
+    void emit();
+};
+
+bool StepEmitter::isWriting() const {
+    if ( _step.ins->isConditional ) {
+        return false;
+    }
+
+    switch ( classB() ) {
+    case OperandClass::RegisterIndirect:
+    case OperandClass::RegisterIndirectOffset:
+    case OperandClass::Stack:
+    case OperandClass::Peek:
+    case OperandClass::Pick:
+    case OperandClass::Indirect:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Operand a is always loaded before operand b is resolved, so its value is
+// captured first.
+std::string StepEmitter::valueA() {
+    auto code = _step.ins->a;
+
+    switch ( classA() ) {
+    case OperandClass::Register: return registerAt( code );
+    case OperandClass::RegisterIndirect: return "rd(c, " + registerAt( code ) + ")";
+    case OperandClass::RegisterIndirectOffset:
+        return "rd(c, (uint16_t)(" + registerAt( code ) + " + " + hex( _step.nextA ) + "))";
+    case OperandClass::Stack: return "rd(c, c->sp++)";
+    case OperandClass::Peek: return "rd(c, c->sp)";
+    case OperandClass::Pick: return "rd(c, (uint16_t)(c->sp + " + hex( _step.nextA ) + "))";
+    case OperandClass::Sp: return "c->sp";
+    case OperandClass::Pc: return hex( pcA( _step ) );
+    case OperandClass::Ex: return "c->ex";
+    case OperandClass::Indirect: return "rd(c, " + hex( _step.nextA ) + ")";
+    case OperandClass::Direct: return hex( _step.nextA );
+    case OperandClass::Literal: return hex( isa::OPERANDS[code].value );
+    }
+
+    return "0";
+}
+
+// Memory operands leave their address in `b`.
+void StepEmitter::resolveB() {
+    auto code = _step.ins->b;
+
+    switch ( classB() ) {
+    case OperandClass::RegisterIndirect:
+        line( "uint16_t b = " + registerAt( code ) + ";" );
+        break;
+    case OperandClass::RegisterIndirectOffset:
+        line( "uint16_t b = " + registerAt( code ) + " + " + hex( _step.nextB ) + ";" );
+        break;
+    case OperandClass::Peek:
+        line( "uint16_t b = c->sp;" );
+        break;
+    case OperandClass::Pick:
+        line( "uint16_t b = c->sp + " + hex( _step.nextB ) + ";" );
+        break;
+    case OperandClass::Indirect:
+        line( "uint16_t b = " + hex( _step.nextB ) + ";" );
+        break;
+    default:
+        break;
+    }
+}
+
+std::string StepEmitter::loadB() {
+    switch ( classB() ) {
+    case OperandClass::Register: return registerAt( _step.ins->b );
+    case OperandClass::RegisterIndirect:
+    case OperandClass::RegisterIndirectOffset:
+    case OperandClass::Peek:
+    case OperandClass::Pick:
+    case OperandClass::Indirect:
+        return "rd(c, b)";
+    // Loading `PUSH` is meaningless.
+    case OperandClass::Stack: return "0";
+    case OperandClass::Sp: return "c->sp";
+    case OperandClass::Pc: return hex( pcB( _step ) );
+    case OperandClass::Ex: return "c->ex";
+    case OperandClass::Direct: return hex( _step.nextB );
+    case OperandClass::Literal: return hex( isa::OPERANDS[_step.ins->b].value );
+    }
+
+    return "0";
+}
+
+void StepEmitter::storeB( const std::string& value ) {
+    switch ( classB() ) {
+    case OperandClass::Register:
+        line( registerAt( _step.ins->b ) + " = " + value + ";" );
+        break;
+    case OperandClass::RegisterIndirect:
+    case OperandClass::RegisterIndirectOffset:
+    case OperandClass::Peek:
+    case OperandClass::Pick:
+    case OperandClass::Indirect:
+        line( "s |= wr(c, b, " + value + ");" );
+        break;
+    case OperandClass::Stack:
+        line( "s |= wr(c, c->sp - 1, " + value + ");" );
+        line( "--c->sp;" );
+        break;
+    case OperandClass::Sp:
+        line( "c->sp = " + value + ";" );
+        break;
+    case OperandClass::Pc:
+        line( "c->pc = " + value + ";" );
+        break;
+    case OperandClass::Ex:
+        line( "c->ex = " + value + ";" );
+        break;
+    // Storing to a literal has no effect.
+    case OperandClass::Direct:
+    case OperandClass::Literal:
+        break;
+    }
+}
+
+void StepEmitter::emitBinary() {
+    auto opcode = _step.ins->binaryOpcode();
+
+    line( "uint32_t y = " + valueA() + ";" );
+    resolveB();
+
+    if ( opcode != Opcode::Set && opcode != Opcode::Sti && opcode != Opcode::Std ) {
+        line( "uint32_t x = " + loadB() + ";" );
+    }
+
+    switch ( opcode ) {
+    case Opcode::Set:
+        storeB( "y" );
+        break;
+    case Opcode::Add:
+    case Opcode::Sub:
+    case Opcode::Mul:
+    case Opcode::Adx:
+    case Opcode::Sbx: {
+        static const char* RESULTS[] = { "x + y", "x - y", "x * y", "x + y + c->ex", "x - y + c->ex" };
+        static const char* EXCESSES[] = { "z > 0xffff ? 1 : 0", "z > 0xffff ? 0xffff : 0", "z >> 16",
+                                          "z > 0xffff ? 1 : 0", "z > 0xffff ? 1 : 0" };
+
+        int i = opcode == Opcode::Add ? 0
+              : opcode == Opcode::Sub ? 1
+              : opcode == Opcode::Mul ? 2
+              : opcode == Opcode::Adx ? 3
+              : 4;
+
+        line( std::string { "uint32_t z = " } + RESULTS[i] + ";" );
+        storeB( "(uint16_t)z" );
+        line( std::string { "c->ex = (uint16_t)(" } + EXCESSES[i] + ");" );
+        break;
+    }
+    case Opcode::Mli:
+        storeB( "(uint16_t)((int16_t)x * (int16_t)y)" );
+        break;
+    case Opcode::Div:
+        line( "c->ex = y != 0 ? (uint16_t)((x << 16) / y) : 0;" );
+        storeB( "y != 0 ? (uint16_t)(x / y) : 0" );
+        break;
+    case Opcode::Dvi:
+        storeB( "y != 0 ? (uint16_t)((int16_t)x / (int16_t)y) : 0" );
+        break;
+    case Opcode::Mod:
+        storeB( "y != 0 ? (uint16_t)(x % y) : 0" );
+        break;
+    case Opcode::Mdi:
+        storeB( "y != 0 ? (uint16_t)((int16_t)x % (int16_t)y) : 0" );
+        break;
+    case Opcode::And:
+        storeB( "(uint16_t)(x & y)" );
+        break;
+    case Opcode::Bor:
+        storeB( "(uint16_t)(x | y)" );
+        break;
+    case Opcode::Xor:
+        storeB( "(uint16_t)(x ^ y)" );
+        break;
+    // Shifting by the width of the operand or more clears it.
+    case Opcode::Shr:
+        line( "c->ex = y < 32 ? (uint16_t)((x << 16) >> y) : 0;" );
+        storeB( "y < 32 ? (uint16_t)(x >> y) : 0" );
+        break;
+    case Opcode::Asr:
+        line( "uint32_t m = y < 31 ? y : 31;" );
+        line( "c->ex = (uint16_t)((int32_t)(x << 16) >> m);" );
+        storeB( "(uint16_t)((int32_t)x >> m)" );
+        break;
+    case Opcode::Shl:
+        line( "c->ex = y < 32 ? (uint16_t)((x << y) >> 16) : 0;" );
+        storeB( "y < 32 ? (uint16_t)(x << y) : 0" );
+        break;
+    case Opcode::Ifb: emitConditional( "(x & y) != 0" ); break;
+    case Opcode::Ifc: emitConditional( "(x & y) == 0" ); break;
+    case Opcode::Ife: emitConditional( "x == y" ); break;
+    case Opcode::Ifn: emitConditional( "x != y" ); break;
+    case Opcode::Ifg: emitConditional( "x > y" ); break;
+    case Opcode::Ifa: emitConditional( "(int16_t)x > (int16_t)y" ); break;
+    case Opcode::Ifl: emitConditional( "x < y" ); break;
+    case Opcode::Ifu: emitConditional( "(int16_t)x < (int16_t)y" ); break;
+    case Opcode::Sti:
+    case Opcode::Std:
+        storeB( "(uint16_t)y" );
+        line( opcode == Opcode::Sti ? "++c->registers[6];" : "--c->registers[6];" );
+        line( opcode == Opcode::Sti ? "++c->registers[7];" : "--c->registers[7];" );
+        break;
+    }
+}
+
+void StepEmitter::emitConditional( const std::string& condition ) {
+    line( "if (!(" + condition + ")) {" );
+    line( (format( "    c->cycles += %d;" ) % _step.skipCycles).str() );
+
+    if ( _step.isSkipInterrupted ) {
+        line( "    c->pc = " + hex( _step.skipTarget ) + ";" );
+        line( "    c->do_skip = 1;" );
+        line( "    return;" );
+    } else {
+        line( "    " + continueAt( _step.skipTarget ) );
+    }
+
+    line( "}" );
+}
+
+void StepEmitter::emitJsr() {
+    line( "uint16_t y = " + valueA() + ";" );
+    line( "wr(c, c->sp - 1, " + hex( _step.following ) + ");" );
+    line( "--c->sp;" );
+    line( "c->pc = y;" );
+    line( "return;" );
+}
+
+// Continue at `address`, either further on in the block or by leaving it.
+std::string StepEmitter::continueAt( Word address ) const {
+    for ( const auto& step : _block.steps ) {
+        if ( step.address == address && &step > &_step ) {
+            return (format( "goto at_%04x;" ) % address).str();
+        }
+    }
+
+    return "c->pc = " + hex( address ) + "; return;";
+}
+
+void StepEmitter::emit() {
+    _out << (format( "    at_%04x: {\n" ) % _step.address);
+    line( (format( "c->cycles += %d;" ) % static_cast<int>( _step.ins->cycles )).str() );
+
+    if ( _step.ins->kind == InstructionKind::Unary ) {
+        emitJsr();
+        _out << "    }\n";
+        return;
+    }
+
+    if ( isWriting() ) {
+        line( "int s = 0;" );
+    }
+
+    emitBinary();
+
+    if ( _step.writesPc() ) {
+        line( "return;" );
+    } else if ( isWriting() ) {
+        // Stop if translated code (possibly this block) was modified.
+        line( "if (s) {" );
+        line( "    c->pc = " + hex( _step.following ) + ";" );
+        line( "    return;" );
+        line( "}" );
+    }
+
+    _out << "    }\n";
+}
+
+std::string functionName( const Block& block ) {
+    return (format( "block_%04x" ) % block.address).str();
+}
+
+}
+
+bool Step::writesPc() const {
+    return ins->kind == InstructionKind::Unary ||
+        (! ins->isConditional && classB( *this ) == OperandClass::Pc);
+}
+
+std::vector<Block> recover( Memory& memory, Word entry ) {
+    std::set<Word> visited {};
+    std::deque<Word> pending { entry };
+    std::vector<Block> blocks {};
+
+    auto follow = [&visited, &pending] ( Word address ) {
+        if ( visited.count( address ) == 0 ) {
+            pending.push_back( address );
+        }
+    };
+
+    while ( ! pending.empty() ) {
+        auto address = pending.front();
+        pending.pop_front();
+
+        if ( ! visited.insert( address ).second ) {
+            continue;
+        }
+
+        Block block { address, {}, {} };
+        BlockReader reader { memory, block };
+        Word pc = address;
+        bool isFallingThrough = true;
+
+        for ( int n = 0; n < MAX_BLOCK_INSTRUCTIONS; ++n ) {
+            Step step {};
+
+            if ( ! readStep( reader, pc, step ) ) {
+                // Execution continues after special instructions, which the
+                // processor executes itself.
+                const auto& ins = decodeCached( memory.read( pc ) );
+
+                if ( ins.kind == InstructionKind::Unary ) {
+                    follow( pc + 1 + ins.size );
+                }
+
+                isFallingThrough = false;
+                break;
+            }
+
+            block.steps.push_back( step );
+
+            if ( step.ins->isConditional && ! step.isSkipInterrupted ) {
+                follow( step.skipTarget );
+            }
+
+            if ( step.writesPc() ) {
+                auto target = jumpTarget( step );
+
+                if ( target ) {
+                    follow( *target );
+                }
+
+                if ( step.ins->kind == InstructionKind::Unary ) {
+                    follow( step.following );
+                }
+
+                isFallingThrough = false;
+                break;
+            }
+
+            pc = step.following;
+        }
+
+        if ( isFallingThrough ) {
+            follow( pc );
+        }
+
+        if ( ! block.steps.empty() ) {
+            blocks.push_back( std::move( block ) );
+        }
+    }
+
+    std::sort( blocks.begin(), blocks.end(), [] ( const Block& x, const Block& y ) {
+        return x.address < y.address;
+    } );
+
+    return blocks;
+}
+
+void emit( std::ostream& out, const std::vector<Block>& blocks ) {
+    out << PRELUDE;
+
+    for ( const auto& block : blocks ) {
+        out << "static void " << functionName( block ) << "(nebula_context* c) {\n";
+
+        for ( const auto& step : block.steps ) {
+            out << "    // " << hex( step.address ) << ": " << mnemonic( step ) << "\n";
+            StepEmitter { out, block, step }.emit();
+        }
+
+        const auto& last = block.steps.back();
+
+        if ( ! last.writesPc() ) {
+            out << "    c->pc = " << hex( last.following ) << ";\n";
+        }
+
+        out << "}\n\n";
+    }
+
+    out << "extern \"C\" {\n\n";
+    out << "extern const uint32_t nebula_abi_version = " << ABI_VERSION << ";\n";
+    out << "extern const uint32_t nebula_num_blocks = " << blocks.size() << ";\n\n";
+
+    out << "extern const nebula_block nebula_blocks[] = {\n";
+
+    std::size_t firstWord = 0;
+
+    for ( const auto& block : blocks ) {
+        out << "    { " << hex( block.address ) << ", " << functionName( block ) << ", "
+            << firstWord << ", " << block.words.size() << " },\n";
+
+        firstWord += block.words.size();
+    }
+
+    out << "    { 0, 0, 0, 0 }\n";
+    out << "};\n\n";
+
+    // Pairs of addresses and values.
+    out << "extern const uint16_t nebula_words[] = {\n";
+
+    for ( const auto& block : blocks ) {
+        for ( const auto& word : block.words ) {
+            out << "    " << hex( word.first ) << ", " << hex( word.second ) << ",\n";
+        }
+    }
+
+    out << "    0, 0\n";
+    out << "};\n\n";
+    out << "}\n";
+}
+
+}
+
+}
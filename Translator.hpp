@@ -0,0 +1,90 @@
+// Translator.hpp
+//
+// Copyright 2013 Jesse Haber-Kucharsky
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "InstructionCache.hpp"
+#include "Memory.hpp"
+
+#include <ostream>
+#include <utility>
+#include <vector>
+
+namespace nebula {
+
+// Ahead-of-time translation of a memory image to C++.
+//
+// The code reachable from the entry point is recovered statically and each
+// basic block becomes a function. Built as a shared object, the output is
+// loaded by `NativeImage`, which falls back to the processor for everything
+// that wasn't translated.
+namespace translation {
+
+// Blocks end after this many instructions, even if control would continue
+// to flow straight through.
+const int MAX_BLOCK_INSTRUCTIONS = 64;
+
+// Skip chains longer than this are left to the processor.
+const int MAX_SKIP_CHAIN = 32;
+
+// Must match the `nebula_abi_version` of translated code that `NativeImage`
+// will load. Increment it whenever the emitted interface changes.
+const int ABI_VERSION = 1;
+
+// An instruction in a block, with the values of its next words.
+struct Step {
+    Word address;
+    const DecodedInstruction* ins;
+    Word nextA;
+    Word nextB;
+
+    // The address of the instruction that follows.
+    Word following;
+
+    // Where execution continues when a conditional instruction fails, and the
+    // cycles that skipping takes (including the cost of failing). If skipping
+    // stops at a malformed instruction, then the processor must raise the
+    // error itself.
+    Word skipTarget;
+    int skipCycles;
+    bool isSkipInterrupted;
+
+    bool writesPc() const;
+};
+
+struct Block {
+    Word address;
+    std::vector<Step> steps;
+
+    // Every memory location that was read to translate the block, and its
+    // value. Translated code is only valid while these are unchanged.
+    std::vector<std::pair<Word, Word>> words;
+};
+
+// Recover the blocks reachable from `entry` by following fall-through,
+// skips, and jumps and subroutine calls to constant addresses. Code only
+// reachable through computed jumps isn't found, except for the return
+// addresses of subroutine calls.
+//
+// Blocks are ordered by address.
+std::vector<Block> recover( Memory& memory, Word entry = 0 );
+
+// Write a self-contained C++ translation unit defining the blocks.
+void emit( std::ostream& out, const std::vector<Block>& blocks );
+
+}
+
+}
@@ -0,0 +1,367 @@
+// X86Assembler.cpp
+//
+// Copyright 2013 Jesse Haber-Kucharsky
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "X86Assembler.hpp"
+
+#include <cassert>
+#include <cstring>
+
+namespace nebula {
+
+namespace x86 {
+
+static inline std::uint8_t low( Reg reg ) { return static_cast<std::uint8_t>( reg ) & 0x7; }
+static inline bool isExtended( Reg reg ) { return static_cast<std::uint8_t>( reg ) >= 8; }
+
+// Instruction extensions, encoded in the reg field of ModRM.
+static inline Reg extension( std::uint8_t ext ) { return static_cast<Reg>( ext ); }
+
+const std::size_t Assembler::UNBOUND;
+
+void Assembler::word( std::uint16_t w ) {
+    byte( w & 0xff );
+    byte( w >> 8 );
+}
+
+void Assembler::dword( std::uint32_t d ) {
+    word( d & 0xffff );
+    word( d >> 16 );
+}
+
+void Assembler::qword( std::uint64_t q ) {
+    dword( q & 0xffffffff );
+    dword( q >> 32 );
+}
+
+void Assembler::rex( bool w, Reg reg, Reg base, bool force ) {
+    std::uint8_t prefix = 0x40 |
+        (w ? 0x8 : 0) |
+        (isExtended( reg ) ? 0x4 : 0) |
+        (isExtended( base ) ? 0x1 : 0);
+
+    if ( prefix != 0x40 || force ) {
+        byte( prefix );
+    }
+}
+
+void Assembler::modrm( Reg reg, Mem m ) {
+    // These bases require a SIB byte.
+    assert( low( m.base ) != low( Reg::Rsp ) );
+
+    byte( 0x40 | (low( reg ) << 3) | low( m.base ) );
+    byte( static_cast<std::uint8_t>( m.disp ) );
+}
+
+void Assembler::modrm( Reg reg, Reg rm ) {
+    byte( 0xc0 | (low( reg ) << 3) | low( rm ) );
+}
+
+void Assembler::rel32( const void* target ) {
+    auto offset = static_cast<const std::uint8_t*>( target ) - (here() + 4);
+    assert( offset >= INT32_MIN && offset <= INT32_MAX );
+
+    dword( static_cast<std::uint32_t>( offset ) );
+}
+
+void Assembler::rel32( Label target ) {
+    _fixups.emplace_back( target.id, _code.size() );
+    dword( 0 );
+}
+
+Label Assembler::newLabel() {
+    _labels.push_back( UNBOUND );
+    return Label { _labels.size() - 1 };
+}
+
+void Assembler::bind( Label label ) {
+    _labels[label.id] = _code.size();
+}
+
+void Assembler::copyTo( std::uint8_t* destination ) const {
+    std::memcpy( destination, _code.data(), _code.size() );
+
+    for ( const auto& fixup : _fixups ) {
+        auto target = _labels[fixup.first];
+        assert( target != UNBOUND );
+
+        auto offset = static_cast<std::int32_t>( target - (fixup.second + 4) );
+        std::memcpy( destination + fixup.second, &offset, sizeof( offset ) );
+    }
+}
+
+void Assembler::mov( Reg dst, Reg src ) {
+    rex( false, src, dst );
+    byte( 0x89 );
+    modrm( src, dst );
+}
+
+void Assembler::mov( Reg dst, std::uint32_t imm ) {
+    rex( false, Reg::Rax, dst );
+    byte( 0xb8 + low( dst ) );
+    dword( imm );
+}
+
+void Assembler::mov64( Reg dst, Reg src ) {
+    rex( true, src, dst );
+    byte( 0x89 );
+    modrm( src, dst );
+}
+
+void Assembler::mov64( Reg dst, std::uint64_t imm ) {
+    rex( true, Reg::Rax, dst );
+    byte( 0xb8 + low( dst ) );
+    qword( imm );
+}
+
+void Assembler::load64( Reg dst, Mem src ) {
+    rex( true, dst, src.base );
+    byte( 0x8b );
+    modrm( dst, src );
+}
+
+void Assembler::load64( Reg dst, Reg base, Reg index ) {
+    // These would require a displacement, or can't be used as an index.
+    assert( low( base ) != low( Reg::Rbp ) );
+    assert( index != Reg::Rsp );
+
+    byte( 0x48 |
+          (isExtended( dst ) ? 0x4 : 0) |
+          (isExtended( index ) ? 0x2 : 0) |
+          (isExtended( base ) ? 0x1 : 0) );
+    byte( 0x8b );
+    byte( (low( dst ) << 3) | 0x4 );
+    byte( 0xc0 | (low( index ) << 3) | low( base ) );
+}
+
+void Assembler::store64( Mem dst, Reg src ) {
+    rex( true, src, dst.base );
+    byte( 0x89 );
+    modrm( src, dst );
+}
+
+void Assembler::movzx16( Reg dst, Mem src ) {
+    rex( false, dst, src.base );
+    byte( 0x0f );
+    byte( 0xb7 );
+    modrm( dst, src );
+}
+
+void Assembler::movzx16( Reg dst, Reg src ) {
+    rex( false, dst, src );
+    byte( 0x0f );
+    byte( 0xb7 );
+    modrm( dst, src );
+}
+
+void Assembler::movsx16( Reg dst, Reg src ) {
+    rex( false, dst, src );
+    byte( 0x0f );
+    byte( 0xbf );
+    modrm( dst, src );
+}
+
+void Assembler::store16( Mem dst, Reg src ) {
+    byte( 0x66 );
+    rex( false, src, dst.base );
+    byte( 0x89 );
+    modrm( src, dst );
+}
+
+void Assembler::store16( Mem dst, std::uint16_t imm ) {
+    byte( 0x66 );
+    rex( false, Reg::Rax, dst.base );
+    byte( 0xc7 );
+    modrm( extension( 0 ), dst );
+    word( imm );
+}
+
+void Assembler::store8( Mem dst, std::uint8_t imm ) {
+    rex( false, Reg::Rax, dst.base );
+    byte( 0xc6 );
+    modrm( extension( 0 ), dst );
+    byte( imm );
+}
+
+void Assembler::alu( AluOp op, Reg dst, Reg src ) {
+    rex( false, src, dst );
+    byte( (static_cast<std::uint8_t>( op ) << 3) | 0x1 );
+    modrm( src, dst );
+}
+
+void Assembler::alu( AluOp op, Reg dst, std::int32_t imm ) {
+    rex( false, Reg::Rax, dst );
+    byte( 0x81 );
+    modrm( extension( static_cast<std::uint8_t>( op ) ), dst );
+    dword( static_cast<std::uint32_t>( imm ) );
+}
+
+void Assembler::add16( Mem dst, std::int8_t imm ) {
+    byte( 0x66 );
+    rex( false, Reg::Rax, dst.base );
+    byte( 0x83 );
+    modrm( extension( 0 ), dst );
+    byte( static_cast<std::uint8_t>( imm ) );
+}
+
+void Assembler::add64( Mem dst, std::int32_t imm ) {
+    rex( true, Reg::Rax, dst.base );
+    byte( 0x81 );
+    modrm( extension( 0 ), dst );
+    dword( static_cast<std::uint32_t>( imm ) );
+}
+
+void Assembler::cmp8( Mem dst, std::uint8_t imm ) {
+    rex( false, Reg::Rax, dst.base );
+    byte( 0x80 );
+    modrm( extension( 7 ), dst );
+    byte( imm );
+}
+
+void Assembler::cmp64( Reg dst, Mem src ) {
+    rex( true, dst, src.base );
+    byte( 0x3b );
+    modrm( dst, src );
+}
+
+void Assembler::test( Reg dst, Reg src ) {
+    rex( false, src, dst );
+    byte( 0x85 );
+    modrm( src, dst );
+}
+
+void Assembler::test64( Reg dst, Reg src ) {
+    rex( true, src, dst );
+    byte( 0x85 );
+    modrm( src, dst );
+}
+
+void Assembler::imul( Reg dst, Reg src ) {
+    rex( false, dst, src );
+    byte( 0x0f );
+    byte( 0xaf );
+    modrm( dst, src );
+}
+
+void Assembler::div( Reg src ) {
+    rex( false, Reg::Rax, src );
+    byte( 0xf7 );
+    modrm( extension( 6 ), src );
+}
+
+void Assembler::idiv( Reg src ) {
+    rex( false, Reg::Rax, src );
+    byte( 0xf7 );
+    modrm( extension( 7 ), src );
+}
+
+void Assembler::cdq() {
+    byte( 0x99 );
+}
+
+void Assembler::shiftCl( ShiftOp op, Reg dst ) {
+    rex( false, Reg::Rax, dst );
+    byte( 0xd3 );
+    modrm( extension( static_cast<std::uint8_t>( op ) ), dst );
+}
+
+void Assembler::shift( ShiftOp op, Reg dst, std::uint8_t imm ) {
+    rex( false, Reg::Rax, dst );
+    byte( 0xc1 );
+    modrm( extension( static_cast<std::uint8_t>( op ) ), dst );
+    byte( imm );
+}
+
+void Assembler::setcc( Condition cond, Reg dst ) {
+    // Without a REX prefix, these would refer to AH, CH, DH and BH.
+    bool force = low( dst ) >= 4 && ! isExtended( dst );
+
+    rex( false, Reg::Rax, dst, force );
+    byte( 0x0f );
+    byte( 0x90 + static_cast<std::uint8_t>( cond ) );
+    modrm( extension( 0 ), dst );
+}
+
+void Assembler::cmovcc( Condition cond, Reg dst, Reg src ) {
+    rex( false, dst, src );
+    byte( 0x0f );
+    byte( 0x40 + static_cast<std::uint8_t>( cond ) );
+    modrm( dst, src );
+}
+
+void Assembler::jmp( Label target ) {
+    byte( 0xe9 );
+    rel32( target );
+}
+
+void Assembler::jmp( const void* target ) {
+    byte( 0xe9 );
+    rel32( target );
+}
+
+void Assembler::jmp( Reg target ) {
+    rex( false, Reg::Rax, target );
+    byte( 0xff );
+    modrm( extension( 4 ), target );
+}
+
+const std::uint8_t* Assembler::jmpPatchable( Label target ) {
+    byte( 0xe9 );
+    auto field = here();
+    rel32( target );
+
+    return field;
+}
+
+void Assembler::jcc( Condition cond, Label target ) {
+    byte( 0x0f );
+    byte( 0x80 + static_cast<std::uint8_t>( cond ) );
+    rel32( target );
+}
+
+void Assembler::jcc( Condition cond, const void* target ) {
+    byte( 0x0f );
+    byte( 0x80 + static_cast<std::uint8_t>( cond ) );
+    rel32( target );
+}
+
+void Assembler::call( Reg target ) {
+    rex( false, Reg::Rax, target );
+    byte( 0xff );
+    modrm( extension( 2 ), target );
+}
+
+void Assembler::push( Reg reg ) {
+    rex( false, Reg::Rax, reg );
+    byte( 0x50 + low( reg ) );
+}
+
+void Assembler::pop( Reg reg ) {
+    rex( false, Reg::Rax, reg );
+    byte( 0x58 + low( reg ) );
+}
+
+void Assembler::ret() {
+    byte( 0xc3 );
+}
+
+void patchJump( std::uint8_t* field, const void* target ) {
+    auto offset = static_cast<std::int32_t>( static_cast<const std::uint8_t*>( target ) - (field + 4) );
+    std::memcpy( field, &offset, sizeof( offset ) );
+}
+
+}
+
+}
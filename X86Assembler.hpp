@@ -0,0 +1,177 @@
+// X86Assembler.hpp
+//
+// Copyright 2013 Jesse Haber-Kucharsky
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace nebula {
+
+namespace x86 {
+
+// General-purpose registers, by their encoding. Instructions operate on the
+// 32-bit (or 64-bit, where noted) width of the register.
+enum class Reg : std::uint8_t {
+    Rax, Rcx, Rdx, Rbx, Rsp, Rbp, Rsi, Rdi,
+    R8, R9, R10, R11, R12, R13, R14, R15
+};
+
+// Condition codes, by their encoding.
+enum class Condition : std::uint8_t {
+    Below = 0x2,
+    AboveOrEqual = 0x3,
+    Equal = 0x4,
+    NotEqual = 0x5,
+    BelowOrEqual = 0x6,
+    Above = 0x7,
+    Less = 0xc,
+    GreaterOrEqual = 0xd,
+    LessOrEqual = 0xe,
+    Greater = 0xf
+};
+
+// A memory operand of the form [base + disp8].
+struct Mem {
+    Reg base;
+    std::int8_t disp;
+};
+
+enum class AluOp : std::uint8_t {
+    Add = 0, Or = 1, And = 4, Sub = 5, Xor = 6, Cmp = 7
+};
+
+enum class ShiftOp : std::uint8_t {
+    Shl = 4, Shr = 5, Sar = 7
+};
+
+// Identifies a position in the code, which may be referenced before it is
+// bound.
+struct Label {
+    std::size_t id;
+};
+
+// Assembles a small subset of x86-64 machine code.
+//
+// Code is assembled into an internal buffer on the understanding that it
+// will be copied to `base`, so that jumps and calls to absolute addresses
+// can be encoded relative to the final location of the code.
+class Assembler final {
+    const std::uint8_t* _base;
+    std::vector<std::uint8_t> _code {};
+
+    // The position of each label, or `UNBOUND`.
+    std::vector<std::size_t> _labels {};
+
+    // The labels referenced by rel32 fields, and the positions of those fields.
+    std::vector<std::pair<std::size_t, std::size_t>> _fixups {};
+
+    static const std::size_t UNBOUND = static_cast<std::size_t>( -1 );
+
+    void byte( std::uint8_t b ) { _code.push_back( b ); }
+    void word( std::uint16_t w );
+    void dword( std::uint32_t d );
+    void qword( std::uint64_t q );
+
+    void rex( bool w, Reg reg, Reg base, bool force = false );
+    void modrm( Reg reg, Mem m );
+    void modrm( Reg reg, Reg rm );
+
+    void rel32( const void* target );
+    void rel32( Label target );
+public:
+    explicit Assembler( const std::uint8_t* base ) :
+        _base { base } {}
+
+    inline std::size_t size() const noexcept { return _code.size(); }
+
+    // The final address of the code at the current position.
+    inline const std::uint8_t* here() const noexcept { return _base + _code.size(); }
+
+    Label newLabel();
+    void bind( Label label );
+
+    // Copy the code to its final location. All labels must be bound.
+    void copyTo( std::uint8_t* destination ) const;
+
+    // Data movement.
+
+    void mov( Reg dst, Reg src );
+    void mov( Reg dst, std::uint32_t imm );
+    void mov64( Reg dst, Reg src );
+    void mov64( Reg dst, std::uint64_t imm );
+    void mov64( Reg dst, const void* imm ) { mov64( dst, reinterpret_cast<std::uintptr_t>( imm ) ); }
+
+    void load64( Reg dst, Mem src );
+    void load64( Reg dst, Reg base, Reg index ); // dst <- [base + index * 8]
+    void store64( Mem dst, Reg src );
+
+    void movzx16( Reg dst, Mem src );
+    void movzx16( Reg dst, Reg src );
+    void movsx16( Reg dst, Reg src );
+
+    void store16( Mem dst, Reg src );
+    void store16( Mem dst, std::uint16_t imm );
+    void store8( Mem dst, std::uint8_t imm );
+
+    // Arithmetic.
+
+    void alu( AluOp op, Reg dst, Reg src );
+    void alu( AluOp op, Reg dst, std::int32_t imm );
+    void add16( Mem dst, std::int8_t imm );
+    void add64( Mem dst, std::int32_t imm );
+    void cmp8( Mem dst, std::uint8_t imm );
+    void cmp64( Reg dst, Mem src );
+    void test( Reg dst, Reg src );
+    void test64( Reg dst, Reg src );
+    void imul( Reg dst, Reg src );
+    void div( Reg src );
+    void idiv( Reg src );
+    void cdq();
+    void shiftCl( ShiftOp op, Reg dst );
+    void shift( ShiftOp op, Reg dst, std::uint8_t imm );
+    void setcc( Condition cond, Reg dst );
+    void cmovcc( Condition cond, Reg dst, Reg src );
+
+    // Control.
+
+    void jmp( Label target );
+    void jmp( const void* target );
+    void jmp( Reg target );
+
+    // Returns the final address of the rel32 field, so the jump can be
+    // retargeted later with `patchJump`.
+    const std::uint8_t* jmpPatchable( Label target );
+
+    void jcc( Condition cond, Label target );
+    void jcc( Condition cond, const void* target );
+    void call( Reg target );
+    void push( Reg reg );
+    void pop( Reg reg );
+    void ret();
+};
+
+inline Condition invert( Condition cond ) {
+    return static_cast<Condition>( static_cast<std::uint8_t>( cond ) ^ 1 );
+}
+
+// Retarget a jump assembled with `jmpPatchable`.
+void patchJump( std::uint8_t* field, const void* target );
+
+}
+
+}